@@ -391,6 +391,26 @@ void listRotate(list *list) {
     list->head = tail;
 }
 
+/* Rotate the list removing the head node and inserting it to the tail.
+ * The node is moved and not reallocated, so references to it stay valid. */
+/*
+ * 将头结点插入到尾结点，结点本身不会重新分配
+ */
+void listRotateHeadToTail(list *list) {
+    listNode *head = list->head;
+
+    if (listLength(list) <= 1) return;
+
+    /* Detach current head */
+    list->head = head->next;
+    list->head->prev = NULL;
+    /* Move it as tail */
+    list->tail->next = head;
+    head->next = NULL;
+    head->prev = list->tail;
+    list->tail = head;
+}
+
 /* Add all the elements of the list 'o' at the end of the
  * list 'l'. The list 'other' remains empty but otherwise valid. */
 /*
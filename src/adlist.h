@@ -86,6 +86,7 @@ listNode *listIndex(list *list, long index);    // 获取list的第index个结
 void listRewind(list *list, listIter *li);      // 重置迭代器li为list的正向迭代器
 void listRewindTail(list *list, listIter *li);  // 重置迭代器li为list的反向迭代器
 void listRotate(list *list);                    // 将尾结点插入到头结点
+void listRotateHeadToTail(list *list);          // 将头结点插入到尾结点
 void listJoin(list *l, list *o);                // 将链表o添加到l后面，之后o的不再拥有原先的结点但不会释放o的list内存，o(1)
 
 /* Directions for iterators */
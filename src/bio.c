@@ -22,7 +22,9 @@
  *
  * Jobs of the same type are guaranteed to be processed from the least
  * recently inserted to the most recently inserted (older jobs processed
- * first).
+ * first). The only exception are the lazy free jobs, that may be served by
+ * a pool of "lazyfree-threads" threads sharing the same queue: since every
+ * job releases objects no longer reachable, the order does not matter.
  *
  * Currently there is no way for the creator of the job to be notified about
  * the completion of the operation, this will only be added when/if needed.
@@ -61,7 +63,8 @@
 #include "server.h"
 #include "bio.h"
 
-static pthread_t bio_threads[BIO_NUM_OPS];
+static pthread_t bio_threads[BIO_NUM_OPS][BIO_MAX_THREADS_PER_OP];
+static int bio_threads_num[BIO_NUM_OPS];
 static pthread_mutex_t bio_mutex[BIO_NUM_OPS];
 static pthread_cond_t bio_newjob_cond[BIO_NUM_OPS];
 static pthread_cond_t bio_step_cond[BIO_NUM_OPS];
@@ -84,9 +87,10 @@ struct bio_job {
 };
 
 void *bioProcessBackgroundJobs(void *arg);
-void lazyfreeFreeObjectFromBioThread(robj *o);
+void lazyfreeFreeBatchFromBioThread(void *batch);
 void lazyfreeFreeDatabaseFromBioThread(dict *ht1, dict *ht2);
 void lazyfreeFreeSlotsMapFromBioThread(zskiplist *sl);
+void lazyfreeFreeDictFromBioThread(dict *d);
 
 /* Make sure we have enough stack to perform all the things we do in the
  * main thread. */
@@ -97,7 +101,7 @@ void bioInit(void) {
     pthread_attr_t attr;
     pthread_t thread;
     size_t stacksize;
-    int j;
+    int j, i;
 
     /* Initialization of state vars and objects */
     for (j = 0; j < BIO_NUM_OPS; j++) {
@@ -106,6 +110,7 @@ void bioInit(void) {
         pthread_cond_init(&bio_step_cond[j],NULL);
         bio_jobs[j] = listCreate();
         bio_pending[j] = 0;
+        bio_threads_num[j] = (j == BIO_LAZY_FREE) ? server.lazyfree_threads : 1;
     }
 
     /* Set the stack size as by default it may be small in some system */
@@ -120,11 +125,13 @@ void bioInit(void) {
      * responsible of. */
     for (j = 0; j < BIO_NUM_OPS; j++) {
         void *arg = (void*)(unsigned long) j;
-        if (pthread_create(&thread,&attr,bioProcessBackgroundJobs,arg) != 0) {
-            serverLog(LL_WARNING,"Fatal: Can't initialize Background Jobs.");
-            exit(1);
+        for (i = 0; i < bio_threads_num[j]; i++) {
+            if (pthread_create(&thread,&attr,bioProcessBackgroundJobs,arg) != 0) {
+                serverLog(LL_WARNING,"Fatal: Can't initialize Background Jobs.");
+                exit(1);
+            }
+            bio_threads[j][i] = thread;
         }
-        bio_threads[j] = thread;
     }
 }
 
@@ -176,9 +183,12 @@ void *bioProcessBackgroundJobs(void *arg) {
             pthread_cond_wait(&bio_newjob_cond[type],&bio_mutex[type]);
             continue;
         }
-        /* Pop the job from the queue. */
+        /* Pop the job from the queue. The job is removed from the list
+         * now, so that other threads serving the same queue can't pick it,
+         * while the pending count is updated only once it is processed. */
         ln = listFirst(bio_jobs[type]);
         job = ln->value;
+        listDelNode(bio_jobs[type],ln);
         /* It is now possible to unlock the background system as we know have
          * a stand alone job structure to process.*/
         pthread_mutex_unlock(&bio_mutex[type]);
@@ -190,13 +200,16 @@ void *bioProcessBackgroundJobs(void *arg) {
             redis_fsync((long)job->arg1);
         } else if (type == BIO_LAZY_FREE) {
             /* What we free changes depending on what arguments are set:
-             * arg1 -> free the object at pointer.
+             * arg1 -> free a batch of objects (see lazyfree.c).
              * arg2 & arg3 -> free two dictionaries (a Redis DB).
+             * only arg2 -> free a dictionary sharing the DB keys.
              * only arg3 -> free the skiplist. */
             if (job->arg1)
-                lazyfreeFreeObjectFromBioThread(job->arg1);
+                lazyfreeFreeBatchFromBioThread(job->arg1);
             else if (job->arg2 && job->arg3)
                 lazyfreeFreeDatabaseFromBioThread(job->arg2,job->arg3);
+            else if (job->arg2)
+                lazyfreeFreeDictFromBioThread(job->arg2);
             else if (job->arg3)
                 lazyfreeFreeSlotsMapFromBioThread(job->arg3);
         } else {
@@ -207,7 +220,6 @@ void *bioProcessBackgroundJobs(void *arg) {
         /* Lock again before reiterating the loop, if there are no longer
          * jobs to process we'll block again in pthread_cond_wait(). */
         pthread_mutex_lock(&bio_mutex[type]);
-        listDelNode(bio_jobs[type],ln);
         bio_pending[type]--;
 
         /* Unblock threads blocked on bioWaitStepOfType() if any. */
@@ -251,17 +263,19 @@ unsigned long long bioWaitStepOfType(int type) {
  * Currently Redis does this only on crash (for instance on SIGSEGV) in order
  * to perform a fast memory check without other threads messing with memory. */
 void bioKillThreads(void) {
-    int err, j;
+    int err, j, i;
 
     for (j = 0; j < BIO_NUM_OPS; j++) {
-        if (pthread_cancel(bio_threads[j]) == 0) {
-            if ((err = pthread_join(bio_threads[j],NULL)) != 0) {
-                serverLog(LL_WARNING,
-                    "Bio thread for job type #%d can be joined: %s",
-                        j, strerror(err));
-            } else {
-                serverLog(LL_WARNING,
-                    "Bio thread for job type #%d terminated",j);
+        for (i = 0; i < bio_threads_num[j]; i++) {
+            if (pthread_cancel(bio_threads[j][i]) == 0) {
+                if ((err = pthread_join(bio_threads[j][i],NULL)) != 0) {
+                    serverLog(LL_WARNING,
+                        "Bio thread for job type #%d can be joined: %s",
+                            j, strerror(err));
+                } else {
+                    serverLog(LL_WARNING,
+                        "Bio thread for job type #%d terminated",j);
+                }
             }
         }
     }
@@ -40,3 +40,6 @@ void bioKillThreads(void);
 #define BIO_AOF_FSYNC     1 /* Deferred AOF fsync. */
 #define BIO_LAZY_FREE     2 /* Deferred objects freeing. */
 #define BIO_NUM_OPS       3
+
+/* Max number of threads serving the same job type, see lazyfree-threads. */
+#define BIO_MAX_THREADS_PER_OP 16
@@ -104,6 +104,7 @@ void blockClient(client *c, int btype) {
     c->btype = btype;
     server.blocked_clients++;
     server.blocked_clients_by_type[btype]++;
+    if (c->bpop.timeout != 0) addClientToTimeoutTable(c);
 }
 
 /* This function is called in the beforeSleep() function of the event loop
@@ -171,10 +172,16 @@ void unblockClient(client *c) {
     } else {
         serverPanic("Unknown btype in unblockClient().");
     }
+    if (c->bpop.timeout != 0) removeClientFromTimeoutTable(c);
     /* Clear the flags, and put the client in the unblocked list so that
      * we'll process new commands in its query buffer ASAP. */
     server.blocked_clients--;
     server.blocked_clients_by_type[c->btype]--;
+    /* Now the blocking command is completed: record its total latency,
+     * that includes the time the client was blocked. */
+    if (server.latency_tracking_enabled && c->read_ustime && c->lastcmd)
+        latencyHistogramRecord(&c->lastcmd->latency_total_hist,
+                               ustime()-c->read_ustime);
     c->flags &= ~CLIENT_BLOCKED;
     c->btype = BLOCKED_NONE;
     queueClientForReprocessing(c);
@@ -263,6 +270,7 @@ void handleClientsBlockedOnKeys(void) {
             dictDelete(rl->db->ready_keys,rl->key);
 
             /* Serve clients blocked on list key. */
+            int refresh = 0;
             robj *o = lookupKeyWrite(rl->db,rl->key);
             if (o != NULL && o->type == OBJ_LIST) {
                 dictEntry *de;
@@ -280,9 +288,9 @@ void handleClientsBlockedOnKeys(void) {
 
                         if (receiver->btype != BLOCKED_LIST) {
                             /* Put at the tail, so that at the next call
-                             * we'll not run into it again. */
-                            listDelNode(clients,clientnode);
-                            listAddNodeTail(clients,receiver);
+                             * we'll not run into it again. The node is
+                             * moved, so the client bkinfo stays valid. */
+                            listRotateHeadToTail(clients);
                             continue;
                         }
 
@@ -293,6 +301,7 @@ void handleClientsBlockedOnKeys(void) {
                         robj *value = listTypePop(o,where);
 
                         if (value) {
+                            refresh = 1;
                             /* Protect receiver->bpop.target, that will be
                              * freed by the next unblockClient()
                              * call. */
@@ -320,8 +329,6 @@ void handleClientsBlockedOnKeys(void) {
                     dbDelete(rl->db,rl->key);
                     notifyKeyspaceEvent(NOTIFY_GENERIC,"del",rl->key,rl->db->id);
                 }
-                /* We don't call signalModifiedKey() as it was already called
-                 * when an element was pushed on the list. */
             }
 
             /* Serve clients blocked on sorted set key. */
@@ -342,9 +349,9 @@ void handleClientsBlockedOnKeys(void) {
 
                         if (receiver->btype != BLOCKED_ZSET) {
                             /* Put at the tail, so that at the next call
-                             * we'll not run into it again. */
-                            listDelNode(clients,clientnode);
-                            listAddNodeTail(clients,receiver);
+                             * we'll not run into it again. The node is
+                             * moved, so the client bkinfo stays valid. */
+                            listRotateHeadToTail(clients);
                             continue;
                         }
 
@@ -354,6 +361,7 @@ void handleClientsBlockedOnKeys(void) {
                         unblockClient(receiver);
                         genericZpopCommand(receiver,&rl->key,1,where,1,NULL);
                         zcard--;
+                        refresh = 1;
 
                         /* Replicate the command. */
                         robj *argv[2];
@@ -388,8 +396,9 @@ void handleClientsBlockedOnKeys(void) {
                     while((ln = listNext(&li))) {
                         client *receiver = listNodeValue(ln);
                         if (receiver->btype != BLOCKED_STREAM) continue;
-                        streamID *gt = dictFetchValue(receiver->bpop.keys,
-                                                      rl->key);
+                        bkinfo *bki = dictFetchValue(receiver->bpop.keys,
+                                                     rl->key);
+                        streamID *gt = &bki->stream_id;
 
                         /* If we blocked in the context of a consumer
                          * group, we need to resolve the group and update the
@@ -426,10 +435,13 @@ void handleClientsBlockedOnKeys(void) {
                             int noack = 0;
 
                             if (group) {
+                                long long mark = keymemValueBegin();
                                 consumer = streamLookupConsumer(group,
                                            receiver->bpop.xread_consumer->ptr,
                                            1);
+                                keymemStreamEnd(s,mark);
                                 noack = receiver->bpop.xread_group_noack;
+                                refresh = 1;
                             }
 
                             /* Emit the two elements sub-array consisting of
@@ -458,6 +470,13 @@ void handleClientsBlockedOnKeys(void) {
                 }
             }
 
+            /* Popping elements or updating the consumer group to serve the
+             * clients modified the key after signalModifiedKey() was called
+             * by the command that made it ready: WATCH, the scripts results
+             * cache, the tracking table and the key memory accounting must
+             * see the new version. */
+            if (refresh) signalModifiedKey(rl->db,rl->key);
+
             /* Free this item. */
             decrRefCount(rl->key);
             zfree(rl);
@@ -465,6 +484,7 @@ void handleClientsBlockedOnKeys(void) {
         }
         listRelease(l); /* We have the new list on place at this point. */
     }
+    keymemFlush(); /* Like call() does after a command. */
 }
 
 /* This is how the current blocking lists/sorted sets/streams work, we use
@@ -505,17 +525,15 @@ void blockForKeys(client *c, int btype, robj **keys, int numkeys, mstime_t timeo
     if (target != NULL) incrRefCount(target);
 
     for (j = 0; j < numkeys; j++) {
-        /* The value associated with the key name in the bpop.keys dictionary
-         * is NULL for lists and sorted sets, or the stream ID for streams. */
-        void *key_data = NULL;
-        if (btype == BLOCKED_STREAM) {
-            key_data = zmalloc(sizeof(streamID));
-            memcpy(key_data,ids+j,sizeof(streamID));
-        }
+        /* Allocate our bkinfo structure, associated to each key the client
+         * is blocked for. */
+        bkinfo *bki = zmalloc(sizeof(*bki));
+        if (btype == BLOCKED_STREAM)
+            bki->stream_id = ids[j];
 
         /* If the key already exists in the dictionary ignore it. */
-        if (dictAdd(c->bpop.keys,keys[j],key_data) != DICT_OK) {
-            zfree(key_data);
+        if (dictAdd(c->bpop.keys,keys[j],bki) != DICT_OK) {
+            zfree(bki);
             continue;
         }
         incrRefCount(keys[j]);
@@ -534,6 +552,7 @@ void blockForKeys(client *c, int btype, robj **keys, int numkeys, mstime_t timeo
             l = dictGetVal(de);
         }
         listAddNodeTail(l,c);
+        bki->listnode = listLast(l);
     }
     blockClient(c,btype);
 }
@@ -550,11 +569,12 @@ void unblockClientWaitingData(client *c) {
     /* The client may wait for multiple keys, so unblock it for every key. */
     while((de = dictNext(di)) != NULL) {
         robj *key = dictGetKey(de);
+        bkinfo *bki = dictGetVal(de);
 
         /* Remove this client from the list of clients waiting for this key. */
         l = dictFetchValue(c->db->blocking_keys,key);
         serverAssertWithInfo(c,key,l != NULL);
-        listDelNode(l,listSearchKey(l,c));
+        listDelNode(l,bki->listnode);
         /* If the list is empty we need to remove it to avoid wasting memory */
         if (listLength(l) == 0)
             dictDelete(c->db->blocking_keys,key);
@@ -605,4 +625,127 @@ void signalKeyAsReady(redisDb *db, robj *key) {
     serverAssert(dictAdd(db->ready_keys,key,NULL) == DICT_OK);
 }
 
+/* -----------------------------------------------------------------------------
+ * Timeout of blocked clients
+ *
+ * Blocked clients having a timeout are indexed into a radix tree ordered by
+ * timeout: the key is the 64 bit big endian timeout followed by the 64 bit
+ * big endian client ID, so that clients with the same timeout are different
+ * elements. This way we only need to look at the head of the tree in order
+ * to find the clients that timed out, instead of scanning all the clients
+ * checking their timeout.
+ *
+ * The event loop timer is armed to fire at the nearest timeout, so clients
+ * are unblocked with milliseconds precision regardless of server.hz, and
+ * only when there is actually some client to unblock.
+ * -------------------------------------------------------------------------- */
+
+/* Compose the radix tree key for the client 'c' into 'buf'. */
+static void encodeTimeoutKey(unsigned char *buf, uint64_t timeout, client *c) {
+    timeout = htonu64(timeout);
+    uint64_t id = htonu64(c->id);
+    memcpy(buf,&timeout,sizeof(timeout));
+    memcpy(buf+8,&id,sizeof(id));
+}
+
+/* Decode the radix tree key, returning the client ID and the timeout. */
+static void decodeTimeoutKey(unsigned char *buf, uint64_t *toptr, uint64_t *idptr) {
+    memcpy(toptr,buf,sizeof(*toptr));
+    memcpy(idptr,buf+8,sizeof(*idptr));
+    *toptr = ntohu64(*toptr);
+    *idptr = ntohu64(*idptr);
+}
+
+/* Return the nearest timeout of the table, or -1 if the table is empty. */
+static mstime_t getNearestTimeout(void) {
+    raxIterator ri;
+    uint64_t id, timeout;
+    mstime_t nearest = -1;
+
+    raxStart(&ri,server.clients_timeout_table);
+    raxSeek(&ri,"^",NULL,0);
+    if (raxNext(&ri)) {
+        decodeTimeoutKey(ri.key,&timeout,&id);
+        nearest = timeout;
+    }
+    raxStop(&ri);
+    return nearest;
+}
+
+/* The timer proc: unblock the clients that timed out, and fire again at the
+ * next nearest timeout, if any. A client times out when the current time is
+ * greater than its timeout, hence the +1. */
+int blockedClientsTimeoutProc(struct aeEventLoop *eventLoop, long long id, void *clientData) {
+    UNUSED(eventLoop);
+    UNUSED(id);
+    UNUSED(clientData);
+
+    handleBlockedClientsTimeout();
+    mstime_t nearest = getNearestTimeout();
+    if (nearest == -1) {
+        server.clients_timeout_timer = -1;
+        return AE_NOMORE;
+    }
+    server.clients_timeout_timer_when = nearest+1;
+    mstime_t delay = server.clients_timeout_timer_when - mstime();
+    return delay > 0 ? delay : 0;
+}
 
+/* Make sure the timer fires not later than 'when'. */
+static void armTimeoutTimer(mstime_t when) {
+    if (server.clients_timeout_timer != -1) {
+        if (server.clients_timeout_timer_when <= when) return;
+        aeDeleteTimeEvent(server.el,server.clients_timeout_timer);
+    }
+    mstime_t delay = when - mstime();
+    server.clients_timeout_timer = aeCreateTimeEvent(server.el,
+        delay > 0 ? delay : 0,blockedClientsTimeoutProc,NULL,NULL);
+    server.clients_timeout_timer_when = when;
+}
+
+/* Add the client to the timeout table. Called by blockClient() for clients
+ * blocked with a non zero timeout. */
+void addClientToTimeoutTable(client *c) {
+    unsigned char buf[16];
+    encodeTimeoutKey(buf,c->bpop.timeout,c);
+    raxInsert(server.clients_timeout_table,buf,sizeof(buf),NULL,NULL);
+    armTimeoutTimer(c->bpop.timeout+1);
+}
+
+/* Remove the client from the timeout table. Called by unblockClient(). */
+void removeClientFromTimeoutTable(client *c) {
+    unsigned char buf[16];
+    encodeTimeoutKey(buf,c->bpop.timeout,c);
+    raxRemove(server.clients_timeout_table,buf,sizeof(buf),NULL);
+}
+
+/* Unblock all the clients whose timeout already elapsed. Since the table is
+ * ordered by timeout we can stop at the first client that did not time out
+ * yet, so only the clients that actually need to be unblocked are touched.
+ * Clients removed from the table because they were served before their
+ * timeout don't disarm the timer: it will just find nothing to do. */
+void handleBlockedClientsTimeout(void) {
+    if (raxSize(server.clients_timeout_table) == 0) return;
+    uint64_t now = mstime();
+    raxIterator ri;
+    raxStart(&ri,server.clients_timeout_table);
+    raxSeek(&ri,"^",NULL,0);
+
+    while(raxNext(&ri)) {
+        uint64_t id, timeout;
+        decodeTimeoutKey(ri.key,&timeout,&id);
+        if (timeout >= now) break; /* All the timeouts are in the future. */
+        client *c = lookupClientByID(id);
+        if (c && c->flags & CLIENT_BLOCKED) {
+            /* Unblocking the client removes it from the table. */
+            replyToBlockedClientTimedOut(c);
+            unblockClient(c);
+        } else {
+            raxRemove(server.clients_timeout_table,ri.key,ri.key_len,NULL);
+        }
+        /* The tree was modified: seek again its head since the iterator
+         * is no longer valid. */
+        raxSeek(&ri,"^",NULL,0);
+    }
+    raxStop(&ri);
+}
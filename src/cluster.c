@@ -502,8 +502,11 @@ void clusterInit(void) {
 
     /* The slots -> keys map is a radix tree. Initialize it here. */
     server.cluster->slots_to_keys = raxNew();
+    server.cluster->slots_to_channels = raxNew();
     memset(server.cluster->slots_keys_count,0,
            sizeof(server.cluster->slots_keys_count));
+    memset(server.cluster->slots_memory,0,
+           sizeof(server.cluster->slots_memory));
 
     /* Set myself->port / cport to my listening ports, we'll just need to
      * discover the IP address via MEET messages. */
@@ -1669,7 +1672,9 @@ int clusterProcessPacket(clusterLink *link) {
 
         explen += sizeof(clusterMsgDataFail);
         if (totlen != explen) return 1;
-    } else if (type == CLUSTERMSG_TYPE_PUBLISH) {
+    } else if (type == CLUSTERMSG_TYPE_PUBLISH ||
+               type == CLUSTERMSG_TYPE_PUBLISHSHARD)
+    {
         uint32_t explen = sizeof(clusterMsg)-sizeof(union clusterMsgData);
 
         explen += sizeof(clusterMsgDataPublish) -
@@ -2019,14 +2024,18 @@ int clusterProcessPacket(clusterLink *link) {
                 "Ignoring FAIL message from unknown node %.40s about %.40s",
                 hdr->sender, hdr->data.fail.about.nodename);
         }
-    } else if (type == CLUSTERMSG_TYPE_PUBLISH) {
+    } else if (type == CLUSTERMSG_TYPE_PUBLISH ||
+               type == CLUSTERMSG_TYPE_PUBLISHSHARD)
+    {
         robj *channel, *message;
         uint32_t channel_len, message_len;
+        int shard = type == CLUSTERMSG_TYPE_PUBLISHSHARD;
 
         /* Don't bother creating useless objects if there are no
          * Pub/Sub subscribers. */
-        if (dictSize(server.pubsub_channels) ||
-           listLength(server.pubsub_patterns))
+        if ((shard && dictSize(server.pubsubshard_channels)) ||
+            (!shard && (dictSize(server.pubsub_channels) ||
+                        dictSize(server.pubsub_patterns))))
         {
             channel_len = ntohl(hdr->data.publish.msg.channel_len);
             message_len = ntohl(hdr->data.publish.msg.message_len);
@@ -2035,7 +2044,10 @@ int clusterProcessPacket(clusterLink *link) {
             message = createStringObject(
                         (char*)hdr->data.publish.msg.bulk_data+channel_len,
                         message_len);
-            pubsubPublishMessage(channel,message);
+            if (shard)
+                pubsubPublishShardMessage(channel,message);
+            else
+                pubsubPublishMessage(channel,message);
             decrRefCount(channel);
             decrRefCount(message);
         }
@@ -2242,6 +2254,23 @@ void clusterBroadcastMessage(void *buf, size_t len) {
     dictReleaseIterator(di);
 }
 
+/* Send a message to the other nodes of the shard of this node, that are
+ * our master (or ourselves if we are a master) and its slaves. */
+void clusterBroadcastShardMessage(void *buf, size_t len) {
+    clusterNode *master = nodeIsSlave(myself) ? myself->slaveof : myself;
+    int j;
+
+    if (master == NULL) return;
+    if (master != myself && master->link)
+        clusterSendMessage(master->link,buf,len);
+    for (j = 0; j < master->numslaves; j++) {
+        clusterNode *slave = master->slaves[j];
+
+        if (slave == myself || !slave->link) continue;
+        clusterSendMessage(slave->link,buf,len);
+    }
+}
+
 /* Build the message header. hdr must point to a buffer at least
  * sizeof(clusterMsg) in bytes. */
 void clusterBuildMessageHdr(clusterMsg *hdr, int type) {
@@ -2512,10 +2541,12 @@ void clusterBroadcastPong(int target) {
     dictReleaseIterator(di);
 }
 
-/* Send a PUBLISH message.
+/* Send a PUBLISH message, of type CLUSTERMSG_TYPE_PUBLISH or
+ * CLUSTERMSG_TYPE_PUBLISHSHARD.
  *
- * If link is NULL, then the message is broadcasted to the whole cluster. */
-void clusterSendPublish(clusterLink *link, robj *channel, robj *message) {
+ * If link is NULL, then the message is broadcasted to the whole cluster,
+ * or only to the nodes of our shard for shard channels. */
+void clusterSendPublish(clusterLink *link, robj *channel, robj *message, uint16_t type) {
     unsigned char buf[sizeof(clusterMsg)], *payload;
     clusterMsg *hdr = (clusterMsg*) buf;
     uint32_t totlen;
@@ -2526,7 +2557,7 @@ void clusterSendPublish(clusterLink *link, robj *channel, robj *message) {
     channel_len = sdslen(channel->ptr);
     message_len = sdslen(message->ptr);
 
-    clusterBuildMessageHdr(hdr,CLUSTERMSG_TYPE_PUBLISH);
+    clusterBuildMessageHdr(hdr,type);
     totlen = sizeof(clusterMsg)-sizeof(union clusterMsgData);
     totlen += sizeof(clusterMsgDataPublish) - 8 + channel_len + message_len;
 
@@ -2548,6 +2579,8 @@ void clusterSendPublish(clusterLink *link, robj *channel, robj *message) {
 
     if (link)
         clusterSendMessage(link,payload,totlen);
+    else if (type == CLUSTERMSG_TYPE_PUBLISHSHARD)
+        clusterBroadcastShardMessage(payload,totlen);
     else
         clusterBroadcastMessage(payload,totlen);
 
@@ -2643,12 +2676,19 @@ int clusterSendModuleMessageToTarget(const char *target, uint64_t module_id, uin
 /* -----------------------------------------------------------------------------
  * CLUSTER Pub/Sub support
  *
- * For now we do very little, just propagating PUBLISH messages across the whole
- * cluster. In the future we'll try to get smarter and avoiding propagating those
- * messages to hosts without receives for a given channel.
+ * PUBLISH messages are propagated across the whole cluster, since the
+ * subscribers of a channel may be connected to any node. Shard channels
+ * (SSUBSCRIBE / SPUBLISH) instead hash to a slot like keys, so their
+ * messages only reach the nodes serving that slot.
  * -------------------------------------------------------------------------- */
 void clusterPropagatePublish(robj *channel, robj *message) {
-    clusterSendPublish(NULL, channel, message);
+    clusterSendPublish(NULL, channel, message, CLUSTERMSG_TYPE_PUBLISH);
+}
+
+/* Shard channels are served by the nodes of the shard owning the slot of
+ * the channel, so SPUBLISH messages are only sent to them. */
+void clusterPropagatePublishShard(robj *channel, robj *message) {
+    clusterSendPublish(NULL, channel, message, CLUSTERMSG_TYPE_PUBLISHSHARD);
 }
 
 /* -----------------------------------------------------------------------------
@@ -3716,6 +3756,12 @@ int clusterDelSlot(int slot) {
     clusterNode *n = server.cluster->slots[slot];
 
     if (!n) return C_ERR;
+
+    /* The shard channels of the slot are no longer served by our shard,
+     * their subscribers will have to subscribe again to the new owner. */
+    if (n == myself || (nodeIsSlave(myself) && myself->slaveof == n))
+        pubsubUnsubscribeShardChannelsInSlot(slot);
+
     serverAssert(clusterNodeClearSlotBit(n,slot) == 1);
     server.cluster->slots[slot] = NULL;
     return C_OK;
@@ -4093,6 +4139,7 @@ const char *clusterGetMessageTypeString(int type) {
     case CLUSTERMSG_TYPE_MEET: return "meet";
     case CLUSTERMSG_TYPE_FAIL: return "fail";
     case CLUSTERMSG_TYPE_PUBLISH: return "publish";
+    case CLUSTERMSG_TYPE_PUBLISHSHARD: return "publishshard";
     case CLUSTERMSG_TYPE_FAILOVER_AUTH_REQUEST: return "auth-req";
     case CLUSTERMSG_TYPE_FAILOVER_AUTH_ACK: return "auth-ack";
     case CLUSTERMSG_TYPE_UPDATE: return "update";
@@ -4208,6 +4255,7 @@ void clusterCommand(client *c) {
 "INFO - Return onformation about the cluster.",
 "KEYSLOT <key> -- Return the hash slot for <key>.",
 "MEET <ip> <port> [bus-port] -- Connect nodes into a working cluster.",
+"MEMORYINSLOT <slot> -- Return the bytes used by the values in <slot> (needs key-memory-tracking).",
 "MYID -- Return the node id.",
 "NODES -- Return cluster configuration seen by node. Output format:",
 "    <id> <ip:port> <flags> <master> <pings> <pongs> <epoch> <link> <slot> ... <slot>",
@@ -4526,6 +4574,25 @@ NULL
             return;
         }
         addReplyLongLong(c,countKeysInSlot(slot));
+    } else if (!strcasecmp(c->argv[1]->ptr,"memoryinslot") && c->argc == 3) {
+        /* CLUSTER MEMORYINSLOT <slot> */
+        long long slot;
+
+        if (getLongLongFromObjectOrReply(c,c->argv[2],&slot,NULL) != C_OK)
+            return;
+        if (slot < 0 || slot >= CLUSTER_SLOTS) {
+            addReplyError(c,"Invalid slot");
+            return;
+        }
+        if (!server.key_memory_tracking) {
+            addReplyError(c,"key-memory-tracking is disabled");
+            return;
+        }
+        if (!keymemIsComplete()) {
+            addReplyError(c,"the keys are still being measured");
+            return;
+        }
+        addReplyLongLong(c,server.cluster->slots_memory[slot]);
     } else if (!strcasecmp(c->argv[1]->ptr,"getkeysinslot") && c->argc == 4) {
         /* CLUSTER GETKEYSINSLOT <slot> <count> */
         long long maxkeys, slot;
@@ -5456,6 +5523,9 @@ clusterNode *getNodeByQuery(client *c, struct redisCommand *cmd, robj **argv, in
     multiState *ms, _ms;
     multiCmd mc;
     int i, slot = 0, migrating_slot = 0, importing_slot = 0, missing_keys = 0;
+    int pubsubshard = cmd->proc == ssubscribeCommand ||
+                      cmd->proc == sunsubscribeCommand ||
+                      cmd->proc == spublishCommand;
 
     /* Allow any key to be set if a module disabled cluster redirections. */
     if (server.cluster_module_flags & CLUSTER_MODULE_FLAG_NO_REDIRECTION)
@@ -5552,8 +5622,10 @@ clusterNode *getNodeByQuery(client *c, struct redisCommand *cmd, robj **argv, in
                 }
             }
 
-            /* Migarting / Improrting slot? Count keys we don't have. */
-            if ((migrating_slot || importing_slot) &&
+            /* Migarting / Improrting slot? Count keys we don't have.
+             * Shard channels are not keys: they are served by the node
+             * owning the slot until the migration is completed. */
+            if ((migrating_slot || importing_slot) && !pubsubshard &&
                 lookupKeyRead(&server.db[0],thiskey) == NULL)
             {
                 missing_keys++;
@@ -5605,10 +5677,12 @@ clusterNode *getNodeByQuery(client *c, struct redisCommand *cmd, robj **argv, in
 
     /* Handle the read-only client case reading from a slave: if this
      * node is a slave and the request is about an hash slot our master
-     * is serving, we can reply without redirection. */
-    if (c->flags & CLIENT_READONLY &&
-        (cmd->flags & CMD_READONLY || cmd->proc == evalCommand ||
-         cmd->proc == evalShaCommand) &&
+     * is serving, we can reply without redirection. The shard channels
+     * are served by all the nodes of the shard, so that the subscribers
+     * can be spread among the replicas. */
+    if (((c->flags & CLIENT_READONLY &&
+          (cmd->flags & CMD_READONLY || cmd->proc == evalCommand ||
+           cmd->proc == evalShaCommand)) || pubsubshard) &&
         nodeIsSlave(myself) &&
         myself->slaveof == n)
     {
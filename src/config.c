@@ -30,6 +30,7 @@
 
 #include "server.h"
 #include "cluster.h"
+#include "bio.h"
 
 #include <fcntl.h>
 #include <sys/stat.h>
@@ -50,6 +51,8 @@ configEnum maxmemory_policy_enum[] = {
     {"volatile-ttl",MAXMEMORY_VOLATILE_TTL},
     {"allkeys-lru",MAXMEMORY_ALLKEYS_LRU},
     {"allkeys-lfu",MAXMEMORY_ALLKEYS_LFU},
+    {"volatile-lfu-size",MAXMEMORY_VOLATILE_LFU_SIZE},
+    {"allkeys-lfu-size",MAXMEMORY_ALLKEYS_LFU_SIZE},
     {"allkeys-random",MAXMEMORY_ALLKEYS_RANDOM},
     {"noeviction",MAXMEMORY_NO_EVICTION},
     {NULL, 0}
@@ -328,6 +331,24 @@ void loadServerConfigFromString(char *config) {
                 err = "maxmemory-samples must be 1 or greater";
                 goto loaderr;
             }
+        } else if (!strcasecmp(argv[0],"maxmemory-background-eviction") && argc == 2) {
+            if ((server.maxmemory_background_eviction = yesnotoi(argv[1])) == -1) {
+                err = "argument must be 'yes' or 'no'"; goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0],"maxmemory-low-watermark") && argc == 2) {
+            server.maxmemory_low_watermark = atoi(argv[1]);
+            if (server.maxmemory_low_watermark < 1 ||
+                server.maxmemory_low_watermark > 100) {
+                err = "maxmemory-low-watermark must be between 1 and 100";
+                goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0],"maxmemory-hard-margin") && argc == 2) {
+            server.maxmemory_hard_margin = atoi(argv[1]);
+            if (server.maxmemory_hard_margin < 0 ||
+                server.maxmemory_hard_margin > 100) {
+                err = "maxmemory-hard-margin must be between 0 and 100";
+                goto loaderr;
+            }
         } else if ((!strcasecmp(argv[0],"proto-max-bulk-len")) && argc == 2) {
             server.proto_max_bulk_len = memtoll(argv[1],NULL);
         } else if ((!strcasecmp(argv[0],"client-query-buffer-limit")) && argc == 2) {
@@ -424,6 +445,10 @@ void loadServerConfigFromString(char *config) {
             if ((server.rdb_checksum = yesnotoi(argv[1])) == -1) {
                 err = "argument must be 'yes' or 'no'"; goto loaderr;
             }
+        } else if (!strcasecmp(argv[0],"inline-small-values") && argc == 2) {
+            if ((server.inline_small_values = yesnotoi(argv[1])) == -1) {
+                err = "argument must be 'yes' or 'no'"; goto loaderr;
+            }
         } else if (!strcasecmp(argv[0],"activerehashing") && argc == 2) {
             if ((server.activerehashing = yesnotoi(argv[1])) == -1) {
                 err = "argument must be 'yes' or 'no'"; goto loaderr;
@@ -440,6 +465,22 @@ void loadServerConfigFromString(char *config) {
             if ((server.lazyfree_lazy_server_del = yesnotoi(argv[1])) == -1) {
                 err = "argument must be 'yes' or 'no'"; goto loaderr;
             }
+        } else if (!strcasecmp(argv[0],"lazyfree-lazy-overwrite") && argc == 2){
+            if ((server.lazyfree_lazy_overwrite = yesnotoi(argv[1])) == -1) {
+                err = "argument must be 'yes' or 'no'"; goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0],"lazyfree-lazy-member-del") && argc == 2){
+            if ((server.lazyfree_lazy_member_del = yesnotoi(argv[1])) == -1) {
+                err = "argument must be 'yes' or 'no'"; goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0],"lazyfree-threads") && argc == 2) {
+            server.lazyfree_threads = atoi(argv[1]);
+            if (server.lazyfree_threads < 1 ||
+                server.lazyfree_threads > BIO_MAX_THREADS_PER_OP)
+            {
+                err = "lazyfree-threads must be between 1 and 16";
+                goto loaderr;
+            }
         } else if ((!strcasecmp(argv[0],"slave-lazy-flush") ||
                     !strcasecmp(argv[0],"replica-lazy-flush")) && argc == 2)
         {
@@ -455,6 +496,10 @@ void loadServerConfigFromString(char *config) {
                 err = "active defrag can't be enabled without proper jemalloc support"; goto loaderr;
 #endif
             }
+        } else if (!strcasecmp(argv[0],"active-defrag-thread") && argc == 2) {
+            if ((server.active_defrag_thread = yesnotoi(argv[1])) == -1) {
+                err = "argument must be 'yes' or 'no'"; goto loaderr;
+            }
         } else if (!strcasecmp(argv[0],"daemonize") && argc == 2) {
             if ((server.daemonize = yesnotoi(argv[1])) == -1) {
                 err = "argument must be 'yes' or 'no'"; goto loaderr;
@@ -696,6 +741,24 @@ void loadServerConfigFromString(char *config) {
             server.lua_time_limit = strtoll(argv[1],NULL,10);
         } else if (!strcasecmp(argv[0],"lua-replicate-commands") && argc == 2) {
             server.lua_always_replicate_commands = yesnotoi(argv[1]);
+        } else if (!strcasecmp(argv[0],"lua-result-cache-max-entries") &&
+                   argc == 2)
+        {
+            long long max = strtoll(argv[1],NULL,10);
+            if (max < 0) {
+                err = "lua-result-cache-max-entries can't be negative";
+                goto loaderr;
+            }
+            server.lua_results_max = max;
+        } else if (!strcasecmp(argv[0],"lua-jit") && argc == 2) {
+            if ((server.lua_jit = yesnotoi(argv[1])) == -1) {
+                err = "argument must be 'yes' or 'no'"; goto loaderr;
+            }
+            if (server.lua_jit) {
+#ifndef USE_LUAJIT
+                err = "lua-jit can't be enabled without LuaJIT support"; goto loaderr;
+#endif
+            }
         } else if (!strcasecmp(argv[0],"slowlog-log-slower-than") &&
                    argc == 2)
         {
@@ -708,6 +771,25 @@ void loadServerConfigFromString(char *config) {
                 err = "The latency threshold can't be negative";
                 goto loaderr;
             }
+        } else if (!strcasecmp(argv[0],"latency-tracking") && argc == 2) {
+            if ((server.latency_tracking_enabled = yesnotoi(argv[1])) == -1) {
+                err = "argument must be 'yes' or 'no'"; goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0],"eventloop-profiling") && argc == 2) {
+            if ((server.eventloop_profiling = yesnotoi(argv[1])) == -1) {
+                err = "argument must be 'yes' or 'no'"; goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0],"key-memory-tracking") && argc == 2) {
+            if ((server.key_memory_tracking = yesnotoi(argv[1])) == -1) {
+                err = "argument must be 'yes' or 'no'"; goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0],"keystats-sample-ratio") && argc == 2) {
+            server.keystats_sample_ratio = strtoll(argv[1],NULL,10);
+            if (server.keystats_sample_ratio < 0) {
+                err = "The sample ratio can't be negative";
+                goto loaderr;
+            }
+            server.keystats_countdown = server.keystats_sample_ratio;
         } else if (!strcasecmp(argv[0],"slowlog-max-len") && argc == 2) {
             server.slowlog_max_len = strtoll(argv[1],NULL,10);
         } else if (!strcasecmp(argv[0],"client-output-buffer-limit") &&
@@ -1098,6 +1180,8 @@ void configSetCommand(client *c) {
       "replica-ignore-maxmemory",server.repl_slave_ignore_maxmemory) {
     } config_set_bool_field(
       "activerehashing",server.activerehashing) {
+    } config_set_bool_field(
+      "inline-small-values",server.inline_small_values) {
     } config_set_bool_field(
       "activedefrag",server.active_defrag_enabled) {
 #ifndef HAVE_DEFRAG
@@ -1111,16 +1195,47 @@ void configSetCommand(client *c) {
             return;
         }
 #endif
+    } config_set_bool_field(
+      "lua-jit",server.lua_jit) {
+#ifndef USE_LUAJIT
+        if (server.lua_jit) {
+            server.lua_jit = 0;
+            addReplyError(c,
+                "-DISABLED The Lua JIT compiler cannot be enabled: it "
+                "requires a Redis server compiled with USE_LUAJIT=yes");
+            return;
+        }
+#endif
+        scriptingSetJit(server.lua,server.lua_jit);
+    } config_set_bool_field(
+      "active-defrag-thread",server.active_defrag_thread) {
     } config_set_bool_field(
       "protected-mode",server.protected_mode) {
     } config_set_bool_field(
       "stop-writes-on-bgsave-error",server.stop_writes_on_bgsave_err) {
     } config_set_bool_field(
       "lazyfree-lazy-eviction",server.lazyfree_lazy_eviction) {
+    } config_set_bool_field(
+      "maxmemory-background-eviction",server.maxmemory_background_eviction) {
     } config_set_bool_field(
       "lazyfree-lazy-expire",server.lazyfree_lazy_expire) {
     } config_set_bool_field(
       "lazyfree-lazy-server-del",server.lazyfree_lazy_server_del) {
+    } config_set_bool_field(
+      "lazyfree-lazy-overwrite",server.lazyfree_lazy_overwrite) {
+    } config_set_bool_field(
+      "lazyfree-lazy-member-del",server.lazyfree_lazy_member_del) {
+    } config_set_bool_field(
+      "latency-tracking",server.latency_tracking_enabled) {
+    } config_set_special_field("eventloop-profiling") {
+        int yn = yesnotoi(o->ptr);
+        if (yn == -1) goto badfmt;
+        elSetProfiling(yn);
+    } config_set_special_field("key-memory-tracking") {
+        int yn = yesnotoi(o->ptr);
+        if (yn == -1) goto badfmt;
+        /* Enabling the tracking measures all the keys. */
+        if (yn != server.key_memory_tracking) keymemSetTracking(yn);
     } config_set_bool_field(
       "slave-lazy-flush",server.repl_slave_lazy_flush) {
     } config_set_bool_field(
@@ -1136,6 +1251,10 @@ void configSetCommand(client *c) {
       "tcp-keepalive",server.tcpkeepalive,0,INT_MAX) {
     } config_set_numerical_field(
       "maxmemory-samples",server.maxmemory_samples,1,INT_MAX) {
+    } config_set_numerical_field(
+      "maxmemory-low-watermark",server.maxmemory_low_watermark,1,100) {
+    } config_set_numerical_field(
+      "maxmemory-hard-margin",server.maxmemory_hard_margin,0,100) {
     } config_set_numerical_field(
       "lfu-log-factor",server.lfu_log_factor,0,INT_MAX) {
     } config_set_numerical_field(
@@ -1178,6 +1297,10 @@ void configSetCommand(client *c) {
       "hll-sparse-max-bytes",server.hll_sparse_max_bytes,0,LONG_MAX) {
     } config_set_numerical_field(
       "lua-time-limit",server.lua_time_limit,0,LONG_MAX) {
+    } config_set_numerical_field(
+      "lua-result-cache-max-entries",ll,0,LONG_MAX) {
+        server.lua_results_max = ll;
+        scriptResultCacheFlush();
     } config_set_numerical_field(
       "slowlog-log-slower-than",server.slowlog_log_slower_than,-1,LLONG_MAX) {
     } config_set_numerical_field(
@@ -1186,6 +1309,9 @@ void configSetCommand(client *c) {
         server.slowlog_max_len = (unsigned long)ll;
     } config_set_numerical_field(
       "latency-monitor-threshold",server.latency_monitor_threshold,0,LLONG_MAX){
+    } config_set_numerical_field(
+      "keystats-sample-ratio",server.keystats_sample_ratio,0,LLONG_MAX){
+        server.keystats_countdown = server.keystats_sample_ratio;
     } config_set_numerical_field(
       "repl-ping-slave-period",server.repl_ping_slave_period,1,INT_MAX) {
     } config_set_numerical_field(
@@ -1346,6 +1472,9 @@ void configGetCommand(client *c) {
     config_get_numerical_field("proto-max-bulk-len",server.proto_max_bulk_len);
     config_get_numerical_field("client-query-buffer-limit",server.client_max_querybuf_len);
     config_get_numerical_field("maxmemory-samples",server.maxmemory_samples);
+    config_get_numerical_field("lazyfree-threads",server.lazyfree_threads);
+    config_get_numerical_field("maxmemory-low-watermark",server.maxmemory_low_watermark);
+    config_get_numerical_field("maxmemory-hard-margin",server.maxmemory_hard_margin);
     config_get_numerical_field("lfu-log-factor",server.lfu_log_factor);
     config_get_numerical_field("lfu-decay-time",server.lfu_decay_time);
     config_get_numerical_field("timeout",server.maxidletime);
@@ -1380,12 +1509,15 @@ void configGetCommand(client *c) {
     config_get_numerical_field("hll-sparse-max-bytes",
             server.hll_sparse_max_bytes);
     config_get_numerical_field("lua-time-limit",server.lua_time_limit);
+    config_get_numerical_field("lua-result-cache-max-entries",server.lua_results_max);
     config_get_numerical_field("slowlog-log-slower-than",
             server.slowlog_log_slower_than);
     config_get_numerical_field("latency-monitor-threshold",
             server.latency_monitor_threshold);
     config_get_numerical_field("slowlog-max-len",
             server.slowlog_max_len);
+    config_get_numerical_field("keystats-sample-ratio",
+            server.keystats_sample_ratio);
     config_get_numerical_field("port",server.port);
     config_get_numerical_field("cluster-announce-port",server.cluster_announce_port);
     config_get_numerical_field("cluster-announce-bus-port",server.cluster_announce_bus_port);
@@ -1441,7 +1573,10 @@ void configGetCommand(client *c) {
     config_get_bool_field("rdbcompression", server.rdb_compression);
     config_get_bool_field("rdbchecksum", server.rdb_checksum);
     config_get_bool_field("activerehashing", server.activerehashing);
+    config_get_bool_field("inline-small-values", server.inline_small_values);
     config_get_bool_field("activedefrag", server.active_defrag_enabled);
+    config_get_bool_field("lua-jit", server.lua_jit);
+    config_get_bool_field("active-defrag-thread", server.active_defrag_thread);
     config_get_bool_field("protected-mode", server.protected_mode);
     config_get_bool_field("repl-disable-tcp-nodelay",
             server.repl_disable_tcp_nodelay);
@@ -1457,10 +1592,22 @@ void configGetCommand(client *c) {
             server.aof_use_rdb_preamble);
     config_get_bool_field("lazyfree-lazy-eviction",
             server.lazyfree_lazy_eviction);
+    config_get_bool_field("maxmemory-background-eviction",
+            server.maxmemory_background_eviction);
     config_get_bool_field("lazyfree-lazy-expire",
             server.lazyfree_lazy_expire);
     config_get_bool_field("lazyfree-lazy-server-del",
             server.lazyfree_lazy_server_del);
+    config_get_bool_field("lazyfree-lazy-overwrite",
+            server.lazyfree_lazy_overwrite);
+    config_get_bool_field("lazyfree-lazy-member-del",
+            server.lazyfree_lazy_member_del);
+    config_get_bool_field("latency-tracking",
+            server.latency_tracking_enabled);
+    config_get_bool_field("eventloop-profiling",
+            server.eventloop_profiling);
+    config_get_bool_field("key-memory-tracking",
+            server.key_memory_tracking);
     config_get_bool_field("slave-lazy-flush",
             server.repl_slave_lazy_flush);
     config_get_bool_field("replica-lazy-flush",
@@ -2167,6 +2314,9 @@ int rewriteConfig(char *path) {
     rewriteConfigBytesOption(state,"client-query-buffer-limit",server.client_max_querybuf_len,PROTO_MAX_QUERYBUF_LEN);
     rewriteConfigEnumOption(state,"maxmemory-policy",server.maxmemory_policy,maxmemory_policy_enum,CONFIG_DEFAULT_MAXMEMORY_POLICY);
     rewriteConfigNumericalOption(state,"maxmemory-samples",server.maxmemory_samples,CONFIG_DEFAULT_MAXMEMORY_SAMPLES);
+    rewriteConfigYesNoOption(state,"maxmemory-background-eviction",server.maxmemory_background_eviction,CONFIG_DEFAULT_MAXMEMORY_BACKGROUND_EVICTION);
+    rewriteConfigNumericalOption(state,"maxmemory-low-watermark",server.maxmemory_low_watermark,CONFIG_DEFAULT_MAXMEMORY_LOW_WATERMARK);
+    rewriteConfigNumericalOption(state,"maxmemory-hard-margin",server.maxmemory_hard_margin,CONFIG_DEFAULT_MAXMEMORY_HARD_MARGIN);
     rewriteConfigNumericalOption(state,"lfu-log-factor",server.lfu_log_factor,CONFIG_DEFAULT_LFU_LOG_FACTOR);
     rewriteConfigNumericalOption(state,"lfu-decay-time",server.lfu_decay_time,CONFIG_DEFAULT_LFU_DECAY_TIME);
     rewriteConfigNumericalOption(state,"active-defrag-threshold-lower",server.active_defrag_threshold_lower,CONFIG_DEFAULT_DEFRAG_THRESHOLD_LOWER);
@@ -2182,6 +2332,7 @@ int rewriteConfig(char *path) {
     rewriteConfigNumericalOption(state,"auto-aof-rewrite-percentage",server.aof_rewrite_perc,AOF_REWRITE_PERC);
     rewriteConfigBytesOption(state,"auto-aof-rewrite-min-size",server.aof_rewrite_min_size,AOF_REWRITE_MIN_SIZE);
     rewriteConfigNumericalOption(state,"lua-time-limit",server.lua_time_limit,LUA_SCRIPT_TIME_LIMIT);
+    rewriteConfigNumericalOption(state,"lua-result-cache-max-entries",server.lua_results_max,CONFIG_DEFAULT_LUA_RESULTS_MAX);
     rewriteConfigYesNoOption(state,"cluster-enabled",server.cluster_enabled,0);
     rewriteConfigStringOption(state,"cluster-config-file",server.cluster_configfile,CONFIG_DEFAULT_CLUSTER_CONFIG_FILE);
     rewriteConfigYesNoOption(state,"cluster-require-full-coverage",server.cluster_require_full_coverage,CLUSTER_DEFAULT_REQUIRE_FULL_COVERAGE);
@@ -2191,6 +2342,10 @@ int rewriteConfig(char *path) {
     rewriteConfigNumericalOption(state,"cluster-replica-validity-factor",server.cluster_slave_validity_factor,CLUSTER_DEFAULT_SLAVE_VALIDITY);
     rewriteConfigNumericalOption(state,"slowlog-log-slower-than",server.slowlog_log_slower_than,CONFIG_DEFAULT_SLOWLOG_LOG_SLOWER_THAN);
     rewriteConfigNumericalOption(state,"latency-monitor-threshold",server.latency_monitor_threshold,CONFIG_DEFAULT_LATENCY_MONITOR_THRESHOLD);
+    rewriteConfigYesNoOption(state,"latency-tracking",server.latency_tracking_enabled,CONFIG_DEFAULT_LATENCY_TRACKING);
+    rewriteConfigYesNoOption(state,"eventloop-profiling",server.eventloop_profiling,CONFIG_DEFAULT_EVENTLOOP_PROFILING);
+    rewriteConfigYesNoOption(state,"key-memory-tracking",server.key_memory_tracking,CONFIG_DEFAULT_KEY_MEMORY_TRACKING);
+    rewriteConfigNumericalOption(state,"keystats-sample-ratio",server.keystats_sample_ratio,CONFIG_DEFAULT_KEYSTATS_SAMPLE_RATIO);
     rewriteConfigNumericalOption(state,"slowlog-max-len",server.slowlog_max_len,CONFIG_DEFAULT_SLOWLOG_MAX_LEN);
     rewriteConfigNotifykeyspaceeventsOption(state);
     rewriteConfigNumericalOption(state,"hash-max-ziplist-entries",server.hash_max_ziplist_entries,OBJ_HASH_MAX_ZIPLIST_ENTRIES);
@@ -2204,7 +2359,10 @@ int rewriteConfig(char *path) {
     rewriteConfigNumericalOption(state,"zset-max-ziplist-value",server.zset_max_ziplist_value,OBJ_ZSET_MAX_ZIPLIST_VALUE);
     rewriteConfigNumericalOption(state,"hll-sparse-max-bytes",server.hll_sparse_max_bytes,CONFIG_DEFAULT_HLL_SPARSE_MAX_BYTES);
     rewriteConfigYesNoOption(state,"activerehashing",server.activerehashing,CONFIG_DEFAULT_ACTIVE_REHASHING);
+    rewriteConfigYesNoOption(state,"inline-small-values",server.inline_small_values,CONFIG_DEFAULT_INLINE_SMALL_VALUES);
     rewriteConfigYesNoOption(state,"activedefrag",server.active_defrag_enabled,CONFIG_DEFAULT_ACTIVE_DEFRAG);
+    rewriteConfigYesNoOption(state,"lua-jit",server.lua_jit,CONFIG_DEFAULT_LUA_JIT);
+    rewriteConfigYesNoOption(state,"active-defrag-thread",server.active_defrag_thread,CONFIG_DEFAULT_ACTIVE_DEFRAG_THREAD);
     rewriteConfigYesNoOption(state,"protected-mode",server.protected_mode,CONFIG_DEFAULT_PROTECTED_MODE);
     rewriteConfigClientoutputbufferlimitOption(state);
     rewriteConfigNumericalOption(state,"hz",server.config_hz,CONFIG_DEFAULT_HZ);
@@ -2216,6 +2374,9 @@ int rewriteConfig(char *path) {
     rewriteConfigYesNoOption(state,"lazyfree-lazy-eviction",server.lazyfree_lazy_eviction,CONFIG_DEFAULT_LAZYFREE_LAZY_EVICTION);
     rewriteConfigYesNoOption(state,"lazyfree-lazy-expire",server.lazyfree_lazy_expire,CONFIG_DEFAULT_LAZYFREE_LAZY_EXPIRE);
     rewriteConfigYesNoOption(state,"lazyfree-lazy-server-del",server.lazyfree_lazy_server_del,CONFIG_DEFAULT_LAZYFREE_LAZY_SERVER_DEL);
+    rewriteConfigYesNoOption(state,"lazyfree-lazy-overwrite",server.lazyfree_lazy_overwrite,CONFIG_DEFAULT_LAZYFREE_LAZY_OVERWRITE);
+    rewriteConfigYesNoOption(state,"lazyfree-lazy-member-del",server.lazyfree_lazy_member_del,CONFIG_DEFAULT_LAZYFREE_LAZY_MEMBER_DEL);
+    rewriteConfigNumericalOption(state,"lazyfree-threads",server.lazyfree_threads,CONFIG_DEFAULT_LAZYFREE_THREADS);
     rewriteConfigYesNoOption(state,"replica-lazy-flush",server.repl_slave_lazy_flush,CONFIG_DEFAULT_SLAVE_LAZY_FLUSH);
     rewriteConfigYesNoOption(state,"dynamic-hz",server.dynamic_hz,CONFIG_DEFAULT_DYNAMIC_HZ);
 
@@ -39,6 +39,7 @@
  *----------------------------------------------------------------------------*/
 
 int keyIsExpired(redisDb *db, robj *key);
+static void keymemSetSize(redisDb *db, sds key, long long size);
 
 /* Update LFU when an object is accessed.
  * Firstly, decrement the counter if the decrement time is reached.
@@ -57,10 +58,18 @@ robj *lookupKey(redisDb *db, robj *key, int flags) {
     if (de) {
         robj *val = dictGetVal(de);
 
-        /* Update the access time for the ageing algorithm.
-         * Don't do it if we have a saving child, as this will trigger
-         * a copy on write madness. */
-        if (server.rdb_child_pid == -1 &&
+        /* Inline values are materialized in the dictionary only when the
+         * caller is going to modify them: for reads a temporary object is
+         * enough. It has no access time to update, like the inline value,
+         * and it is not part of the key memory since it is released after
+         * the command, see dbReleaseTempValues(). */
+        if (objIsInline(val) && !(flags & LOOKUP_WRITE)) {
+            val = createObjectFromInline(val);
+            listAddNodeTail(server.inline_temp_values,val);
+        } else if (objIsInline(val)) {
+            val = dbGetValue(db,de);
+            server.inline_pending++;
+        } else if (server.rdb_child_pid == -1 &&
             server.aof_child_pid == -1 &&
             !(flags & LOOKUP_NOTOUCH))
         {
@@ -70,6 +79,15 @@ robj *lookupKey(redisDb *db, robj *key, int flags) {
                 val->lru = LRU_CLOCK();
             }
         }
+
+        if (server.key_memory_tracking) keymemTouch(db,dictGetKey(de));
+
+        /* Hot keys / big keys sampling, see keystats.c. */
+        if (server.keystats_sample_ratio && !(flags & LOOKUP_NOTOUCH) &&
+            --server.keystats_countdown <= 0)
+        {
+            keystatsSampleLookup(db,dictGetKey(de),val);
+        }
         return val;
     } else {
         return NULL;
@@ -91,6 +109,7 @@ robj *lookupKey(redisDb *db, robj *key, int flags) {
  *
  *  LOOKUP_NONE (or zero): no special flags are passed.
  *  LOOKUP_NOTOUCH: don't alter the last access time of the key.
+ *  LOOKUP_WRITE: the value is going to be modified, used by lookupKeyWrite().
  *
  * Note: this function also returns NULL if the key is logically expired
  * but still existing, in case this is a slave, since this API is called only
@@ -151,7 +170,7 @@ robj *lookupKeyRead(redisDb *db, robj *key) {
  * does not exist in the specified DB. */
 robj *lookupKeyWrite(redisDb *db, robj *key) {
     expireIfNeeded(db,key);
-    return lookupKey(db,key,LOOKUP_NONE);
+    return lookupKey(db,key,LOOKUP_WRITE);
 }
 
 robj *lookupKeyReadOrReply(client *c, robj *key, robj *reply) {
@@ -166,6 +185,21 @@ robj *lookupKeyWriteOrReply(client *c, robj *key, robj *reply) {
     return o;
 }
 
+/* Return true if small values can be stored inline. Like for the shared
+ * integers, this is not possible when the eviction policy needs the access
+ * time of every object. */
+static int dbCanInline(void) {
+    return server.inline_small_values &&
+           (server.maxmemory == 0 ||
+            !(server.maxmemory_policy & MAXMEMORY_FLAG_NO_SHARED_INTEGERS));
+}
+
+/* Called when 'val' is stored in the DB as an object: if it could be stored
+ * inline, inlineValuesCron() has something to do. */
+static void dbCountInlineCandidate(robj *val) {
+    if (dbCanInline() && objectToInline(val)) server.inline_pending++;
+}
+
 /* Add the key to the DB. It's up to the caller to increment the reference
  * counter of the value if needed.
  *
@@ -179,6 +213,8 @@ void dbAdd(redisDb *db, robj *key, robj *val) {
         val->type == OBJ_ZSET)
         signalKeyAsReady(db, key);
     if (server.cluster_enabled) slotToKeyAdd(key);
+    keymemSetValue(db,copy,val);
+    dbCountInlineCandidate(val);
 }
 
 /* Overwrite an existing key with a new value. Incrementing the reference
@@ -192,40 +228,95 @@ void dbOverwrite(redisDb *db, robj *key, robj *val) {
     serverAssertWithInfo(NULL,key,de != NULL);
     dictEntry auxentry = *de;
     robj *old = dictGetVal(de);
-    if (server.maxmemory_policy & MAXMEMORY_FLAG_LFU) {
+    if (server.maxmemory_policy & MAXMEMORY_FLAG_LFU && !objIsInline(old)) {
         val->lru = old->lru;
     }
+    keymemDelete(db,key);
     dictSetVal(db->dict, de, val);
 
-    if (server.lazyfree_lazy_server_del) {
+    if ((server.lazyfree_lazy_server_del || server.lazyfree_lazy_overwrite) &&
+        !objIsInline(old))
+    {
         freeObjAsync(old);
         dictSetVal(db->dict, &auxentry, NULL);
     }
 
     dictFreeVal(db->dict, &auxentry);
+    keymemSetValue(db,dictGetKey(de),val);
+    dbCountInlineCandidate(val);
+}
+
+/* Store the value of 'key', that must be the object 'val', directly in the
+ * dictEntry if it is small enough (see objectToInline()). Returns 1 if the
+ * value was stored inline: in this case the dictionary no longer uses the
+ * reference it was holding to 'val', and it's up to the caller to release
+ * it if needed. Otherwise 0 is returned and nothing is changed. */
+int dbInlineValue(redisDb *db, robj *key, robj *val) {
+    dictEntry *de;
+    void *v;
+
+    if (!dbCanInline() || (v = objectToInline(val)) == NULL) return 0;
+    de = dictFind(db->dict,key->ptr);
+    serverAssertWithInfo(NULL,key,de != NULL && dictGetVal(de) == val);
+    dictSetVal(db->dict,de,v);
+    keymemSignal(db,key);
+    server.inline_pending--; /* Counted by dbAdd() or dbOverwrite(). */
+    return 1;
+}
+
+/* Return the value of the main dictionary entry 'de' as an object. Inline
+ * values are converted back into an object that replaces them in the entry,
+ * since the callers may modify the value or retain a reference to it. The
+ * values not accessed for some time are stored inline again by
+ * inlineValuesCron(). */
+robj *dbGetValue(redisDb *db, dictEntry *de) {
+    robj *val = dictGetVal(de);
+
+    if (objIsInline(val)) {
+        val = createObjectFromInline(val);
+        dictSetVal(db->dict,de,val);
+        if (server.key_memory_tracking)
+            keymemSetSize(db,dictGetKey(de),objectAllocSize(val));
+    }
+    return val;
+}
+
+/* Release the temporary objects created by the read lookups of inline
+ * values. Callers retaining one of them incremented its reference count, so
+ * it is safe to call this function once the command that performed the
+ * lookups returned, that is, after processCommand() executed it. */
+void dbReleaseTempValues(void) {
+    if (listLength(server.inline_temp_values))
+        listEmpty(server.inline_temp_values);
 }
 
 /* High level Set operation. This function can be used in order to set
  * a key, whatever it was existing or not, to a new object.
  *
- * 1) The ref count of the value object is incremented.
+ * 1) The ref count of the value object is incremented, unless the value
+ *    is small enough to be stored inline in the dictionary.
  * 2) clients WATCHing for the destination key notified.
  * 3) The expire time of the key is reset (the key is made persistent).
  *
  * All the new keys in the database should be created via this interface. */
 void setKey(redisDb *db, robj *key, robj *val) {
-    if (lookupKeyWrite(db,key) == NULL) {
+    /* The old value is going to be replaced: there is no need to convert
+     * it into an object if it is stored inline, like lookupKeyWrite()
+     * would do. */
+    expireIfNeeded(db,key);
+    if (lookupKey(db,key,LOOKUP_NONE) == NULL) {
         dbAdd(db,key,val);
     } else {
         dbOverwrite(db,key,val);
     }
-    incrRefCount(val);
+    if (!dbInlineValue(db,key,val)) incrRefCount(val);
     removeExpire(db,key);
     signalModifiedKey(db,key);
 }
 
 int dbExists(redisDb *db, robj *key) {
-    return dictFind(db->dict,key->ptr) != NULL;
+    int exists = dictFind(db->dict,key->ptr) != NULL;
+    return exists;
 }
 
 /* Return a random key, in form of a Redis object.
@@ -269,15 +360,17 @@ robj *dbRandomKey(redisDb *db) {
 
 /* Delete a key, value, and associated expiration entry if any, from the DB */
 int dbSyncDelete(redisDb *db, robj *key) {
+    int deleted = 0;
+
     /* Deleting an entry from the expires dict will not free the sds of
      * the key, because it is shared with the main dictionary. */
+    keymemDelete(db,key);
     if (dictSize(db->expires) > 0) dictDelete(db->expires,key->ptr);
     if (dictDelete(db->dict,key->ptr) == DICT_OK) {
         if (server.cluster_enabled) slotToKeyDel(key);
-        return 1;
-    } else {
-        return 0;
+        deleted = 1;
     }
+    return deleted;
 }
 
 /* This is a wrapper whose behavior depends on the Redis lazy free
@@ -361,9 +454,12 @@ long long emptyDb(int dbnum, int flags, void(callback)(void*)) {
         if (async) {
             emptyDbAsync(&server.db[j]);
         } else {
+            dictEmpty(server.db[j].memory,callback);
             dictEmpty(server.db[j].dict,callback);
             dictEmpty(server.db[j].expires,callback);
         }
+        server.db[j].used_memory = 0;
+        keymemForgetDb(&server.db[j]);
     }
     if (server.cluster_enabled) {
         if (async) {
@@ -373,6 +469,7 @@ long long emptyDb(int dbnum, int flags, void(callback)(void*)) {
         }
     }
     if (dbnum == -1) flushSlaveKeysWithExpireList();
+    scriptResultCacheFlush();
     return removed;
 }
 
@@ -393,11 +490,447 @@ int selectDb(client *c, int id) {
  *----------------------------------------------------------------------------*/
 
 void signalModifiedKey(redisDb *db, robj *key) {
+    keymemSignal(db,key);
     touchWatchedKey(db,key);
+    scriptResultCacheTouchKey(db,key);
+    trackingInvalidateKey(key);
 }
 
 void signalFlushedDb(int dbid) {
     touchWatchedKeysOnFlush(dbid);
+    trackingInvalidateKeysOnFlush(dbid);
+}
+
+/*-----------------------------------------------------------------------------
+ * Key memory accounting
+ *
+ * When key-memory-tracking is enabled, db->memory maps every key to the
+ * number of bytes allocated for its value, and db->used_memory (plus the
+ * per slot totals in cluster mode) is the sum of such sizes.
+ *
+ * Computing the exact size of a value is O(N), so the type implementations
+ * account the memory their operations allocate and free: the code changing
+ * an aggregate value is enclosed between keymemValueBegin() and
+ * keymemValueEnd(), that record the difference of the used memory as
+ * pending for such value. When the key is signaled as modified the pending
+ * difference is added to its size. The values allocated as a single block
+ * (strings, listpacks, intsets, ...) are just measured again instead, since
+ * this is O(1). The pending differences are indexed by the pointer to the
+ * data structure of the value (the dict, the quicklist, ...), that unlike
+ * the object is known to all the type specific code, like the one of the
+ * streams.
+ *
+ * A value stored with dbAdd() or dbOverwrite() is measured from scratch,
+ * that is O(N) only in the number of elements the command itself created,
+ * unless it is the value of another key the command looked up, as it
+ * happens in RENAME and MOVE: in this case the size is just copied.
+ *
+ * Read only commands may change the size of a value as well, for instance
+ * performing a rehashing step of the dictionary of a set, so when a command
+ * returns the differences of the values that were not signaled are added
+ * to the keys the command looked up holding such values.
+ *
+ * When the tracking is enabled at runtime keymemCron() measures the keys
+ * incrementally: the totals are not reported until the scan is completed.
+ *----------------------------------------------------------------------------*/
+
+#define KEYMEM_CRON_TIME 1000   /* Microseconds per cron call. */
+
+static struct {
+    int nesting;            /* keymemValueBegin() nesting level. */
+    long long adjust;       /* Bytes added by keymemValueAdjust(). */
+    struct {                /* Differences not yet added to a key. */
+        void *ptr;
+        long long delta;
+    } *pending;
+    int pending_len, pending_size;
+    struct {                /* Keys looked up by the current command. */
+        redisDb *db;
+        sds key;
+    } *touched;
+    int touched_len, touched_size;
+    int scanning;           /* True if keymemCron() has keys to measure. */
+    int scan_db;            /* DB and cursor of the keymemCron() scan. */
+    unsigned long scan_cursor;
+} keymem;
+
+/* Set the size of the key to 'size' updating the totals. */
+static void keymemSetSize(redisDb *db, sds key, long long size) {
+    dictEntry *existing, *de = dictAddRaw(db->memory,key,&existing);
+    long long delta;
+
+    if (de) dictSetUnsignedIntegerVal(de,0); else de = existing;
+    delta = size - (long long)dictGetUnsignedIntegerVal(de);
+    dictSetUnsignedIntegerVal(de,size);
+    db->used_memory += delta;
+    if (server.cluster_enabled)
+        server.cluster->slots_memory[keyHashSlot(key,sdslen(key))] += delta;
+}
+
+/* Return the tracked size of the key, or -1 if the key is not tracked. */
+long long keymemGetSize(redisDb *db, sds key) {
+    dictEntry *de = dictFind(db->memory,key);
+    return de ? (long long)dictGetUnsignedIntegerVal(de) : -1;
+}
+
+/* Return true if the totals are exact, that is, the tracking is enabled
+ * and all the keys were measured. */
+int keymemIsComplete(void) {
+    return server.key_memory_tracking && !keymem.scanning;
+}
+
+/* Return true if the value can be measured in constant time. */
+static int keymemIsFlat(robj *val) {
+    if (objIsInline(val)) return 1;
+    switch(val->encoding) {
+    case OBJ_ENCODING_HT:
+    case OBJ_ENCODING_QUICKLIST:
+    case OBJ_ENCODING_SKIPLIST:
+    case OBJ_ENCODING_STREAM:
+        return 0;
+    default:
+        return 1;
+    }
+}
+
+/* Remove the pending difference of the value with data structure 'ptr'
+ * and return it. */
+static long long keymemTakePending(void *ptr) {
+    for (int j = keymem.pending_len-1; j >= 0; j--) {
+        if (keymem.pending[j].ptr == ptr) {
+            long long delta = keymem.pending[j].delta;
+            keymem.pending[j] = keymem.pending[--keymem.pending_len];
+            return delta;
+        }
+    }
+    return 0;
+}
+
+/* The code modifying the value 'val' of a key calls keymemValueBegin()
+ * before and keymemValueEnd() after doing so, passing the returned mark.
+ * The calls can be nested, only the outermost pair is considered. When the
+ * tracking is disabled nothing is done. The code of the streams, that has
+ * no access to the object, uses keymemStreamEnd() instead. */
+long long keymemValueBegin(void) {
+    if (!server.key_memory_tracking) return -1;
+    if (keymem.nesting++) return -2;
+    keymem.adjust = 0;
+    return zmalloc_thread_used_memory();
+}
+
+static void keymemRecord(void *ptr, long long mark) {
+    long long delta;
+    int j;
+
+    if (mark == -1) return;
+    keymem.nesting--;
+    if (mark == -2 || ptr == NULL) return;
+    delta = zmalloc_thread_used_memory() - mark + keymem.adjust;
+    if (delta == 0) return;
+
+    /* Usually the last value is modified again. */
+    for (j = keymem.pending_len-1; j >= 0; j--)
+        if (keymem.pending[j].ptr == ptr) break;
+    if (j == -1) {
+        if (keymem.pending_len == keymem.pending_size) {
+            keymem.pending_size = keymem.pending_size ?
+                                  keymem.pending_size*2 : 16;
+            keymem.pending = zrealloc(keymem.pending,
+                sizeof(keymem.pending[0])*keymem.pending_size);
+        }
+        j = keymem.pending_len++;
+        keymem.pending[j].ptr = ptr;
+        keymem.pending[j].delta = 0;
+    }
+    keymem.pending[j].delta += delta;
+}
+
+void keymemValueEnd(robj *val, long long mark) {
+    if (mark == -1) return;
+    keymemRecord(keymemIsFlat(val) ? NULL : val->ptr,mark);
+}
+
+void keymemStreamEnd(stream *s, long long mark) {
+    keymemRecord(s,mark);
+}
+
+/* Return true if the code is between keymemValueBegin() and
+ * keymemValueEnd(). */
+int keymemValueIsOpen(void) {
+    return keymem.nesting != 0;
+}
+
+/* Add 'bytes' to the difference the current keymemValueEnd() is going to
+ * record: the memory that is part of the value but was allocated before
+ * keymemValueBegin(), or is released by other threads, is positive, and
+ * what was allocated for other purposes is negative. */
+void keymemValueAdjust(long long bytes) {
+    if (keymem.nesting) keymem.adjust += bytes;
+}
+
+/* Update the size of the key of the main dictionary entry 'de'. */
+static void keymemUpdate(redisDb *db, dictEntry *de) {
+    robj *val = dictGetVal(de);
+    long long delta, size;
+
+    if (keymemIsFlat(val)) {
+        keymemSetSize(db,dictGetKey(de),objectAllocSize(val));
+        return;
+    }
+
+    /* Keys not measured yet by keymemCron() have no size to update. */
+    delta = keymemTakePending(val->ptr);
+    if (delta == 0 || (size = keymemGetSize(db,dictGetKey(de))) == -1)
+        return;
+    size += delta;
+    keymemSetSize(db,dictGetKey(de),size < 0 ? 0 : size);
+}
+
+/* Called by lookupKey() for every key accessed while the tracking is
+ * enabled. */
+void keymemTouch(redisDb *db, sds key) {
+    int last = keymem.touched_len-1;
+
+    if (last >= 0 && keymem.touched[last].db == db &&
+        keymem.touched[last].key == key) return;
+    if (keymem.touched_len == keymem.touched_size) {
+        keymem.touched_size = keymem.touched_size ? keymem.touched_size*2 : 16;
+        keymem.touched = zrealloc(keymem.touched,
+            sizeof(keymem.touched[0])*keymem.touched_size);
+    }
+    keymem.touched[keymem.touched_len].db = db;
+    keymem.touched[keymem.touched_len].key = key;
+    keymem.touched_len++;
+}
+
+/* Forget the touched keys matching 'key', or all the keys of 'db' if 'key'
+ * is NULL, as they are no longer valid. */
+static void keymemUntouch(redisDb *db, sds key) {
+    for (int j = 0; j < keymem.touched_len; j++) {
+        if (keymem.touched[j].db == db &&
+            (key == NULL || keymem.touched[j].key == key))
+            keymem.touched[j].db = NULL;
+    }
+}
+
+/* Called when 'val' is stored at 'key', by dbAdd() and dbOverwrite(). */
+void keymemSetValue(redisDb *db, sds key, robj *val) {
+    long long size = -1;
+
+    if (!server.key_memory_tracking) return;
+    for (int j = 0; j < keymem.touched_len; j++) {
+        redisDb *srcdb = keymem.touched[j].db;
+        dictEntry *de;
+
+        if (srcdb == NULL || (srcdb == db && keymem.touched[j].key == key))
+            continue;
+        de = dictFind(srcdb->dict,keymem.touched[j].key);
+        if (de && dictGetVal(de) == val) {
+            keymemUpdate(srcdb,de);
+            size = keymemGetSize(srcdb,dictGetKey(de));
+            break;
+        }
+    }
+    if (size == -1) {
+        if (!keymemIsFlat(val)) keymemTakePending(val->ptr);
+        size = objectAllocSize(val);
+    }
+    keymemSetSize(db,key,size);
+    keymemTouch(db,key);
+}
+
+/* Called by signalModifiedKey(). */
+void keymemSignal(redisDb *db, robj *key) {
+    dictEntry *de;
+
+    if (!server.key_memory_tracking) return;
+    if ((de = dictFind(db->dict,key->ptr)) != NULL) keymemUpdate(db,de);
+}
+
+/* Called when a key is removed from the DB, or its value is replaced. */
+void keymemDelete(redisDb *db, robj *key) {
+    dictEntry *de;
+    robj *val;
+
+    if (!server.key_memory_tracking) return;
+    if ((de = dictFind(db->dict,key->ptr)) == NULL) return;
+    val = dictGetVal(de);
+    if (!keymemIsFlat(val)) keymemTakePending(val->ptr);
+    keymemUntouch(db,dictGetKey(de));
+    if ((de = dictFind(db->memory,key->ptr)) == NULL) return;
+    db->used_memory -= dictGetUnsignedIntegerVal(de);
+    if (server.cluster_enabled) {
+        server.cluster->slots_memory[keyHashSlot(key->ptr,sdslen(key->ptr))]
+            -= dictGetUnsignedIntegerVal(de);
+    }
+    dictDelete(db->memory,key->ptr);
+}
+
+/* Called when a DB is flushed or swapped. The pending differences of its
+ * values can't be told apart from the others, so they are all dropped. */
+void keymemForgetDb(redisDb *db) {
+    keymemUntouch(db,NULL);
+    keymem.pending_len = 0;
+    /* The cursor of the scan is no longer valid: restart it. The keys
+     * already measured are skipped. */
+    if (keymem.scanning) {
+        keymem.scan_db = 0;
+        keymem.scan_cursor = 0;
+    }
+}
+
+/* Called when a command returns, and after the code modifying the keys
+ * outside of call(): the keys that were looked up get the pending
+ * differences of their values, or are measured again if the value is flat,
+ * since they may have been modified after being signaled. */
+void keymemFlush(void) {
+    if (keymem.touched_len == 0 && keymem.pending_len == 0) return;
+    for (int j = 0; j < keymem.touched_len; j++) {
+        redisDb *db = keymem.touched[j].db;
+        dictEntry *de;
+
+        if (db == NULL) continue;
+        de = dictFind(db->dict,keymem.touched[j].key);
+        if (de) keymemUpdate(db,de);
+    }
+    keymem.pending_len = 0;
+    keymem.touched_len = 0;
+}
+
+/* Start or stop the key memory accounting. The sizes are released in the
+ * background when the DBs are large, and measured again by keymemCron(). */
+void keymemSetTracking(int enable) {
+    server.key_memory_tracking = enable;
+    keymem.pending_len = 0;
+    keymem.touched_len = 0;
+    keymem.scanning = enable;
+    keymem.scan_db = 0;
+    keymem.scan_cursor = 0;
+    if (server.cluster_enabled)
+        memset(server.cluster->slots_memory,0,
+               sizeof(server.cluster->slots_memory));
+    for (int j = 0; j < server.dbnum; j++) {
+        emptyDbMemoryAsync(server.db+j);
+        server.db[j].used_memory = 0;
+    }
+}
+
+static void keymemScanCallback(void *privdata, const dictEntry *de) {
+    redisDb *db = privdata;
+    sds key = dictGetKey(de);
+
+    if (keymemGetSize(db,key) == -1)
+        keymemSetSize(db,key,objectAllocSize(dictGetVal(de)));
+}
+
+/* Measure the keys not measured yet, in steps of KEYMEM_CRON_TIME
+ * microseconds, or until all the keys are measured if 'sync' is true. */
+void keymemCron(int sync) {
+    long long start = ustime();
+    int iterations = 0;
+
+    if (!keymem.scanning) return;
+    while (keymem.scan_db < server.dbnum) {
+        redisDb *db = server.db+keymem.scan_db;
+
+        if (dictSize(db->dict) != dictSize(db->memory))
+            keymem.scan_cursor = dictScan(db->dict,keymem.scan_cursor,
+                                          keymemScanCallback,NULL,db);
+        else
+            keymem.scan_cursor = 0;
+        if (keymem.scan_cursor == 0) keymem.scan_db++;
+        if (!sync && (++iterations & 15) == 0 &&
+            ustime()-start > KEYMEM_CRON_TIME) return;
+    }
+    keymem.scanning = 0;
+}
+
+/*-----------------------------------------------------------------------------
+ * Inline values
+ *
+ * setKey() and the RDB loading store the small strings inline. Read lookups
+ * use a temporary object, but a value looked up for writing is converted
+ * back into an object (see dbGetValue()), since values like the INCR
+ * counters are modified in place or stored with dbOverwrite(), where the
+ * caller retains a reference. So the cron scans the keyspace incrementally
+ * and stores inline again the values not accessed for INLINE_VALUES_MIN_IDLE
+ * seconds: converting the hot keys at every access would just waste CPU.
+ *
+ * server.inline_pending counts the values converted back since the last
+ * scan, plus the ones the last scan found not idle enough: once a full scan
+ * leaves nothing behind, the cron stops until a value is converted again.
+ *----------------------------------------------------------------------------*/
+
+#define INLINE_VALUES_MIN_IDLE 10       /* Seconds. */
+#define INLINE_VALUES_CRON_TIME 1000    /* Microseconds per cron call. */
+
+static long long inline_scan_pending; /* Not idle values of current scan. */
+
+static void inlineValuesScanCallback(void *privdata, const dictEntry *const_de) {
+    dictEntry *de = (dictEntry*)const_de;
+    redisDb *db = privdata;
+    robj *val = dictGetVal(de);
+    void *v;
+
+    if (objIsInline(val) || val->refcount != 1) return;
+    if ((v = objectToInline(val)) == NULL) return;
+    /* With the LFU policies the lru field holds the last access time in
+     * minutes instead. */
+    if ((server.maxmemory_policy & MAXMEMORY_FLAG_LFU) ?
+        LFUTimeElapsed(val->lru >> 8) == 0 :
+        estimateObjectIdleTime(val)/1000 < INLINE_VALUES_MIN_IDLE)
+    {
+        inline_scan_pending++;
+        return;
+    }
+
+    if (server.key_memory_tracking) {
+        long long size = keymemGetSize(db,dictGetKey(de));
+        if (size != -1) {
+            size -= objectAllocSize(val);
+            keymemSetSize(db,dictGetKey(de),size < 0 ? 0 : size);
+        }
+    }
+    dictSetVal(db->dict,de,v);
+    decrRefCount(val);
+}
+
+/* Called by databasesCron() when there is no child saving the DB, since
+ * touching the values would cause copy-on-write. */
+void inlineValuesCron(void) {
+    static unsigned int current_db = 0;
+    static unsigned long cursor = 0;
+    static long long scan_start_pending = -1; /* -1: no scan in progress. */
+    long long start;
+    int iterations = 0;
+
+    if (!dbCanInline()) return;
+    if (scan_start_pending == -1) {
+        if (server.inline_pending <= 0) return;
+        scan_start_pending = server.inline_pending;
+        inline_scan_pending = 0;
+        current_db = 0;
+        cursor = 0;
+    }
+
+    start = ustime();
+    while (current_db < (unsigned int)server.dbnum) {
+        redisDb *db = server.db+current_db;
+
+        if (dictSize(db->dict))
+            cursor = dictScan(db->dict,cursor,inlineValuesScanCallback,NULL,db);
+        else
+            cursor = 0;
+        if (cursor == 0) current_db++;
+        if ((++iterations & 15) == 0 &&
+            ustime()-start > INLINE_VALUES_CRON_TIME) return;
+    }
+
+    /* Scan completed: what is still pending are the values that were not
+     * idle enough, and the ones converted during the scan. */
+    server.inline_pending = inline_scan_pending +
+                            (server.inline_pending - scan_start_pending);
+    scan_start_pending = -1;
 }
 
 /*-----------------------------------------------------------------------------
@@ -671,11 +1204,11 @@ void scanGenericCommand(client *c, robj *o, unsigned long cursor) {
 
     /* Step 2: Iterate the collection.
      *
-     * Note that if the object is encoded with a ziplist, intset, or any other
-     * representation that is not a hash table, we are sure that it is also
-     * composed of a small number of elements. So to avoid taking state we
-     * just return everything inside the object in a single call, setting the
-     * cursor to zero to signal the end of the iteration. */
+     * Note that if the object is encoded with a listpack, intset, or any
+     * other representation that is not a hash table, we are sure that it is
+     * also composed of a small number of elements. So to avoid taking state
+     * we just return everything inside the object in a single call, setting
+     * the cursor to zero to signal the end of the iteration. */
 
     /* Handle the case of a hash table. */
     ht = NULL;
@@ -718,17 +1251,17 @@ void scanGenericCommand(client *c, robj *o, unsigned long cursor) {
             listAddNodeTail(keys,createStringObjectFromLongLong(ll));
         cursor = 0;
     } else if (o->type == OBJ_HASH || o->type == OBJ_ZSET) {
-        unsigned char *p = ziplistIndex(o->ptr,0);
+        unsigned char *p = lpFirst(o->ptr);
         unsigned char *vstr;
         unsigned int vlen;
         long long vll;
 
         while(p) {
-            ziplistGet(p,&vstr,&vlen,&vll);
+            vstr = lpGetValue(p,&vlen,&vll);
             listAddNodeTail(keys,
                 (vstr != NULL) ? createStringObject((char*)vstr,vlen) :
                                  createStringObjectFromLongLong(vll));
-            p = ziplistNext(o->ptr,p);
+            p = lpNext(o->ptr,p);
         }
         cursor = 0;
     } else {
@@ -813,29 +1346,28 @@ void lastsaveCommand(client *c) {
     addReplyLongLong(c,server.lastsave);
 }
 
+/* Return the name of the type of the object, as reported by TYPE. */
+char *getObjectTypeName(robj *o) {
+    switch(o->type) {
+    case OBJ_STRING: return "string";
+    case OBJ_LIST: return "list";
+    case OBJ_SET: return "set";
+    case OBJ_ZSET: return "zset";
+    case OBJ_HASH: return "hash";
+    case OBJ_STREAM: return "stream";
+    case OBJ_MODULE: {
+        moduleValue *mv = o->ptr;
+        return mv->type->name;
+    }
+    default: return "unknown";
+    }
+}
+
 void typeCommand(client *c) {
     robj *o;
-    char *type;
 
     o = lookupKeyReadWithFlags(c->db,c->argv[1],LOOKUP_NOTOUCH);
-    if (o == NULL) {
-        type = "none";
-    } else {
-        switch(o->type) {
-        case OBJ_STRING: type = "string"; break;
-        case OBJ_LIST: type = "list"; break;
-        case OBJ_SET: type = "set"; break;
-        case OBJ_ZSET: type = "zset"; break;
-        case OBJ_HASH: type = "hash"; break;
-        case OBJ_STREAM: type = "stream"; break;
-        case OBJ_MODULE: {
-            moduleValue *mv = o->ptr;
-            type = mv->type->name;
-        }; break;
-        default: type = "unknown"; break;
-        }
-    }
-    addReplyStatus(c,type);
+    addReplyStatus(c, o ? getObjectTypeName(o) : "none");
 }
 
 void shutdownCommand(client *c) {
@@ -967,6 +1499,8 @@ void moveCommand(client *c) {
 
     /* OK! key moved, free the entry in the source DB */
     dbDelete(src,c->argv[1]);
+    signalModifiedKey(src,c->argv[1]);
+    signalModifiedKey(dst,c->argv[1]);
     server.dirty++;
     addReply(c,shared.cone);
 }
@@ -1009,11 +1543,17 @@ int dbSwapDatabases(int id1, int id2) {
      * remain in the same DB they were. */
     db1->dict = db2->dict;
     db1->expires = db2->expires;
+    db1->memory = db2->memory;
+    db1->used_memory = db2->used_memory;
     db1->avg_ttl = db2->avg_ttl;
 
     db2->dict = aux.dict;
     db2->expires = aux.expires;
+    db2->memory = aux.memory;
+    db2->used_memory = aux.used_memory;
     db2->avg_ttl = aux.avg_ttl;
+    keymemForgetDb(db1);
+    keymemForgetDb(db2);
 
     /* Now we need to handle clients blocked on lists: as an effect
      * of swapping the two DBs, a client that was waiting for list
@@ -1053,6 +1593,8 @@ void swapdbCommand(client *c) {
         addReplyError(c,"DB index is out of range");
         return;
     } else {
+        scriptResultCacheFlush();
+        trackingInvalidateKeysOnFlush(-1);
         server.dirty++;
         addReply(c,shared.ok);
     }
@@ -1063,10 +1605,13 @@ void swapdbCommand(client *c) {
  *----------------------------------------------------------------------------*/
 
 int removeExpire(redisDb *db, robj *key) {
+    int removed;
+
     /* An expire may only be removed if there is a corresponding entry in the
      * main dict. Otherwise, the key will never be freed. */
     serverAssertWithInfo(NULL,key,dictFind(db->dict,key->ptr) != NULL);
-    return dictDelete(db->expires,key->ptr) == DICT_OK;
+    removed = dictDelete(db->expires,key->ptr) == DICT_OK;
+    return removed;
 }
 
 /* Set an expire to the specified key. If the expire is set in the context
@@ -1076,11 +1621,14 @@ int removeExpire(redisDb *db, robj *key) {
 void setExpire(client *c, redisDb *db, robj *key, long long when) {
     dictEntry *kde, *de;
 
+
     /* Reuse the sds from the main dict in the expire dict */
     kde = dictFind(db->dict,key->ptr);
     serverAssertWithInfo(NULL,key,kde != NULL);
     de = dictAddOrFind(db->expires,dictGetKey(kde));
     dictSetSignedIntegerVal(de,when);
+    /* Cached script results don't depend on volatile keys. */
+    scriptResultCacheTouchKey(db,key);
 
     int writable_slave = server.masterhost && server.repl_slave_ro == 0;
     if (c && writable_slave && !(c->flags & CLIENT_MASTER))
@@ -1093,8 +1641,11 @@ long long getExpire(redisDb *db, robj *key) {
     dictEntry *de;
 
     /* No expire? return ASAP */
-    if (dictSize(db->expires) == 0 ||
-       (de = dictFind(db->expires,key->ptr)) == NULL) return -1;
+    if (dictSize(db->expires) == 0) return -1;
+    de = dictFind(db->expires,key->ptr);
+    if (de == NULL) {
+        return -1;
+    }
 
     /* The entry was found in the expire dict, this means it should also
      * be present in the main dict (safety check). */
@@ -1499,6 +2050,8 @@ void slotToKeyFlush(void) {
     server.cluster->slots_to_keys = raxNew();
     memset(server.cluster->slots_keys_count,0,
            sizeof(server.cluster->slots_keys_count));
+    memset(server.cluster->slots_memory,0,
+           sizeof(server.cluster->slots_memory));
 }
 
 /* Pupulate the specified array of objects with keys in the specified slot.
@@ -147,7 +147,7 @@ void xorObjectDigest(redisDb *db, robj *keyobj, unsigned char *digest, robj *o)
     } else if (o->type == OBJ_ZSET) {
         unsigned char eledigest[20];
 
-        if (o->encoding == OBJ_ENCODING_ZIPLIST) {
+        if (o->encoding == OBJ_ENCODING_LISTPACK) {
             unsigned char *zl = o->ptr;
             unsigned char *eptr, *sptr;
             unsigned char *vstr;
@@ -155,13 +155,13 @@ void xorObjectDigest(redisDb *db, robj *keyobj, unsigned char *digest, robj *o)
             long long vll;
             double score;
 
-            eptr = ziplistIndex(zl,0);
+            eptr = lpSeek(zl,0);
             serverAssert(eptr != NULL);
-            sptr = ziplistNext(zl,eptr);
+            sptr = lpNext(zl,eptr);
             serverAssert(sptr != NULL);
 
             while (eptr != NULL) {
-                serverAssert(ziplistGet(eptr,&vstr,&vlen,&vll));
+                vstr = lpGetValue(eptr,&vlen,&vll);
                 score = zzlGetScore(sptr);
 
                 memset(eledigest,0,20);
@@ -287,7 +287,13 @@ void computeDatasetDigest(unsigned char *final) {
             mixDigest(digest,key,sdslen(key));
 
             o = dictGetVal(de);
-            xorObjectDigest(db,keyobj,digest,o);
+            if (objIsInline(o)) {
+                o = createObjectFromInline(o);
+                xorObjectDigest(db,keyobj,digest,o);
+                decrRefCount(o);
+            } else {
+                xorObjectDigest(db,keyobj,digest,o);
+            }
 
             /* We can finally xor the key-val digest to the final digest */
             xorDigest(final,digest,20);
@@ -309,6 +315,7 @@ void debugCommand(client *c) {
 "LOG <message> -- write message to the server log.",
 "HTSTATS <dbid> -- Return hash table statistics of the specified Redis database.",
 "HTSTATS-KEY <key> -- Like htstats but for the hash table stored as key's value.",
+"KEYMEM-CHECK -- Return the keys of the current DB whose memory tracked by key-memory-tracking differs from the actual size, as key, tracked, actual triplets.",
 "LOADAOF -- Flush the AOF buffers on disk and reload the AOF in memory.",
 "LUA-ALWAYS-REPLICATE-COMMANDS <0|1> -- Setting it to 1 makes Lua replication defaulting to replicating single commands, without the script having to enable effects replication.",
 "OBJECT <key> -- Show low level info about key and associated value.",
@@ -387,12 +394,17 @@ NULL
         dictEntry *de;
         robj *val;
         char *strenc;
+        int inlined;
 
         if ((de = dictFind(c->db->dict,c->argv[2]->ptr)) == NULL) {
             addReply(c,shared.nokeyerr);
             return;
         }
+        /* Don't store inline values back as objects: introspection should
+         * not change how the value is stored. */
         val = dictGetVal(de);
+        inlined = objIsInline(val);
+        if (inlined) val = createObjectFromInline(val);
         strenc = strEncoding(val->encoding);
 
         char extra[138] = {0};
@@ -409,8 +421,8 @@ NULL
             used = snprintf(nextra, remaining, " ql_avg_node:%.2f", avg);
             nextra += used;
             remaining -= used;
-            /* Add quicklist fill level / max ziplist size */
-            used = snprintf(nextra, remaining, " ql_ziplist_max:%d", ql->fill);
+            /* Add quicklist fill level / max listpack size */
+            used = snprintf(nextra, remaining, " ql_listpack_max:%d", ql->fill);
             nextra += used;
             remaining -= used;
             /* Add isCompressed? */
@@ -435,6 +447,7 @@ NULL
             (void*)val, val->refcount,
             strenc, rdbSavedObjectLen(val),
             val->lru, estimateObjectIdleTime(val)/1000, extra);
+        if (inlined) decrRefCount(val);
     } else if (!strcasecmp(c->argv[1]->ptr,"sdslen") && c->argc == 3) {
         dictEntry *de;
         robj *val;
@@ -447,7 +460,9 @@ NULL
         val = dictGetVal(de);
         key = dictGetKey(de);
 
-        if (val->type != OBJ_STRING || !sdsEncodedObject(val)) {
+        if (objIsInline(val) || val->type != OBJ_STRING ||
+            !sdsEncodedObject(val))
+        {
             addReplyError(c,"Not an sds encoded string.");
         } else {
             addReplyStatusFormat(c,
@@ -462,9 +477,10 @@ NULL
         }
     } else if (!strcasecmp(c->argv[1]->ptr,"ziplist") && c->argc == 3) {
         robj *o;
+        int inlined;
 
-        if ((o = objectCommandLookupOrReply(c,c->argv[2],shared.nokeyerr))
-                == NULL) return;
+        if ((o = objectCommandLookupOrReply(c,c->argv[2],shared.nokeyerr,
+                &inlined)) == NULL) return;
 
         if (o->encoding != OBJ_ENCODING_ZIPLIST) {
             addReplyError(c,"Not an sds encoded string.");
@@ -472,6 +488,7 @@ NULL
             ziplistRepr(o->ptr);
             addReplyStatus(c,"Ziplist structure printed on stdout");
         }
+        if (inlined) decrRefCount(o);
     } else if (!strcasecmp(c->argv[1]->ptr,"populate") &&
                c->argc >= 3 && c->argc <= 5) {
         long keys, j;
@@ -590,9 +607,10 @@ NULL
     } else if (!strcasecmp(c->argv[1]->ptr,"htstats-key") && c->argc == 3) {
         robj *o;
         dict *ht = NULL;
+        int inlined;
 
-        if ((o = objectCommandLookupOrReply(c,c->argv[2],shared.nokeyerr))
-                == NULL) return;
+        if ((o = objectCommandLookupOrReply(c,c->argv[2],shared.nokeyerr,
+                &inlined)) == NULL) return;
 
         /* Get the hash table reference from the object, if possible. */
         switch (o->encoding) {
@@ -615,6 +633,39 @@ NULL
             dictGetStats(buf,sizeof(buf),ht);
             addReplyBulkCString(c,buf);
         }
+        if (inlined) decrRefCount(o);
+    } else if (!strcasecmp(c->argv[1]->ptr,"keymem-check") && c->argc == 2) {
+        dictIterator *di = dictGetIterator(c->db->dict);
+        dictEntry *de;
+        void *replylen = addDeferredMultiBulkLength(c);
+        long long total = 0, numreplies = 0;
+
+        if (!server.key_memory_tracking) {
+            dictReleaseIterator(di);
+            setDeferredMultiBulkLength(c,replylen,0);
+            return;
+        }
+        keymemCron(1); /* Measure the keys not measured yet. */
+        while((de = dictNext(di)) != NULL) {
+            sds key = dictGetKey(de);
+            long long tracked = keymemGetSize(c->db,key);
+            long long actual = objectAllocSize(dictGetVal(de));
+
+            total += actual;
+            if (tracked == actual) continue;
+            addReplyBulkCBuffer(c,key,sdslen(key));
+            addReplyLongLong(c,tracked);
+            addReplyLongLong(c,actual);
+            numreplies += 3;
+        }
+        dictReleaseIterator(di);
+        if (total != c->db->used_memory) {
+            addReplyBulkCString(c,"(total)");
+            addReplyLongLong(c,c->db->used_memory);
+            addReplyLongLong(c,total);
+            numreplies += 3;
+        }
+        setDeferredMultiBulkLength(c,replylen,numreplies);
     } else if (!strcasecmp(c->argv[1]->ptr,"change-repl-id") && c->argc == 2) {
         serverLog(LL_WARNING,"Changing replication IDs after receiving DEBUG change-repl-id");
         changeReplicationId();
@@ -1143,8 +1194,12 @@ void logCurrentClient(void) {
         de = dictFind(cc->db->dict, key->ptr);
         if (de) {
             val = dictGetVal(de);
-            serverLog(LL_WARNING,"key '%s' found in DB containing the following object:", (char*)key->ptr);
-            serverLogObjectDebugInfo(val);
+            if (objIsInline(val)) {
+                serverLog(LL_WARNING,"key '%s' found in DB containing an inline small string value", (char*)key->ptr);
+            } else {
+                serverLog(LL_WARNING,"key '%s' found in DB containing the following object:", (char*)key->ptr);
+                serverLogObjectDebugInfo(val);
+            }
         }
         decrRefCount(key);
     }
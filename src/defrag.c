@@ -425,8 +425,8 @@ long activeDefragQuickListNodes(quicklist *ql) {
             node = newnode;
             defragged++;
         }
-        if ((newzl = activeDefragAlloc(node->zl)))
-            defragged++, node->zl = newzl;
+        if ((newzl = activeDefragAlloc(node->entry)))
+            defragged++, node->entry = newzl;
         node = node->next;
     }
     return defragged;
@@ -731,6 +731,8 @@ void* defragStreamConsumerGroup(raxIterator *ri, void *privdata, long *defragged
         *defragged += defragRadixTree(&cg->consumers, 0, defragStreamConsumer, cg);
     if (cg->pel)
         *defragged += defragRadixTree(&cg->pel, 0, NULL, NULL);
+    if (cg->pel_by_time)
+        *defragged += defragRadixTree(&cg->pel_by_time, 0, NULL, NULL);
     return NULL;
 }
 
@@ -754,6 +756,11 @@ long defragStream(redisDb *db, dictEntry *kde) {
 
     if (s->cgroups)
         defragged += defragRadixTree(&s->cgroups, 1, defragStreamConsumerGroup, NULL);
+    if (s->tail_fields) {
+        sds newsds = activeDefragSds(s->tail_fields);
+        if (newsds)
+            defragged++, s->tail_fields = newsds;
+    }
     return defragged;
 }
 
@@ -778,9 +785,16 @@ long defragKey(redisDb *db, dictEntry *de) {
         uint64_t hash = dictGetHash(db->dict, de->key);
         replaceSateliteDictKeyPtrAndOrDefragDictEntry(db->expires, keysds, newsds, hash, &defragged);
     }
+    /* The key memory tracking dict shares the key as well. */
+    if (dictSize(db->memory)) {
+        uint64_t hash = dictGetHash(db->dict, de->key);
+        replaceSateliteDictKeyPtrAndOrDefragDictEntry(db->memory, keysds, newsds, hash, &defragged);
+    }
 
-    /* Try to defrag robj and / or string value. */
+    /* Try to defrag robj and / or string value. Inline values have no
+     * allocation at all. */
     ob = dictGetVal(de);
+    if (objIsInline(ob)) return defragged;
     if ((newob = activeDefragStringOb(ob, &defragged))) {
         de->v.val = newob;
         ob = newob;
@@ -808,7 +822,7 @@ long defragKey(redisDb *db, dictEntry *de) {
             serverPanic("Unknown set encoding");
         }
     } else if (ob->type == OBJ_ZSET) {
-        if (ob->encoding == OBJ_ENCODING_ZIPLIST) {
+        if (ob->encoding == OBJ_ENCODING_LISTPACK) {
             if ((newzl = activeDefragAlloc(ob->ptr)))
                 defragged++, ob->ptr = newzl;
         } else if (ob->encoding == OBJ_ENCODING_SKIPLIST) {
@@ -817,7 +831,7 @@ long defragKey(redisDb *db, dictEntry *de) {
             serverPanic("Unknown sorted set encoding");
         }
     } else if (ob->type == OBJ_HASH) {
-        if (ob->encoding == OBJ_ENCODING_ZIPLIST) {
+        if (ob->encoding == OBJ_ENCODING_LISTPACK) {
             if ((newzl = activeDefragAlloc(ob->ptr)))
                 defragged++, ob->ptr = newzl;
         } else if (ob->encoding == OBJ_ENCODING_HT) {
@@ -897,7 +911,7 @@ long defragOtherGlobals() {
 /* returns 0 more work may or may not be needed (see non-zero cursor),
  * and 1 if time is up and more work is needed. */
 int defragLaterItem(dictEntry *de, unsigned long *cursor, long long endtime) {
-    if (de) {
+    if (de && !objIsInline(dictGetVal(de))) {
         robj *ob = dictGetVal(de);
         if (ob->type == OBJ_LIST) {
             server.stat_active_defrag_hits += scanLaterList(ob);
@@ -914,7 +928,7 @@ int defragLaterItem(dictEntry *de, unsigned long *cursor, long long endtime) {
             *cursor = 0; /* object type may have changed since we schedule it for later */
         }
     } else {
-        *cursor = 0; /* object may have been deleted already */
+        *cursor = 0; /* object may have been deleted or stored inline */
     }
     return 0;
 }
@@ -1024,10 +1038,10 @@ void computeDefragCycles() {
     }
 }
 
-/* Perform incremental defragmentation work from the serverCron.
- * This works in a similar way to activeExpireCycle, in the sense that
- * we do incremental work across calls. */
-void activeDefragCycle(void) {
+/* Perform incremental defragmentation work for at most 'timelimit'
+ * microseconds. This works in a similar way to activeExpireCycle, in the
+ * sense that we do incremental work across calls. */
+static void activeDefragStep(long long timelimit) {
     static int current_db = -1;
     static unsigned long cursor = 0;
     static redisDb *db = NULL;
@@ -1035,25 +1049,11 @@ void activeDefragCycle(void) {
     unsigned int iterations = 0;
     unsigned long long prev_defragged = server.stat_active_defrag_hits;
     unsigned long long prev_scanned = server.stat_active_defrag_scanned;
-    long long start, timelimit, endtime;
+    long long start, endtime;
     mstime_t latency;
     int quit = 0;
 
-    if (server.aof_child_pid!=-1 || server.rdb_child_pid!=-1)
-        return; /* Defragging memory while there's a fork will just do damage. */
-
-    /* Once a second, check if we the fragmentation justfies starting a scan
-     * or making it more aggressive. */
-    run_with_period(1000) {
-        computeDefragCycles();
-    }
-    if (!server.active_defrag_running)
-        return;
-
-    /* See activeExpireCycle for how timelimit is handled. */
     start = ustime();
-    timelimit = 1000000*server.active_defrag_running/server.hz/100;
-    if (timelimit <= 0) timelimit = 1;
     endtime = start + timelimit;
     latencyStartMonitor(latency);
 
@@ -1131,10 +1131,133 @@ void activeDefragCycle(void) {
     latencyAddSampleIfNeeded("active-defrag-cycle",latency);
 }
 
+/* ----------------------------------------------------------------------------
+ * Defrag thread
+ *
+ * With "active-defrag-thread" enabled the defragmentation work is performed
+ * by a thread of its own instead of serverCron(), so that it no longer eats
+ * the time budget of the main thread. The thread moves the allocations only
+ * while holding the GIL used by the modules thread safe contexts, that the
+ * main thread releases in beforeSleep() and takes back in afterSleep(): so
+ * the defrag runs while the main thread is idle, and it never swaps a
+ * pointer while a command, or anything else in the main thread, uses it.
+ *
+ * The GIL is taken for at most ACTIVE_DEFRAG_THREAD_STEP microseconds at a
+ * time, which is the worst delay for the main thread when it wakes up, then
+ * the thread sleeps so that it stays within the CPU effort computed by
+ * computeDefragCycles().
+ *
+ * The main thread releases the GIL for the defrag thread only while there is
+ * defrag work for it (see activeDefragThreadNeedsGIL()). Otherwise, and in
+ * particular once active-defrag-thread is turned off, the thread stays
+ * parked waiting for the GIL, without using any CPU, and serverCron() does
+ * the work if needed. When modules release the GIL anyway the thread just
+ * finds nothing to do and goes back to wait.
+ *
+ * 碎片整理线程：持有GIL（主线程在beforeSleep中释放）时执行一小步，
+ * 避免占用主线程的时间预算，同时保证指针替换时主线程不会使用它们。
+ * --------------------------------------------------------------------------*/
+
+#define ACTIVE_DEFRAG_THREAD_STEP 500 /* Microseconds */
+#define ACTIVE_DEFRAG_THREAD_IDLE 100000 /* Microseconds */
+
+static pthread_t defrag_thread;
+static int defrag_thread_started = 0;
+
+static void *activeDefragThreadMain(void *arg) {
+    int arena = (long)arg;
+    sigset_t sigset;
+
+    /* Block SIGALRM so we are sure that only the main thread will
+     * receive the watchdog signal. */
+    sigemptyset(&sigset);
+    sigaddset(&sigset, SIGALRM);
+    if (pthread_sigmask(SIG_BLOCK, &sigset, NULL))
+        serverLog(LL_WARNING,
+            "Warning: can't mask SIGALRM in defrag thread: %s", strerror(errno));
+
+    /* The moved allocations must go to the arena of the main thread. */
+    zmalloc_set_thread_arena(arena);
+
+    while(1) {
+        long long wait = ACTIVE_DEFRAG_THREAD_IDLE;
+
+        moduleAcquireGIL();
+        if (server.active_defrag_enabled && server.active_defrag_thread &&
+            server.active_defrag_running &&
+            server.aof_child_pid == -1 && server.rdb_child_pid == -1)
+        {
+            int effort = server.active_defrag_running;
+            long long start = ustime(), elapsed;
+
+            activeDefragStep(ACTIVE_DEFRAG_THREAD_STEP);
+            elapsed = ustime()-start;
+            wait = elapsed*(100-effort)/effort;
+            /* Always give the main thread a chance to take the GIL. */
+            if (wait < ACTIVE_DEFRAG_THREAD_STEP/10)
+                wait = ACTIVE_DEFRAG_THREAD_STEP/10;
+        }
+        moduleReleaseGIL();
+        usleep(wait);
+    }
+    return NULL;
+}
+
+/* Return true if the defrag thread has work to do: the main thread should
+ * release the GIL before sleeping. */
+int activeDefragThreadNeedsGIL(void) {
+    return defrag_thread_started && server.active_defrag_thread &&
+           server.active_defrag_enabled && server.active_defrag_running;
+}
+
+static void activeDefragThreadStart(void) {
+    void *arg = (void*)(long)zmalloc_get_thread_arena();
+
+    if (defrag_thread_started) return;
+    if (pthread_create(&defrag_thread,NULL,activeDefragThreadMain,arg) != 0) {
+        serverLog(LL_WARNING,
+            "Can't create the defrag thread, defragmenting in serverCron().");
+        server.active_defrag_thread = 0;
+        return;
+    }
+    defrag_thread_started = 1;
+}
+
+/* Called by serverCron() when active defrag is enabled. */
+void activeDefragCycle(void) {
+    long long timelimit;
+
+    if (server.aof_child_pid!=-1 || server.rdb_child_pid!=-1)
+        return; /* Defragging memory while there's a fork will just do damage. */
+
+    /* Once a second, check if we the fragmentation justfies starting a scan
+     * or making it more aggressive. */
+    run_with_period(1000) {
+        computeDefragCycles();
+    }
+
+    /* The work is done by the defrag thread if enabled. */
+    if (server.active_defrag_thread) {
+        activeDefragThreadStart();
+        if (server.active_defrag_thread) return;
+    }
+    if (!server.active_defrag_running)
+        return;
+
+    /* See activeExpireCycle for how timelimit is handled. */
+    timelimit = 1000000*server.active_defrag_running/server.hz/100;
+    if (timelimit <= 0) timelimit = 1;
+    activeDefragStep(timelimit);
+}
+
 #else /* HAVE_DEFRAG */
 
 void activeDefragCycle(void) {
     /* Not implemented yet. */
 }
 
+int activeDefragThreadNeedsGIL(void) {
+    return 0;
+}
+
 #endif
@@ -151,6 +151,18 @@ void evictionPoolAlloc(void) {
     EvictionPoolLRU = ep;
 }
 
+/* Return the number of bytes evicting the key would free. The size of the
+ * value is the one tracked when key-memory-tracking is enabled, otherwise
+ * it is estimated sampling a few elements of aggregate values. */
+static unsigned long long evictionKeySize(int dbid, sds key, robj *o) {
+    long long size = -1;
+
+    if (server.key_memory_tracking)
+        size = keymemGetSize(server.db+dbid,key);
+    if (size == -1) size = objectComputeSize(o,OBJ_COMPUTE_SIZE_DEF_SAMPLES);
+    return size + sdsZmallocSize(key) + sizeof(dictEntry);
+}
+
 /* This is an helper function for freeMemoryIfNeeded(), it is used in order
  * to populate the evictionPool with a few entries every time we want to
  * expire a key. Keys with idle time smaller than one of the current
@@ -179,7 +191,10 @@ void evictionPoolPopulate(int dbid, dict *sampledict, dict *keydict, struct evic
          * again in the key dictionary to obtain the value object. */
         if (server.maxmemory_policy != MAXMEMORY_VOLATILE_TTL) {
             if (sampledict != keydict) de = dictFind(keydict, key);
-            o = dictGetVal(de);
+            /* Values stored inline before the policy was switched to one
+             * that needs the access time get their object back here. Having
+             * no access time, they start to age from now. */
+            o = dbGetValue(server.db+dbid,de);
         }
 
         /* Calculate the idle time according to the policy. This is called
@@ -187,6 +202,12 @@ void evictionPoolPopulate(int dbid, dict *sampledict, dict *keydict, struct evic
          * just a score where an higher score means better candidate. */
         if (server.maxmemory_policy & MAXMEMORY_FLAG_LRU) {
             idle = estimateObjectIdleTime(o);
+        } else if (server.maxmemory_policy & MAXMEMORY_FLAG_SIZE) {
+            /* With the size aware policies we evict first the keys using
+             * more memory per access: the freed bytes divided by the
+             * accesses estimated from the LFU counter. */
+            idle = (evictionKeySize(dbid,key,o) << 16) /
+                   LFUEstimateAccesses(LFUDecrAndReturn(o));
         } else if (server.maxmemory_policy & MAXMEMORY_FLAG_LFU) {
             /* When we use an LRU policy, we sort the keys by idle time
              * so that we expire keys starting from greater idle time.
@@ -343,6 +364,19 @@ unsigned long LFUDecrAndReturn(robj *o) {
     return counter;
 }
 
+/* Estimate the number of accesses that brought the logarithmic counter to
+ * its current value, inverting LFULogIncr(): on average going from
+ * LFU_INIT_VAL+n to LFU_INIT_VAL+n+1 requires n*lfu_log_factor+1 accesses.
+ * Counters below LFU_INIT_VAL, decayed since nobody accessed the key,
+ * count as a fraction of an access, so the result is scaled by
+ * LFU_INIT_VAL+1 in order to always return an integer >= 1. */
+unsigned long long LFUEstimateAccesses(unsigned long counter) {
+    if (counter <= LFU_INIT_VAL) return counter+1;
+    unsigned long long n = counter - LFU_INIT_VAL;
+    unsigned long long accesses = n + server.lfu_log_factor*n*(n-1)/2;
+    return (LFU_INIT_VAL+1)*(accesses+1);
+}
+
 /* ----------------------------------------------------------------------------
  * The external API for eviction: freeMemroyIfNeeded() is called by the
  * server when there is data to add in order to make space if needed.
@@ -436,38 +470,56 @@ int getMaxmemoryState(size_t *total, size_t *logical, size_t *tofree, float *lev
     return C_ERR;
 }
 
-/* This function is periodically called to see if there is memory to free
- * according to the current "maxmemory" settings. In case we are over the
- * memory limit, the function will try to free some memory to return back
- * under the limit.
- *
- * The function returns C_OK if we are under the memory limit or if we
- * were over the limit, but the attempt to free memory was successful.
- * Otehrwise if we are over the memory limit, but not enough memory
- * was freed to return back under the limit, the function returns C_ERR. */
-int freeMemoryIfNeeded(void) {
-    /* By default replicas should ignore maxmemory
-     * and just be masters exact copies. */
-    if (server.masterhost && server.repl_slave_ignore_maxmemory) return C_OK;
-
-    size_t mem_reported, mem_tofree, mem_freed;
-    mstime_t latency, eviction_latency;
-    long long delta;
-    int slaves = listLength(server.slaves);
+/* Return the memory used from the point of view of the maxmemory directive,
+ * that is, without the slaves output buffers and the AOF buffers. */
+static size_t evictionLogicalMemory(void) {
+    size_t used = zmalloc_used_memory();
+    size_t overhead = freeMemoryGetNotCountedMemory();
+    return (used > overhead) ? used-overhead : 0;
+}
 
-    /* When clients are paused the dataset should be static not just from the
-     * POV of clients not being able to write, but also from the POV of
-     * expires and evictions of keys not being performed. */
-    if (clientsArePaused()) return C_OK;
-    if (getMaxmemoryState(&mem_reported,NULL,&mem_tofree,NULL) == C_OK)
-        return C_OK;
+/* Return the memory level background eviction tries to stay under. */
+static size_t evictionLowWatermark(void) {
+    return (size_t)((double)server.maxmemory/100*server.maxmemory_low_watermark);
+}
 
-    mem_freed = 0;
+/* Return the amount of memory the server is over its eviction target: the
+ * low watermark if background eviction is enabled, maxmemory otherwise.
+ * Reported as "eviction_lag_bytes" by INFO. */
+size_t evictionLag(void) {
+    if (!server.maxmemory) return 0;
+    size_t target = server.maxmemory_background_eviction ?
+                    evictionLowWatermark() : server.maxmemory;
+    size_t used = evictionLogicalMemory();
+    return (used > target) ? used-target : 0;
+}
 
-    if (server.maxmemory_policy == MAXMEMORY_NO_EVICTION)
-        goto cant_free; /* We need to free memory, but policy forbids. */
+/* Return values of evictKeys(). */
+#define EVICT_OK 0      /* The requested amount of memory was released. */
+#define EVICT_TIMEOUT 1 /* The time limit was reached. */
+#define EVICT_FAIL 2    /* There are no more keys to evict. */
+
+/* Evict keys according to the maxmemory policy until 'mem_tofree' bytes
+ * are released, or until the memory (as returned by evictionLogicalMemory())
+ * drops under 'target' when the deletions happen in the lazyfree thread.
+ *
+ * If 'timelimit' is not zero the function returns EVICT_TIMEOUT after
+ * evicting keys for about 'timelimit' microseconds. If 'lazy' is true the
+ * values are released with dbAsyncDelete().
+ *
+ * The amount of memory released by the deletions is stored in '*freed',
+ * and the time spent deleting is removed from the caller 'latency' event
+ * since it is reported separately as "eviction-del". */
+static int evictKeys(size_t target, size_t mem_tofree, long long timelimit,
+                     int lazy, size_t *freed, mstime_t *latency)
+{
+    size_t mem_freed = 0;
+    mstime_t eviction_latency;
+    long long delta, start = timelimit ? ustime() : 0;
+    int slaves = listLength(server.slaves);
+    int retval = EVICT_OK;
+    unsigned long evicted = 0;
 
-    latencyStartMonitor(latency);
     while (mem_freed < mem_tofree) {
         int j, k, i, keys_freed = 0;
         static unsigned int next_db = 0;
@@ -555,7 +607,7 @@ int freeMemoryIfNeeded(void) {
         if (bestkey) {
             db = server.db+bestdbid;
             robj *keyobj = createStringObject(bestkey,sdslen(bestkey));
-            propagateExpire(db,keyobj,server.lazyfree_lazy_eviction);
+            propagateExpire(db,keyobj,lazy);
             /* We compute the amount of memory freed by db*Delete() alone.
              * It is possible that actually the memory needed to propagate
              * the DEL in AOF and replication link is greater than the one
@@ -563,23 +615,28 @@ int freeMemoryIfNeeded(void) {
              * that otherwise we would never exit the loop.
              *
              * AOF and Output buffer memory will be freed eventually so
-             * we only care about memory used by the key space. */
-            delta = (long long) zmalloc_used_memory();
+             * we only care about memory used by the key space. The memory
+             * counter of this thread is used, so that the memory released
+             * meanwhile by the lazyfree threads is not mistaken for memory
+             * released by this eviction. */
+            delta = zmalloc_thread_used_memory();
             latencyStartMonitor(eviction_latency);
-            if (server.lazyfree_lazy_eviction)
+            if (lazy)
                 dbAsyncDelete(db,keyobj);
             else
                 dbSyncDelete(db,keyobj);
             latencyEndMonitor(eviction_latency);
             latencyAddSampleIfNeeded("eviction-del",eviction_latency);
-            latencyRemoveNestedEvent(latency,eviction_latency);
-            delta -= (long long) zmalloc_used_memory();
+            latencyRemoveNestedEvent(*latency,eviction_latency);
+            delta -= zmalloc_thread_used_memory();
             mem_freed += delta;
             server.stat_evictedkeys++;
             notifyKeyspaceEvent(NOTIFY_EVICTED, "evicted",
                 keyobj, db->id);
+            scriptResultCacheTouchKey(db,keyobj);
             decrRefCount(keyobj);
             keys_freed++;
+            evicted++;
 
             /* When the memory to free starts to be big enough, we may
              * start spending so much time here that is impossible to
@@ -594,28 +651,102 @@ int freeMemoryIfNeeded(void) {
              * memory, since the "mem_freed" amount is computed only
              * across the dbAsyncDelete() call, while the thread can
              * release the memory all the time. */
-            if (server.lazyfree_lazy_eviction && !(keys_freed % 16)) {
-                if (getMaxmemoryState(NULL,NULL,NULL,NULL) == C_OK) {
+            if (lazy && !(evicted % 16)) {
+                lazyfreeFlushBatch();
+                if (evictionLogicalMemory() <= target) {
                     /* Let's satisfy our stop condition. */
                     mem_freed = mem_tofree;
                 }
             }
+
+            /* Checking the time every 16 keys is enough: a single eviction
+             * is cheap unless the value is big and it is freed in place. */
+            if (timelimit && mem_freed < mem_tofree && !(evicted % 16) &&
+                ustime()-start > timelimit)
+            {
+                retval = EVICT_TIMEOUT;
+                break;
+            }
         }
 
         if (!keys_freed) {
-            latencyEndMonitor(latency);
-            latencyAddSampleIfNeeded("eviction-cycle",latency);
-            goto cant_free; /* nothing to free... */
+            retval = EVICT_FAIL; /* nothing to free... */
+            break;
         }
     }
+    *freed = mem_freed;
+    return retval;
+}
+
+/* This function is periodically called to see if there is memory to free
+ * according to the current "maxmemory" settings. In case we are over the
+ * memory limit, the function will try to free some memory to return back
+ * under the limit.
+ *
+ * When background eviction is enabled most of the work is performed by
+ * evictionCron(), so this is just a fallback for when the writes are faster
+ * than the cron: the keys are evicted lazily and for at most
+ * EVICTION_CMD_TIME_LIMIT microseconds, after that the command is executed
+ * anyway and the cron will continue the work. However if the memory is still
+ * over maxmemory plus "maxmemory-hard-margin" percent C_ERR is returned, so
+ * that the commands that may use more memory are refused.
+ *
+ * The function returns C_OK if we are under the memory limit or if we
+ * were over the limit, but the attempt to free memory was successful
+ * (or is still in progress, see above).
+ * Otehrwise if we are over the memory limit, but not enough memory
+ * was freed to return back under the limit, the function returns C_ERR. */
+int freeMemoryIfNeeded(void) {
+    /* By default replicas should ignore maxmemory
+     * and just be masters exact copies. */
+    if (server.masterhost && server.repl_slave_ignore_maxmemory) return C_OK;
+
+    size_t mem_reported, mem_tofree, mem_freed;
+    mstime_t latency;
+    long long start, elapsed;
+    int background = server.maxmemory_background_eviction, retval;
+
+    /* When clients are paused the dataset should be static not just from the
+     * POV of clients not being able to write, but also from the POV of
+     * expires and evictions of keys not being performed. */
+    if (clientsArePaused()) return C_OK;
+    if (getMaxmemoryState(&mem_reported,NULL,&mem_tofree,NULL) == C_OK)
+        return C_OK;
+
+    mem_freed = 0;
+
+    if (server.maxmemory_policy == MAXMEMORY_NO_EVICTION)
+        goto cant_free; /* We need to free memory, but policy forbids. */
+
+    latencyStartMonitor(latency);
+    start = ustime();
+    retval = evictKeys(server.maxmemory,mem_tofree,
+                       background ? EVICTION_CMD_TIME_LIMIT : 0,
+                       server.lazyfree_lazy_eviction || background,
+                       &mem_freed,&latency);
+    elapsed = ustime()-start;
+    server.stat_eviction_cmd_count++;
+    server.stat_eviction_cmd_time += elapsed;
+    if (elapsed > server.stat_eviction_cmd_max_time)
+        server.stat_eviction_cmd_max_time = elapsed;
     latencyEndMonitor(latency);
     latencyAddSampleIfNeeded("eviction-cycle",latency);
+    if (retval == EVICT_FAIL) goto cant_free;
+    if (retval == EVICT_TIMEOUT) {
+        /* The memory released by the lazyfree threads counts here, so
+         * the memory used is checked again instead of using mem_freed. */
+        size_t ceiling = server.maxmemory +
+            (size_t)((double)server.maxmemory/100*server.maxmemory_hard_margin);
+        lazyfreeFlushBatch();
+        if (evictionLogicalMemory() > ceiling) return C_ERR;
+    }
     return C_OK;
 
 cant_free:
     /* We are here if we are not able to reclaim memory. There is only one
      * last thing we can try: check if the lazyfree thread has jobs in queue
      * and wait... */
+    lazyfreeFlushBatch();
     while(bioPendingJobsOfType(BIO_LAZY_FREE)) {
         if (((mem_reported - zmalloc_used_memory()) + mem_freed) >= mem_tofree)
             break;
@@ -635,3 +766,38 @@ int freeMemoryIfNeededAndSafe(void) {
     if (server.lua_timedout || server.loading) return C_OK;
     return freeMemoryIfNeeded();
 }
+
+/* Background eviction, called by serverCron() at every cycle when
+ * "maxmemory-background-eviction" is enabled. Instead of waiting for the
+ * memory to reach the limit and evict in the command path, the keys are
+ * evicted ahead of time until the memory drops under the low watermark
+ * ("maxmemory-low-watermark" percent of maxmemory), using at most
+ * EVICTION_CRON_TIME_PERC percent of the CPU time. The values are always
+ * released by the lazyfree thread, so that a big key can't block the
+ * server here either.
+ *
+ * 后台淘汰：在 serverCron 中按时间预算把内存降到低水位以下，
+ * 命令路径中只保留一个有时间上限的兜底淘汰。 */
+void evictionCron(void) {
+    if (!server.maxmemory || !server.maxmemory_background_eviction) return;
+    if (server.maxmemory_policy == MAXMEMORY_NO_EVICTION) return;
+    if (server.masterhost && server.repl_slave_ignore_maxmemory) return;
+    if (clientsArePaused() || server.lua_timedout || server.loading) return;
+
+    size_t target = evictionLowWatermark();
+    size_t used = evictionLogicalMemory();
+    size_t mem_freed;
+    if (used <= target) return;
+
+    long long timelimit = 1000000*EVICTION_CRON_TIME_PERC/server.hz/100;
+    long long evicted = server.stat_evictedkeys;
+    long long start = ustime();
+    mstime_t latency;
+
+    latencyStartMonitor(latency);
+    evictKeys(target,used-target,timelimit,1,&mem_freed,&latency);
+    latencyEndMonitor(latency);
+    latencyAddSampleIfNeeded("eviction-cron",latency);
+    server.stat_eviction_cron_time += ustime()-start;
+    server.stat_evictedkeys_background += server.stat_evictedkeys-evicted;
+}
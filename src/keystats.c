@@ -0,0 +1,332 @@
+/* Keyspace statistics: hot keys and big keys detection.
+ *
+ * Finding hot keys and big keys from the outside requires scanning the
+ * whole keyspace, that adds load exactly when the server is in trouble and
+ * returns an answer too late. Here the server keeps the information itself,
+ * sampling the key lookups so that the cost is negligible:
+ *
+ * 1) One key lookup every "keystats-sample-ratio" (on average, the exact
+ *    interval is randomized so that periodic access patterns can't hide from
+ *    the sampler) is counted into a count-min sketch. The keys with the
+ *    highest estimated count are kept into a small min-heap, so that a new
+ *    key enters the top-K only when its count is greater than the count of
+ *    the smallest element. Every second all the counters are halved, so the
+ *    counts track the recent access rate and not the all time popularity.
+ *
+ * 2) The size of every sampled key, plus the size of a few random keys every
+ *    cron cycle (so that big keys that are rarely accessed are found as
+ *    well), is estimated with objectComputeSize() and the biggest keys are
+ *    kept into another min-heap.
+ *
+ * Both the lists are returned instantly by the KEYSTATS command.
+ *
+ * 键空间统计：通过对 lookupKey 采样，维护热 key（count-min sketch + 最小堆）
+ * 和大 key（objectComputeSize 估算 + 最小堆）的 top-K 列表。
+ */
+
+#include "server.h"
+
+#define KEYSTATS_TOPK 32            /* Number of hot / big keys remembered. */
+#define KEYSTATS_CMS_DEPTH 4        /* Count-min sketch rows. */
+#define KEYSTATS_CMS_WIDTH 2048     /* Count-min sketch counters per row. */
+#define KEYSTATS_CRON_SAMPLES 3     /* Random keys sized per DB every cron. */
+
+typedef struct keystatsEntry {
+    sds key;
+    int dbid;
+    uint64_t value;     /* Access count for hot keys, bytes for big keys. */
+} keystatsEntry;
+
+/* A min-heap of at most KEYSTATS_TOPK entries ordered by value. */
+typedef struct keystatsTop {
+    keystatsEntry e[KEYSTATS_TOPK];
+    int len;
+} keystatsTop;
+
+static uint32_t cms[KEYSTATS_CMS_DEPTH][KEYSTATS_CMS_WIDTH];
+static keystatsTop hotkeys, bigkeys;
+
+/* ----------------------------------------------------------------------------
+ * Top-K min-heap
+ * --------------------------------------------------------------------------*/
+
+static void keystatsSwap(keystatsTop *t, int a, int b) {
+    keystatsEntry tmp = t->e[a];
+    t->e[a] = t->e[b];
+    t->e[b] = tmp;
+}
+
+static void keystatsSiftUp(keystatsTop *t, int i) {
+    while (i > 0) {
+        int parent = (i-1)/2;
+        if (t->e[parent].value <= t->e[i].value) break;
+        keystatsSwap(t,parent,i);
+        i = parent;
+    }
+}
+
+static void keystatsSiftDown(keystatsTop *t, int i) {
+    while (1) {
+        int min = i, l = i*2+1, r = i*2+2;
+        if (l < t->len && t->e[l].value < t->e[min].value) min = l;
+        if (r < t->len && t->e[r].value < t->e[min].value) min = r;
+        if (min == i) break;
+        keystatsSwap(t,min,i);
+        i = min;
+    }
+}
+
+/* The heap is tiny, a linear scan is faster than maintaining an index. */
+static int keystatsFind(keystatsTop *t, int dbid, sds key) {
+    for (int j = 0; j < t->len; j++) {
+        if (t->e[j].dbid == dbid && sdscmp(t->e[j].key,key) == 0) return j;
+    }
+    return -1;
+}
+
+/* Remove the element at position 'i', fixing the heap. */
+static void keystatsRemove(keystatsTop *t, int i) {
+    sdsfree(t->e[i].key);
+    t->len--;
+    if (i == t->len) return;
+    t->e[i] = t->e[t->len];
+    keystatsSiftDown(t,i);
+    keystatsSiftUp(t,i);
+}
+
+/* Set the value of the specified key, adding it to the heap if there is
+ * still room or if its value is greater than the smallest one. */
+static void keystatsUpdate(keystatsTop *t, int dbid, sds key, uint64_t value) {
+    int i = keystatsFind(t,dbid,key);
+
+    if (i != -1) {
+        t->e[i].value = value;
+    } else if (t->len < KEYSTATS_TOPK) {
+        i = t->len++;
+        t->e[i].key = sdsdup(key);
+        t->e[i].dbid = dbid;
+        t->e[i].value = value;
+    } else if (value > t->e[0].value) {
+        i = 0;
+        sdsfree(t->e[0].key);
+        t->e[0].key = sdsdup(key);
+        t->e[0].dbid = dbid;
+        t->e[0].value = value;
+    } else {
+        return;
+    }
+    keystatsSiftDown(t,i);
+    keystatsSiftUp(t,i);
+}
+
+static void keystatsClear(keystatsTop *t) {
+    for (int j = 0; j < t->len; j++) sdsfree(t->e[j].key);
+    t->len = 0;
+}
+
+/* ----------------------------------------------------------------------------
+ * Sampling
+ * --------------------------------------------------------------------------*/
+
+/* Count an access to the key into the sketch and return its estimated
+ * count. We use the "conservative update" variant: only the counters
+ * having the minimum value are incremented, which greatly reduces the
+ * overestimation of the keys colliding with hot keys. The row indexes are
+ * derived from a single 64 bit hash (double hashing). */
+static uint64_t keystatsCount(int dbid, sds key) {
+    uint64_t hash = dictGenHashFunction(key,sdslen(key));
+    uint32_t h1 = hash & 0xffffffff;
+    uint32_t h2 = (hash >> 32) ^ ((uint32_t)dbid * 0x9e3779b9);
+    uint32_t *counters[KEYSTATS_CMS_DEPTH];
+    uint32_t min = UINT32_MAX;
+
+    for (int j = 0; j < KEYSTATS_CMS_DEPTH; j++) {
+        counters[j] = &cms[j][(h1 + j*h2) % KEYSTATS_CMS_WIDTH];
+        if (*counters[j] < min) min = *counters[j];
+    }
+    if (min == UINT32_MAX) return min;
+    for (int j = 0; j < KEYSTATS_CMS_DEPTH; j++)
+        if (*counters[j] == min) (*counters[j])++;
+    return min+1;
+}
+
+static void keystatsSampleSize(redisDb *db, sds key, robj *val) {
+    size_t size = sdsZmallocSize(key);
+
+    /* Inline values are too small to be big keys anyway. */
+    if (objIsInline(val)) return;
+    size += objectComputeSize(val,OBJ_COMPUTE_SIZE_DEF_SAMPLES);
+    keystatsUpdate(&bigkeys,db->id,key,size);
+}
+
+/* Called by lookupKey() when the sampling countdown reaches zero: count
+ * the access and size the value, then schedule the next sample. Note that
+ * 'key' must be the key stored in the dictionary, as it gets sized. */
+void keystatsSampleLookup(redisDb *db, sds key, robj *val) {
+    long long ratio = server.keystats_sample_ratio;
+
+    server.keystats_countdown = ratio > 1 ? 1 + random() % (ratio*2-1) : 1;
+    keystatsUpdate(&hotkeys,db->id,key,keystatsCount(db->id,key));
+    keystatsSampleSize(db,key,val);
+}
+
+/* Called every 100 milliseconds by serverCron(). The sketch and the hot
+ * keys counts are halved every second, and a few random keys of every DB
+ * are sized so that big keys are discovered even if nobody touches them. */
+void keystatsCron(void) {
+    if (server.keystats_sample_ratio == 0) return;
+
+    run_with_period(1000) {
+        for (int j = 0; j < KEYSTATS_CMS_DEPTH; j++)
+            for (int i = 0; i < KEYSTATS_CMS_WIDTH; i++)
+                cms[j][i] >>= 1;
+        /* Halving all the values keeps the heap property, and the keys
+         * that dropped to zero are all at the top of the heap. */
+        for (int j = 0; j < hotkeys.len; j++) hotkeys.e[j].value >>= 1;
+        while (hotkeys.len && hotkeys.e[0].value == 0)
+            keystatsRemove(&hotkeys,0);
+    }
+
+    for (int j = 0; j < server.dbnum; j++) {
+        redisDb *db = server.db+j;
+        if (dictSize(db->dict) == 0) continue;
+        for (int i = 0; i < KEYSTATS_CRON_SAMPLES; i++) {
+            dictEntry *de = dictGetRandomKey(db->dict);
+            keystatsSampleSize(db,dictGetKey(de),dictGetVal(de));
+        }
+    }
+}
+
+void keystatsReset(void) {
+    memset(cms,0,sizeof(cms));
+    keystatsClear(&hotkeys);
+    keystatsClear(&bigkeys);
+}
+
+/* ----------------------------------------------------------------------------
+ * KEYSTATS command
+ * --------------------------------------------------------------------------*/
+
+/* qsort() has no context argument: the entries the indexes refer to. */
+static keystatsEntry *keystatsSortIdx;
+
+static int keystatsCompareIdxDesc(const void *a, const void *b) {
+    const keystatsEntry *ea = keystatsSortIdx + *(const int*)a,
+                        *eb = keystatsSortIdx + *(const int*)b;
+    if (ea->value == eb->value) return 0;
+    return ea->value < eb->value ? 1 : -1;
+}
+
+/* KEYSTATS HOT [COUNT <count>]
+ * KEYSTATS BIG [COUNT <count>]
+ * KEYSTATS RESET */
+void keystatsCommand(client *c) {
+    if (c->argc == 2 && !strcasecmp(c->argv[1]->ptr,"help")) {
+        const char *help[] = {
+"HOT [COUNT <count>] -- Return the most accessed keys with their estimated ops/sec.",
+"BIG [COUNT <count>] -- Return the biggest keys seen with their estimated size.",
+"RESET -- Forget the collected statistics.",
+NULL
+        };
+        addReplyHelp(c, help);
+    } else if (c->argc == 2 && !strcasecmp(c->argv[1]->ptr,"reset")) {
+        keystatsReset();
+        addReply(c,shared.ok);
+    } else if ((c->argc == 2 || c->argc == 4) &&
+               (!strcasecmp(c->argv[1]->ptr,"hot") ||
+                !strcasecmp(c->argv[1]->ptr,"big")))
+    {
+        int hot = !strcasecmp(c->argv[1]->ptr,"hot");
+        keystatsTop *t = hot ? &hotkeys : &bigkeys;
+        keystatsEntry sorted[KEYSTATS_TOPK];
+        long count = 10;
+
+        if (c->argc == 4) {
+            if (strcasecmp(c->argv[2]->ptr,"count")) {
+                addReply(c,shared.syntaxerr);
+                return;
+            }
+            if (getLongFromObjectOrReply(c,c->argv[3],&count,NULL) != C_OK)
+                return;
+            if (count < 1) {
+                addReplyError(c,"COUNT must be > 0");
+                return;
+            }
+        }
+
+        /* Big keys may have been deleted or changed since they were sized:
+         * drop the ones no longer existing and refresh the others. Both the
+         * operations would reorder the heap while we scan it, so we work on
+         * a copy of the entries and rebuild the heap from the survivors. */
+        char *types[KEYSTATS_TOPK];
+        int len = t->len;
+
+        memcpy(sorted,t->e,sizeof(keystatsEntry)*len);
+        if (!hot) {
+            int j, kept = 0;
+
+            for (j = 0; j < len; j++) {
+                keystatsEntry *e = sorted+j;
+                redisDb *db = server.db+e->dbid;
+                dictEntry *de = dictFind(db->dict,e->key);
+                robj *o = de ? dictGetVal(de) : NULL;
+
+                if (o == NULL) {
+                    sdsfree(e->key);
+                    continue;
+                }
+                /* Inline values live in the dictEntry: only the key counts.
+                 * Read lookups don't convert them into objects, so they may
+                 * have been sampled as objects. */
+                e->value = sdsZmallocSize(dictGetKey(de));
+                if (objIsInline(o)) {
+                    types[kept] = "string";
+                } else {
+                    e->value += objectComputeSize(o,OBJ_COMPUTE_SIZE_DEF_SAMPLES);
+                    types[kept] = getObjectTypeName(o);
+                }
+                sorted[kept++] = *e;
+            }
+            len = kept;
+            memcpy(t->e,sorted,sizeof(keystatsEntry)*len);
+            t->len = len;
+            for (j = len/2-1; j >= 0; j--) keystatsSiftDown(t,j);
+        }
+
+        /* Sort the copy, keeping every type next to its entry. */
+        int idx[KEYSTATS_TOPK];
+        for (int j = 0; j < len; j++) idx[j] = j;
+        keystatsSortIdx = sorted;
+        qsort(idx,len,sizeof(int),keystatsCompareIdxDesc);
+        if (count > len) count = len;
+
+        addReplyMultiBulkLen(c,count);
+        for (int j = 0; j < count; j++) {
+            keystatsEntry *e = sorted+idx[j];
+            if (hot) {
+                /* With the counters halved every second, a key sampled N
+                 * times per second converges to a count of 2*N. */
+                long long ratio = server.keystats_sample_ratio;
+                addReplyMultiBulkLen(c,6);
+                addReplyBulkCString(c,"db");
+                addReplyLongLong(c,e->dbid);
+                addReplyBulkCString(c,"key");
+                addReplyBulkCBuffer(c,e->key,sdslen(e->key));
+                addReplyBulkCString(c,"ops_per_sec");
+                addReplyLongLong(c,(e->value*(ratio ? ratio : 1)+1)/2);
+            } else {
+                addReplyMultiBulkLen(c,8);
+                addReplyBulkCString(c,"db");
+                addReplyLongLong(c,e->dbid);
+                addReplyBulkCString(c,"key");
+                addReplyBulkCBuffer(c,e->key,sdslen(e->key));
+                addReplyBulkCString(c,"type");
+                addReplyBulkCString(c,types[idx[j]]);
+                addReplyBulkCString(c,"bytes");
+                addReplyLongLong(c,e->value);
+            }
+        }
+    } else {
+        addReplySubcommandSyntaxError(c);
+    }
+}
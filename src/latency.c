@@ -558,6 +558,236 @@ sds latencyCommandGenSparkeline(char *event, struct latencyTimeSeries *ts) {
     return graph;
 }
 
+/* ---------------------- Latency histograms -------------------------------- */
+
+/* Return the histogram bucket for the value 'v'. Values smaller than
+ * 2^LATENCY_HIST_SUB_BITS have a bucket each, bigger values are indexed
+ * by their most significant bit, plus the LATENCY_HIST_SUB_BITS bits that
+ * follow it. */
+static int latencyHistogramIndex(uint64_t v) {
+    if (v < (1<<LATENCY_HIST_SUB_BITS)) return v;
+    int msb = 63 - __builtin_clzll(v);
+    int shift = msb - LATENCY_HIST_SUB_BITS;
+    return ((shift+1) << LATENCY_HIST_SUB_BITS) +
+           ((v >> shift) & ((1<<LATENCY_HIST_SUB_BITS)-1));
+}
+
+/* Return the highest value that falls into the bucket 'idx'. */
+static uint64_t latencyHistogramBucketMax(int idx) {
+    if (idx < (1<<LATENCY_HIST_SUB_BITS)) return idx;
+    int shift = (idx >> LATENCY_HIST_SUB_BITS) - 1;
+    uint64_t sub = idx & ((1<<LATENCY_HIST_SUB_BITS)-1);
+    uint64_t min = ((1ULL<<LATENCY_HIST_SUB_BITS) + sub) << shift;
+    return min + (1ULL<<shift) - 1;
+}
+
+/* Record 'usec' into the histogram pointed by 'hp', allocating it the
+ * first time: most commands are never called, so we don't want to pay
+ * the histogram memory for them. */
+void latencyHistogramRecord(latencyHistogram **hp, long long usec) {
+    latencyHistogram *h = *hp;
+    if (h == NULL) h = *hp = zcalloc(sizeof(*h));
+    if (usec < 0) usec = 0;
+    uint64_t v = usec;
+    if (v >= (1ULL<<LATENCY_HIST_MAX_BITS))
+        v = (1ULL<<LATENCY_HIST_MAX_BITS)-1;
+    h->buckets[latencyHistogramIndex(v)]++;
+    h->count++;
+    if (v > h->max) h->max = v;
+}
+
+/* Return the value at the specified percentile (0-100) of the histogram,
+ * that is the upper bound of the bucket where the percentile falls,
+ * capped to the max recorded value. */
+uint64_t latencyHistogramPercentile(latencyHistogram *h, double percentile) {
+    if (h == NULL || h->count == 0) return 0;
+    uint64_t rank = (uint64_t)((percentile/100)*h->count + 0.5);
+    if (rank == 0) rank = 1;
+    if (rank > h->count) rank = h->count;
+
+    uint64_t seen = 0;
+    for (int j = 0; j < LATENCY_HIST_BUCKETS; j++) {
+        seen += h->buckets[j];
+        if (seen >= rank) {
+            uint64_t v = latencyHistogramBucketMax(j);
+            return v < h->max ? v : h->max;
+        }
+    }
+    return h->max;
+}
+
+/* Append the percentiles we report in INFO for the histogram 'h' to the
+ * sds string 's', in the form p50=...,p99=...,p99.9=...,max=... */
+sds latencyHistogramCatPercentiles(sds s, latencyHistogram *h) {
+    return sdscatprintf(s,"p50=%llu,p99=%llu,p99.9=%llu,max=%llu",
+        (unsigned long long) latencyHistogramPercentile(h,50),
+        (unsigned long long) latencyHistogramPercentile(h,99),
+        (unsigned long long) latencyHistogramPercentile(h,99.9),
+        (unsigned long long) (h ? h->max : 0));
+}
+
+/* Reply with the non empty buckets of the histogram 'h', as a flat array
+ * of bucket upper bound and cumulative count pairs. */
+static void latencyCommandReplyWithHistogram(client *c, latencyHistogram *h) {
+    void *replylen = addDeferredMultiBulkLength(c);
+    long buckets = 0;
+    uint64_t seen = 0;
+    for (int j = 0; h && j < LATENCY_HIST_BUCKETS; j++) {
+        if (h->buckets[j] == 0) continue;
+        seen += h->buckets[j];
+        addReplyLongLong(c,latencyHistogramBucketMax(j));
+        addReplyLongLong(c,seen);
+        buckets++;
+    }
+    setDeferredMultiBulkLength(c,replylen,buckets*2);
+}
+
+/* Reply with the latency histograms of the command 'cmd', see the
+ * LATENCY HISTOGRAM command. */
+static void latencyCommandReplyWithCommandHistogram(client *c, struct redisCommand *cmd) {
+    addReplyBulkCString(c,cmd->name);
+    addReplyMultiBulkLen(c,6);
+    addReplyBulkCString(c,"calls");
+    addReplyLongLong(c,cmd->latency_hist ? cmd->latency_hist->count : 0);
+    addReplyBulkCString(c,"histogram_usec");
+    latencyCommandReplyWithHistogram(c,cmd->latency_hist);
+    addReplyBulkCString(c,"total_histogram_usec");
+    latencyCommandReplyWithHistogram(c,cmd->latency_total_hist);
+}
+
+/* ---------------------- Event loop phases profiler ------------------------ */
+
+static char *elPhaseNames[EL_PHASE_NUM] = {
+    "other", "poll", "read", "parse", "exec", "write", "cron", "expire",
+    "aof", "beforesleep"
+};
+
+/* Charge the time elapsed since the last phase switch to the current
+ * phase, and switch to 'phase'. The previous phase is returned, so that
+ * the caller can restore it with elPhaseRestore() once done:
+ *
+ *  int old_phase = elPhaseEnter(EL_PHASE_WRITE);
+ *  ... write ...
+ *  elPhaseRestore(old_phase);
+ *
+ * The "At" variants take the current time in microseconds, for callers
+ * that already have it, so that the profiling has no additional cost.
+ *
+ * When eventloop-profiling is disabled all these functions do nothing,
+ * without even calling ustime(). */
+int elPhaseEnterAt(int phase, long long now) {
+    int old_phase = server.el_phase;
+    if (!server.eventloop_profiling) return old_phase;
+    server.el_phases[old_phase].usec += now - server.el_phase_start;
+    server.el_phases[phase].calls++;
+    server.el_phase = phase;
+    server.el_phase_start = now;
+    return old_phase;
+}
+
+/* Like elPhaseEnterAt() but without counting a new call for 'phase',
+ * since we are returning to a phase already entered. */
+void elPhaseRestoreAt(int phase, long long now) {
+    if (!server.eventloop_profiling) return;
+    server.el_phases[server.el_phase].usec += now - server.el_phase_start;
+    server.el_phase = phase;
+    server.el_phase_start = now;
+}
+
+int elPhaseEnter(int phase) {
+    if (!server.eventloop_profiling) return server.el_phase;
+    return elPhaseEnterAt(phase,ustime());
+}
+
+void elPhaseRestore(int phase) {
+    if (!server.eventloop_profiling) return;
+    elPhaseRestoreAt(phase,ustime());
+}
+
+/* Called when the event loop returns from polling, once the modules GIL is
+ * acquired again: the time spent polling (and waiting for the GIL) is
+ * charged to the poll phase, and a new iteration starts. We remember
+ * the phases times at this point, so that if the iteration turns out to be
+ * slow we can tell in what phase the time was spent. */
+void elIterationStart(void) {
+    if (!server.eventloop_profiling) return;
+    long long now = ustime();
+    elPhaseRestoreAt(EL_PHASE_OTHER,now);
+    server.el_iterations++;
+    server.el_iteration_start = now;
+    for (int j = 0; j < EL_PHASE_NUM; j++)
+        server.el_iteration_usec[j] = server.el_phases[j].usec;
+}
+
+/* Called before the event loop goes polling again, at the end of
+ * beforeSleep() but before the modules GIL is released. If the iteration took more than the latency monitor
+ * threshold, it is logged as an "eventloop" latency event, together with
+ * "eventloop-<phase>" events for the phases that were above the threshold,
+ * and its breakdown by phase is logged at verbose level. */
+void elIterationEnd(void) {
+    if (!server.eventloop_profiling) return;
+    long long now = ustime();
+    elPhaseEnterAt(EL_PHASE_POLL,now);
+
+    if (server.el_iteration_start == 0 || !server.latency_monitor_threshold)
+        return;
+    mstime_t latency = (now - server.el_iteration_start)/1000;
+    if (latency < server.latency_monitor_threshold) return;
+
+    sds breakdown = sdsempty();
+    latencyAddSample("eventloop",latency);
+    for (int j = 0; j < EL_PHASE_NUM; j++) {
+        if (j == EL_PHASE_POLL) continue;
+        long long usec = server.el_phases[j].usec -
+                         server.el_iteration_usec[j];
+        if (usec == 0) continue;
+        char event[64];
+        snprintf(event,sizeof(event),"eventloop-%s",elPhaseNames[j]);
+        latencyAddSampleIfNeeded(event,usec/1000);
+        breakdown = sdscatprintf(breakdown," %s=%lld",elPhaseNames[j],usec);
+    }
+    serverLog(LL_VERBOSE,"Slow event loop iteration: %lld ms, usec by phase:%s",
+        (long long) latency, breakdown);
+    sdsfree(breakdown);
+}
+
+/* Turn the profiler on or off (CONFIG SET eventloop-profiling). When it is
+ * turned on we restart from a clean state: the phase recorded when it was
+ * turned off is stale, and the time elapsed since then should not be
+ * charged to it. The current iteration is not checked for slowness. */
+void elSetProfiling(int enabled) {
+    if (enabled && !server.eventloop_profiling) {
+        server.el_phase = EL_PHASE_OTHER;
+        server.el_phase_start = ustime();
+        server.el_iteration_start = 0;
+    }
+    server.eventloop_profiling = enabled;
+}
+
+/* Reset the phases statistics, as a result of CONFIG RESETSTAT. */
+void elResetStats(void) {
+    for (int j = 0; j < EL_PHASE_NUM; j++) {
+        server.el_phases[j].calls = 0;
+        server.el_phases[j].usec = 0;
+        server.el_iteration_usec[j] = 0;
+    }
+    server.el_iterations = 0;
+}
+
+/* Append the "eventloop" INFO section fields to 'info'. */
+sds elCatStatsInfoString(sds info) {
+    info = sdscatprintf(info,"eventloop_iterations:%lld\r\n",
+        server.el_iterations);
+    for (int j = 0; j < EL_PHASE_NUM; j++) {
+        struct elPhaseStats *ps = server.el_phases+j;
+        info = sdscatprintf(info,
+            "eventloop_phase_%s:calls=%lld,usec=%lld,usec_per_call=%.2f\r\n",
+            elPhaseNames[j], ps->calls, ps->usec,
+            (ps->calls == 0) ? 0 : ((float)ps->usec/ps->calls));
+    }
+    return info;
+}
+
 /* LATENCY command implementations.
  *
  * LATENCY HISTORY: return time-latency samples for the specified event.
@@ -565,6 +795,8 @@ sds latencyCommandGenSparkeline(char *event, struct latencyTimeSeries *ts) {
  * LATENCY DOCTOR: returns a human readable analysis of instance latency.
  * LATENCY GRAPH: provide an ASCII graph of the latency of the specified event.
  * LATENCY RESET: reset data of a specified event or all the data if no event provided.
+ * LATENCY HISTOGRAM: return the latency histograms of the specified commands
+ *                    or of all the commands called so far.
  */
 void latencyCommand(client *c) {
     const char *help[] = {
@@ -574,6 +806,9 @@ void latencyCommand(client *c) {
 "LATEST              -- Returns the latest latency samples for all events.",
 "RESET   [event ...] -- Resets latency data of one or more event classes.",
 "                       (default: reset all data for all event classes)",
+"HISTOGRAM [cmd ...] -- Returns the latency histograms of the commands.",
+"                       (default: all the commands called so far; use",
+"                       CONFIG RESETSTAT to reset them)",
 "HELP                -- Prints this help.",
 NULL
     };
@@ -621,6 +856,33 @@ NULL
                 resets += latencyResetEvent(c->argv[j]->ptr);
             addReplyLongLong(c,resets);
         }
+    } else if (!strcasecmp(c->argv[1]->ptr,"histogram") && c->argc >= 2) {
+        /* LATENCY HISTOGRAM [command ...] */
+        struct redisCommand *cmd;
+        if (c->argc == 2) {
+            void *replylen = addDeferredMultiBulkLength(c);
+            long count = 0;
+            dictEntry *de;
+            dictIterator *di = dictGetSafeIterator(server.commands);
+            while((de = dictNext(di)) != NULL) {
+                cmd = dictGetVal(de);
+                if (cmd->latency_hist == NULL) continue;
+                latencyCommandReplyWithCommandHistogram(c,cmd);
+                count++;
+            }
+            dictReleaseIterator(di);
+            setDeferredMultiBulkLength(c,replylen,count*2);
+        } else {
+            int j, count = 0;
+            void *replylen = addDeferredMultiBulkLength(c);
+            for (j = 2; j < c->argc; j++) {
+                cmd = dictFetchValue(server.commands,c->argv[j]->ptr);
+                if (cmd == NULL) continue;
+                latencyCommandReplyWithCommandHistogram(c,cmd);
+                count++;
+            }
+            setDeferredMultiBulkLength(c,replylen,count*2);
+        }
     } else if (!strcasecmp(c->argv[1]->ptr,"help") && c->argc >= 2) {
         addReplyHelp(c, help);
     } else {
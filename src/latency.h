@@ -61,9 +61,59 @@ struct latencyStats {
     time_t period;          /* Number of seconds since first event and now. */
 };
 
+/* Latency histograms, used to track the distribution of the execution time
+ * of every command. They are log-bucketed in the spirit of HDR histograms:
+ * every power of two is split into 2^LATENCY_HIST_SUB_BITS linear
+ * sub-buckets, so a value is known with a relative error of at most 12.5%,
+ * while recording it is just an array increment. Values are in microseconds
+ * and are clamped to 2^LATENCY_HIST_MAX_BITS-1 (about 19 hours). */
+#define LATENCY_HIST_SUB_BITS 3
+#define LATENCY_HIST_MAX_BITS 36
+#define LATENCY_HIST_BUCKETS \
+    ((LATENCY_HIST_MAX_BITS-LATENCY_HIST_SUB_BITS+1)<<LATENCY_HIST_SUB_BITS)
+
+typedef struct latencyHistogram {
+    uint64_t count;     /* Number of recorded values. */
+    uint64_t max;       /* Max recorded value. */
+    uint64_t buckets[LATENCY_HIST_BUCKETS];
+} latencyHistogram;
+
+/* Event loop phases. The time spent by the event loop is charged to the
+ * phase currently running, see elPhaseEnter(). Phases nest: the time spent
+ * in a nested phase (for instance executing a command while parsing the
+ * query buffer) is only charged to the nested phase. */
+#define EL_PHASE_OTHER 0        /* Anything not covered by other phases. */
+#define EL_PHASE_POLL 1         /* Waiting for events, that is idle time. */
+#define EL_PHASE_READ 2         /* Reading from clients sockets. */
+#define EL_PHASE_PARSE 3        /* Parsing the clients query buffers. */
+#define EL_PHASE_EXEC 4         /* Executing commands. */
+#define EL_PHASE_WRITE 5        /* Writing replies to clients sockets. */
+#define EL_PHASE_CRON 6         /* serverCron(). */
+#define EL_PHASE_EXPIRE 7       /* Active expire cycles. */
+#define EL_PHASE_AOF 8          /* Writing and fsyncing the AOF buffer. */
+#define EL_PHASE_BEFORESLEEP 9  /* The rest of beforeSleep(). */
+#define EL_PHASE_NUM 10
+
+struct elPhaseStats {
+    long long calls;    /* Number of times the phase was entered. */
+    long long usec;     /* Time spent in the phase, nested phases excluded. */
+};
+
 void latencyMonitorInit(void);
 void latencyAddSample(char *event, mstime_t latency);
 int THPIsEnabled(void);
+void latencyHistogramRecord(latencyHistogram **hp, long long usec);
+uint64_t latencyHistogramPercentile(latencyHistogram *h, double percentile);
+sds latencyHistogramCatPercentiles(sds s, latencyHistogram *h);
+int elPhaseEnterAt(int phase, long long now);
+void elPhaseRestoreAt(int phase, long long now);
+int elPhaseEnter(int phase);
+void elPhaseRestore(int phase);
+void elIterationStart(void);
+void elIterationEnd(void);
+void elSetProfiling(int enabled);
+void elResetStats(void);
+sds elCatStatsInfoString(sds info);
 
 /* Latency monitoring macros. */
 
@@ -6,6 +6,49 @@
 static size_t lazyfree_objects = 0;
 pthread_mutex_t lazyfree_objects_mutex = PTHREAD_MUTEX_INITIALIZER;
 
+/* The objects to release are not handed to the lazyfree threads one by one:
+ * they are accumulated into a batch that is queued as a single bio.c job
+ * when it is full, or before returning to the event loop, so that the job
+ * creation and the locking are paid once every LAZYFREE_BATCH_SIZE objects.
+ * Besides whole values, a batch may contain the fields of hashes and the
+ * nodes of sorted sets released by "lazyfree-lazy-member-del". */
+#define LAZYFREE_BATCH_SIZE 64
+#define LAZYFREE_ITEM_OBJ 0     /* decrRefCount() */
+#define LAZYFREE_ITEM_SDS 1     /* sdsfree() */
+#define LAZYFREE_ITEM_ZSLNODE 2 /* zslFreeNode() */
+
+typedef struct lazyfreeBatch {
+    int len;
+    struct {
+        int type;
+        void *ptr;
+    } items[LAZYFREE_BATCH_SIZE];
+} lazyfreeBatch;
+
+static lazyfreeBatch *lazyfree_batch = NULL;
+
+/* Queue the current batch, if any, to the lazyfree threads. */
+void lazyfreeFlushBatch(void) {
+    if (lazyfree_batch == NULL) return;
+    bioCreateBackgroundJob(BIO_LAZY_FREE,lazyfree_batch,NULL,NULL);
+    lazyfree_batch = NULL;
+}
+
+static void lazyfreeAddItem(int type, void *ptr) {
+    /* The batch is not part of the value the item was removed from. */
+    long long used = keymemValueIsOpen() ? zmalloc_thread_used_memory() : -1;
+
+    if (lazyfree_batch == NULL) {
+        lazyfree_batch = zmalloc(sizeof(*lazyfree_batch));
+        lazyfree_batch->len = 0;
+    }
+    lazyfree_batch->items[lazyfree_batch->len].type = type;
+    lazyfree_batch->items[lazyfree_batch->len].ptr = ptr;
+    atomicIncr(lazyfree_objects,1);
+    if (++lazyfree_batch->len == LAZYFREE_BATCH_SIZE) lazyfreeFlushBatch();
+    if (used != -1) keymemValueAdjust(used-zmalloc_thread_used_memory());
+}
+
 /* Return the number of currently pending objects to free. */
 size_t lazyfreeGetPendingObjectsCount(void) {
     size_t aux;
@@ -52,8 +95,11 @@ size_t lazyfreeGetFreeEffort(robj *obj) {
  * will be reclaimed in a different bio.c thread. */
 #define LAZYFREE_THRESHOLD 64
 int dbAsyncDelete(redisDb *db, robj *key) {
+    int deleted = 0;
+
     /* Deleting an entry from the expires dict will not free the sds of
      * the key, because it is shared with the main dictionary. */
+    keymemDelete(db,key);
     if (dictSize(db->expires) > 0) dictDelete(db->expires,key->ptr);
 
     /* If the value is composed of a few allocations, to free in a lazy way
@@ -62,7 +108,7 @@ int dbAsyncDelete(redisDb *db, robj *key) {
     dictEntry *de = dictUnlink(db->dict,key->ptr);
     if (de) {
         robj *val = dictGetVal(de);
-        size_t free_effort = lazyfreeGetFreeEffort(val);
+        size_t free_effort = objIsInline(val) ? 0 : lazyfreeGetFreeEffort(val);
 
         /* If releasing the object is too much work, do it in the background
          * by adding the object to the lazy free list.
@@ -73,8 +119,7 @@ int dbAsyncDelete(redisDb *db, robj *key) {
          * through and reach the dictFreeUnlinkedEntry() call, that will be
          * equivalent to just calling decrRefCount(). */
         if (free_effort > LAZYFREE_THRESHOLD && val->refcount == 1) {
-            atomicIncr(lazyfree_objects,1);
-            bioCreateBackgroundJob(BIO_LAZY_FREE,val,NULL,NULL);
+            lazyfreeAddItem(LAZYFREE_ITEM_OBJ,val);
             dictSetVal(db->dict,de,NULL);
         }
     }
@@ -84,23 +129,39 @@ int dbAsyncDelete(redisDb *db, robj *key) {
     if (de) {
         dictFreeUnlinkedEntry(db->dict,de);
         if (server.cluster_enabled) slotToKeyDel(key);
-        return 1;
-    } else {
-        return 0;
+        deleted = 1;
     }
+    return deleted;
 }
 
 /* Free an object, if the object is huge enough, free it in async way. */
 void freeObjAsync(robj *o) {
     size_t free_effort = lazyfreeGetFreeEffort(o);
     if (free_effort > LAZYFREE_THRESHOLD && o->refcount == 1) {
-        atomicIncr(lazyfree_objects,1);
-        bioCreateBackgroundJob(BIO_LAZY_FREE,o,NULL,NULL);
+        lazyfreeAddItem(LAZYFREE_ITEM_OBJ,o);
     } else {
         decrRefCount(o);
     }
 }
 
+/* Free a field or a value removed from a hash in the lazyfree threads.
+ * The memory released in the other thread is not seen by the key memory
+ * tracking, so it is subtracted here from the value. */
+void freeSdsAsync(sds s) {
+    if (keymemValueIsOpen()) keymemValueAdjust(-(long long)sdsZmallocSize(s));
+    lazyfreeAddItem(LAZYFREE_ITEM_SDS,s);
+}
+
+/* Free a node removed from the skiplist of a sorted set, together with its
+ * element, in the lazyfree threads. */
+void freeZslNodeAsync(zskiplistNode *node) {
+    if (keymemValueIsOpen()) {
+        keymemValueAdjust(-(long long)(zmalloc_size(node)+
+                                       sdsZmallocSize(node->ele)));
+    }
+    lazyfreeAddItem(LAZYFREE_ITEM_ZSLNODE,node);
+}
+
 /* Empty a Redis DB asynchronously. What the function does actually is to
  * create a new empty set of hash tables and scheduling the old ones for
  * lazy freeing. */
@@ -110,6 +171,18 @@ void emptyDbAsync(redisDb *db) {
     db->expires = dictCreate(&keyptrDictType,NULL);
     atomicIncr(lazyfree_objects,dictSize(oldht1));
     bioCreateBackgroundJob(BIO_LAZY_FREE,NULL,oldht1,oldht2);
+    emptyDbMemoryAsync(db);
+}
+
+/* Empty the key memory accounting dict of a DB, in the lazyfree threads if
+ * it is large. */
+void emptyDbMemoryAsync(redisDb *db) {
+    if (dictSize(db->memory) > LAZYFREE_THRESHOLD) {
+        bioCreateBackgroundJob(BIO_LAZY_FREE,NULL,db->memory,NULL);
+        db->memory = dictCreate(&keyptrDictType,NULL);
+    } else {
+        dictEmpty(db->memory,NULL);
+    }
 }
 
 /* Empty the slots-keys map of Redis CLuster by creating a new empty one
@@ -120,15 +193,26 @@ void slotToKeyFlushAsync(void) {
     server.cluster->slots_to_keys = raxNew();
     memset(server.cluster->slots_keys_count,0,
            sizeof(server.cluster->slots_keys_count));
+    memset(server.cluster->slots_memory,0,
+           sizeof(server.cluster->slots_memory));
     atomicIncr(lazyfree_objects,old->numele);
     bioCreateBackgroundJob(BIO_LAZY_FREE,NULL,NULL,old);
 }
 
-/* Release objects from the lazyfree thread. It's just decrRefCount()
- * updating the count of objects to release. */
-void lazyfreeFreeObjectFromBioThread(robj *o) {
-    decrRefCount(o);
-    atomicDecr(lazyfree_objects,1);
+/* Release a batch of objects from a lazyfree thread, updating the count of
+ * objects to release. */
+void lazyfreeFreeBatchFromBioThread(void *ptr) {
+    lazyfreeBatch *batch = ptr;
+    for (int j = 0; j < batch->len; j++) {
+        ptr = batch->items[j].ptr;
+        switch(batch->items[j].type) {
+        case LAZYFREE_ITEM_OBJ: decrRefCount(ptr); break;
+        case LAZYFREE_ITEM_SDS: sdsfree(ptr); break;
+        case LAZYFREE_ITEM_ZSLNODE: zslFreeNode(ptr); break;
+        }
+    }
+    atomicDecr(lazyfree_objects,batch->len);
+    zfree(batch);
 }
 
 /* Release a database from the lazyfree thread. The 'db' pointer is the
@@ -143,6 +227,12 @@ void lazyfreeFreeDatabaseFromBioThread(dict *ht1, dict *ht2) {
     atomicDecr(lazyfree_objects,numkeys);
 }
 
+/* Release a dictionary sharing the keys with a Redis DB, like the key
+ * memory accounting one. */
+void lazyfreeFreeDictFromBioThread(dict *d) {
+    dictRelease(d);
+}
+
 /* Release the skiplist mapping Redis Cluster keys to slots in the
  * lazyfree thread. */
 void lazyfreeFreeSlotsMapFromBioThread(rax *rt) {
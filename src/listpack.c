@@ -86,6 +86,10 @@
 #define LP_ENCODING_32BIT_STR_MASK 0xFF
 #define LP_ENCODING_IS_32BIT_STR(byte) (((byte)&LP_ENCODING_32BIT_STR_MASK)==LP_ENCODING_32BIT_STR)
 
+#define LP_ENCODING_IS_STR(byte) (LP_ENCODING_IS_6BIT_STR(byte) || \
+                                  LP_ENCODING_IS_12BIT_STR(byte) || \
+                                  LP_ENCODING_IS_32BIT_STR(byte))
+
 #define LP_EOF 0xFF
 
 #define LP_ENCODING_6BIT_STR_LEN(p) ((p)[0] & 0x3F)
@@ -202,9 +206,13 @@ int lpStringToInt64(const char *s, unsigned long slen, int64_t *value) {
 }
 
 /* Create a new, empty listpack.
+ * 'capacity' is the number of bytes to preallocate (it is ignored if smaller
+ * than the empty listpack size), so that callers that know the listpack will
+ * grow can avoid reallocating on every insertion. Use 0 for an exact fit.
  * On success the new listpack is returned, otherwise an error is returned. */
-unsigned char *lpNew(void) {
-    unsigned char *lp = lp_malloc(LP_HDR_SIZE+1);
+unsigned char *lpNew(size_t capacity) {
+    unsigned char *lp = lp_malloc(capacity > LP_HDR_SIZE+1 ?
+                                  capacity : LP_HDR_SIZE+1);
     if (lp == NULL) return NULL;
     lpSetTotalBytes(lp,LP_HDR_SIZE+1);
     lpSetNumElements(lp,0);
@@ -217,6 +225,33 @@ void lpFree(unsigned char *lp) {
     lp_free(lp);
 }
 
+/* Release the spare capacity of a listpack created with lpNew(capacity), or
+ * grown with lpReserve(), once no more elements are going to be added to it. */
+unsigned char *lpShrinkToFit(unsigned char *lp) {
+    size_t size = lpGetTotalBytes(lp);
+    if (size < lp_malloc_size(lp)) {
+        return lp_realloc(lp,size);
+    } else {
+        return lp;
+    }
+}
+
+/* Make sure that 'bytes' more bytes can be appended to the listpack without
+ * reallocating it. When a reallocation is needed the allocation is at least
+ * doubled, up to 'max_capacity' bytes, so that a listpack growing one element
+ * at a time is only reallocated a logarithmic number of times, while a small
+ * listpack doesn't pay for capacity it may never use. */
+unsigned char *lpReserve(unsigned char *lp, size_t bytes, size_t max_capacity) {
+    size_t needed = lpGetTotalBytes(lp)+bytes;
+    size_t capacity = lp_malloc_size(lp);
+
+    if (needed <= capacity) return lp;
+    capacity *= 2;
+    if (capacity > max_capacity) capacity = max_capacity;
+    if (capacity < needed) capacity = needed;
+    return lp_realloc(lp,capacity);
+}
+
 /* Given an element 'ele' of size 'size', determine if the element can be
  * represented inside the listpack encoded as integer, and returns
  * LP_ENCODING_INT if so. Otherwise returns LP_ENCODING_STR if no integer
@@ -568,6 +603,85 @@ unsigned char *lpGet(unsigned char *p, int64_t *count, unsigned char *intbuf) {
     }
 }
 
+/* Like lpGet() without an 'intbuf', but with the same prototype of
+ * ziplistGet(): if the element is a string, a pointer to it is returned and
+ * its length is stored into '*slen', otherwise NULL is returned and the
+ * integer value is stored into '*lval'. */
+unsigned char *lpGetValue(unsigned char *p, unsigned int *slen, long long *lval) {
+    unsigned char *vstr;
+    int64_t ele_len;
+
+    vstr = lpGet(p,&ele_len,NULL);
+    if (vstr) {
+        *slen = ele_len;
+    } else {
+        *lval = ele_len;
+    }
+    return vstr;
+}
+
+/* Find the element equal to the string 's' of length 'slen', starting the
+ * search at the element 'p' and skipping 'skip' elements between every
+ * comparison, like ziplistFind() does. Returns NULL when the element could
+ * not be found.
+ *
+ * Since lpInsert() always stores strings that look like integers using an
+ * integer encoding, 's' can only match elements of the same kind: this is
+ * checked once, so that the elements of the other kind are skipped just
+ * looking at their encoding byte, without decoding them. Small integers and
+ * short strings, that are the most common elements of small aggregates, are
+ * also compared and skipped inline. */
+unsigned char *lpFind(unsigned char *lp, unsigned char *p, unsigned char *s,
+                      uint32_t slen, unsigned int skip)
+{
+    int skipcnt = 0;
+    int64_t sval = 0, count;
+    unsigned char *value;
+    int sint = lpStringToInt64((const char*)s,slen,&sval);
+
+    ((void) lp); /* Not used, like in lpNext(). */
+    while (p) {
+        if (skipcnt == 0) {
+            if (LP_ENCODING_IS_7BIT_UINT(p[0])) {
+                if (sint && (p[0] & 0x7f) == sval) return p;
+            } else if (LP_ENCODING_IS_13BIT_INT(p[0])) {
+                if (sint) {
+                    count = ((p[0] & 0x1f) << 8) | p[1];
+                    if (count >= 1<<12) count -= 1<<13;
+                    if (count == sval) return p;
+                }
+            } else if (LP_ENCODING_IS_6BIT_STR(p[0])) {
+                if (!sint && LP_ENCODING_6BIT_STR_LEN(p) == slen &&
+                    memcmp(p+1,s,slen) == 0) return p;
+            } else if (LP_ENCODING_IS_STR(p[0])) {
+                if (!sint) {
+                    value = lpGet(p,&count,NULL);
+                    if (count == slen && memcmp(value,s,slen) == 0) return p;
+                }
+            } else if (sint) {
+                lpGet(p,&count,NULL);
+                if (count == sval) return p;
+            }
+            skipcnt = skip;
+        } else {
+            skipcnt--;
+        }
+
+        /* Move to the next element. The encodings handled inline are at
+         * most 64 bytes long, so their backlen is a single byte. */
+        if (LP_ENCODING_IS_7BIT_UINT(p[0]))
+            p += 2;
+        else if (LP_ENCODING_IS_13BIT_INT(p[0]))
+            p += 3;
+        else if (LP_ENCODING_IS_6BIT_STR(p[0]))
+            p += 2+LP_ENCODING_6BIT_STR_LEN(p);
+        else
+            p = lpSkip(p);
+        if (p[0] == LP_EOF) break;
+    }
+    return NULL;
+}
+
 /* Insert, delete or replace the specified element 'ele' of length 'len' at
  * the specified position 'p', with 'p' being a listpack element pointer
  * obtained with lpFirst(), lpLast(), lpIndex(), lpNext(), lpPrev() or
@@ -655,8 +769,11 @@ unsigned char *lpInsert(unsigned char *lp, unsigned char *ele, uint32_t size, un
 
     unsigned char *dst = lp + poff; /* May be updated after reallocation. */
 
-    /* Realloc before: we need more room. */
-    if (new_listpack_bytes > old_listpack_bytes) {
+    /* Realloc before: we need more room, unless the allocation already has
+     * enough spare capacity. */
+    if (new_listpack_bytes > old_listpack_bytes &&
+        new_listpack_bytes > lp_malloc_size(lp))
+    {
         if ((lp = lp_realloc(lp,new_listpack_bytes)) == NULL) return NULL;
         dst = lp + poff;
     }
@@ -739,6 +856,13 @@ unsigned char *lpAppend(unsigned char *lp, unsigned char *ele, uint32_t size) {
     return lpInsert(lp,ele,size,eofptr,LP_BEFORE,NULL);
 }
 
+/* Insert the specified element 'ele' of length 'len' at the head of the
+ * listpack, in front of the first element, or of the EOF if the listpack
+ * is empty. The return value is the same as lpInsert(). */
+unsigned char *lpPrepend(unsigned char *lp, unsigned char *ele, uint32_t size) {
+    return lpInsert(lp,ele,size,lp+LP_HDR_SIZE,LP_BEFORE,NULL);
+}
+
 /* Remove the element pointed by 'p', and return the resulting listpack.
  * If 'newp' is not NULL, the next element pointer (to the right of the
  * deleted one) is returned by reference. If the deleted element was the
@@ -747,6 +871,131 @@ unsigned char *lpDelete(unsigned char *lp, unsigned char *p, unsigned char **new
     return lpInsert(lp,NULL,0,p,LP_REPLACE,newp);
 }
 
+/* Delete 'num' consecutive elements starting at the element pointed by '*p',
+ * or less if the listpack ends before. Unlike calling lpDelete() 'num' times,
+ * the tail of the listpack is moved and reallocated just once. On return '*p'
+ * points to the element that followed the deleted ones, or is set to NULL if
+ * the deleted elements were the last ones. */
+unsigned char *lpDeleteRangeWithEntry(unsigned char *lp, unsigned char **p, unsigned long num) {
+    unsigned char *first = *p, *tail = *p;
+    uint32_t bytes = lpGetTotalBytes(lp);
+    uint32_t numele = lpGetNumElements(lp);
+    unsigned long deleted = 0;
+    size_t offset = first-lp;
+
+    while (deleted < num && tail[0] != LP_EOF) {
+        tail = lpSkip(tail);
+        deleted++;
+    }
+
+    /* Move the remaining elements, and the EOF byte, over the deleted
+     * ones. */
+    memmove(first,tail,(lp+bytes)-tail);
+    bytes -= tail-first;
+    lpSetTotalBytes(lp,bytes);
+    if (numele != LP_HDR_NUMELE_UNKNOWN)
+        lpSetNumElements(lp,numele-deleted);
+    lp = lp_realloc(lp,bytes);
+    *p = lp[offset] == LP_EOF ? NULL : lp+offset;
+    return lp;
+}
+
+/* Like lpDeleteRangeWithEntry() but the first element to delete is given by
+ * its index, see lpSeek(). */
+unsigned char *lpDeleteRange(unsigned char *lp, long index, unsigned long num) {
+    unsigned char *p = lpSeek(lp,index);
+
+    if (p == NULL || num == 0) return lp;
+    return lpDeleteRangeWithEntry(lp,&p,num);
+}
+
+/* Merge the listpacks '*first' and '*second', with the elements of '*first'
+ * followed by the ones of '*second', like ziplistMerge() does: the bigger
+ * listpack is reallocated to contain the result, the other one is freed and
+ * set to NULL, and the pointer of the retained one is set to the merged
+ * listpack, that is also returned. Since every listpack element only
+ * encodes its own length, the seam needs no cascade update.
+ *
+ * Returns NULL, without touching the listpacks, if the merge is not
+ * possible. */
+unsigned char *lpMerge(unsigned char **first, unsigned char **second) {
+    /* If any params are null, we can't merge, so NULL. */
+    if (first == NULL || *first == NULL || second == NULL || *second == NULL)
+        return NULL;
+
+    /* Can't merge same list into itself. */
+    if (*first == *second) return NULL;
+
+    size_t first_bytes = lpGetTotalBytes(*first);
+    size_t second_bytes = lpGetTotalBytes(*second);
+    uint32_t first_len = lpGetNumElements(*first);
+    uint32_t second_len = lpGetNumElements(*second);
+
+    /* Calculate final bytes (subtract one pair of header and EOF). */
+    size_t lpbytes = first_bytes + second_bytes - LP_HDR_SIZE - 1;
+    if (lpbytes > UINT32_MAX) return NULL;
+
+    /* The merged length can only be cached if both lengths are known and
+     * the sum fits the header. */
+    unsigned long lplength = LP_HDR_NUMELE_UNKNOWN;
+    if (first_len != LP_HDR_NUMELE_UNKNOWN &&
+        second_len != LP_HDR_NUMELE_UNKNOWN &&
+        (unsigned long)first_len + second_len < LP_HDR_NUMELE_UNKNOWN)
+    {
+        lplength = first_len + second_len;
+    }
+
+    /* Pick the largest listpack so we can resize easily in-place, and
+     * track if we are appending or prepending to it. */
+    int append = first_bytes >= second_bytes;
+    unsigned char *target = append ? *first : *second;
+    unsigned char *source = append ? *second : *first;
+    size_t target_bytes = append ? first_bytes : second_bytes;
+    size_t source_bytes = append ? second_bytes : first_bytes;
+
+    target = lp_realloc(target,lpbytes);
+    if (append) {
+        /* [TARGET - EOF, SOURCE - HEADER] */
+        memcpy(target+target_bytes-1,
+               source+LP_HDR_SIZE,
+               source_bytes-LP_HDR_SIZE);
+    } else {
+        /* Move the target elements (and EOF) after the room needed by the
+         * source elements, then copy the source there.
+         * [SOURCE - EOF, TARGET - HEADER] */
+        memmove(target+source_bytes-1,
+                target+LP_HDR_SIZE,
+                target_bytes-LP_HDR_SIZE);
+        memcpy(target,source,source_bytes-1);
+    }
+    lpSetTotalBytes(target,lpbytes);
+    lpSetNumElements(target,lplength);
+
+    /* Now free and NULL out what we didn't realloc. */
+    if (append) {
+        lp_free(*second);
+        *second = NULL;
+        *first = target;
+    } else {
+        lp_free(*first);
+        *first = NULL;
+        *second = target;
+    }
+    return target;
+}
+
+/* Return 1 if the element pointed by 'p' is equal to the string 's' of
+ * length 'slen', otherwise 0 is returned, like ziplistCompare() does.
+ * Elements stored as integers are compared by their string representation,
+ * that is the same lpInsert() converted them from. */
+int lpCompare(unsigned char *p, unsigned char *s, uint32_t slen) {
+    unsigned char buf[LP_INTBUF_SIZE];
+    int64_t len;
+    unsigned char *value = lpGet(p,&len,buf);
+
+    return len == slen && memcmp(value,s,slen) == 0;
+}
+
 /* Return the total number of bytes the listpack is composed of. */
 uint32_t lpBytes(unsigned char *lp) {
     return lpGetTotalBytes(lp);
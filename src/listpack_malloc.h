@@ -42,4 +42,12 @@
 #define lp_malloc zmalloc
 #define lp_realloc zrealloc
 #define lp_free zfree
+/* Usable size of an allocation, so that a listpack created with some spare
+ * capacity can grow without reallocating. When the allocator can't tell,
+ * zero is returned and every growth reallocates as usual. */
+#ifdef HAVE_MALLOC_SIZE
+#define lp_malloc_size zmalloc_size
+#else
+#define lp_malloc_size(p) ((void)(p),0)
+#endif
 #endif
@@ -74,7 +74,7 @@ void queueMultiCommand(client *c) {
 void discardTransaction(client *c) {
     freeClientMultiState(c);
     initClientMultiState(c);
-    c->flags &= ~(CLIENT_MULTI|CLIENT_DIRTY_CAS|CLIENT_DIRTY_EXEC);
+    c->flags &= ~(CLIENT_MULTI|CLIENT_DIRTY_EXEC);
     unwatchAllKeys(c);
 }
 
@@ -132,7 +132,7 @@ void execCommand(client *c) {
      * A failed EXEC in the first case returns a multi bulk nil object
      * (technically it is not an error but a special behavior), while
      * in the second an EXECABORT error is returned. */
-    if (c->flags & (CLIENT_DIRTY_CAS|CLIENT_DIRTY_EXEC)) {
+    if (c->flags & CLIENT_DIRTY_EXEC || isWatchedKeyTouched(c)) {
         addReply(c, c->flags & CLIENT_DIRTY_EXEC ? shared.execaborterr :
                                                   shared.nullmultibulk);
         discardTransaction(c);
@@ -215,24 +215,34 @@ handle_monitor:
 
 /* ===================== WATCH (CAS alike for MULTI/EXEC) ===================
  *
- * The implementation uses a per-DB hash table mapping keys to list of clients
- * WATCHing those keys, so that given a key that is going to be modified
- * we can mark all the associated clients as dirty.
+ * The implementation uses a per-DB hash table mapping every WATCHed key to
+ * a version number, shared by all the clients watching the key. Every time
+ * the key is modified its version is incremented: this is an O(1) operation
+ * regardless of the number of clients watching the key. WATCH remembers the
+ * version of the key, and EXEC fails if some version changed meanwhile.
  *
  * Also every client contains a list of WATCHed keys so that's possible to
  * un-watch such keys when the client is freed or when UNWATCH is called. */
 
+/* Value of the db->watched_keys hash table. */
+typedef struct keyVersion {
+    unsigned long long version; /* Incremented when the key is modified. */
+    unsigned long watchers;     /* Number of clients watching the key. */
+} keyVersion;
+
 /* In the client->watched_keys list we need to use watchedKey structures
  * as in order to identify a key in Redis we need both the key name and the
  * DB */
 typedef struct watchedKey {
     robj *key;
     redisDb *db;
+    keyVersion *kv;             /* Shared version of the key. */
+    unsigned long long version; /* Version of the key at WATCH time. */
 } watchedKey;
 
 /* Watch for the specified key */
 void watchForKey(client *c, robj *key) {
-    list *clients = NULL;
+    keyVersion *kv;
     listIter li;
     listNode *ln;
     watchedKey *wk;
@@ -245,17 +255,21 @@ void watchForKey(client *c, robj *key) {
             return; /* Key already watched */
     }
     /* This key is not already watched in this DB. Let's add it */
-    clients = dictFetchValue(c->db->watched_keys,key);
-    if (!clients) {
-        clients = listCreate();
-        dictAdd(c->db->watched_keys,key,clients);
+    kv = dictFetchValue(c->db->watched_keys,key);
+    if (!kv) {
+        kv = zmalloc(sizeof(*kv));
+        kv->version = 0;
+        kv->watchers = 0;
+        dictAdd(c->db->watched_keys,key,kv);
         incrRefCount(key);
     }
-    listAddNodeTail(clients,c);
+    kv->watchers++;
     /* Add the new key to the list of keys watched by this client */
     wk = zmalloc(sizeof(*wk));
     wk->key = key;
     wk->db = c->db;
+    wk->kv = kv;
+    wk->version = kv->version;
     incrRefCount(key);
     listAddNodeTail(c->watched_keys,wk);
 }
@@ -269,17 +283,12 @@ void unwatchAllKeys(client *c) {
     if (listLength(c->watched_keys) == 0) return;
     listRewind(c->watched_keys,&li);
     while((ln = listNext(&li))) {
-        list *clients;
         watchedKey *wk;
 
-        /* Lookup the watched key -> clients list and remove the client
-         * from the list */
+        /* Kill the watched key entry at all if this was the only client
+         * watching it. */
         wk = listNodeValue(ln);
-        clients = dictFetchValue(wk->db->watched_keys, wk->key);
-        serverAssertWithInfo(c,NULL,clients != NULL);
-        listDelNode(clients,listSearchKey(clients,c));
-        /* Kill the entry at all if this was the only client */
-        if (listLength(clients) == 0)
+        if (--wk->kv->watchers == 0)
             dictDelete(wk->db->watched_keys, wk->key);
         /* Remove this watched key from the client->watched list */
         listDelNode(c->watched_keys,ln);
@@ -288,25 +297,29 @@ void unwatchAllKeys(client *c) {
     }
 }
 
-/* "Touch" a key, so that if this key is being WATCHed by some client the
- * next EXEC will fail. */
-void touchWatchedKey(redisDb *db, robj *key) {
-    list *clients;
+/* Return true if some of the keys WATCHed by the client was modified since
+ * the client started watching it, so that the next EXEC will fail. */
+int isWatchedKeyTouched(client *c) {
     listIter li;
     listNode *ln;
 
-    if (dictSize(db->watched_keys) == 0) return;
-    clients = dictFetchValue(db->watched_keys, key);
-    if (!clients) return;
-
-    /* Mark all the clients watching this key as CLIENT_DIRTY_CAS */
-    /* Check if we are already watching for this key */
-    listRewind(clients,&li);
+    listRewind(c->watched_keys,&li);
     while((ln = listNext(&li))) {
-        client *c = listNodeValue(ln);
+        watchedKey *wk = listNodeValue(ln);
 
-        c->flags |= CLIENT_DIRTY_CAS;
+        if (wk->kv->version != wk->version) return 1;
     }
+    return 0;
+}
+
+/* "Touch" a key, so that if this key is being WATCHed by some client the
+ * next EXEC will fail. */
+void touchWatchedKey(redisDb *db, robj *key) {
+    keyVersion *kv;
+
+    if (dictSize(db->watched_keys) == 0) return;
+    kv = dictFetchValue(db->watched_keys, key);
+    if (kv) kv->version++;
 }
 
 /* On FLUSHDB or FLUSHALL all the watched keys that are present before the
@@ -314,25 +327,25 @@ void touchWatchedKey(redisDb *db, robj *key) {
  * be touched. "dbid" is the DB that's getting the flush. -1 if it is
  * a FLUSHALL operation (all the DBs flushed). */
 void touchWatchedKeysOnFlush(int dbid) {
-    listIter li1, li2;
-    listNode *ln;
+    dictIterator *di;
+    dictEntry *de;
+    int j;
+
+    /* For every watched key of the flushed DBs, if the key exists, touch
+     * it, as it will be removed. */
+    for (j = 0; j < server.dbnum; j++) {
+        redisDb *db = server.db+j;
+
+        if (dbid != -1 && dbid != j) continue;
+        if (dictSize(db->watched_keys) == 0) continue;
+        di = dictGetIterator(db->watched_keys);
+        while((de = dictNext(di)) != NULL) {
+            robj *key = dictGetKey(de);
+            keyVersion *kv = dictGetVal(de);
 
-    /* For every client, check all the waited keys */
-    listRewind(server.clients,&li1);
-    while((ln = listNext(&li1))) {
-        client *c = listNodeValue(ln);
-        listRewind(c->watched_keys,&li2);
-        while((ln = listNext(&li2))) {
-            watchedKey *wk = listNodeValue(ln);
-
-            /* For every watched key matching the specified DB, if the
-             * key exists, mark the client as dirty, as the key will be
-             * removed. */
-            if (dbid == -1 || wk->db->id == dbid) {
-                if (dictFind(wk->db->dict, wk->key->ptr) != NULL)
-                    c->flags |= CLIENT_DIRTY_CAS;
-            }
+            if (dictFind(db->dict, key->ptr) != NULL) kv->version++;
         }
+        dictReleaseIterator(di);
     }
 }
 
@@ -350,6 +363,5 @@ void watchCommand(client *c) {
 
 void unwatchCommand(client *c) {
     unwatchAllKeys(c);
-    c->flags &= (~CLIENT_DIRTY_CAS);
     addReply(c,shared.ok);
 }
@@ -55,16 +55,34 @@ size_t getStringObjectSdsUsedMemory(robj *o) {
     }
 }
 
-/* Client.reply list dup and free methods. */
+/* Client.reply list dup and free methods. Full blocks are immutable, so
+ * they are shared instead of copied. */
 void *dupClientReplyValue(void *o) {
     clientReplyBlock *old = o;
+    if (old->used == old->size) {
+        old->refcount++;
+        return old;
+    }
     clientReplyBlock *buf = zmalloc(sizeof(clientReplyBlock) + old->size);
     memcpy(buf, o, sizeof(clientReplyBlock) + old->size);
+    buf->refcount = 1;
     return buf;
 }
 
 void freeClientReplyValue(void *o) {
-    zfree(o);
+    clientReplyBlock *b = o;
+    /* NULL is the placeholder of addDeferredMultiBulkLength(). */
+    if (b && --b->refcount == 0) zfree(b);
+}
+
+/* Create a reply block with room for at least 'size' bytes of protocol. */
+clientReplyBlock *createReplyBlock(size_t size) {
+    clientReplyBlock *b = zmalloc(size + sizeof(clientReplyBlock));
+    /* take over the allocation's internal fragmentation */
+    b->size = zmalloc_usable(b) - sizeof(clientReplyBlock);
+    b->used = 0;
+    b->refcount = 1;
+    return b;
 }
 
 int listMatchObjects(void *a, void *b) {
@@ -124,6 +142,7 @@ client *createClient(int fd) {
     c->sentlen = 0;
     c->flags = 0;
     c->ctime = c->lastinteraction = server.unixtime;
+    c->read_ustime = 0;
     c->authenticated = 0;
     c->replstate = REPL_STATE_NONE;
     c->repl_put_online_on_ack = 0;
@@ -151,8 +170,10 @@ client *createClient(int fd) {
     c->woff = 0;
     c->watched_keys = listCreate();
     c->pubsub_channels = dictCreate(&objectKeyPointerValueDictType,NULL);
+    c->pubsubshard_channels = dictCreate(&objectKeyPointerValueDictType,NULL);
     c->pubsub_patterns = listCreate();
     c->peerid = NULL;
+    c->client_tracking_redirection = 0;
     c->client_list_node = NULL;
     listSetFreeMethod(c->pubsub_patterns,decrRefCountVoid);
     listSetMatchMethod(c->pubsub_patterns,listMatchObjects);
@@ -278,9 +299,7 @@ void _addReplyStringToList(client *c, const char *s, size_t len) {
         /* Create a new node, make sure it is allocated to at
          * least PROTO_REPLY_CHUNK_BYTES */
         size_t size = len < PROTO_REPLY_CHUNK_BYTES? PROTO_REPLY_CHUNK_BYTES: len;
-        tail = zmalloc(size + sizeof(clientReplyBlock));
-        /* take over the allocation's internal fragmentation */
-        tail->size = zmalloc_usable(tail) - sizeof(clientReplyBlock);
+        tail = createReplyBlock(size);
         tail->used = len;
         memcpy(tail->buf, s, len);
         listAddNodeTail(c->reply, tail);
@@ -289,6 +308,28 @@ void _addReplyStringToList(client *c, const char *s, size_t len) {
     asyncCloseClientOnOutputBufferLimitReached(c);
 }
 
+/* Queue the protocol in the block 'b' without copying it, adding a reference
+ * to the block: this is useful when the same protocol is sent to many
+ * clients, like the Pub/Sub messages. The block must be full, so that no
+ * client will append to it, and the caller must release its own reference
+ * with freeClientReplyValue() when done.
+ *
+ * 同一个block可以被多个客户端的输出缓冲区共享，避免重复拷贝。 */
+void addReplyBlock(client *c, clientReplyBlock *b) {
+    serverAssert(b->used == b->size);
+    if (c->flags & CLIENT_LUA_DIRECT_REPLY) {
+        luaReplyProto(b->buf,b->used);
+        return;
+    }
+    if (prepareClientToWrite(c) != C_OK) return;
+    if (c->flags & CLIENT_CLOSE_AFTER_REPLY) return;
+
+    b->refcount++;
+    listAddNodeTail(c->reply,b);
+    c->reply_bytes += b->size;
+    asyncCloseClientOnOutputBufferLimitReached(c);
+}
+
 /* -----------------------------------------------------------------------------
  * Higher level functions to queue data on the client output buffer.
  * The following functions are the ones that commands implementations will call.
@@ -299,7 +340,10 @@ void addReply(client *c, robj *obj) {
     if (prepareClientToWrite(c) != C_OK) return;
 
     if (sdsEncodedObject(obj)) {
-        if (_addReplyToBuffer(c,obj->ptr,sdslen(obj->ptr)) != C_OK)
+        /* See "Direct Redis reply to Lua type conversion" in scripting.c */
+        if (c->flags & CLIENT_LUA_DIRECT_REPLY)
+            luaReplyProto(obj->ptr,sdslen(obj->ptr));
+        else if (_addReplyToBuffer(c,obj->ptr,sdslen(obj->ptr)) != C_OK)
             _addReplyStringToList(c,obj->ptr,sdslen(obj->ptr));
     } else if (obj->encoding == OBJ_ENCODING_INT) {
         /* For integer encoded strings we just convert it into a string
@@ -307,7 +351,9 @@ void addReply(client *c, robj *obj) {
          * to the output buffer. */
         char buf[32];
         size_t len = ll2string(buf,sizeof(buf),(long)obj->ptr);
-        if (_addReplyToBuffer(c,buf,len) != C_OK)
+        if (c->flags & CLIENT_LUA_DIRECT_REPLY)
+            luaReplyProto(buf,len);
+        else if (_addReplyToBuffer(c,buf,len) != C_OK)
             _addReplyStringToList(c,buf,len);
     } else {
         serverPanic("Wrong obj->encoding in addReply()");
@@ -322,7 +368,9 @@ void addReplySds(client *c, sds s) {
         sdsfree(s);
         return;
     }
-    if (_addReplyToBuffer(c,s,sdslen(s)) != C_OK)
+    if (c->flags & CLIENT_LUA_DIRECT_REPLY)
+        luaReplyProto(s,sdslen(s));
+    else if (_addReplyToBuffer(c,s,sdslen(s)) != C_OK)
         _addReplyStringToList(c,s,sdslen(s));
     sdsfree(s);
 }
@@ -337,7 +385,9 @@ void addReplySds(client *c, sds s) {
  * in the list of objects. */
 void addReplyString(client *c, const char *s, size_t len) {
     if (prepareClientToWrite(c) != C_OK) return;
-    if (_addReplyToBuffer(c,s,len) != C_OK)
+    if (c->flags & CLIENT_LUA_DIRECT_REPLY)
+        luaReplyProto(s,len);
+    else if (_addReplyToBuffer(c,s,len) != C_OK)
         _addReplyStringToList(c,s,len);
 }
 
@@ -350,6 +400,11 @@ void addReplyString(client *c, const char *s, size_t len) {
  * code provided is used, otherwise the string "-ERR " for the generic
  * error code is automatically added. */
 void addReplyErrorLength(client *c, const char *s, size_t len) {
+    if (c->flags & CLIENT_LUA_DIRECT_REPLY) {
+        luaReplyError(s,len);
+        return;
+    }
+
     /* If the string already starts with "-..." then the error code
      * is provided by the caller. Otherwise we use "-ERR". */
     if (!len || s[0] != '-') addReplyString(c,"-ERR ",5);
@@ -397,6 +452,10 @@ void addReplyErrorFormat(client *c, const char *fmt, ...) {
 }
 
 void addReplyStatusLength(client *c, const char *s, size_t len) {
+    if (c->flags & CLIENT_LUA_DIRECT_REPLY) {
+        luaReplyStatus(s,len);
+        return;
+    }
     addReplyString(c,"+",1);
     addReplyString(c,s,len);
     addReplyString(c,"\r\n",2);
@@ -422,6 +481,7 @@ void *addDeferredMultiBulkLength(client *c) {
      * ready to be sent, since we are sure that before returning to the
      * event loop setDeferredMultiBulkLength() will be called. */
     if (prepareClientToWrite(c) != C_OK) return NULL;
+    if (c->flags & CLIENT_LUA_DIRECT_REPLY) return luaReplyDeferredArray();
     listAddNodeTail(c->reply,NULL); /* NULL is our placeholder. */
     return listLast(c->reply);
 }
@@ -436,6 +496,10 @@ void setDeferredMultiBulkLength(client *c, void *node, long length) {
     /* Abort when *node is NULL: when the client should not accept writes
      * we return NULL in addDeferredMultiBulkLength() */
     if (node == NULL) return;
+    if (c->flags & CLIENT_LUA_DIRECT_REPLY) {
+        luaReplySetDeferredArray(node,length);
+        return;
+    }
     serverAssert(!listNodeValue(ln));
 
     /* Normally we fill this dummy NULL node, added by addDeferredMultiBulkLength(),
@@ -457,9 +521,7 @@ void setDeferredMultiBulkLength(client *c, void *node, long length) {
         listDelNode(c->reply,ln);
     } else {
         /* Create a new node */
-        clientReplyBlock *buf = zmalloc(lenstr_len + sizeof(clientReplyBlock));
-        /* Take over the allocation's internal fragmentation */
-        buf->size = zmalloc_usable(buf) - sizeof(clientReplyBlock);
+        clientReplyBlock *buf = createReplyBlock(lenstr_len);
         buf->used = lenstr_len;
         memcpy(buf->buf, lenstr, lenstr_len);
         listNodeValue(ln) = buf;
@@ -478,6 +540,10 @@ void addReplyDouble(client *c, double d) {
         addReplyBulkCString(c, d > 0 ? "inf" : "-inf");
     } else {
         dlen = snprintf(dbuf,sizeof(dbuf),"%.17g",d);
+        if (c->flags & CLIENT_LUA_DIRECT_REPLY) {
+            luaReplyBulk(dbuf,dlen);
+            return;
+        }
         slen = snprintf(sbuf,sizeof(sbuf),"$%d\r\n%s\r\n",dlen,dbuf);
         addReplyString(c,sbuf,slen);
     }
@@ -517,7 +583,9 @@ void addReplyLongLongWithPrefix(client *c, long long ll, char prefix) {
 }
 
 void addReplyLongLong(client *c, long long ll) {
-    if (ll == 0)
+    if (c->flags & CLIENT_LUA_DIRECT_REPLY)
+        luaReplyInteger(ll);
+    else if (ll == 0)
         addReply(c,shared.czero);
     else if (ll == 1)
         addReply(c,shared.cone);
@@ -526,7 +594,9 @@ void addReplyLongLong(client *c, long long ll) {
 }
 
 void addReplyMultiBulkLen(client *c, long length) {
-    if (length < OBJ_SHARED_BULKHDR_LEN)
+    if (c->flags & CLIENT_LUA_DIRECT_REPLY)
+        luaReplyArray(length);
+    else if (length < OBJ_SHARED_BULKHDR_LEN)
         addReply(c,shared.mbulkhdr[length]);
     else
         addReplyLongLongWithPrefix(c,length,'*');
@@ -560,6 +630,16 @@ void addReplyBulkLen(client *c, robj *obj) {
 
 /* Add a Redis Object as a bulk reply */
 void addReplyBulk(client *c, robj *obj) {
+    if (c->flags & CLIENT_LUA_DIRECT_REPLY) {
+        if (sdsEncodedObject(obj)) {
+            luaReplyBulk(obj->ptr,sdslen(obj->ptr));
+        } else {
+            char buf[32];
+            size_t len = ll2string(buf,sizeof(buf),(long)obj->ptr);
+            luaReplyBulk(buf,len);
+        }
+        return;
+    }
     addReplyBulkLen(c,obj);
     addReply(c,obj);
     addReply(c,shared.crlf);
@@ -567,6 +647,10 @@ void addReplyBulk(client *c, robj *obj) {
 
 /* Add a C buffer as bulk reply */
 void addReplyBulkCBuffer(client *c, const void *p, size_t len) {
+    if (c->flags & CLIENT_LUA_DIRECT_REPLY) {
+        luaReplyBulk(p,len);
+        return;
+    }
     addReplyLongLongWithPrefix(c,len,'$');
     addReplyString(c,p,len);
     addReply(c,shared.crlf);
@@ -574,6 +658,11 @@ void addReplyBulkCBuffer(client *c, const void *p, size_t len) {
 
 /* Add sds to reply (takes ownership of sds and frees it) */
 void addReplyBulkSds(client *c, sds s)  {
+    if (c->flags & CLIENT_LUA_DIRECT_REPLY) {
+        luaReplyBulk(s,sdslen(s));
+        sdsfree(s);
+        return;
+    }
     addReplyLongLongWithPrefix(c,sdslen(s),'$');
     addReplySds(c,s);
     addReply(c,shared.crlf);
@@ -582,7 +671,10 @@ void addReplyBulkSds(client *c, sds s)  {
 /* Add a C null term string as bulk reply */
 void addReplyBulkCString(client *c, const char *s) {
     if (s == NULL) {
-        addReply(c,shared.nullbulk);
+        if (c->flags & CLIENT_LUA_DIRECT_REPLY)
+            luaReplyNull();
+        else
+            addReply(c,shared.nullbulk);
     } else {
         addReplyBulkCBuffer(c,s,strlen(s));
     }
@@ -881,18 +973,23 @@ void freeClient(client *c) {
     sdsfree(c->pending_querybuf);
     c->querybuf = NULL;
 
-    /* Deallocate structures used to block on blocking ops. */
+    /* Deallocate structures used to block on blocking ops. The client will
+     * never get a reply, so don't record its latency when unblocking it. */
+    c->read_ustime = 0;
     if (c->flags & CLIENT_BLOCKED) unblockClient(c);
     dictRelease(c->bpop.keys);
 
     /* UNWATCH all the keys */
     unwatchAllKeys(c);
+    disableTracking(c);
     listRelease(c->watched_keys);
 
     /* Unsubscribe from all the pubsub channels */
     pubsubUnsubscribeAllChannels(c,0);
     pubsubUnsubscribeAllPatterns(c,0);
+    pubsubUnsubscribeAllShardChannels(c,0);
     dictRelease(c->pubsub_channels);
+    dictRelease(c->pubsubshard_channels);
     listRelease(c->pubsub_patterns);
 
     /* Free data structures. */
@@ -1072,7 +1169,9 @@ int writeToClient(int fd, client *c, int handler_installed) {
 void sendReplyToClient(aeEventLoop *el, int fd, void *privdata, int mask) {
     UNUSED(el);
     UNUSED(mask);
+    int old_phase = elPhaseEnter(EL_PHASE_WRITE);
     writeToClient(fd,privdata,1);
+    elPhaseRestore(old_phase);
 }
 
 /* This function is called just before entering the event loop, in the hope
@@ -1083,6 +1182,8 @@ int handleClientsWithPendingWrites(void) {
     listIter li;
     listNode *ln;
     int processed = listLength(server.clients_pending_write);
+    if (processed == 0) return 0;
+    int old_phase = elPhaseEnter(EL_PHASE_WRITE);
 
     listRewind(server.clients_pending_write,&li);
     while((ln = listNext(&li))) {
@@ -1118,6 +1219,7 @@ int handleClientsWithPendingWrites(void) {
             }
         }
     }
+    elPhaseRestore(old_phase);
     return processed;
 }
 
@@ -1422,6 +1524,7 @@ int processMultibulkBuffer(client *c) {
  * or because a client was blocked and later reactivated, so there could be
  * pending query buffer, already representing a full command, to process. */
 void processInputBuffer(client *c) {
+    int old_phase = elPhaseEnter(EL_PHASE_PARSE);
     server.current_client = c;
 
     /* Keep processing while there is something in the input buffer */
@@ -1494,6 +1597,7 @@ void processInputBuffer(client *c) {
     }
 
     server.current_client = NULL;
+    elPhaseRestore(old_phase);
 }
 
 /* This is a wrapper for processInputBuffer that also cares about handling
@@ -1519,6 +1623,8 @@ void readQueryFromClient(aeEventLoop *el, int fd, void *privdata, int mask) {
     client *c = (client*) privdata;
     int nread, readlen;
     size_t qblen;
+    long long now;
+    int old_phase = elPhaseEnter(EL_PHASE_READ);
     UNUSED(el);
     UNUSED(mask);
 
@@ -1545,15 +1651,18 @@ void readQueryFromClient(aeEventLoop *el, int fd, void *privdata, int mask) {
     nread = read(fd, c->querybuf+qblen, readlen);
     if (nread == -1) {
         if (errno == EAGAIN) {
+            elPhaseRestore(old_phase);
             return;
         } else {
             serverLog(LL_VERBOSE, "Reading from client: %s",strerror(errno));
             freeClient(c);
+            elPhaseRestore(old_phase);
             return;
         }
     } else if (nread == 0) {
         serverLog(LL_VERBOSE, "Client closed connection");
         freeClient(c);
+        elPhaseRestore(old_phase);
         return;
     } else if (c->flags & CLIENT_MASTER) {
         /* Append the query buffer to the pending (not applied) buffer
@@ -1565,6 +1674,11 @@ void readQueryFromClient(aeEventLoop *el, int fd, void *privdata, int mask) {
 
     sdsIncrLen(c->querybuf,nread);
     c->lastinteraction = server.unixtime;
+    if (server.eventloop_profiling || server.latency_tracking_enabled) {
+        now = ustime();
+        elPhaseRestoreAt(old_phase,now);
+        if (server.latency_tracking_enabled) c->read_ustime = now;
+    }
     if (c->flags & CLIENT_MASTER) c->read_reploff += nread;
     server.stat_net_input_bytes += nread;
     if (sdslen(c->querybuf) > server.client_max_querybuf_len) {
@@ -1658,12 +1772,13 @@ sds catClientInfoString(sds s, client *client) {
     if (client->flags & CLIENT_PUBSUB) *p++ = 'P';
     if (client->flags & CLIENT_MULTI) *p++ = 'x';
     if (client->flags & CLIENT_BLOCKED) *p++ = 'b';
-    if (client->flags & CLIENT_DIRTY_CAS) *p++ = 'd';
+    if (isWatchedKeyTouched(client)) *p++ = 'd';
     if (client->flags & CLIENT_CLOSE_AFTER_REPLY) *p++ = 'c';
     if (client->flags & CLIENT_UNBLOCKED) *p++ = 'u';
     if (client->flags & CLIENT_CLOSE_ASAP) *p++ = 'A';
     if (client->flags & CLIENT_UNIX_SOCKET) *p++ = 'U';
     if (client->flags & CLIENT_READONLY) *p++ = 'r';
+    if (client->flags & CLIENT_TRACKING) *p++ = 't';
     if (p == flags) *p++ = 'N';
     *p++ = '\0';
 
@@ -1673,7 +1788,7 @@ sds catClientInfoString(sds s, client *client) {
     if (emask & AE_WRITABLE) *p++ = 'w';
     *p = '\0';
     return sdscatfmt(s,
-        "id=%U addr=%s fd=%i name=%s age=%I idle=%I flags=%s db=%i sub=%i psub=%i multi=%i qbuf=%U qbuf-free=%U obl=%U oll=%U omem=%U events=%s cmd=%s",
+        "id=%U addr=%s fd=%i name=%s age=%I idle=%I flags=%s db=%i sub=%i psub=%i ssub=%i multi=%i qbuf=%U qbuf-free=%U obl=%U oll=%U omem=%U events=%s cmd=%s",
         (unsigned long long) client->id,
         getClientPeerId(client),
         client->fd,
@@ -1684,6 +1799,7 @@ sds catClientInfoString(sds s, client *client) {
         client->db->id,
         (int) dictSize(client->pubsub_channels),
         (int) listLength(client->pubsub_patterns),
+        (int) dictSize(client->pubsubshard_channels),
         (client->flags & CLIENT_MULTI) ? client->mstate.count : -1,
         (unsigned long long) sdslen(client->querybuf),
         (unsigned long long) sdsavail(client->querybuf),
@@ -1730,6 +1846,7 @@ void clientCommand(client *c) {
 "reply (on|off|skip)    -- Control the replies sent to the current connection.",
 "setname <name>         -- Assign the name <name> to the current connection.",
 "unblock <clientid> [TIMEOUT|ERROR] -- Unblock the specified blocked client.",
+"tracking (on|off) [REDIRECT <id>] -- Enable client keys tracking for client side caching.",
 NULL
         };
         addReplyHelp(c, help);
@@ -1925,6 +2042,47 @@ NULL
                                         != C_OK) return;
         pauseClients(duration);
         addReply(c,shared.ok);
+    } else if (!strcasecmp(c->argv[1]->ptr,"tracking") &&
+               (c->argc == 3 || c->argc == 5))
+    {
+        /* CLIENT TRACKING (on|off) [REDIRECT <id>] */
+        long long redir = 0;
+
+        if (c->argc == 5) {
+            if (strcasecmp(c->argv[3]->ptr,"redirect")) {
+                addReply(c,shared.syntaxerr);
+                return;
+            }
+            if (getLongLongFromObjectOrReply(c,c->argv[4],&redir,NULL) !=
+                C_OK) return;
+            /* We will require the client with the specified ID to exist
+             * right now, even if it is possible that it gets disconnected
+             * later. */
+            if (lookupClientByID(redir) == NULL) {
+                addReplyError(c,"The client ID you want redirect to "
+                                "does not exist");
+                return;
+            }
+        }
+
+        if (!strcasecmp(c->argv[2]->ptr,"on")) {
+            /* RESP2 can't mix invalidation messages with the replies of
+             * the normal commands, so another connection, subscribed to
+             * the __redis__:invalidate channel, is required. */
+            if (redir == 0 || (uint64_t)redir == c->id) {
+                addReplyError(c,"Tracking requires a REDIRECT to another "
+                                "connection subscribed to "
+                                "__redis__:invalidate");
+                return;
+            }
+            enableTracking(c,redir);
+        } else if (!strcasecmp(c->argv[2]->ptr,"off")) {
+            disableTracking(c);
+        } else {
+            addReply(c,shared.syntaxerr);
+            return;
+        }
+        addReply(c,shared.ok);
     } else {
         addReplyErrorFormat(c, "Unknown subcommand or wrong number of arguments for '%s'. Try CLIENT HELP", (char*)c->argv[1]->ptr);
     }
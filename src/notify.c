@@ -105,6 +105,10 @@ void notifyKeyspaceEvent(int type, char *event, robj *key, int dbid) {
      * will only call event subscribers if the event type matches the types
      * they are interested in. */
      moduleNotifyKeyspaceEvent(type, event, key, dbid);
+
+    /* Keys expired or evicted don't pass via signalModifiedKey(), but the
+     * clients caching them must be notified as well. */
+    if (type & (NOTIFY_EXPIRED|NOTIFY_EVICTED)) trackingInvalidateKey(key);
     
     /* If notifications for this class of events are off, return ASAP. */
     if (!(server.notify_keyspace_events & type)) return;
@@ -119,6 +119,53 @@ robj *createEmbeddedStringObject(const char *ptr, size_t len) {
     return o;
 }
 
+/* Return the inline representation of the string object 'o' (see the
+ * OBJ_INLINE_* defines in server.h), or NULL if it is not small enough or
+ * not worth it: shared integers don't use any memory per key already.
+ * 小整数和短字符串可以直接存放在dictEntry中，不需要分配robj。 */
+void *objectToInline(robj *o) {
+    if (o->type != OBJ_STRING || o->refcount == OBJ_SHARED_REFCOUNT)
+        return NULL;
+
+    if (o->encoding == OBJ_ENCODING_INT) {
+        long value = (long)o->ptr;
+        if (value < OBJ_INLINE_INT_MIN || value > OBJ_INLINE_INT_MAX)
+            return NULL;
+        return (void*)(((uintptr_t)value << 2) | OBJ_INLINE_TAG);
+    } else if (o->encoding == OBJ_ENCODING_EMBSTR) {
+        size_t len = sdslen(o->ptr);
+        unsigned char *p = o->ptr;
+        uintptr_t v;
+
+        if (len > OBJ_INLINE_STR_MAXLEN) return NULL;
+        v = (len << 2) | OBJ_INLINE_STR | OBJ_INLINE_TAG;
+        for (size_t j = 0; j < len; j++) v |= (uintptr_t)p[j] << ((j+1)*8);
+        return (void*)v;
+    }
+    return NULL;
+}
+
+/* Create a new object from the inline value 'v'. The encoding is the one
+ * the value had before objectToInline() was called. Inline values have no
+ * access time: like any new object, the access time is set to the current
+ * one by createObject(). */
+robj *createObjectFromInline(void *v) {
+    uintptr_t u = (uintptr_t)v;
+    robj *o;
+
+    if (u & OBJ_INLINE_STR) {
+        char buf[sizeof(void*)];
+        size_t len = (u >> 2) & 7;
+
+        for (size_t j = 0; j < len; j++) buf[j] = (u >> ((j+1)*8)) & 0xff;
+        o = createEmbeddedStringObject(buf,len);
+    } else {
+        o = createObject(OBJ_STRING,(void*)(long)((intptr_t)u >> 2));
+        o->encoding = OBJ_ENCODING_INT;
+    }
+    return o;
+}
+
 /* Create a string object with EMBSTR encoding if it is smaller than
  * OBJ_ENCODING_EMBSTR_SIZE_LIMIT, otherwise the RAW encoding is
  * used.
@@ -257,9 +304,9 @@ robj *createIntsetObject(void) {
 }
 
 robj *createHashObject(void) {
-    unsigned char *zl = ziplistNew();
-    robj *o = createObject(OBJ_HASH, zl);
-    o->encoding = OBJ_ENCODING_ZIPLIST;
+    unsigned char *lp = lpNew(0);
+    robj *o = createObject(OBJ_HASH, lp);
+    o->encoding = OBJ_ENCODING_LISTPACK;
     return o;
 }
 
@@ -274,10 +321,10 @@ robj *createZsetObject(void) {
     return o;
 }
 
-robj *createZsetZiplistObject(void) {
-    unsigned char *zl = ziplistNew();
-    robj *o = createObject(OBJ_ZSET,zl);
-    o->encoding = OBJ_ENCODING_ZIPLIST;
+robj *createZsetListpackObject(void) {
+    unsigned char *lp = lpNew(0);
+    robj *o = createObject(OBJ_ZSET,lp);
+    o->encoding = OBJ_ENCODING_LISTPACK;
     return o;
 }
 
@@ -331,8 +378,8 @@ void freeZsetObject(robj *o) {
         zslFree(zs->zsl);
         zfree(zs);
         break;
-    case OBJ_ENCODING_ZIPLIST:
-        zfree(o->ptr);
+    case OBJ_ENCODING_LISTPACK:
+        lpFree(o->ptr);
         break;
     default:
         serverPanic("Unknown sorted set encoding");
@@ -344,8 +391,8 @@ void freeHashObject(robj *o) {
     case OBJ_ENCODING_HT:
         dictRelease((dict*) o->ptr);
         break;
-    case OBJ_ENCODING_ZIPLIST:
-        zfree(o->ptr);
+    case OBJ_ENCODING_LISTPACK:
+        lpFree(o->ptr);
         break;
     default:
         serverPanic("Unknown hash encoding type");
@@ -779,6 +826,7 @@ char *strEncoding(int encoding) {
     case OBJ_ENCODING_HT: return "hashtable";
     case OBJ_ENCODING_QUICKLIST: return "quicklist";
     case OBJ_ENCODING_ZIPLIST: return "ziplist";
+    case OBJ_ENCODING_LISTPACK: return "listpack";
     case OBJ_ENCODING_INTSET: return "intset";
     case OBJ_ENCODING_SKIPLIST: return "skiplist";
     case OBJ_ENCODING_EMBSTR: return "embstr";
@@ -819,9 +867,8 @@ size_t streamRadixTreeMemoryUsage(rax *rax) {
 /* Returns the size in bytes consumed by the key's value in RAM.
  * Note that the returned value is just an approximation, especially in the
  * case of aggregated data types where only "sample_size" elements
- * are checked and averaged to estimate the total size. *
- * 返回键值在RAM中所消耗的字节数。请注意，返回值只是一个近似值，特别是在只检查和平均“sample_size”元素以估计总大小的聚合数据类型的情况下/
-#define OBJ_COMPUTE_SIZE_DEF_SAMPLES 5 /* Default sample size. */
+ * are checked and averaged to estimate the total size.
+ * 返回键值在RAM中所消耗的字节数。请注意，返回值只是一个近似值，特别是在只检查和平均“sample_size”元素以估计总大小的聚合数据类型的情况下 */
 size_t objectComputeSize(robj *o, size_t sample_size) {
     sds ele, ele2;
     dict *d;
@@ -845,7 +892,7 @@ size_t objectComputeSize(robj *o, size_t sample_size) {
             quicklistNode *node = ql->head;
             asize = sizeof(*o)+sizeof(quicklist);
             do {
-                elesize += sizeof(quicklistNode)+ziplistBlobLen(node->zl);
+                elesize += sizeof(quicklistNode)+node->sz;
                 samples++;
             } while ((node = node->next) && samples < sample_size);
             asize += (double)elesize/samples*ql->len;
@@ -873,8 +920,8 @@ size_t objectComputeSize(robj *o, size_t sample_size) {
             serverPanic("Unknown set encoding");
         }
     } else if (o->type == OBJ_ZSET) {
-        if (o->encoding == OBJ_ENCODING_ZIPLIST) {
-            asize = sizeof(*o)+(ziplistBlobLen(o->ptr));
+        if (o->encoding == OBJ_ENCODING_LISTPACK) {
+            asize = sizeof(*o)+(lpBytes(o->ptr));
         } else if (o->encoding == OBJ_ENCODING_SKIPLIST) {
             d = ((zset*)o->ptr)->dict;
             zskiplist *zsl = ((zset*)o->ptr)->zsl;
@@ -891,8 +938,8 @@ size_t objectComputeSize(robj *o, size_t sample_size) {
             serverPanic("Unknown sorted set encoding");
         }
     } else if (o->type == OBJ_HASH) {
-        if (o->encoding == OBJ_ENCODING_ZIPLIST) {
-            asize = sizeof(*o)+(ziplistBlobLen(o->ptr));
+        if (o->encoding == OBJ_ENCODING_LISTPACK) {
+            asize = sizeof(*o)+(lpBytes(o->ptr));
         } else if (o->encoding == OBJ_ENCODING_HT) {
             d = o->ptr;
             di = dictGetIterator(d);
@@ -952,6 +999,7 @@ size_t objectComputeSize(robj *o, size_t sample_size) {
                 asize += sizeof(*cg);
                 asize += streamRadixTreeMemoryUsage(cg->pel);
                 asize += sizeof(streamNACK)*raxSize(cg->pel);
+                asize += streamRadixTreeMemoryUsage(cg->pel_by_time);
 
                 /* For each consumer we also need to add the basic data
                  * structures and the PEL memory usage. */
@@ -984,6 +1032,121 @@ size_t objectComputeSize(robj *o, size_t sample_size) {
     return asize;
 }
 
+/* Helpers for objectAllocSize(). */
+static size_t dictAllocSize(dict *d, int sdskeys, int sdsvals) {
+    size_t asize = zmalloc_size(d);
+
+    for (int t = 0; t < 2; t++) {
+        dictht *ht = &d->ht[t];
+        if (ht->table == NULL) continue;
+        asize += zmalloc_size(ht->table);
+        for (unsigned long j = 0; j < ht->size; j++) {
+            dictEntry *de = ht->table[j];
+            while(de) {
+                asize += zmalloc_size(de);
+                if (sdskeys) asize += sdsZmallocSize(dictGetKey(de));
+                if (sdsvals) asize += sdsZmallocSize(dictGetVal(de));
+                de = de->next;
+            }
+        }
+    }
+    return asize;
+}
+
+static size_t listpackAllocSize(void *lp) {
+    return zmalloc_size(lp);
+}
+
+static size_t streamNACKAllocSize(void *nack) {
+    return zmalloc_size(nack);
+}
+
+static size_t streamConsumerAllocSize(void *ptr) {
+    streamConsumer *consumer = ptr;
+    /* NACKs are shared with the consumer group PEL, don't count them
+     * twice. */
+    return zmalloc_size(consumer) + sdsZmallocSize(consumer->name) +
+           raxAllocSize(consumer->pel,NULL);
+}
+
+static size_t streamCGAllocSize(void *ptr) {
+    streamCG *cg = ptr;
+    return zmalloc_size(cg) +
+           raxAllocSize(cg->pel,streamNACKAllocSize) +
+           raxAllocSize(cg->pel_by_time,NULL) +
+           raxAllocSize(cg->consumers,streamConsumerAllocSize);
+}
+
+/* Return the exact number of bytes allocated for the object, that is, the
+ * amount zmalloc_used_memory() would drop if the object was released.
+ * Unlike objectComputeSize() this always visits every element, so it is
+ * O(N) for the aggregated types that are not encoded as a single blob: it
+ * is used by the key memory accounting only when the size of a value can't
+ * be tracked incrementally. Shared objects are not counted. */
+size_t objectAllocSize(robj *o) {
+    size_t asize;
+
+    /* Inline values live inside the dictEntry. */
+    if (objIsInline(o) || o->refcount == OBJ_SHARED_REFCOUNT) return 0;
+    asize = zmalloc_size(o);
+    if (o->type == OBJ_STRING) {
+        if (o->encoding == OBJ_ENCODING_RAW) asize += sdsZmallocSize(o->ptr);
+    } else if (o->type == OBJ_LIST) {
+        if (o->encoding == OBJ_ENCODING_QUICKLIST) {
+            quicklist *ql = o->ptr;
+            quicklistNode *node = ql->head;
+            asize += zmalloc_size(ql);
+            while(node) {
+                asize += zmalloc_size(node) + zmalloc_size(node->entry);
+                node = node->next;
+            }
+        } else {
+            asize += zmalloc_size(o->ptr);
+        }
+    } else if (o->type == OBJ_SET) {
+        if (o->encoding == OBJ_ENCODING_HT) {
+            asize += dictAllocSize(o->ptr,1,0);
+        } else {
+            asize += zmalloc_size(o->ptr);
+        }
+    } else if (o->type == OBJ_ZSET) {
+        if (o->encoding == OBJ_ENCODING_SKIPLIST) {
+            zset *zs = o->ptr;
+            zskiplistNode *znode = zs->zsl->header;
+            /* The elements are shared between the dict and the skiplist,
+             * and the dict values point inside the skiplist nodes. */
+            asize += zmalloc_size(zs) + zmalloc_size(zs->zsl) +
+                     dictAllocSize(zs->dict,0,0);
+            while(znode) {
+                asize += zmalloc_size(znode);
+                if (znode->ele) asize += sdsZmallocSize(znode->ele);
+                znode = znode->level[0].forward;
+            }
+        } else {
+            asize += zmalloc_size(o->ptr);
+        }
+    } else if (o->type == OBJ_HASH) {
+        if (o->encoding == OBJ_ENCODING_HT) {
+            asize += dictAllocSize(o->ptr,1,1);
+        } else {
+            asize += zmalloc_size(o->ptr);
+        }
+    } else if (o->type == OBJ_STREAM) {
+        stream *s = o->ptr;
+        asize += zmalloc_size(s) + raxAllocSize(s->rax,listpackAllocSize);
+        if (s->tail_fields) asize += sdsZmallocSize(s->tail_fields);
+        if (s->cgroups) asize += raxAllocSize(s->cgroups,streamCGAllocSize);
+    } else if (o->type == OBJ_MODULE) {
+        moduleValue *mv = o->ptr;
+        moduleType *mt = mv->type;
+        asize += zmalloc_size(mv);
+        if (mt->mem_usage != NULL) asize += mt->mem_usage(mv->value);
+    } else {
+        serverPanic("Unknown object type");
+    }
+    return asize;
+}
+
 /* Release data obtained with getMemoryOverheadData(). */
 void freeMemoryOverheadData(struct redisMemOverhead *mh) {
     zfree(mh->db);
@@ -1079,6 +1242,7 @@ struct redisMemOverhead *getMemoryOverheadData(void) {
         mem += listLength(server.repl_scriptcache_fifo) * (sizeof(listNode) + 
             sdsZmallocSize(listNodeValue(listFirst(server.repl_scriptcache_fifo))));
     }
+    mem += server.lua_results_mem;
     mh->lua_caches = mem;
     mem_total+=mem;
 
@@ -1276,16 +1440,28 @@ void objectSetLRUOrLFU(robj *val, long long lfu_freq, long long lru_idle,
 /* ======================= The OBJECT and MEMORY commands =================== */
 
 /* This is a helper function for the OBJECT command. We need to lookup keys
- * without any modification of LRU or other parameters. */
-robj *objectCommandLookup(client *c, robj *key) {
+ * without any modification of LRU or other parameters.
+ *
+ * Inline values are returned as a new object that is not stored back into
+ * the dictionary, since introspection should not change how the value is
+ * stored: in this case '*inlined' is set to 1 and the caller must release
+ * the object with decrRefCount(). */
+robj *objectCommandLookup(client *c, robj *key, int *inlined) {
     dictEntry *de;
+    robj *val;
 
+    *inlined = 0;
     if ((de = dictFind(c->db->dict,key->ptr)) == NULL) return NULL;
-    return (robj*) dictGetVal(de);
+    val = dictGetVal(de);
+    if (objIsInline(val)) {
+        *inlined = 1;
+        return createObjectFromInline(val);
+    }
+    return val;
 }
 
-robj *objectCommandLookupOrReply(client *c, robj *key, robj *reply) {
-    robj *o = objectCommandLookup(c,key);
+robj *objectCommandLookupOrReply(client *c, robj *key, robj *reply, int *inlined) {
+    robj *o = objectCommandLookup(c,key,inlined);
 
     if (!o) addReply(c, reply);
     return o;
@@ -1295,6 +1471,7 @@ robj *objectCommandLookupOrReply(client *c, robj *key, robj *reply) {
  * Usage: OBJECT <refcount|encoding|idletime|freq> <key> */
 void objectCommand(client *c) {
     robj *o;
+    int inlined;
 
     if (c->argc == 2 && !strcasecmp(c->argv[1]->ptr,"help")) {
         const char *help[] = {
@@ -1306,33 +1483,37 @@ NULL
         };
         addReplyHelp(c, help);
     } else if (!strcasecmp(c->argv[1]->ptr,"refcount") && c->argc == 3) {
-        if ((o = objectCommandLookupOrReply(c,c->argv[2],shared.nullbulk))
-                == NULL) return;
+        if ((o = objectCommandLookupOrReply(c,c->argv[2],shared.nullbulk,
+                &inlined)) == NULL) return;
         addReplyLongLong(c,o->refcount);
+        if (inlined) decrRefCount(o);
     } else if (!strcasecmp(c->argv[1]->ptr,"encoding") && c->argc == 3) {
-        if ((o = objectCommandLookupOrReply(c,c->argv[2],shared.nullbulk))
-                == NULL) return;
+        if ((o = objectCommandLookupOrReply(c,c->argv[2],shared.nullbulk,
+                &inlined)) == NULL) return;
         addReplyBulkCString(c,strEncoding(o->encoding));
+        if (inlined) decrRefCount(o);
     } else if (!strcasecmp(c->argv[1]->ptr,"idletime") && c->argc == 3) {
-        if ((o = objectCommandLookupOrReply(c,c->argv[2],shared.nullbulk))
-                == NULL) return;
+        if ((o = objectCommandLookupOrReply(c,c->argv[2],shared.nullbulk,
+                &inlined)) == NULL) return;
         if (server.maxmemory_policy & MAXMEMORY_FLAG_LFU) {
             addReplyError(c,"An LFU maxmemory policy is selected, idle time not tracked. Please note that when switching between policies at runtime LRU and LFU data will take some time to adjust.");
-            return;
+        } else {
+            addReplyLongLong(c,estimateObjectIdleTime(o)/1000);
         }
-        addReplyLongLong(c,estimateObjectIdleTime(o)/1000);
+        if (inlined) decrRefCount(o);
     } else if (!strcasecmp(c->argv[1]->ptr,"freq") && c->argc == 3) {
-        if ((o = objectCommandLookupOrReply(c,c->argv[2],shared.nullbulk))
-                == NULL) return;
+        if ((o = objectCommandLookupOrReply(c,c->argv[2],shared.nullbulk,
+                &inlined)) == NULL) return;
         if (!(server.maxmemory_policy & MAXMEMORY_FLAG_LFU)) {
             addReplyError(c,"An LFU maxmemory policy is not selected, access frequency not tracked. Please note that when switching between policies at runtime LRU and LFU data will take some time to adjust.");
-            return;
+        } else {
+            /* LFUDecrAndReturn should be called
+             * in case of the key has not been accessed for a long time,
+             * because we update the access time only
+             * when the key is read or overwritten. */
+            addReplyLongLong(c,LFUDecrAndReturn(o));
         }
-        /* LFUDecrAndReturn should be called
-         * in case of the key has not been accessed for a long time,
-         * because we update the access time only
-         * when the key is read or overwritten. */
-        addReplyLongLong(c,LFUDecrAndReturn(o));
+        if (inlined) decrRefCount(o);
     } else {
         addReplySubcommandSyntaxError(c);
     }
@@ -1349,13 +1530,14 @@ void memoryCommand(client *c) {
 "MALLOC-STATS -- Return internal statistics report from the memory allocator.",
 "PURGE -- Attempt to purge dirty pages for reclamation by the allocator.",
 "STATS -- Return information about the memory usage of the server.",
-"USAGE <key> [SAMPLES <count>] -- Return memory in bytes used by <key> and its value. Nested values are sampled up to <count> times (default: 5).",
+"USAGE <key> [SAMPLES <count>] -- Return memory in bytes used by <key> and its value. Nested values are sampled up to <count> times (default: 5), unless key-memory-tracking is enabled and SAMPLES is not given.",
 NULL
         };
         addReplyHelp(c, help);
     } else if (!strcasecmp(c->argv[1]->ptr,"usage") && c->argc >= 3) {
         dictEntry *de;
         long long samples = OBJ_COMPUTE_SIZE_DEF_SAMPLES;
+        int tracked = server.key_memory_tracking;
         for (int j = 3; j < c->argc; j++) {
             if (!strcasecmp(c->argv[j]->ptr,"samples") &&
                 j+1 < c->argc)
@@ -1367,6 +1549,7 @@ NULL
                     return;
                 }
                 if (samples == 0) samples = LLONG_MAX;;
+                tracked = 0;
                 j++; /* skip option argument. */
             } else {
                 addReply(c,shared.syntaxerr);
@@ -1377,7 +1560,10 @@ NULL
             addReply(c, shared.nullbulk);
             return;
         }
-        size_t usage = objectComputeSize(dictGetVal(de),samples);
+        robj *val = dictGetVal(de);
+        long long size = tracked ? keymemGetSize(c->db,dictGetKey(de)) : -1;
+        size_t usage = size != -1 ? (size_t)size :
+                       objIsInline(val) ? 0 : objectComputeSize(val,samples);
         usage += sdsAllocSize(dictGetKey(de));
         usage += sizeof(dictEntry);
         addReplyLongLong(c,usage);
@@ -28,23 +28,65 @@
  */
 
 #include "server.h"
+#include "cluster.h"
+
+/* Messages of at least this size are serialized once and shared by the
+ * output buffers of all the receivers, see pubsubPublishMessage(). */
+#define PUBSUB_SHARED_MESSAGE_MIN_LEN 1024
 
 /*-----------------------------------------------------------------------------
  * Pubsub low level API
  *----------------------------------------------------------------------------*/
 
-void freePubsubPattern(void *p) {
-    pubsubPattern *pat = p;
+/* The patterns are deduplicated in server.pubsub_patterns, that maps every
+ * pattern to the list of the subscribed clients, and indexed by their
+ * literal prefix, that is the part before the first special character, in
+ * the server.pubsub_patterns_index radix tree, where every prefix is
+ * associated to the list of the patterns starting with it. A channel can
+ * only match the patterns having as prefix a prefix of the channel name
+ * itself: so PUBLISH finds them with a single walk of the tree, and calls
+ * stringmatchlen() only for such candidates, skipping the prefix that is
+ * already known to match.
+ *
+ * 模式订阅按字面前缀索引在rax中，PUBLISH只匹配前缀相符的候选模式。 */
 
-    decrRefCount(pat->pattern);
-    zfree(pat);
+/* Return the length of the literal prefix of the pattern. */
+static size_t pubsubPatternPrefixLen(sds pattern) {
+    size_t len = strcspn(pattern,"*?[\\");
+    return len < sdslen(pattern) ? len : sdslen(pattern);
 }
 
-int listMatchPubsubPattern(void *a, void *b) {
-    pubsubPattern *pa = a, *pb = b;
+/* Add the pattern to the index. The index holds a reference. */
+static void pubsubIndexPattern(robj *pattern) {
+    unsigned char *prefix = pattern->ptr;
+    size_t prefixlen = pubsubPatternPrefixLen(pattern->ptr);
+    list *patterns = raxFind(server.pubsub_patterns_index,prefix,prefixlen);
 
-    return (pa->client == pb->client) &&
-           (equalStringObjects(pa->pattern,pb->pattern));
+    if (patterns == raxNotFound) {
+        patterns = listCreate();
+        listSetFreeMethod(patterns,decrRefCountVoid);
+        raxInsert(server.pubsub_patterns_index,prefix,prefixlen,patterns,NULL);
+    }
+    listAddNodeTail(patterns,pattern);
+    incrRefCount(pattern);
+}
+
+/* Remove the pattern from the index. Patterns are compared by pointer, as
+ * the index references the same object used as key in the patterns table. */
+static void pubsubUnindexPattern(robj *pattern) {
+    unsigned char *prefix = pattern->ptr;
+    size_t prefixlen = pubsubPatternPrefixLen(pattern->ptr);
+    list *patterns = raxFind(server.pubsub_patterns_index,prefix,prefixlen);
+    listNode *ln;
+
+    serverAssert(patterns != raxNotFound);
+    ln = listSearchKey(patterns,pattern);
+    serverAssert(ln != NULL);
+    listDelNode(patterns,ln);
+    if (listLength(patterns) == 0) {
+        raxRemove(server.pubsub_patterns_index,prefix,prefixlen,NULL);
+        listRelease(patterns);
+    }
 }
 
 /* Return the number of channels + patterns a client is subscribed to. */
@@ -53,23 +95,104 @@ int clientSubscriptionsCount(client *c) {
            listLength(c->pubsub_patterns);
 }
 
+/* Return the number of shard channels a client is subscribed to. */
+int clientShardSubscriptionsCount(client *c) {
+    return dictSize(c->pubsubshard_channels);
+}
+
+/* Return the number of subscriptions of any kind of the client: when it
+ * drops to zero the client exits the Pub/Sub mode. */
+int clientTotalSubscriptionsCount(client *c) {
+    return clientSubscriptionsCount(c)+clientShardSubscriptionsCount(c);
+}
+
+static dict *getClientPubSubChannels(client *c) {
+    return c->pubsub_channels;
+}
+
+static dict *getClientPubSubShardChannels(client *c) {
+    return c->pubsubshard_channels;
+}
+
+/* Classic channels and shard channels (SSUBSCRIBE / SPUBLISH) are handled
+ * by the same code, this structure describes where the subscriptions of
+ * a given kind are stored and the messages sent to the clients. Shard
+ * channels are bound to the hash slot of their name: in cluster mode they
+ * only live in the shard (master and replicas) serving that slot. */
+typedef struct pubsubType {
+    int shard;
+    dict *(*clientChannels)(client *c);
+    int (*subscriptionCount)(client *c);
+    dict **serverChannels;
+    robj **subscribeMsg;
+    robj **unsubscribeMsg;
+    robj **messageBulk;
+} pubsubType;
+
+static pubsubType pubsubClassicType = {
+    0, getClientPubSubChannels, clientSubscriptionsCount,
+    &server.pubsub_channels, &shared.subscribebulk, &shared.unsubscribebulk,
+    &shared.messagebulk
+};
+
+static pubsubType pubsubShardType = {
+    1, getClientPubSubShardChannels, clientShardSubscriptionsCount,
+    &server.pubsubshard_channels, &shared.ssubscribebulk,
+    &shared.sunsubscribebulk, &shared.smessagebulk
+};
+
+/* In cluster mode the shard channels are also indexed by slot, exactly
+ * like the keys in slots_to_keys, so that the channels of a slot moving to
+ * another shard are found without scanning all of them. */
+static void pubsubShardSlotUpdate(robj *channel, int add) {
+    unsigned int hashslot = keyHashSlot(channel->ptr,sdslen(channel->ptr));
+    unsigned char buf[64];
+    unsigned char *indexed = buf;
+    size_t len = sdslen(channel->ptr);
+
+    if (len+2 > 64) indexed = zmalloc(len+2);
+    indexed[0] = (hashslot >> 8) & 0xff;
+    indexed[1] = hashslot & 0xff;
+    memcpy(indexed+2,channel->ptr,len);
+    if (add) {
+        raxInsert(server.cluster->slots_to_channels,indexed,len+2,NULL,NULL);
+    } else {
+        raxRemove(server.cluster->slots_to_channels,indexed,len+2,NULL);
+    }
+    if (indexed != buf) zfree(indexed);
+}
+
+/* Send the client the confirmation of the unsubscription from 'channel',
+ * that may be NULL if the client was subscribed to nothing. */
+static void addReplyPubsubUnsubscribed(client *c, robj *channel, pubsubType *type) {
+    addReply(c,shared.mbulkhdr[3]);
+    addReply(c,*type->unsubscribeMsg);
+    if (channel)
+        addReplyBulk(c,channel);
+    else
+        addReply(c,shared.nullbulk);
+    addReplyLongLong(c,type->subscriptionCount(c));
+}
+
 /* Subscribe a client to a channel. Returns 1 if the operation succeeded, or
  * 0 if the client was already subscribed to that channel. */
-int pubsubSubscribeChannel(client *c, robj *channel) {
+static int pubsubSubscribeChannelType(client *c, robj *channel, pubsubType *type) {
     dictEntry *de;
     list *clients = NULL;
     int retval = 0;
 
     /* Add the channel to the client -> channels hash table */
-    if (dictAdd(c->pubsub_channels,channel,NULL) == DICT_OK) {
+    if (dictAdd(type->clientChannels(c),channel,NULL) == DICT_OK) {
         retval = 1;
         incrRefCount(channel);
         /* Add the client to the channel -> list of clients hash table */
-        de = dictFind(server.pubsub_channels,channel);
+        de = dictFind(*type->serverChannels,channel);
         if (de == NULL) {
             clients = listCreate();
-            dictAdd(server.pubsub_channels,channel,clients);
+            dictAdd(*type->serverChannels,channel,clients);
             incrRefCount(channel);
+            if (type->shard && server.cluster_enabled)
+                pubsubShardSlotUpdate(channel,1);
         } else {
             clients = dictGetVal(de);
         }
@@ -77,15 +200,19 @@ int pubsubSubscribeChannel(client *c, robj *channel) {
     }
     /* Notify the client */
     addReply(c,shared.mbulkhdr[3]);
-    addReply(c,shared.subscribebulk);
+    addReply(c,*type->subscribeMsg);
     addReplyBulk(c,channel);
-    addReplyLongLong(c,clientSubscriptionsCount(c));
+    addReplyLongLong(c,type->subscriptionCount(c));
     return retval;
 }
 
+int pubsubSubscribeChannel(client *c, robj *channel) {
+    return pubsubSubscribeChannelType(c,channel,&pubsubClassicType);
+}
+
 /* Unsubscribe a client from a channel. Returns 1 if the operation succeeded, or
  * 0 if the client was not subscribed to the specified channel. */
-int pubsubUnsubscribeChannel(client *c, robj *channel, int notify) {
+static int pubsubUnsubscribeChannelType(client *c, robj *channel, int notify, pubsubType *type) {
     dictEntry *de;
     list *clients;
     listNode *ln;
@@ -94,10 +221,10 @@ int pubsubUnsubscribeChannel(client *c, robj *channel, int notify) {
     /* Remove the channel from the client -> channels hash table */
     incrRefCount(channel); /* channel may be just a pointer to the same object
                             we have in the hash tables. Protect it... */
-    if (dictDelete(c->pubsub_channels,channel) == DICT_OK) {
+    if (dictDelete(type->clientChannels(c),channel) == DICT_OK) {
         retval = 1;
         /* Remove the client from the channel -> clients list hash table */
-        de = dictFind(server.pubsub_channels,channel);
+        de = dictFind(*type->serverChannels,channel);
         serverAssertWithInfo(c,NULL,de != NULL);
         clients = dictGetVal(de);
         ln = listSearchKey(clients,c);
@@ -107,35 +234,44 @@ int pubsubUnsubscribeChannel(client *c, robj *channel, int notify) {
             /* Free the list and associated hash entry at all if this was
              * the latest client, so that it will be possible to abuse
              * Redis PUBSUB creating millions of channels. */
-            dictDelete(server.pubsub_channels,channel);
+            if (type->shard && server.cluster_enabled)
+                pubsubShardSlotUpdate(channel,0);
+            dictDelete(*type->serverChannels,channel);
         }
     }
     /* Notify the client */
-    if (notify) {
-        addReply(c,shared.mbulkhdr[3]);
-        addReply(c,shared.unsubscribebulk);
-        addReplyBulk(c,channel);
-        addReplyLongLong(c,dictSize(c->pubsub_channels)+
-                       listLength(c->pubsub_patterns));
-
-    }
+    if (notify) addReplyPubsubUnsubscribed(c,channel,type);
     decrRefCount(channel); /* it is finally safe to release it */
     return retval;
 }
 
+int pubsubUnsubscribeChannel(client *c, robj *channel, int notify) {
+    return pubsubUnsubscribeChannelType(c,channel,notify,&pubsubClassicType);
+}
+
 /* Subscribe a client to a pattern. Returns 1 if the operation succeeded, or 0 if the client was already subscribed to that pattern. */
 int pubsubSubscribePattern(client *c, robj *pattern) {
     int retval = 0;
 
     if (listSearchKey(c->pubsub_patterns,pattern) == NULL) {
+        dictEntry *de;
+        list *clients;
+
         retval = 1;
-        pubsubPattern *pat;
+        pattern = getDecodedObject(pattern);
         listAddNodeTail(c->pubsub_patterns,pattern);
-        incrRefCount(pattern);
-        pat = zmalloc(sizeof(*pat));
-        pat->pattern = getDecodedObject(pattern);
-        pat->client = c;
-        listAddNodeTail(server.pubsub_patterns,pat);
+        /* Add the client to the pattern -> list of clients hash table */
+        de = dictFind(server.pubsub_patterns,pattern);
+        if (de == NULL) {
+            clients = listCreate();
+            dictAdd(server.pubsub_patterns,pattern,clients);
+            incrRefCount(pattern);
+            pubsubIndexPattern(pattern);
+        } else {
+            clients = dictGetVal(de);
+        }
+        listAddNodeTail(clients,c);
+        server.pubsub_patterns_count++;
     }
     /* Notify the client */
     addReply(c,shared.mbulkhdr[3]);
@@ -148,18 +284,27 @@ int pubsubSubscribePattern(client *c, robj *pattern) {
 /* Unsubscribe a client from a channel. Returns 1 if the operation succeeded, or
  * 0 if the client was not subscribed to the specified channel. */
 int pubsubUnsubscribePattern(client *c, robj *pattern, int notify) {
+    dictEntry *de;
+    list *clients;
     listNode *ln;
-    pubsubPattern pat;
     int retval = 0;
 
     incrRefCount(pattern); /* Protect the object. May be the same we remove */
     if ((ln = listSearchKey(c->pubsub_patterns,pattern)) != NULL) {
         retval = 1;
         listDelNode(c->pubsub_patterns,ln);
-        pat.client = c;
-        pat.pattern = pattern;
-        ln = listSearchKey(server.pubsub_patterns,&pat);
-        listDelNode(server.pubsub_patterns,ln);
+        /* Remove the client from the pattern -> clients list hash table */
+        de = dictFind(server.pubsub_patterns,pattern);
+        serverAssertWithInfo(c,NULL,de != NULL);
+        clients = dictGetVal(de);
+        ln = listSearchKey(clients,c);
+        serverAssertWithInfo(c,NULL,ln != NULL);
+        listDelNode(clients,ln);
+        if (listLength(clients) == 0) {
+            pubsubUnindexPattern(dictGetKey(de));
+            dictDelete(server.pubsub_patterns,pattern);
+        }
+        server.pubsub_patterns_count--;
     }
     /* Notify the client */
     if (notify) {
@@ -175,28 +320,71 @@ int pubsubUnsubscribePattern(client *c, robj *pattern, int notify) {
 
 /* Unsubscribe from all the channels. Return the number of channels the
  * client was subscribed to. */
-int pubsubUnsubscribeAllChannels(client *c, int notify) {
-    dictIterator *di = dictGetSafeIterator(c->pubsub_channels);
+static int pubsubUnsubscribeAllChannelsType(client *c, int notify, pubsubType *type) {
+    dictIterator *di = dictGetSafeIterator(type->clientChannels(c));
     dictEntry *de;
     int count = 0;
 
     while((de = dictNext(di)) != NULL) {
         robj *channel = dictGetKey(de);
 
-        count += pubsubUnsubscribeChannel(c,channel,notify);
+        count += pubsubUnsubscribeChannelType(c,channel,notify,type);
     }
     /* We were subscribed to nothing? Still reply to the client. */
-    if (notify && count == 0) {
-        addReply(c,shared.mbulkhdr[3]);
-        addReply(c,shared.unsubscribebulk);
-        addReply(c,shared.nullbulk);
-        addReplyLongLong(c,dictSize(c->pubsub_channels)+
-                       listLength(c->pubsub_patterns));
-    }
+    if (notify && count == 0) addReplyPubsubUnsubscribed(c,NULL,type);
     dictReleaseIterator(di);
     return count;
 }
 
+int pubsubUnsubscribeAllChannels(client *c, int notify) {
+    return pubsubUnsubscribeAllChannelsType(c,notify,&pubsubClassicType);
+}
+
+int pubsubUnsubscribeAllShardChannels(client *c, int notify) {
+    return pubsubUnsubscribeAllChannelsType(c,notify,&pubsubShardType);
+}
+
+/* Called in cluster mode when the slot is no longer served by the shard
+ * of this node: the subscribers of the shard channels of the slot are
+ * unsubscribed, so that they can subscribe again to the new owner. */
+void pubsubUnsubscribeShardChannelsInSlot(unsigned int slot) {
+    unsigned char prefix[2] = {(slot >> 8) & 0xff, slot & 0xff};
+    raxIterator ri;
+
+    while(1) {
+        robj *channel;
+        list *clients;
+        listNode *ln;
+        listIter li;
+
+        /* The iterator is invalidated by the removal of the channel from
+         * the index, so we seek again the first channel of the slot. */
+        raxStart(&ri,server.cluster->slots_to_channels);
+        raxSeek(&ri,">=",prefix,2);
+        if (!raxNext(&ri) || ri.key_len < 2 || memcmp(ri.key,prefix,2)) {
+            raxStop(&ri);
+            break;
+        }
+        channel = createStringObject((char*)ri.key+2,ri.key_len-2);
+        raxStop(&ri);
+
+        clients = dictFetchValue(server.pubsubshard_channels,channel);
+        listRewind(clients,&li);
+        while ((ln = listNext(&li)) != NULL) {
+            client *c = ln->value;
+            int retval = dictDelete(c->pubsubshard_channels,channel);
+
+            serverAssertWithInfo(c,channel,retval == DICT_OK);
+            addReplyPubsubUnsubscribed(c,channel,&pubsubShardType);
+            if (clientTotalSubscriptionsCount(c) == 0)
+                c->flags &= ~CLIENT_PUBSUB;
+        }
+        pubsubShardSlotUpdate(channel,0);
+        dictDelete(server.pubsubshard_channels,channel);
+        decrRefCount(channel);
+    }
+}
+
 /* Unsubscribe from all the patterns. Return the number of patterns the
  * client was subscribed from. */
 int pubsubUnsubscribeAllPatterns(client *c, int notify) {
@@ -221,15 +409,108 @@ int pubsubUnsubscribeAllPatterns(client *c, int notify) {
     return count;
 }
 
-/* Publish a message */
-int pubsubPublishMessage(robj *channel, robj *message) {
-    int receivers = 0;
-    dictEntry *de;
+/* Return a full reply block with the channel and message bulks, that is
+ * the part of the message frame common to all the receivers, so that it is
+ * serialized only once and shared by their output buffers. */
+static clientReplyBlock *pubsubCreateMessageBlock(robj *channel, robj *message) {
+    clientReplyBlock *b;
+    robj *objs[2];
+    char hdr[2][LONG_STR_SIZE+3];
+    size_t hdrlen[2], total = 0;
+
+    objs[0] = getDecodedObject(channel);
+    objs[1] = getDecodedObject(message);
+    for (int j = 0; j < 2; j++) {
+        hdr[j][0] = '$';
+        hdrlen[j] = 1+ll2string(hdr[j]+1,sizeof(hdr[j])-3,sdslen(objs[j]->ptr));
+        memcpy(hdr[j]+hdrlen[j],"\r\n",2);
+        hdrlen[j] += 2;
+        total += hdrlen[j]+sdslen(objs[j]->ptr)+2;
+    }
+
+    b = createReplyBlock(total);
+    for (int j = 0; j < 2; j++) {
+        memcpy(b->buf+b->used,hdr[j],hdrlen[j]);
+        b->used += hdrlen[j];
+        memcpy(b->buf+b->used,objs[j]->ptr,sdslen(objs[j]->ptr));
+        b->used += sdslen(objs[j]->ptr);
+        memcpy(b->buf+b->used,"\r\n",2);
+        b->used += 2;
+        decrRefCount(objs[j]);
+    }
+    /* No client should append to the block. */
+    b->size = b->used;
+    return b;
+}
+
+/* Queue the channel and message bulks in the output buffer of 'c'. Small
+ * messages are just copied, this is cheaper than adding a node to the reply
+ * list, but big messages are serialized once in a shared block. */
+static void pubsubAddReplyMessage(client *c, robj *channel, robj *message,
+                                  clientReplyBlock **block)
+{
+    if (stringObjectLen(message) < PUBSUB_SHARED_MESSAGE_MIN_LEN) {
+        addReplyBulk(c,channel);
+        addReplyBulk(c,message);
+    } else {
+        if (*block == NULL) *block = pubsubCreateMessageBlock(channel,message);
+        addReplyBlock(c,*block);
+    }
+}
+
+struct pubsubPublishContext {
+    robj *channel;
+    robj *message;
+    clientReplyBlock *block;
+    int receivers;
+};
+
+/* raxFindPrefixes() callback: 'patterns' have a prefix of the channel as
+ * literal prefix, of length 'prefixlen'. */
+static void pubsubPublishToPatterns(size_t prefixlen, void *patterns, void *privdata) {
+    struct pubsubPublishContext *ctx = privdata;
+    sds channel = ctx->channel->ptr;
     listNode *ln;
     listIter li;
 
+    /* The prefix is already known to match, but stringmatchlen() handles
+     * trailing stars only after consuming at least one character of the
+     * string, so we leave the last byte of the prefix to it. */
+    if (prefixlen) prefixlen--;
+
+    listRewind(patterns,&li);
+    while ((ln = listNext(&li)) != NULL) {
+        robj *pattern = ln->value;
+
+        if (!stringmatchlen((char*)pattern->ptr+prefixlen,
+                            sdslen(pattern->ptr)-prefixlen,
+                            channel+prefixlen,
+                            sdslen(channel)-prefixlen,0)) continue;
+
+        list *clients = dictFetchValue(server.pubsub_patterns,pattern);
+        listNode *cln;
+        listIter cli;
+
+        listRewind(clients,&cli);
+        while ((cln = listNext(&cli)) != NULL) {
+            client *c = cln->value;
+
+            addReply(c,shared.mbulkhdr[4]);
+            addReply(c,shared.pmessagebulk);
+            addReplyBulk(c,pattern);
+            pubsubAddReplyMessage(c,ctx->channel,ctx->message,&ctx->block);
+            ctx->receivers++;
+        }
+    }
+}
+
+/* Publish a message */
+static int pubsubPublishMessageType(robj *channel, robj *message, pubsubType *type) {
+    struct pubsubPublishContext ctx = {channel,message,NULL,0};
+    dictEntry *de;
+
     /* Send to clients listening for that channel */
-    de = dictFind(server.pubsub_channels,channel);
+    de = dictFind(*type->serverChannels,channel);
     if (de) {
         list *list = dictGetVal(de);
         listNode *ln;
@@ -240,34 +521,29 @@ int pubsubPublishMessage(robj *channel, robj *message) {
             client *c = ln->value;
 
             addReply(c,shared.mbulkhdr[3]);
-            addReply(c,shared.messagebulk);
-            addReplyBulk(c,channel);
-            addReplyBulk(c,message);
-            receivers++;
+            addReply(c,*type->messageBulk);
+            pubsubAddReplyMessage(c,channel,message,&ctx.block);
+            ctx.receivers++;
         }
     }
-    /* Send to clients listening to matching channels */
-    if (listLength(server.pubsub_patterns)) {
-        listRewind(server.pubsub_patterns,&li);
-        channel = getDecodedObject(channel);
-        while ((ln = listNext(&li)) != NULL) {
-            pubsubPattern *pat = ln->value;
-
-            if (stringmatchlen((char*)pat->pattern->ptr,
-                                sdslen(pat->pattern->ptr),
-                                (char*)channel->ptr,
-                                sdslen(channel->ptr),0)) {
-                addReply(pat->client,shared.mbulkhdr[4]);
-                addReply(pat->client,shared.pmessagebulk);
-                addReplyBulk(pat->client,pat->pattern);
-                addReplyBulk(pat->client,channel);
-                addReplyBulk(pat->client,message);
-                receivers++;
-            }
-        }
-        decrRefCount(channel);
+    /* Send to clients listening to matching channels. Patterns never
+     * match shard channels. */
+    if (!type->shard && raxSize(server.pubsub_patterns_index)) {
+        ctx.channel = getDecodedObject(channel);
+        raxFindPrefixes(server.pubsub_patterns_index,ctx.channel->ptr,
+            sdslen(ctx.channel->ptr),pubsubPublishToPatterns,&ctx);
+        decrRefCount(ctx.channel);
     }
-    return receivers;
+    if (ctx.block) freeClientReplyValue(ctx.block);
+    return ctx.receivers;
+}
+
+int pubsubPublishMessage(robj *channel, robj *message) {
+    return pubsubPublishMessageType(channel,message,&pubsubClassicType);
+}
+
+int pubsubPublishShardMessage(robj *channel, robj *message) {
+    return pubsubPublishMessageType(channel,message,&pubsubShardType);
 }
 
 /*-----------------------------------------------------------------------------
@@ -291,7 +567,7 @@ void unsubscribeCommand(client *c) {
         for (j = 1; j < c->argc; j++)
             pubsubUnsubscribeChannel(c,c->argv[j],1);
     }
-    if (clientSubscriptionsCount(c) == 0) c->flags &= ~CLIENT_PUBSUB;
+    if (clientTotalSubscriptionsCount(c) == 0) c->flags &= ~CLIENT_PUBSUB;
 }
 
 void psubscribeCommand(client *c) {
@@ -311,7 +587,32 @@ void punsubscribeCommand(client *c) {
         for (j = 1; j < c->argc; j++)
             pubsubUnsubscribePattern(c,c->argv[j],1);
     }
-    if (clientSubscriptionsCount(c) == 0) c->flags &= ~CLIENT_PUBSUB;
+    if (clientTotalSubscriptionsCount(c) == 0) c->flags &= ~CLIENT_PUBSUB;
+}
+
+/* SSUBSCRIBE shardchannel [shardchannel ...]
+ *
+ * In cluster mode all the channels must hash to the same slot, served by
+ * the shard of this node: this is checked by getNodeByQuery() as for the
+ * keys of the other commands. */
+void ssubscribeCommand(client *c) {
+    int j;
+
+    for (j = 1; j < c->argc; j++)
+        pubsubSubscribeChannelType(c,c->argv[j],&pubsubShardType);
+    c->flags |= CLIENT_PUBSUB;
+}
+
+void sunsubscribeCommand(client *c) {
+    if (c->argc == 1) {
+        pubsubUnsubscribeAllChannelsType(c,1,&pubsubShardType);
+    } else {
+        int j;
+
+        for (j = 1; j < c->argc; j++)
+            pubsubUnsubscribeChannelType(c,c->argv[j],1,&pubsubShardType);
+    }
+    if (clientTotalSubscriptionsCount(c) == 0) c->flags &= ~CLIENT_PUBSUB;
 }
 
 void publishCommand(client *c) {
@@ -323,6 +624,57 @@ void publishCommand(client *c) {
     addReplyLongLong(c,receivers);
 }
 
+/* SPUBLISH shardchannel message
+ *
+ * Unlike PUBLISH, in cluster mode the message is only propagated to the
+ * other nodes of the shard serving the channel slot, and not to the whole
+ * cluster, so the Pub/Sub traffic scales with the number of shards. */
+void spublishCommand(client *c) {
+    int receivers = pubsubPublishShardMessage(c->argv[1],c->argv[2]);
+    if (server.cluster_enabled)
+        clusterPropagatePublishShard(c->argv[1],c->argv[2]);
+    else
+        forceCommandPropagation(c,PROPAGATE_REPL);
+    addReplyLongLong(c,receivers);
+}
+
+/* Reply with the channels of 'channels' matching the pattern 'pat', or all
+ * of them if 'pat' is NULL. */
+static void addReplyPubsubChannels(client *c, dict *channels, sds pat) {
+    dictIterator *di = dictGetIterator(channels);
+    dictEntry *de;
+    long mblen = 0;
+    void *replylen;
+
+    replylen = addDeferredMultiBulkLength(c);
+    while((de = dictNext(di)) != NULL) {
+        robj *cobj = dictGetKey(de);
+        sds channel = cobj->ptr;
+
+        if (!pat || stringmatchlen(pat, sdslen(pat),
+                                   channel, sdslen(channel),0))
+        {
+            addReplyBulk(c,cobj);
+            mblen++;
+        }
+    }
+    dictReleaseIterator(di);
+    setDeferredMultiBulkLength(c,replylen,mblen);
+}
+
+/* Reply with the number of subscribers of every channel in argv. */
+static void addReplyPubsubNumSub(client *c, dict *channels, robj **argv, int argc) {
+    int j;
+
+    addReplyMultiBulkLen(c,argc*2);
+    for (j = 0; j < argc; j++) {
+        list *l = dictFetchValue(channels,argv[j]);
+
+        addReplyBulk(c,argv[j]);
+        addReplyLongLong(c,l ? listLength(l) : 0);
+    }
+}
+
 /* PUBSUB command for Pub/Sub introspection. */
 void pubsubCommand(client *c) {
     if (c->argc == 2 && !strcasecmp(c->argv[1]->ptr,"help")) {
@@ -330,6 +682,8 @@ void pubsubCommand(client *c) {
 "CHANNELS [<pattern>] -- Return the currently active channels matching a pattern (default: all).",
 "NUMPAT -- Return number of subscriptions to patterns.",
 "NUMSUB [channel-1 .. channel-N] -- Returns the number of subscribers for the specified channels (excluding patterns, default: none).",
+"SHARDCHANNELS [<pattern>] -- Return the currently active shard channels matching a pattern (default: all).",
+"SHARDNUMSUB [channel-1 .. channel-N] -- Returns the number of subscribers for the specified shard channels (default: none).",
 NULL
         };
         addReplyHelp(c, help);
@@ -338,39 +692,22 @@ NULL
     {
         /* PUBSUB CHANNELS [<pattern>] */
         sds pat = (c->argc == 2) ? NULL : c->argv[2]->ptr;
-        dictIterator *di = dictGetIterator(server.pubsub_channels);
-        dictEntry *de;
-        long mblen = 0;
-        void *replylen;
-
-        replylen = addDeferredMultiBulkLength(c);
-        while((de = dictNext(di)) != NULL) {
-            robj *cobj = dictGetKey(de);
-            sds channel = cobj->ptr;
-
-            if (!pat || stringmatchlen(pat, sdslen(pat),
-                                       channel, sdslen(channel),0))
-            {
-                addReplyBulk(c,cobj);
-                mblen++;
-            }
-        }
-        dictReleaseIterator(di);
-        setDeferredMultiBulkLength(c,replylen,mblen);
+        addReplyPubsubChannels(c,server.pubsub_channels,pat);
     } else if (!strcasecmp(c->argv[1]->ptr,"numsub") && c->argc >= 2) {
         /* PUBSUB NUMSUB [Channel_1 ... Channel_N] */
-        int j;
-
-        addReplyMultiBulkLen(c,(c->argc-2)*2);
-        for (j = 2; j < c->argc; j++) {
-            list *l = dictFetchValue(server.pubsub_channels,c->argv[j]);
-
-            addReplyBulk(c,c->argv[j]);
-            addReplyLongLong(c,l ? listLength(l) : 0);
-        }
+        addReplyPubsubNumSub(c,server.pubsub_channels,c->argv+2,c->argc-2);
+    } else if (!strcasecmp(c->argv[1]->ptr,"shardchannels") &&
+        (c->argc == 2 || c->argc == 3))
+    {
+        /* PUBSUB SHARDCHANNELS [<pattern>] */
+        sds pat = (c->argc == 2) ? NULL : c->argv[2]->ptr;
+        addReplyPubsubChannels(c,server.pubsubshard_channels,pat);
+    } else if (!strcasecmp(c->argv[1]->ptr,"shardnumsub") && c->argc >= 2) {
+        /* PUBSUB SHARDNUMSUB [Channel_1 ... Channel_N] */
+        addReplyPubsubNumSub(c,server.pubsubshard_channels,c->argv+2,c->argc-2);
     } else if (!strcasecmp(c->argv[1]->ptr,"numpat") && c->argc == 2) {
         /* PUBSUB NUMPAT */
-        addReplyLongLong(c,listLength(server.pubsub_patterns));
+        addReplyLongLong(c,server.pubsub_patterns_count);
     } else {
         addReplySubcommandSyntaxError(c);
     }
@@ -924,6 +924,40 @@ void *raxFind(rax *rax, unsigned char *s, size_t len) {
     return raxGetData(h);
 }
 
+/* Call 'fn' for every key of the rax that is a prefix of the string 's'
+ * (including the empty key and 's' itself), in order of length, passing
+ * the length of the key and the associated value. This is just a single
+ * lookup of 's', while finding the same keys with raxFind() would require
+ * one lookup per prefix length. */
+void raxFindPrefixes(rax *rax, unsigned char *s, size_t len, void (*fn)(size_t keylen, void *data, void *privdata), void *privdata) {
+    raxNode *h = rax->head;
+    size_t i = 0; /* Position in the string. */
+    size_t j;     /* Position in the node children (or bytes if compressed).*/
+
+    while(1) {
+        /* A key is stored in the node reached after consuming i bytes. */
+        if (h->iskey) fn(i,raxGetData(h),privdata);
+        if (h->size == 0 || i == len) break;
+
+        unsigned char *v = h->data;
+        if (h->iscompr) {
+            for (j = 0; j < h->size && i < len; j++, i++) {
+                if (v[j] != s[i]) break;
+            }
+            if (j != h->size) break;
+            j = 0; /* Compressed node only child is at index 0. */
+        } else {
+            for (j = 0; j < h->size; j++) {
+                if (v[j] == s[i]) break;
+            }
+            if (j == h->size) break;
+            i++;
+        }
+        raxNode **children = raxNodeFirstChildPtr(h);
+        memcpy(&h,children+j,sizeof(h));
+    }
+}
+
 /* Return the memory address where the 'parent' node stores the specified
  * 'child' pointer, so that the caller can update the pointer with another
  * one if needed. The function assumes it will find a match, otherwise the
@@ -1248,6 +1282,29 @@ void raxFree(rax *rax) {
     raxFreeWithCallback(rax,NULL);
 }
 
+/* Depth-first scan of the tree summing the allocation size of the nodes,
+ * and of the auxiliary data if a callback is given. */
+size_t raxRecursiveAllocSize(raxNode *n, size_t (*data_size)(void*)) {
+    size_t size = rax_malloc_size(n);
+    int numchildren = n->iscompr ? 1 : n->size;
+    raxNode **cp = raxNodeFirstChildPtr(n);
+    while(numchildren--) {
+        raxNode *child;
+        memcpy(&child,cp,sizeof(child));
+        size += raxRecursiveAllocSize(child,data_size);
+        cp++;
+    }
+    if (data_size && n->iskey && !n->isnull)
+        size += data_size(raxGetData(n));
+    return size;
+}
+
+/* Return the number of bytes allocated for the radix tree, calling the
+ * specified callback to get the size of the auxiliary data. */
+size_t raxAllocSize(rax *rax, size_t (*data_size)(void*)) {
+    return rax_malloc_size(rax) + raxRecursiveAllocSize(rax->head,data_size);
+}
+
 /* ------------------------------- Iterator --------------------------------- */
 
 /* Initialize a Rax iterator. This call should be performed a single time
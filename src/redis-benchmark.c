@@ -839,6 +839,19 @@ int main(int argc, const char **argv) {
             free(cmd);
         }
 
+        if (test_is_selected("xadd") || test_is_selected("xrange")) {
+            len = redisFormatCommand(&cmd,
+                "XADD mystream * myfield %s",data);
+            benchmark("XADD",cmd,len);
+            free(cmd);
+        }
+
+        if (test_is_selected("xrange")) {
+            len = redisFormatCommand(&cmd,"XRANGE mystream - + COUNT 100");
+            benchmark("XRANGE (first 100 entries)",cmd,len);
+            free(cmd);
+        }
+
         if (!config.csv) printf("\n");
     } while(config.loop);
 
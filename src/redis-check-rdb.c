@@ -85,7 +85,10 @@ char *rdb_type_string[] = {
     "zset-ziplist",
     "hash-ziplist",
     "quicklist",
-    "stream"
+    "stream",
+    "hash-listpack",
+    "zset-listpack",
+    "quicklist-v2"
 };
 
 /* Show a few stats collected into 'rdbstate' */
@@ -35,6 +35,9 @@
 #include <lua.h>
 #include <lauxlib.h>
 #include <lualib.h>
+#ifdef USE_LUAJIT
+#include <luajit.h>
+#endif
 #include <ctype.h>
 #include <math.h>
 
@@ -53,6 +56,7 @@ void luaLdbLineHook(lua_State *lua, lua_Debug *ar);
 void ldbLog(sds entry);
 void ldbLogRedisReply(char *reply);
 sds ldbCatStackValue(sds s, lua_State *lua, int idx);
+void scriptResultCacheCheckCommand(client *c);
 
 /* Debugger shared state is stored inside this global structure. */
 #define LDB_BREAKPOINTS_MAX 64  /* Max number of breakpoints. */
@@ -76,6 +80,14 @@ struct ldbState {
     int maxlen_hint_sent; /* Did we already hint about "set maxlen"? */
 } ldb;
 
+/* Results cache state about the script being executed, see the
+ * scriptResultCache*() functions. */
+struct resultCacheState {
+    int cacheable;  /* True if the result of the script can be cached. */
+    robj **keys;    /* Keys declared by the script (the caller argv). */
+    int numkeys;    /* Number of declared keys. */
+} resultCache;
+
 /* ---------------------------------------------------------------------------
  * Utility functions.
  * ------------------------------------------------------------------------- */
@@ -200,6 +212,234 @@ char *redisProtocolToLuaType_MultiBulk(lua_State *lua, char *reply) {
     return p;
 }
 
+/* ---------------------------------------------------------------------------
+ * Direct Redis reply to Lua type conversion.
+ *
+ * Formatting the reply of every redis.call() as protocol, just to parse it
+ * again with redisProtocolToLuaType(), dominates the cost of scripts doing
+ * many cheap calls. So while a command is executed on behalf of a script,
+ * the Lua client is flagged CLIENT_LUA_DIRECT_REPLY and the addReply*()
+ * functions of networking.c call the functions below, that build the Lua
+ * values directly on the Lua stack, with the same conversion rules of
+ * redisProtocolToLuaType().
+ *
+ * The functions used to emit raw protocol (addReply() of shared objects,
+ * addReplyString(), ...) call luaReplyProto() instead, an incremental
+ * parser that accepts the protocol in arbitrary chunks.
+ *
+ * 脚本调用命令时，回复直接转换成Lua值，不再先序列化为协议再解析。
+ * ------------------------------------------------------------------------- */
+
+/* An array still receiving its elements. The table is on the Lua stack. */
+typedef struct luaReplyFrame {
+    long left;      /* Elements still expected, -1 for deferred length. */
+    long count;     /* Elements received so far. */
+} luaReplyFrame;
+
+static struct {
+    luaReplyFrame *frames;  /* Stack of open arrays. */
+    int depth;              /* Number of open arrays. */
+    int size;               /* Allocated frames. */
+    int values;             /* Complete top level values pushed. */
+    int type;               /* Protocol type of the top level value. */
+    sds line;               /* Partial protocol line, see luaReplyProto(). */
+    sds bulk;               /* Partial bulk payload. */
+    long long bulkleft;     /* Bulk payload + CRLF bytes still expected. */
+} luaReply;
+
+static void luaReplyBegin(void) {
+    luaReply.depth = 0;
+    luaReply.values = 0;
+    luaReply.type = 0;
+    luaReply.bulkleft = 0;
+    if (luaReply.line == NULL) luaReply.line = sdsempty();
+    if (luaReply.bulk == NULL) luaReply.bulk = sdsempty();
+    sdsclear(luaReply.line);
+    sdsclear(luaReply.bulk);
+}
+
+/* Called after a value was pushed on the Lua stack: add it to the array
+ * being built, closing the arrays that are now complete, or account it as
+ * the top level reply. 'type' is the protocol type of the value. */
+static void luaReplyValue(int type) {
+    lua_State *lua = server.lua;
+
+    while (luaReply.depth) {
+        luaReplyFrame *f = luaReply.frames+luaReply.depth-1;
+
+        lua_rawseti(lua,-2,++f->count);
+        if (f->left == -1 || --f->left > 0) return;
+        luaReply.depth--; /* The table is now a complete value. */
+        type = '*';
+    }
+    luaReply.values++;
+    luaReply.type = type;
+}
+
+void luaReplyBulk(const char *s, size_t len) {
+    lua_pushlstring(server.lua,s,len);
+    luaReplyValue('$');
+}
+
+void luaReplyInteger(long long ll) {
+    lua_pushnumber(server.lua,(lua_Number)ll);
+    luaReplyValue(':');
+}
+
+/* Null bulks and null multi bulks are both converted to false. */
+void luaReplyNull(void) {
+    lua_pushboolean(server.lua,0);
+    luaReplyValue('$');
+}
+
+/* Push a table with a single 'field' set to the string obtained by
+ * concatenating 'prefix' (that may be NULL) and 's'. */
+static void luaReplyFieldTable(const char *field, const char *prefix,
+                               const char *s, size_t len)
+{
+    lua_State *lua = server.lua;
+
+    lua_newtable(lua);
+    lua_pushstring(lua,field);
+    if (prefix) {
+        lua_pushstring(lua,prefix);
+        lua_pushlstring(lua,s,len);
+        lua_concat(lua,2);
+    } else {
+        lua_pushlstring(lua,s,len);
+    }
+    lua_settable(lua,-3);
+}
+
+void luaReplyStatus(const char *s, size_t len) {
+    luaReplyFieldTable("ok",NULL,s,len);
+    luaReplyValue('+');
+}
+
+/* Like addReplyErrorLength(), if 's' does not start with "-" the generic
+ * "ERR " error code is used. */
+void luaReplyError(const char *s, size_t len) {
+    if (len && s[0] == '-')
+        luaReplyFieldTable("err",NULL,s+1,len-1);
+    else
+        luaReplyFieldTable("err","ERR ",s,len);
+    luaReplyValue('-');
+}
+
+static void luaReplyPushFrame(long len) {
+    if (luaReply.depth == luaReply.size) {
+        luaReply.size = luaReply.size ? luaReply.size*2 : 8;
+        luaReply.frames = zrealloc(luaReply.frames,
+                                   sizeof(luaReplyFrame)*luaReply.size);
+    }
+    luaReply.frames[luaReply.depth].left = len;
+    luaReply.frames[luaReply.depth].count = 0;
+    luaReply.depth++;
+}
+
+void luaReplyArray(long len) {
+    if (len < 0) {
+        luaReplyNull();
+        return;
+    }
+    lua_checkstack(server.lua,3);
+    lua_newtable(server.lua);
+    if (len == 0)
+        luaReplyValue('*');
+    else
+        luaReplyPushFrame(len);
+}
+
+/* Open an array whose length is not yet known, returning the handle to
+ * pass to luaReplySetDeferredArray() once all the elements were emitted. */
+void *luaReplyDeferredArray(void) {
+    lua_checkstack(server.lua,3);
+    lua_newtable(server.lua);
+    luaReplyPushFrame(-1);
+    return (void*)(long)luaReply.depth;
+}
+
+void luaReplySetDeferredArray(void *handle, long len) {
+    luaReplyFrame *f = luaReply.frames+luaReply.depth-1;
+
+    /* Deferred lengths are always set once the elements of the nested
+     * arrays were emitted, so this is the innermost open array. */
+    serverAssert((long)handle == luaReply.depth && f->left == -1 &&
+                 f->count == len);
+    luaReply.depth--;
+    luaReplyValue('*');
+}
+
+/* Convert a single line of protocol, without the final CRLF. */
+static void luaReplyProtoLine(const char *p, size_t len) {
+    long long ll = 0;
+
+    switch(p[0]) {
+    case '+': luaReplyStatus(p+1,len-1); break;
+    case '-': luaReplyError(p,len); break;
+    case ':':
+        string2ll(p+1,len-1,&ll);
+        luaReplyInteger(ll);
+        break;
+    case '$':
+        string2ll(p+1,len-1,&ll);
+        if (ll == -1)
+            luaReplyNull();
+        else
+            luaReply.bulkleft = ll+2;
+        break;
+    case '*':
+        string2ll(p+1,len-1,&ll);
+        luaReplyArray(ll);
+        break;
+    default:
+        serverPanic("Unknown protocol type in a reply to Lua: '%c'",p[0]);
+    }
+}
+
+/* Convert raw protocol, that may be just a part of a reply. */
+void luaReplyProto(const char *s, size_t len) {
+    while(len) {
+        if (luaReply.bulkleft) {
+            /* Bulk payload: avoid the copy if we have it all. */
+            if (sdslen(luaReply.bulk) == 0 &&
+                (long long)len >= luaReply.bulkleft)
+            {
+                luaReplyBulk(s,luaReply.bulkleft-2);
+                s += luaReply.bulkleft;
+                len -= luaReply.bulkleft;
+                luaReply.bulkleft = 0;
+            } else {
+                size_t n = (long long)len < luaReply.bulkleft ?
+                           len : (size_t)luaReply.bulkleft;
+                luaReply.bulk = sdscatlen(luaReply.bulk,s,n);
+                s += n;
+                len -= n;
+                luaReply.bulkleft -= n;
+                if (luaReply.bulkleft == 0) {
+                    luaReplyBulk(luaReply.bulk,sdslen(luaReply.bulk)-2);
+                    sdsclear(luaReply.bulk);
+                }
+            }
+            continue;
+        }
+
+        const char *nl = memchr(s,'\n',len);
+        size_t n = nl ? (size_t)(nl-s+1) : len;
+        if (nl && sdslen(luaReply.line) == 0) {
+            luaReplyProtoLine(s,n-2);
+        } else {
+            luaReply.line = sdscatlen(luaReply.line,s,n);
+            if (nl) {
+                luaReplyProtoLine(luaReply.line,sdslen(luaReply.line)-2);
+                sdsclear(luaReply.line);
+            }
+        }
+        s += n;
+        len -= n;
+    }
+}
+
 /* This function is used in order to push an error on the Lua stack in the
  * format used by redis.pcall to return errors, which is a lua table
  * with a single "err" field set to the error string. Note that this
@@ -531,6 +771,7 @@ int luaRedisGenericCommand(lua_State *lua, int raise_error) {
 
     if (cmd->flags & CMD_RANDOM) server.lua_random_dirty = 1;
     if (cmd->flags & CMD_WRITE) server.lua_write_dirty = 1;
+    if (resultCache.cacheable) scriptResultCacheCheckCommand(c);
 
     /* If this is a Redis Cluster node, we need to make sure Lua is not
      * trying to access non-local keys, with the exception of commands
@@ -573,6 +814,28 @@ int luaRedisGenericCommand(lua_State *lua, int raise_error) {
         if (server.lua_repl & PROPAGATE_REPL)
             call_flags |= CMD_CALL_PROPAGATE_REPL;
     }
+
+    /* Unless the debugger needs to log the protocol, the reply is directly
+     * converted into a Lua value while the command emits it. */
+    if (!(ldb.active && ldb.step)) {
+        luaReplyBegin();
+        c->flags |= CLIENT_LUA_DIRECT_REPLY;
+        call(c,call_flags);
+        c->flags &= ~CLIENT_LUA_DIRECT_REPLY;
+        serverAssert(luaReply.values == 1 && luaReply.depth == 0 &&
+                     luaReply.bulkleft == 0 && sdslen(luaReply.line) == 0);
+
+        if (raise_error && luaReply.type != '-') raise_error = 0;
+        /* Sort the output array if needed, assuming it is a non-null multi
+         * bulk reply as expected. */
+        if ((cmd->flags & CMD_SORT_FOR_SCRIPT) &&
+            (server.lua_replicate_commands == 0) &&
+            luaReply.type == '*')
+        {
+            luaSortArray(lua);
+        }
+        goto cleanup;
+    }
     call(c,call_flags);
 
     /* Convert the result of the Redis command into a suitable Lua type.
@@ -850,6 +1113,12 @@ void luaLoadLibraries(lua_State *lua) {
     luaLoadLib(lua, "struct", luaopen_struct);
     luaLoadLib(lua, "cmsgpack", luaopen_cmsgpack);
     luaLoadLib(lua, "bit", luaopen_bit);
+#ifdef USE_LUAJIT
+    /* The trace compiler is initialized when the "jit" library is opened.
+     * The library itself is not exposed to scripts, see
+     * luaRemoveUnsupportedFunctions(). */
+    luaLoadLib(lua, LUA_JITLIBNAME, luaopen_jit);
+#endif
 
 #if 0 /* Stuff that we don't load currently, for sandboxing concerns. */
     luaLoadLib(lua, LUA_LOADLIBNAME, luaopen_package);
@@ -857,6 +1126,54 @@ void luaLoadLibraries(lua_State *lua) {
 #endif
 }
 
+#ifdef USE_LUAJIT
+/* Unlike the Lua interpreter shipped with Redis, where loading of precompiled
+ * chunks was removed, LuaJIT happily loads bytecode, that can be crafted in
+ * order to escape the sandbox. The following replacements of loadstring()
+ * and load() only accept source code. */
+int luaLoadStringSource(lua_State *lua) {
+    size_t len;
+    const char *s = luaL_checklstring(lua,1,&len);
+    const char *chunkname = luaL_optstring(lua,2,s);
+
+    if (luaL_loadbufferx(lua,s,len,chunkname,"t") == 0) return 1;
+    lua_pushnil(lua);
+    lua_insert(lua,-2); /* nil, error message. */
+    return 2;
+}
+
+int luaLoadSource(lua_State *lua) {
+    luaL_Buffer b;
+    size_t len;
+    const char *s, *chunkname;
+
+    luaL_checktype(lua,1,LUA_TFUNCTION);
+    chunkname = luaL_optstring(lua,2,"=(load)");
+    lua_settop(lua,2);
+
+    /* Collect the pieces returned by the reader function. */
+    luaL_buffinit(lua,&b);
+    while(1) {
+        lua_pushvalue(lua,1);
+        lua_call(lua,0,1);
+        if (lua_isnil(lua,-1)) {
+            lua_pop(lua,1);
+            break;
+        }
+        if (!lua_isstring(lua,-1))
+            return luaL_error(lua,"reader function must return a string");
+        luaL_addvalue(&b);
+    }
+    luaL_pushresult(&b);
+
+    s = lua_tolstring(lua,-1,&len);
+    if (luaL_loadbufferx(lua,s,len,chunkname,"t") == 0) return 1;
+    lua_pushnil(lua);
+    lua_insert(lua,-2);
+    return 2;
+}
+#endif
+
 /* Remove a functions that we don't want to expose to the Redis scripting
  * environment. */
 void luaRemoveUnsupportedFunctions(lua_State *lua) {
@@ -864,6 +1181,34 @@ void luaRemoveUnsupportedFunctions(lua_State *lua) {
     lua_setglobal(lua,"loadfile");
     lua_pushnil(lua);
     lua_setglobal(lua,"dofile");
+#ifdef USE_LUAJIT
+    lua_pushnil(lua);
+    lua_setglobal(lua,LUA_JITLIBNAME);
+    lua_pushcfunction(lua,luaLoadStringSource);
+    lua_setglobal(lua,"loadstring");
+    lua_pushcfunction(lua,luaLoadSource);
+    lua_setglobal(lua,"load");
+#endif
+}
+
+/* Turn the LuaJIT trace compiler on or off. When it is turned off the
+ * traces compiled so far are flushed, so that every script runs again in
+ * the interpreter: this is needed because compiled code does not call the
+ * hooks we use for the script time limit and for the debugger.
+ *
+ * With the bundled Lua interpreter this function does nothing. */
+void scriptingSetJit(lua_State *lua, int on) {
+#ifdef USE_LUAJIT
+    if (on) {
+        luaJIT_setmode(lua,0,LUAJIT_MODE_ENGINE|LUAJIT_MODE_ON);
+    } else {
+        luaJIT_setmode(lua,0,LUAJIT_MODE_ENGINE|LUAJIT_MODE_OFF);
+        luaJIT_setmode(lua,0,LUAJIT_MODE_ENGINE|LUAJIT_MODE_FLUSH);
+    }
+#else
+    UNUSED(lua);
+    UNUSED(on);
+#endif
 }
 
 /* This function installs metamethods in the global table _G that prevent
@@ -933,6 +1278,7 @@ void scriptingInit(int setup) {
      * as EVAL, so we need to remember the associated script. */
     server.lua_scripts = dictCreate(&shaScriptObjectDictType,NULL);
     server.lua_scripts_mem = 0;
+    if (setup) server.lua_results = dictCreate(&luaResultsDictType,NULL);
 
     /* Register the redis commands table and fields */
     lua_newtable(lua);
@@ -1084,12 +1430,14 @@ void scriptingInit(int setup) {
      * to global variables. */
     scriptingEnableGlobalsProtection(lua);
 
+    scriptingSetJit(lua,server.lua_jit);
     server.lua = lua;
 }
 
 /* Release resources related to Lua scripting.
  * This function is used in order to reset the scripting environment. */
 void scriptingRelease(void) {
+    scriptResultCacheFlush();
     dictRelease(server.lua_scripts);
     server.lua_scripts_mem = 0;
     lua_close(server.lua);
@@ -1156,6 +1504,204 @@ int redis_math_randomseed (lua_State *L) {
   return 0;
 }
 
+/* ---------------------------------------------------------------------------
+ * Results cache of read only scripts
+ * ------------------------------------------------------------------------- */
+
+/* When lua-result-cache-max-entries is not zero, the replies of scripts that
+ * only called read only, deterministic commands against the keys declared
+ * in KEYS are remembered, keyed by SHA1, DB, keys and arguments. The next
+ * call with the same arguments is served without entering Lua at all.
+ *
+ * Every cached result is referenced, for each of its keys, by a list in the
+ * db->lua_results_keys dictionary: when a key is modified, like it happens
+ * for WATCH, signalModifiedKey() invalidates the results depending on it.
+ * Results depending on keys with an expire are not cached, since expired
+ * keys are removed without signaling them. */
+typedef struct luaResult {
+    sds id;             /* Cache ID, key of server.lua_results. */
+    redisDb *db;        /* DB of the keys. */
+    robj **keys;        /* Keys the result depends on. */
+    int numkeys;
+    sds reply;          /* The script reply as Redis protocol. */
+} luaResult;
+
+/* Return the cache ID for the script 'sha' called by 'c' with the
+ * specified number of keys. */
+sds scriptResultCacheId(client *c, char *sha) {
+    sds id = sdsnewlen(sha,40);
+    int j;
+
+    id = sdscatfmt(id,":%i",c->db->id);
+    for (j = 2; j < c->argc; j++) {
+        sds arg = c->argv[j]->ptr;
+
+        /* Arguments are length prefixed so that different arguments vectors
+         * can't produce the same ID. */
+        id = sdscatfmt(id,":%U:",(unsigned long long)sdslen(arg));
+        id = sdscatsds(id,arg);
+    }
+    return id;
+}
+
+size_t scriptResultSize(luaResult *r) {
+    return sizeof(*r) + sdsZmallocSize(r->id) + sdsZmallocSize(r->reply) +
+           sizeof(robj*)*r->numkeys;
+}
+
+/* Remove the result from the cache and from the lists of its keys. */
+void scriptResultCacheDelete(luaResult *r) {
+    int j;
+
+    for (j = 0; j < r->numkeys; j++) {
+        list *l = dictFetchValue(r->db->lua_results_keys,r->keys[j]);
+
+        listDelNode(l,listSearchKey(l,r));
+        if (listLength(l) == 0) dictDelete(r->db->lua_results_keys,r->keys[j]);
+        decrRefCount(r->keys[j]);
+    }
+    dictDelete(server.lua_results,r->id);
+    server.lua_results_mem -= scriptResultSize(r);
+    zfree(r->keys);
+    sdsfree(r->id);
+    sdsfree(r->reply);
+    zfree(r);
+}
+
+/* Invalidate the cached results depending on 'key'. Called by
+ * signalModifiedKey() and every time a key is evicted or gets an expire. */
+void scriptResultCacheTouchKey(redisDb *db, robj *key) {
+    list *l;
+
+    if (dictSize(db->lua_results_keys) == 0) return;
+    while ((l = dictFetchValue(db->lua_results_keys,key)) != NULL)
+        scriptResultCacheDelete(listNodeValue(listFirst(l)));
+}
+
+/* Invalidate all the cached results: called when the data set is flushed,
+ * DBs are swapped, or the scripting engine is reset. */
+void scriptResultCacheFlush(void) {
+    dictIterator *di;
+    dictEntry *de;
+
+    if (server.lua_results == NULL || dictSize(server.lua_results) == 0)
+        return;
+    di = dictGetSafeIterator(server.lua_results);
+    while ((de = dictNext(di)) != NULL)
+        scriptResultCacheDelete(dictGetVal(de));
+    dictReleaseIterator(di);
+}
+
+/* Called by luaRedisGenericCommand() for every command executed by a script
+ * whose result is still cacheable: commands that may write, that are non
+ * deterministic, that don't access keys, or that access keys not declared
+ * in KEYS, make the result of the script not cacheable. */
+void scriptResultCacheCheckCommand(client *c) {
+    struct redisCommand *cmd = c->cmd;
+    int *keys, numkeys, j, k;
+
+    if (cmd->flags & (CMD_WRITE|CMD_RANDOM)) {
+        resultCache.cacheable = 0;
+        return;
+    }
+    keys = getKeysFromCommand(cmd,c->argv,c->argc,&numkeys);
+    if (numkeys == 0) resultCache.cacheable = 0;
+    for (j = 0; j < numkeys && resultCache.cacheable; j++) {
+        robj *key = c->argv[keys[j]];
+
+        for (k = 0; k < resultCache.numkeys; k++)
+            if (equalStringObjects(key,resultCache.keys[k])) break;
+        if (k == resultCache.numkeys) resultCache.cacheable = 0;
+    }
+    getKeysFreeResult(keys);
+}
+
+/* Reply to 'c' with the cached result having the specified ID, if any.
+ * Returns 1 if the client was served, otherwise 0 is returned and the
+ * script must be executed, checking if its result can be cached. */
+int scriptResultCacheLookup(client *c, sds id, long long numkeys) {
+    luaResult *r = dictFetchValue(server.lua_results,id);
+
+    if (r) {
+        /* Access the keys like the script would do, so that their LRU/LFU
+         * data and the keyspace hits/misses stats are updated. */
+        for (int j = 0; j < r->numkeys; j++) lookupKeyRead(r->db,r->keys[j]);
+        addReplyString(c,r->reply,sdslen(r->reply));
+        if (c->flags & CLIENT_TRACKING)
+            trackingRememberKeysList(c,r->keys,r->numkeys);
+        server.stat_lua_results_hits++;
+        return 1;
+    }
+    resultCache.cacheable = 1;
+    resultCache.keys = c->argv+3;
+    resultCache.numkeys = numkeys;
+    return 0;
+}
+
+/* Convert the Lua return value at the top of the stack into Redis protocol
+ * and send it to the client 'c', like luaReplyToRedisReply() does, also
+ * storing the reply in the cache with the specified ID. */
+void scriptResultCacheStore(client *c, sds id, lua_State *lua) {
+    client *lc = server.lua_client;
+    luaResult *r;
+    sds reply;
+    int j;
+
+    /* Use the Lua client, that is not in use now, to collect the
+     * protocol. */
+    luaReplyToRedisReply(lc,lua);
+    reply = sdsnewlen(lc->buf,lc->bufpos);
+    lc->bufpos = 0;
+    while(listLength(lc->reply)) {
+        clientReplyBlock *o = listNodeValue(listFirst(lc->reply));
+
+        reply = sdscatlen(reply,o->buf,o->used);
+        listDelNode(lc->reply,listFirst(lc->reply));
+    }
+    lc->reply_bytes = 0;
+    addReplyString(c,reply,sdslen(reply));
+    server.stat_lua_results_misses++;
+
+    for (j = 0; j < resultCache.numkeys; j++) {
+        if (getExpire(c->db,resultCache.keys[j]) != -1) break;
+    }
+    if (j != resultCache.numkeys || sdslen(reply) > LUA_RESULT_MAX_LEN) {
+        sdsfree(reply);
+        return;
+    }
+
+    /* Make room evicting a random result if needed. */
+    if (dictSize(server.lua_results) >= server.lua_results_max) {
+        dictEntry *de = dictGetRandomKey(server.lua_results);
+        scriptResultCacheDelete(dictGetVal(de));
+    }
+
+    r = zmalloc(sizeof(*r));
+    r->id = sdsdup(id);
+    r->db = c->db;
+    r->numkeys = resultCache.numkeys;
+    r->keys = zmalloc(sizeof(robj*)*r->numkeys);
+    r->reply = reply;
+    for (j = 0; j < r->numkeys; j++) {
+        robj *key = resultCache.keys[j];
+        dictEntry *de = dictFind(r->db->lua_results_keys,key);
+        list *l;
+
+        if (de == NULL) {
+            l = listCreate();
+            incrRefCount(key);
+            dictAdd(r->db->lua_results_keys,key,l);
+        } else {
+            l = dictGetVal(de);
+        }
+        listAddNodeTail(l,r);
+        incrRefCount(key);
+        r->keys[j] = key;
+    }
+    dictAdd(server.lua_results,r->id,r);
+    server.lua_results_mem += scriptResultSize(r);
+}
+
 /* ---------------------------------------------------------------------------
  * EVAL and SCRIPT commands implementation
  * ------------------------------------------------------------------------- */
@@ -1263,6 +1809,7 @@ void evalGenericCommand(client *c, int evalsha) {
     long long numkeys;
     long long initial_server_dirty = server.dirty;
     int delhook = 0, err;
+    sds cacheid = NULL;
 
     /* When we replicate whole scripts, we want the same PRNG sequence at
      * every call so that our PRNG is not affected by external state. */
@@ -1340,6 +1887,16 @@ void evalGenericCommand(client *c, int evalsha) {
         serverAssert(!lua_isnil(lua,-1));
     }
 
+    /* Serve the script from the results cache if possible. */
+    if (server.lua_results_max && !ldb.active) {
+        cacheid = scriptResultCacheId(c,funcname+2);
+        if (scriptResultCacheLookup(c,cacheid,numkeys)) {
+            lua_pop(lua,2); /* Remove the function and the error handler. */
+            sdsfree(cacheid);
+            return;
+        }
+    }
+
     /* Populate the argv and keys table accordingly to the arguments that
      * EVAL received. */
     luaSetGlobalArray(lua,"KEYS",c->argv+3,numkeys);
@@ -1362,6 +1919,8 @@ void evalGenericCommand(client *c, int evalsha) {
         lua_sethook(lua,luaMaskCountHook,LUA_MASKCOUNT,100000);
         delhook = 1;
     } else if (ldb.active) {
+        /* Compiled code would not call the line hook of the debugger. */
+        if (server.lua_jit) scriptingSetJit(lua,0);
         lua_sethook(server.lua,luaLdbLineHook,LUA_MASKLINE|LUA_MASKCOUNT,100000);
         delhook = 1;
     }
@@ -1373,6 +1932,7 @@ void evalGenericCommand(client *c, int evalsha) {
 
     /* Perform some cleanup that we need to do both on error and success. */
     if (delhook) lua_sethook(lua,NULL,0,0); /* Disable hook */
+    if (ldb.active && server.lua_jit) scriptingSetJit(lua,1);
     if (server.lua_timedout) {
         server.lua_timedout = 0;
         /* Restore the client that was protected when the script timeout
@@ -1407,9 +1967,14 @@ void evalGenericCommand(client *c, int evalsha) {
     } else {
         /* On success convert the Lua return value into Redis protocol, and
          * send it to * the client. */
-        luaReplyToRedisReply(c,lua); /* Convert and consume the reply. */
+        if (resultCache.cacheable)
+            scriptResultCacheStore(c,cacheid,lua);
+        else
+            luaReplyToRedisReply(c,lua); /* Convert and consume the reply. */
         lua_pop(lua,1); /* Remove the error handler. */
     }
+    resultCache.cacheable = 0;
+    sdsfree(cacheid);
 
     /* If we are using single commands replication, emit EXEC if there
      * was at least a write. */
@@ -2208,8 +2773,13 @@ void ldbEval(lua_State *lua, sds *argv, int argc) {
     /* Try to compile it as an expression, prepending "return ". */
     if (luaL_loadbuffer(lua,expr,sdslen(expr),"@ldb_eval")) {
         lua_pop(lua,1);
-        /* Failed? Try as a statement. */
+        /* Failed? Try as a statement. The code is loaded as it is, so
+         * with LuaJIT make sure it is not a precompiled chunk. */
+#ifdef USE_LUAJIT
+        if (luaL_loadbufferx(lua,code,sdslen(code),"@ldb_eval","t")) {
+#else
         if (luaL_loadbuffer(lua,code,sdslen(code),"@ldb_eval")) {
+#endif
             ldbLog(sdscatfmt(sdsempty(),"<error> %s",lua_tostring(lua,-1)));
             lua_pop(lua,1);
             sdsfree(code);
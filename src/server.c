@@ -271,6 +271,9 @@ struct redisCommand redisCommandTable[] = {
     {"punsubscribe",punsubscribeCommand,-1,"pslt",0,NULL,0,0,0,0,0},
     {"publish",publishCommand,3,"pltF",0,NULL,0,0,0,0,0},
     {"pubsub",pubsubCommand,-2,"pltR",0,NULL,0,0,0,0,0},
+    {"ssubscribe",ssubscribeCommand,-2,"pslt",0,NULL,1,-1,1,0,0},
+    {"sunsubscribe",sunsubscribeCommand,-1,"pslt",0,NULL,1,-1,1,0,0},
+    {"spublish",spublishCommand,3,"pltF",0,NULL,1,1,1,0,0},
     {"watch",watchCommand,-2,"sF",0,NULL,1,-1,1,0,0},
     {"unwatch",unwatchCommand,1,"sF",0,NULL,0,0,0,0,0},
     {"cluster",clusterCommand,-2,"a",0,NULL,0,0,0,0,0},
@@ -318,12 +321,14 @@ struct redisCommand redisCommandTable[] = {
     {"xack",xackCommand,-4,"wF",0,NULL,1,1,1,0,0},
     {"xpending",xpendingCommand,-3,"rR",0,NULL,1,1,1,0,0},
     {"xclaim",xclaimCommand,-6,"wRF",0,NULL,1,1,1,0,0},
+    {"xautoclaim",xautoclaimCommand,-5,"wRF",0,NULL,1,1,1,0,0},
     {"xinfo",xinfoCommand,-2,"rR",0,NULL,2,2,1,0,0},
     {"xdel",xdelCommand,-3,"wF",0,NULL,1,1,1,0,0},
     {"xtrim",xtrimCommand,-2,"wFR",0,NULL,1,1,1,0,0},
     {"post",securityWarningCommand,-1,"lt",0,NULL,0,0,0,0,0},
     {"host:",securityWarningCommand,-1,"lt",0,NULL,0,0,0,0,0},
     {"latency",latencyCommand,-2,"aslt",0,NULL,0,0,0,0,0},
+    {"keystats",keystatsCommand,-2,"aslt",0,NULL,0,0,0,0,0},
     {"lolwut",lolwutCommand,-1,"r",0,NULL,0,0,0,0,0}
 };
 
@@ -498,6 +503,15 @@ void dictObjectDestructor(void *privdata, void *val)
     decrRefCount(val);
 }
 
+/* Values of the main dictionary may be stored inline, see dbInlineValue(). */
+void dictDbValueDestructor(void *privdata, void *val)
+{
+    DICT_NOTUSED(privdata);
+
+    if (val == NULL || objIsInline(val)) return;
+    decrRefCount(val);
+}
+
 void dictSdsDestructor(void *privdata, void *val)
 {
     DICT_NOTUSED(privdata);
@@ -615,7 +629,7 @@ dictType dbDictType = {
     NULL,                       /* val dup */
     dictSdsKeyCompare,          /* key compare */
     dictSdsDestructor,          /* key destructor */
-    dictObjectDestructor   /* val destructor */
+    dictDbValueDestructor       /* val destructor */
 };
 
 /* server.lua_scripts sha (as sds string) -> scripts (as robj) cache. */
@@ -628,6 +642,17 @@ dictType shaScriptObjectDictType = {
     dictObjectDestructor        /* val destructor */
 };
 
+/* server.lua_results cache ID (as sds string) -> cached script result. The
+ * entries are owned and released by scripting.c. */
+dictType luaResultsDictType = {
+    dictSdsHash,                /* hash function */
+    NULL,                       /* key dup */
+    NULL,                       /* val dup */
+    dictSdsKeyCompare,          /* key compare */
+    NULL,                       /* key destructor */
+    NULL                        /* val destructor */
+};
+
 /* Db->expires */
 dictType keyptrDictType = {
     dictSdsHash,                /* hash function */
@@ -648,7 +673,7 @@ dictType commandTableDictType = {
     NULL                        /* val destructor */
 };
 
-/* Hash type hash table (note that small hashes are represented with ziplists) */
+/* Hash type hash table (note that small hashes are represented with listpacks) */
 dictType hashDictType = {
     dictSdsHash,                /* hash function */
     NULL,                       /* key dup */
@@ -826,15 +851,10 @@ int clientsCronHandleTimeout(client *c, mstime_t now_ms) {
         freeClient(c);
         return 1;
     } else if (c->flags & CLIENT_BLOCKED) {
-        /* Blocked OPS timeout is handled with milliseconds resolution.
-         * However note that the actual resolution is limited by
-         * server.hz. */
-
-        if (c->bpop.timeout != 0 && c->bpop.timeout < now_ms) {
-            /* Handle blocking operation specific timeout. */
-            replyToBlockedClientTimedOut(c);
-            unblockClient(c);
-        } else if (server.cluster_enabled) {
+        /* Blocked OPS timeout is handled by a timer using the timeout
+         * table, see handleBlockedClientsTimeout(), here we just need to
+         * check the cluster state. */
+        if (server.cluster_enabled) {
             /* Cluster: handle unblock & redirect of clients blocked
              * into keys no longer served by this server. */
             if (clusterRedirectBlockedClientIfNeeded(c))
@@ -1002,7 +1022,9 @@ void databasesCron(void) {
      * as master will synthesize DELs for us. */
     if (server.active_expire_enabled) {
         if (server.masterhost == NULL) {
+            int old_phase = elPhaseEnter(EL_PHASE_EXPIRE);
             activeExpireCycle(ACTIVE_EXPIRE_CYCLE_SLOW);
+            elPhaseRestore(old_phase);
         } else {
             expireSlaveKeys();
         }
@@ -1012,10 +1034,16 @@ void databasesCron(void) {
     if (server.active_defrag_enabled)
         activeDefragCycle();
 
+    /* Measure the keys when key-memory-tracking was just enabled. */
+    if (server.key_memory_tracking) keymemCron(0);
+
     /* Perform hash tables rehashing if needed, but only if there are no
      * other processes saving the DB on disk. Otherwise rehashing is bad
      * as will cause a lot of copy-on-write of memory pages. */
     if (server.rdb_child_pid == -1 && server.aof_child_pid == -1) {
+        /* Store inline the small values that were not accessed recently. */
+        if (server.inline_small_values) inlineValuesCron();
+
         /* We use global counters so if we stop the computation at a given
          * DB we'll be able to start from the successive in the next
          * cron loop iteration. */
@@ -1090,6 +1118,7 @@ void updateCachedTime(void) {
 
 int serverCron(struct aeEventLoop *eventLoop, long long id, void *clientData) {
     int j;
+    int old_phase = elPhaseEnter(EL_PHASE_CRON);
     UNUSED(eventLoop);
     UNUSED(id);
     UNUSED(clientData);
@@ -1298,7 +1327,11 @@ int serverCron(struct aeEventLoop *eventLoop, long long id, void *clientData) {
 
     /* AOF postponed flush: Try at every cron cycle if the slow fsync
      * completed. */
-    if (server.aof_flush_postponed_start) flushAppendOnlyFile(0);
+    if (server.aof_flush_postponed_start) {
+        int old_phase = elPhaseEnter(EL_PHASE_AOF);
+        flushAppendOnlyFile(0);
+        elPhaseRestore(old_phase);
+    }
 
     /* AOF write errors: in this case we have a buffer to flush as well and
      * clear the AOF error in case of success to make the DB writable again,
@@ -1319,6 +1352,12 @@ int serverCron(struct aeEventLoop *eventLoop, long long id, void *clientData) {
      * detect transfer failures, start background RDB transfers and so forth. */
     run_with_period(1000) replicationCron();
 
+    /* Evict keys ahead of time if background eviction is enabled. */
+    evictionCron();
+
+    /* Decay the hot keys counters and look for big keys. */
+    run_with_period(100) keystatsCron();
+
     /* Run the Redis Cluster cron. */
     run_with_period(100) {
         if (server.cluster_enabled) clusterCron();
@@ -1351,14 +1390,21 @@ int serverCron(struct aeEventLoop *eventLoop, long long id, void *clientData) {
     }
 
     server.cronloops++;
+    elPhaseRestore(old_phase);
     return 1000/server.hz;
 }
 
+/* True if beforeSleep() released the GIL, so that afterSleep() takes it
+ * back even if the conditions changed in the meantime. */
+static int gil_released = 0;
+
 /* This function gets called every time Redis is entering the
  * main loop of the event driven library, that is, before to sleep
  * for ready file descriptors. */
 void beforeSleep(struct aeEventLoop *eventLoop) {
+    int old_phase;
     UNUSED(eventLoop);
+    elPhaseEnter(EL_PHASE_BEFORESLEEP);
 
     /* Call the Redis Cluster before sleep function. Note that this function
      * may change the state of Redis Cluster (from ok to fail or vice versa),
@@ -1368,8 +1414,11 @@ void beforeSleep(struct aeEventLoop *eventLoop) {
 
     /* Run a fast expire cycle (the called function will return
      * ASAP if a fast cycle is not needed). */
-    if (server.active_expire_enabled && server.masterhost == NULL)
+    if (server.active_expire_enabled && server.masterhost == NULL) {
+        old_phase = elPhaseEnter(EL_PHASE_EXPIRE);
         activeExpireCycle(ACTIVE_EXPIRE_CYCLE_FAST);
+        elPhaseRestore(old_phase);
+    }
 
     /* Send all the slaves an ACK request if at least one client blocked
      * during the previous event loop iteration. */
@@ -1399,16 +1448,34 @@ void beforeSleep(struct aeEventLoop *eventLoop) {
     if (listLength(server.unblocked_clients))
         processUnblockedClients();
 
+    /* Hand the objects freed lazily in this iteration to the lazyfree
+     * threads. */
+    lazyfreeFlushBatch();
+
     /* Write the AOF buffer on disk */
+    old_phase = elPhaseEnter(EL_PHASE_AOF);
     flushAppendOnlyFile(0);
+    elPhaseRestore(old_phase);
 
     /* Handle writes with pending output buffers. */
     handleClientsWithPendingWrites();
 
+    /* Release the inline values decoded by lookups performed outside of
+     * processCommand(), for instance by modules timers, and account the
+     * memory such code allocated for the keys. */
+    dbReleaseTempValues();
+    keymemFlush();
+
+    /* We are going to poll for new events: the iteration is over. This
+     * updates the event loop stats, so it must happen while we still hold
+     * the GIL. */
+    elIterationEnd();
+
     /* Before we are going to sleep, let the threads access the dataset by
      * releasing the GIL. Redis main thread will not touch anything at this
-     * time. */
-    if (moduleCount()) moduleReleaseGIL();
+     * time. The defrag thread also waits for the GIL to move allocations. */
+    gil_released = moduleCount() || activeDefragThreadNeedsGIL();
+    if (gil_released) moduleReleaseGIL();
 }
 
 /* This function is called immadiately after the event loop multiplexing
@@ -1416,7 +1483,9 @@ void beforeSleep(struct aeEventLoop *eventLoop) {
  * the different events callbacks. */
 void afterSleep(struct aeEventLoop *eventLoop) {
     UNUSED(eventLoop);
-    if (moduleCount()) moduleAcquireGIL();
+    if (gil_released) moduleAcquireGIL();
+    gil_released = 0;
+    elIterationStart();
 }
 
 /* =========================== Server initialization ======================== */
@@ -1489,6 +1558,9 @@ void createSharedObjects(void) {
     shared.unsubscribebulk = createStringObject("$11\r\nunsubscribe\r\n",18);
     shared.psubscribebulk = createStringObject("$10\r\npsubscribe\r\n",17);
     shared.punsubscribebulk = createStringObject("$12\r\npunsubscribe\r\n",19);
+    shared.smessagebulk = createStringObject("$8\r\nsmessage\r\n",14);
+    shared.ssubscribebulk = createStringObject("$10\r\nssubscribe\r\n",17);
+    shared.sunsubscribebulk = createStringObject("$12\r\nsunsubscribe\r\n",19);
     shared.del = createStringObject("DEL",3);
     shared.unlink = createStringObject("UNLINK",6);
     shared.rpop = createStringObject("RPOP",4);
@@ -1548,6 +1620,7 @@ void initServerConfig(void) {
     server.tcpkeepalive = CONFIG_DEFAULT_TCP_KEEPALIVE;
     server.active_expire_enabled = 1;
     server.active_defrag_enabled = CONFIG_DEFAULT_ACTIVE_DEFRAG;
+    server.active_defrag_thread = CONFIG_DEFAULT_ACTIVE_DEFRAG_THREAD;
     server.active_defrag_ignore_bytes = CONFIG_DEFAULT_DEFRAG_IGNORE_BYTES;
     server.active_defrag_threshold_lower = CONFIG_DEFAULT_DEFRAG_THRESHOLD_LOWER;
     server.active_defrag_threshold_upper = CONFIG_DEFAULT_DEFRAG_THRESHOLD_UPPER;
@@ -1592,15 +1665,21 @@ void initServerConfig(void) {
     server.rdb_checksum = CONFIG_DEFAULT_RDB_CHECKSUM;
     server.stop_writes_on_bgsave_err = CONFIG_DEFAULT_STOP_WRITES_ON_BGSAVE_ERROR;
     server.activerehashing = CONFIG_DEFAULT_ACTIVE_REHASHING;
+    server.inline_small_values = CONFIG_DEFAULT_INLINE_SMALL_VALUES;
+    server.inline_pending = 0;
     server.active_defrag_running = 0;
     server.notify_keyspace_events = 0;
     server.maxclients = CONFIG_DEFAULT_MAX_CLIENTS;
     server.blocked_clients = 0;
     memset(server.blocked_clients_by_type,0,
            sizeof(server.blocked_clients_by_type));
+    server.tracking_clients = 0;
     server.maxmemory = CONFIG_DEFAULT_MAXMEMORY;
     server.maxmemory_policy = CONFIG_DEFAULT_MAXMEMORY_POLICY;
     server.maxmemory_samples = CONFIG_DEFAULT_MAXMEMORY_SAMPLES;
+    server.maxmemory_background_eviction = CONFIG_DEFAULT_MAXMEMORY_BACKGROUND_EVICTION;
+    server.maxmemory_low_watermark = CONFIG_DEFAULT_MAXMEMORY_LOW_WATERMARK;
+    server.maxmemory_hard_margin = CONFIG_DEFAULT_MAXMEMORY_HARD_MARGIN;
     server.lfu_log_factor = CONFIG_DEFAULT_LFU_LOG_FACTOR;
     server.lfu_decay_time = CONFIG_DEFAULT_LFU_DECAY_TIME;
     server.hash_max_ziplist_entries = OBJ_HASH_MAX_ZIPLIST_ENTRIES;
@@ -1631,8 +1710,13 @@ void initServerConfig(void) {
     server.lazyfree_lazy_eviction = CONFIG_DEFAULT_LAZYFREE_LAZY_EVICTION;
     server.lazyfree_lazy_expire = CONFIG_DEFAULT_LAZYFREE_LAZY_EXPIRE;
     server.lazyfree_lazy_server_del = CONFIG_DEFAULT_LAZYFREE_LAZY_SERVER_DEL;
+    server.lazyfree_lazy_overwrite = CONFIG_DEFAULT_LAZYFREE_LAZY_OVERWRITE;
+    server.lazyfree_lazy_member_del = CONFIG_DEFAULT_LAZYFREE_LAZY_MEMBER_DEL;
+    server.lazyfree_threads = CONFIG_DEFAULT_LAZYFREE_THREADS;
     server.always_show_logo = CONFIG_DEFAULT_ALWAYS_SHOW_LOGO;
     server.lua_time_limit = LUA_SCRIPT_TIME_LIMIT;
+    server.lua_jit = CONFIG_DEFAULT_LUA_JIT;
+    server.lua_results_max = CONFIG_DEFAULT_LUA_RESULTS_MAX;
 
     unsigned int lruclock = getLRUClock();
     atomicSet(server.lruclock,lruclock);
@@ -1713,6 +1797,11 @@ void initServerConfig(void) {
 
     /* Latency monitor */
     server.latency_monitor_threshold = CONFIG_DEFAULT_LATENCY_MONITOR_THRESHOLD;
+    server.latency_tracking_enabled = CONFIG_DEFAULT_LATENCY_TRACKING;
+    server.eventloop_profiling = CONFIG_DEFAULT_EVENTLOOP_PROFILING;
+    server.keystats_sample_ratio = CONFIG_DEFAULT_KEYSTATS_SAMPLE_RATIO;
+    server.keystats_countdown = CONFIG_DEFAULT_KEYSTATS_SAMPLE_RATIO;
+    server.key_memory_tracking = CONFIG_DEFAULT_KEY_MEMORY_TRACKING;
 
     /* Debugging */
     server.assert_failed = "<no assertion failed>";
@@ -1987,7 +2076,14 @@ void resetServerStats(void) {
     server.stat_expired_stale_perc = 0;
     server.stat_expired_time_cap_reached_count = 0;
     server.stat_evictedkeys = 0;
+    server.stat_evictedkeys_background = 0;
+    server.stat_eviction_cron_time = 0;
+    server.stat_eviction_cmd_count = 0;
+    server.stat_eviction_cmd_time = 0;
+    server.stat_eviction_cmd_max_time = 0;
     server.stat_keyspace_misses = 0;
+    server.stat_lua_results_hits = 0;
+    server.stat_lua_results_misses = 0;
     server.stat_keyspace_hits = 0;
     server.stat_active_defrag_hits = 0;
     server.stat_active_defrag_misses = 0;
@@ -2010,6 +2106,7 @@ void resetServerStats(void) {
     server.stat_net_input_bytes = 0;
     server.stat_net_output_bytes = 0;
     server.aof_delayed_fsync = 0;
+    elResetStats();
 }
 
 void initServer(void) {
@@ -2029,10 +2126,15 @@ void initServer(void) {
     server.current_client = NULL;
     server.clients = listCreate();
     server.clients_index = raxNew();
+    server.clients_timeout_table = raxNew();
+    server.clients_timeout_timer = -1;
+    server.clients_timeout_timer_when = 0;
     server.clients_to_close = listCreate();
     server.slaves = listCreate();
     server.monitors = listCreate();
     server.clients_pending_write = listCreate();
+    server.inline_temp_values = listCreate();
+    listSetFreeMethod(server.inline_temp_values,decrRefCountVoid);
     server.slaveseldb = -1; /* Force to emit the first SELECT command. */
     server.unblocked_clients = listCreate();
     server.ready_keys = listCreate();
@@ -2079,18 +2181,22 @@ void initServer(void) {
     for (j = 0; j < server.dbnum; j++) {
         server.db[j].dict = dictCreate(&dbDictType,NULL);
         server.db[j].expires = dictCreate(&keyptrDictType,NULL);
+        server.db[j].memory = dictCreate(&keyptrDictType,NULL);
+        server.db[j].used_memory = 0;
         server.db[j].blocking_keys = dictCreate(&keylistDictType,NULL);
         server.db[j].ready_keys = dictCreate(&objectKeyPointerValueDictType,NULL);
-        server.db[j].watched_keys = dictCreate(&keylistDictType,NULL);
+        server.db[j].watched_keys = dictCreate(&objectKeyHeapPointerValueDictType,NULL);
+        server.db[j].lua_results_keys = dictCreate(&keylistDictType,NULL);
         server.db[j].id = j;
         server.db[j].avg_ttl = 0;
         server.db[j].defrag_later = listCreate();
     }
     evictionPoolAlloc(); /* Initialize the LRU keys pool. */
     server.pubsub_channels = dictCreate(&keylistDictType,NULL);
-    server.pubsub_patterns = listCreate();
-    listSetFreeMethod(server.pubsub_patterns,freePubsubPattern);
-    listSetMatchMethod(server.pubsub_patterns,listMatchPubsubPattern);
+    server.pubsub_patterns = dictCreate(&keylistDictType,NULL);
+    server.pubsub_patterns_index = raxNew();
+    server.pubsub_patterns_count = 0;
+    server.pubsubshard_channels = dictCreate(&keylistDictType,NULL);
     server.cronloops = 0;
     server.rdb_child_pid = -1;
     server.aof_child_pid = -1;
@@ -2106,6 +2212,9 @@ void initServer(void) {
     server.rdb_save_time_last = -1;
     server.rdb_save_time_start = -1;
     server.dirty = 0;
+    server.el_phase = EL_PHASE_OTHER;
+    server.el_phase_start = ustime();
+    server.el_iteration_start = 0;
     resetServerStats();
     /* A few stats we don't want to reset: server startup time, and peak mem. */
     server.stat_starttime = time(NULL);
@@ -2232,6 +2341,10 @@ void resetCommandTableStats(void) {
         c = (struct redisCommand *) dictGetVal(de);
         c->microseconds = 0;
         c->calls = 0;
+        zfree(c->latency_hist);
+        zfree(c->latency_total_hist);
+        c->latency_hist = NULL;
+        c->latency_total_hist = NULL;
     }
     dictReleaseIterator(di);
 
@@ -2436,8 +2549,12 @@ void call(client *c, int flags) {
     /* Call the command. */
     dirty = server.dirty;
     start = ustime();
+    int old_phase = elPhaseEnterAt(EL_PHASE_EXEC,start);
     c->cmd->proc(c);
-    duration = ustime()-start;
+    keymemFlush();
+    long long end = ustime();
+    elPhaseRestoreAt(old_phase,end);
+    duration = end-start;
     dirty = server.dirty-dirty;
     if (dirty < 0) dirty = 0;
 
@@ -2446,6 +2563,16 @@ void call(client *c, int flags) {
     if (server.loading && c->flags & CLIENT_LUA)
         flags &= ~(CMD_CALL_SLOWLOG | CMD_CALL_STATS);
 
+    /* If the client has tracking enabled, remember the keys fetched by read
+     * only commands. For commands called by scripts the keys are remembered
+     * for the client that called the script. */
+    if (server.tracking_clients && c->cmd->flags & CMD_READONLY) {
+        client *caller = (c->flags & CLIENT_LUA && server.lua_caller) ?
+                         server.lua_caller : c;
+        if (caller->flags & CLIENT_TRACKING)
+            trackingRememberKeys(caller,c->argv,c->argc,c->cmd);
+    }
+
     /* If the caller is Lua, we want to force the EVAL caller to propagate
      * the script if the command flag or client flag are forcing the
      * propagation. */
@@ -2470,6 +2597,15 @@ void call(client *c, int flags) {
          * EXPIRE, GEOADD, etc. */
         real_cmd->microseconds += duration;
         real_cmd->calls++;
+        if (server.latency_tracking_enabled) {
+            latencyHistogramRecord(&real_cmd->latency_hist,duration);
+            /* The total latency of blocked clients is recorded when they
+             * are unblocked, see unblockClient(). Clients not reading
+             * commands from a socket (Lua, AOF, ...) have no read time. */
+            if (c->read_ustime && !(c->flags & CLIENT_BLOCKED))
+                latencyHistogramRecord(&real_cmd->latency_total_hist,
+                                       start+duration-c->read_ustime);
+        }
     }
 
     /* Propagate the command into the AOF and replication link */
@@ -2682,8 +2818,10 @@ int processCommand(client *c) {
         c->cmd->proc != subscribeCommand &&
         c->cmd->proc != unsubscribeCommand &&
         c->cmd->proc != psubscribeCommand &&
-        c->cmd->proc != punsubscribeCommand) {
-        addReplyError(c,"only (P)SUBSCRIBE / (P)UNSUBSCRIBE / PING / QUIT allowed in this context");
+        c->cmd->proc != punsubscribeCommand &&
+        c->cmd->proc != ssubscribeCommand &&
+        c->cmd->proc != sunsubscribeCommand) {
+        addReplyError(c,"only (P|S)SUBSCRIBE / (P|S)UNSUBSCRIBE / PING / QUIT allowed in this context");
         return C_OK;
     }
 
@@ -2734,6 +2872,7 @@ int processCommand(client *c) {
         c->woff = server.master_repl_offset;
         if (listLength(server.ready_keys))
             handleClientsBlockedOnKeys();
+        dbReleaseTempValues();
     }
     return C_OK;
 }
@@ -3181,10 +3320,16 @@ sds genRedisInfoString(char *section) {
             "connected_clients:%lu\r\n"
             "client_recent_max_input_buffer:%zu\r\n"
             "client_recent_max_output_buffer:%zu\r\n"
-            "blocked_clients:%d\r\n",
+            "blocked_clients:%d\r\n"
+            "clients_in_timeout_table:%llu\r\n"
+            "tracking_clients:%d\r\n"
+            "tracking_table_used_slots:%lu\r\n",
             listLength(server.clients)-listLength(server.slaves),
             maxin, maxout,
-            server.blocked_clients);
+            server.blocked_clients,
+            (unsigned long long) raxSize(server.clients_timeout_table),
+            server.tracking_clients,
+            trackingGetUsedSlots());
     }
 
     /* Memory */
@@ -3414,10 +3559,20 @@ sds genRedisInfoString(char *section) {
             "expired_stale_perc:%.2f\r\n"
             "expired_time_cap_reached_count:%lld\r\n"
             "evicted_keys:%lld\r\n"
+            "evicted_keys_background:%lld\r\n"
+            "eviction_lag_bytes:%zu\r\n"
+            "eviction_cron_time_ms:%lld\r\n"
+            "eviction_cmd_count:%lld\r\n"
+            "eviction_cmd_time_ms:%lld\r\n"
+            "eviction_cmd_avg_usec:%.2f\r\n"
+            "eviction_cmd_max_usec:%lld\r\n"
             "keyspace_hits:%lld\r\n"
             "keyspace_misses:%lld\r\n"
+            "lua_results_hits:%lld\r\n"
+            "lua_results_misses:%lld\r\n"
             "pubsub_channels:%ld\r\n"
             "pubsub_patterns:%lu\r\n"
+            "pubsubshard_channels:%lu\r\n"
             "latest_fork_usec:%lld\r\n"
             "migrate_cached_sockets:%ld\r\n"
             "slave_expires_tracked_keys:%zu\r\n"
@@ -3440,10 +3595,21 @@ sds genRedisInfoString(char *section) {
             server.stat_expired_stale_perc*100,
             server.stat_expired_time_cap_reached_count,
             server.stat_evictedkeys,
+            server.stat_evictedkeys_background,
+            evictionLag(),
+            server.stat_eviction_cron_time/1000,
+            server.stat_eviction_cmd_count,
+            server.stat_eviction_cmd_time/1000,
+            server.stat_eviction_cmd_count ? (double)
+                server.stat_eviction_cmd_time/server.stat_eviction_cmd_count : 0,
+            server.stat_eviction_cmd_max_time,
             server.stat_keyspace_hits,
             server.stat_keyspace_misses,
+            server.stat_lua_results_hits,
+            server.stat_lua_results_misses,
             dictSize(server.pubsub_channels),
-            listLength(server.pubsub_patterns),
+            server.pubsub_patterns_count,
+            dictSize(server.pubsubshard_channels),
             server.stat_fork_time,
             dictSize(server.migrate_cached_sockets),
             getSlaveKeyWithExpireCount(),
@@ -3616,6 +3782,41 @@ sds genRedisInfoString(char *section) {
         dictReleaseIterator(di);
     }
 
+    /* Event loop phases */
+    if (allsections || !strcasecmp(section,"eventloop")) {
+        if (sections++) info = sdscat(info,"\r\n");
+        info = sdscatprintf(info, "# Eventloop\r\n");
+        info = elCatStatsInfoString(info);
+    }
+
+    /* Latency statistics */
+    if (allsections || !strcasecmp(section,"latencystats")) {
+        if (sections++) info = sdscat(info,"\r\n");
+        info = sdscatprintf(info, "# Latencystats\r\n");
+
+        struct redisCommand *c;
+        dictEntry *de;
+        dictIterator *di;
+        di = dictGetSafeIterator(server.commands);
+        while((de = dictNext(di)) != NULL) {
+            c = (struct redisCommand *) dictGetVal(de);
+            if (c->latency_hist) {
+                info = sdscatprintf(info,"latency_percentiles_usec_%s:",
+                    c->name);
+                info = latencyHistogramCatPercentiles(info,c->latency_hist);
+                info = sdscatlen(info,"\r\n",2);
+            }
+            if (c->latency_total_hist) {
+                info = sdscatprintf(info,
+                    "latency_total_percentiles_usec_%s:",c->name);
+                info = latencyHistogramCatPercentiles(info,
+                    c->latency_total_hist);
+                info = sdscatlen(info,"\r\n",2);
+            }
+        }
+        dictReleaseIterator(di);
+    }
+
     /* Cluster */
     if (allsections || defsections || !strcasecmp(section,"cluster")) {
         if (sections++) info = sdscat(info,"\r\n");
@@ -3636,8 +3837,12 @@ sds genRedisInfoString(char *section) {
             vkeys = dictSize(server.db[j].expires);
             if (keys || vkeys) {
                 info = sdscatprintf(info,
-                    "db%d:keys=%lld,expires=%lld,avg_ttl=%lld\r\n",
+                    "db%d:keys=%lld,expires=%lld,avg_ttl=%lld",
                     j, keys, vkeys, server.db[j].avg_ttl);
+                if (keymemIsComplete())
+                    info = sdscatprintf(info,",used_memory=%lld",
+                        server.db[j].used_memory);
+                info = sdscatlen(info,"\r\n",2);
             }
         }
     }
@@ -58,6 +58,7 @@ typedef long long mstime_t; /* millisecond time type. */
 #include "zmalloc.h" /* total memory usage aware version of malloc/free */
 #include "anet.h"    /* Networking the easy way */
 #include "ziplist.h" /* Compact list data structure */
+#include "listpack.h" /* Compact list data structure, no cascade updates */
 #include "intset.h"  /* Compact integer set structure */
 #include "version.h" /* Version macro */
 #include "util.h"    /* Misc functions useful in many places */
@@ -137,6 +138,9 @@ typedef long long mstime_t; /* millisecond time type. */
 #define CONFIG_DEFAULT_REPL_DISABLE_TCP_NODELAY 0
 #define CONFIG_DEFAULT_MAXMEMORY 0
 #define CONFIG_DEFAULT_MAXMEMORY_SAMPLES 5
+#define CONFIG_DEFAULT_MAXMEMORY_BACKGROUND_EVICTION 0
+#define CONFIG_DEFAULT_MAXMEMORY_LOW_WATERMARK 95 /* percent of maxmemory */
+#define CONFIG_DEFAULT_MAXMEMORY_HARD_MARGIN 5 /* percent of maxmemory */
 #define CONFIG_DEFAULT_LFU_LOG_FACTOR 10
 #define CONFIG_DEFAULT_LFU_DECAY_TIME 1
 #define CONFIG_DEFAULT_AOF_FILENAME "appendonly.aof"
@@ -144,6 +148,7 @@ typedef long long mstime_t; /* millisecond time type. */
 #define CONFIG_DEFAULT_AOF_LOAD_TRUNCATED 1
 #define CONFIG_DEFAULT_AOF_USE_RDB_PREAMBLE 1
 #define CONFIG_DEFAULT_ACTIVE_REHASHING 1
+#define CONFIG_DEFAULT_INLINE_SMALL_VALUES 0
 #define CONFIG_DEFAULT_AOF_REWRITE_INCREMENTAL_FSYNC 1
 #define CONFIG_DEFAULT_RDB_SAVE_INCREMENTAL_FSYNC 1
 #define CONFIG_DEFAULT_MIN_SLAVES_TO_WRITE 0
@@ -153,12 +158,20 @@ typedef long long mstime_t; /* millisecond time type. */
 #define CONFIG_BINDADDR_MAX 16
 #define CONFIG_MIN_RESERVED_FDS 32
 #define CONFIG_DEFAULT_LATENCY_MONITOR_THRESHOLD 0
+#define CONFIG_DEFAULT_LATENCY_TRACKING 1
+#define CONFIG_DEFAULT_EVENTLOOP_PROFILING 1
+#define CONFIG_DEFAULT_KEYSTATS_SAMPLE_RATIO 0
+#define CONFIG_DEFAULT_KEY_MEMORY_TRACKING 0
 #define CONFIG_DEFAULT_SLAVE_LAZY_FLUSH 0
 #define CONFIG_DEFAULT_LAZYFREE_LAZY_EVICTION 0
 #define CONFIG_DEFAULT_LAZYFREE_LAZY_EXPIRE 0
 #define CONFIG_DEFAULT_LAZYFREE_LAZY_SERVER_DEL 0
+#define CONFIG_DEFAULT_LAZYFREE_LAZY_OVERWRITE 0
+#define CONFIG_DEFAULT_LAZYFREE_LAZY_MEMBER_DEL 0
+#define CONFIG_DEFAULT_LAZYFREE_THREADS 1
 #define CONFIG_DEFAULT_ALWAYS_SHOW_LOGO 0
 #define CONFIG_DEFAULT_ACTIVE_DEFRAG 0
+#define CONFIG_DEFAULT_ACTIVE_DEFRAG_THREAD 0
 #define CONFIG_DEFAULT_DEFRAG_THRESHOLD_LOWER 10 /* don't defrag when fragmentation is below 10% */
 #define CONFIG_DEFAULT_DEFRAG_THRESHOLD_UPPER 100 /* maximum defrag force at 100% fragmentation */
 #define CONFIG_DEFAULT_DEFRAG_IGNORE_BYTES (100<<20) /* don't defrag if frag overhead is below 100mb */
@@ -173,6 +186,9 @@ typedef long long mstime_t; /* millisecond time type. */
 #define ACTIVE_EXPIRE_CYCLE_SLOW 0
 #define ACTIVE_EXPIRE_CYCLE_FAST 1
 
+#define EVICTION_CRON_TIME_PERC 25 /* CPU max % for background eviction */
+#define EVICTION_CMD_TIME_LIMIT 500 /* Microseconds of eviction per command */
+
 /* Instantaneous metrics tracking. */
 #define STATS_METRIC_SAMPLES 16     /* Number of samples per metric. */
 #define STATS_METRIC_COMMAND 0      /* Number of commands executed. */
@@ -230,7 +246,6 @@ typedef long long mstime_t; /* millisecond time type. */
 #define CLIENT_MONITOR (1<<2) /* This client is a slave monitor, see MONITOR */
 #define CLIENT_MULTI (1<<3)   /* This client is in a MULTI context */
 #define CLIENT_BLOCKED (1<<4) /* The client is waiting in a blocking operation */
-#define CLIENT_DIRTY_CAS (1<<5) /* Watched keys modified. EXEC will fail. */
 #define CLIENT_CLOSE_AFTER_REPLY (1<<6) /* Close after writing entire reply. */
 #define CLIENT_UNBLOCKED (1<<7) /* This client was unblocked and is stored in
                                   server.unblocked_clients */
@@ -257,6 +272,10 @@ typedef long long mstime_t; /* millisecond time type. */
 #define CLIENT_LUA_DEBUG_SYNC (1<<26)  /* EVAL debugging without fork() */
 #define CLIENT_MODULE (1<<27) /* Non connected client used by some module. */
 #define CLIENT_PROTECTED (1<<28) /* Client should not be freed for now. */
+#define CLIENT_LUA_DIRECT_REPLY (1<<29) /* Lua client: replies are converted
+                                           to Lua values as they are built. */
+#define CLIENT_TRACKING (1<<30)   /* Client enabled keys tracking in order to
+                                     perform client side caching. */
 
 /* Client block type (btype field in client structure)
  * if CLIENT_BLOCKED flag is set. */
@@ -383,6 +402,7 @@ typedef long long mstime_t; /* millisecond time type. */
 #define MAXMEMORY_FLAG_LRU (1<<0)
 #define MAXMEMORY_FLAG_LFU (1<<1)
 #define MAXMEMORY_FLAG_ALLKEYS (1<<2)
+#define MAXMEMORY_FLAG_SIZE (1<<3)
 #define MAXMEMORY_FLAG_NO_SHARED_INTEGERS \
     (MAXMEMORY_FLAG_LRU|MAXMEMORY_FLAG_LFU)
 
@@ -394,11 +414,18 @@ typedef long long mstime_t; /* millisecond time type. */
 #define MAXMEMORY_ALLKEYS_LFU ((5<<8)|MAXMEMORY_FLAG_LFU|MAXMEMORY_FLAG_ALLKEYS)
 #define MAXMEMORY_ALLKEYS_RANDOM ((6<<8)|MAXMEMORY_FLAG_ALLKEYS)
 #define MAXMEMORY_NO_EVICTION (7<<8)
+#define MAXMEMORY_VOLATILE_LFU_SIZE \
+    ((8<<8)|MAXMEMORY_FLAG_LFU|MAXMEMORY_FLAG_SIZE)
+#define MAXMEMORY_ALLKEYS_LFU_SIZE \
+    ((9<<8)|MAXMEMORY_FLAG_LFU|MAXMEMORY_FLAG_SIZE|MAXMEMORY_FLAG_ALLKEYS)
 
 #define CONFIG_DEFAULT_MAXMEMORY_POLICY MAXMEMORY_NO_EVICTION
 
 /* Scripting */
 #define LUA_SCRIPT_TIME_LIMIT 5000 /* milliseconds */
+#define CONFIG_DEFAULT_LUA_JIT 0
+#define CONFIG_DEFAULT_LUA_RESULTS_MAX 0 /* Script results cache disabled. */
+#define LUA_RESULT_MAX_LEN (1024*64) /* Bigger results are not cached. */
 
 /* Units */
 #define UNIT_SECONDS 0
@@ -596,8 +623,9 @@ typedef struct RedisModuleDigest {
 #define OBJ_ENCODING_INTSET 6  /* Encoded as intset */
 #define OBJ_ENCODING_SKIPLIST 7  /* Encoded as skiplist */
 #define OBJ_ENCODING_EMBSTR 8  /* Embedded sds string encoding */
-#define OBJ_ENCODING_QUICKLIST 9 /* Encoded as linked list of ziplists */
+#define OBJ_ENCODING_QUICKLIST 9 /* Encoded as linked list of listpacks */
 #define OBJ_ENCODING_STREAM 10 /* Encoded as a radix tree of listpacks */
+#define OBJ_ENCODING_LISTPACK 11 /* Encoded as a listpack */
 
 #define LRU_BITS 24
 #define LRU_CLOCK_MAX ((1<<LRU_BITS)-1) /* Max value of obj->lru */
@@ -625,12 +653,34 @@ typedef struct redisObject {
     _var.ptr = _ptr; \
 } while(0)
 
+/* Small string values may be stored directly inside the dictEntry of the
+ * main dictionary instead of allocating an object, see dbInlineValue().
+ * Such values are pointers having the lowest bit set, which is never the
+ * case for an allocated object:
+ *
+ *   integers: the value shifted left by two bits, with the "01" tag.
+ *   strings:  "11" tag, length in the bits 2-4, the bytes from the second
+ *             byte on (so up to 7 bytes with 64 bit pointers).
+ *
+ * Only the code accessing the main dictionary directly has to care about
+ * them: lookupKey() and the other DB level functions always return
+ * objects. */
+#define OBJ_INLINE_TAG 1
+#define OBJ_INLINE_STR 2
+#define OBJ_INLINE_STR_MAXLEN (sizeof(void*)-1)
+#define OBJ_INLINE_INT_MIN (INTPTR_MIN/4)
+#define OBJ_INLINE_INT_MAX (INTPTR_MAX/4)
+#define objIsInline(o) (((uintptr_t)(o)) & OBJ_INLINE_TAG)
+
 struct evictionPoolEntry; /* Defined in evict.c */
 
 /* This structure is used in order to represent the output buffer of a client,
- * which is actually a linked list of blocks like that, that is: client->reply. */
+ * which is actually a linked list of blocks like that, that is: client->reply.
+ * A block without free space is never modified again, so it can be shared
+ * by the output buffers of many clients, see addReplyBlock(). */
 typedef struct clientReplyBlock {
     size_t size, used;
+    int refcount;
     char buf[];
 } clientReplyBlock;
 
@@ -640,9 +690,13 @@ typedef struct clientReplyBlock {
 typedef struct redisDb {
     dict *dict;                 /* The keyspace for this DB */
     dict *expires;              /* Timeout of keys with a timeout set */
+    dict *memory;               /* Bytes allocated for every value, if
+                                   key-memory-tracking is enabled. */
+    long long used_memory;      /* Sum of the values of the 'memory' dict. */
     dict *blocking_keys;        /* Keys with clients waiting for data (BLPOP)*/
     dict *ready_keys;           /* Blocked keys that received a PUSH */
-    dict *watched_keys;         /* WATCHED keys for MULTI/EXEC CAS */
+    dict *watched_keys;         /* WATCHED keys -> version, for MULTI/EXEC */
+    dict *lua_results_keys;     /* Keys read by cached script results */
     int id;                     /* Database ID */
     long long avg_ttl;          /* Average TTL, just for stats */
     list *defrag_later;         /* List of key names to attempt to defrag one by one, gradually. */
@@ -737,6 +791,10 @@ typedef struct client {
                                buffer or object being sent. */
     time_t ctime;           /* Client creation time. */
     time_t lastinteraction; /* Time of the last interaction, used for timeout */
+    long long read_ustime;  /* Time of the last read from the socket in
+                               microseconds, that is the arrival time of the
+                               commands in the query buffer. Zero for clients
+                               not reading from a socket. */
     time_t obuf_soft_limit_reached_time;
     int flags;              /* Client flags: CLIENT_* macros. */
     int authenticated;      /* When requirepass is non-NULL. */
@@ -764,8 +822,12 @@ typedef struct client {
     list *watched_keys;     /* Keys WATCHED for MULTI/EXEC CAS */
     dict *pubsub_channels;  /* channels a client is interested in (SUBSCRIBE) */
     list *pubsub_patterns;  /* patterns a client is interested in (SUBSCRIBE) */
+    dict *pubsubshard_channels; /* shard channels a client is interested in (SSUBSCRIBE) */
     sds peerid;             /* Cached peer ID. */
     listNode *client_list_node; /* list node in client list */
+    uint64_t client_tracking_redirection; /* Client ID receiving the
+                                             invalidation messages of this
+                                             client if CLIENT_TRACKING. */
 
     /* Response buffer */
     int bufpos;
@@ -790,7 +852,8 @@ struct sharedObjectsStruct {
     *outofrangeerr, *noscripterr, *loadingerr, *slowscripterr, *bgsaveerr,
     *masterdownerr, *roslaveerr, *execaborterr, *noautherr, *noreplicaserr,
     *busykeyerr, *oomerr, *plus, *messagebulk, *pmessagebulk, *subscribebulk,
-    *unsubscribebulk, *psubscribebulk, *punsubscribebulk, *del, *unlink,
+    *unsubscribebulk, *psubscribebulk, *punsubscribebulk, *smessagebulk,
+    *ssubscribebulk, *sunsubscribebulk, *del, *unlink,
     *rpop, *lpop, *lpush, *rpoplpush, *zpopmin, *zpopmax, *emptyscan,
     *select[PROTO_SHARED_SELECT_CMDS],
     *integers[OBJ_SHARED_INTEGERS],
@@ -821,6 +884,13 @@ typedef struct zset {
     zskiplist *zsl;
 } zset;
 
+/* Element of the array consumed by zsetBulkLoad(). */
+typedef struct zsetBulkEntry {  // 批量构建跳跃表时使用的元素
+    sds ele;
+    double score;
+    dictEntry *de;  /* Entry of 'ele' already in the zset dict, or NULL. */
+} zsetBulkEntry;
+
 typedef struct clientBufferLimitsConfig {
     unsigned long long hard_limit_bytes;
     unsigned long long soft_limit_bytes;
@@ -948,6 +1018,9 @@ struct redisServer {
     unsigned int lruclock;      /* Clock for LRU eviction */
     int shutdown_asap;          /* SHUTDOWN needed ASAP */
     int activerehashing;        /* Incremental rehash in serverCron() */
+    int inline_small_values;    /* Store small strings in the dict entry. */
+    long long inline_pending;   /* Values inlineValuesCron() may inline. */
+    list *inline_temp_values;   /* Objects decoded by read lookups. */
     int active_defrag_running;  /* Active defragmentation running (holds current scan aggressiveness) */
     char *requirepass;          /* Pass for AUTH command, or NULL */
     char *pidfile;              /* PID file path */
@@ -983,6 +1056,10 @@ struct redisServer {
     list *slaves, *monitors;    /* List of slaves and MONITORs */
     client *current_client; /* Current client, only used on crash report */
     rax *clients_index;         /* Active clients dictionary by client ID. */
+    rax *clients_timeout_table; /* Blocked clients ordered by timeout. */
+    long long clients_timeout_timer; /* Timer ID unblocking timed out
+                                        clients, or -1 if not armed. */
+    mstime_t clients_timeout_timer_when; /* Unix time the timer fires at. */
     int clients_paused;         /* True if clients are currently paused */
     mstime_t clients_pause_end_time; /* Time when we undo clients_paused */
     char neterr[ANET_ERR_LEN];   /* Error buffer for anet.c */
@@ -1009,8 +1086,15 @@ struct redisServer {
     double stat_expired_stale_perc; /* Percentage of keys probably expired */
     long long stat_expired_time_cap_reached_count; /* Early expire cylce stops.*/
     long long stat_evictedkeys;     /* Number of evicted keys (maxmemory) */
+    long long stat_evictedkeys_background; /* Keys evicted by evictionCron() */
+    long long stat_eviction_cron_time;  /* Microseconds in evictionCron() */
+    long long stat_eviction_cmd_count;  /* Commands that had to evict keys */
+    long long stat_eviction_cmd_time;   /* Microseconds evicting in commands */
+    long long stat_eviction_cmd_max_time; /* Longest eviction in a command */
     long long stat_keyspace_hits;   /* Number of successful lookups of keys */
     long long stat_keyspace_misses; /* Number of failed lookups of keys */
+    long long stat_lua_results_hits;   /* Scripts served by results cache */
+    long long stat_lua_results_misses; /* Cacheable scripts executed */
     long long stat_active_defrag_hits;      /* number of allocations moved */
     long long stat_active_defrag_misses;    /* number of allocations scanned but not moved */
     long long stat_active_defrag_key_hits;  /* number of keys with moved allocations */
@@ -1046,6 +1130,7 @@ struct redisServer {
     int tcpkeepalive;               /* Set SO_KEEPALIVE if non-zero. */
     int active_expire_enabled;      /* Can be disabled for testing purposes. */
     int active_defrag_enabled;
+    int active_defrag_thread;       /* Defrag in a thread instead of the cron */
     size_t active_defrag_ignore_bytes; /* minimum amount of fragmentation waste to start active defrag */
     int active_defrag_threshold_lower; /* minimum percentage of fragmentation to start active defrag */
     int active_defrag_threshold_upper; /* maximum percentage of fragmentation at which we use maximum effort */
@@ -1194,6 +1279,9 @@ struct redisServer {
     unsigned long long maxmemory;   /* Max number of memory bytes to use */
     int maxmemory_policy;           /* Policy for key eviction */
     int maxmemory_samples;          /* Pricision of random sampling */
+    int maxmemory_background_eviction; /* Evict in serverCron() ahead of time */
+    int maxmemory_low_watermark;    /* Background eviction target, % of maxmemory */
+    int maxmemory_hard_margin;      /* OOM over maxmemory plus this %, see above */
     int lfu_log_factor;             /* LFU logarithmic counter factor. */
     int lfu_decay_time;             /* LFU counter decay factor. */
     long long proto_max_bulk_len;   /* Protocol bulk length maximum size. */
@@ -1202,6 +1290,8 @@ struct redisServer {
     unsigned int blocked_clients_by_type[BLOCKED_NUM];
     list *unblocked_clients; /* list of clients to unblock before next loop */
     list *ready_keys;        /* List of readyList structures for BLPOP & co */
+    /* Client side caching. */
+    unsigned int tracking_clients;  /* # of clients with tracking enabled.*/
     /* Sort parameters - qsort_r() is only available under BSD so we
      * have to take this state global, in order to pass it to sortCompare() */
     int sort_desc;
@@ -1227,7 +1317,10 @@ struct redisServer {
     long long mstime;   /* Like 'unixtime' but with milliseconds resolution. */
     /* Pubsub */
     dict *pubsub_channels;  /* Map channels to list of subscribed clients */
-    list *pubsub_patterns;  /* A list of pubsub_patterns */
+    dict *pubsub_patterns;  /* Map patterns to list of subscribed clients */
+    rax *pubsub_patterns_index; /* Literal prefix -> patterns, see pubsub.c */
+    unsigned long pubsub_patterns_count; /* Clients-patterns subscriptions */
+    dict *pubsubshard_channels; /* Map shard channels to list of subscribed clients */
     int notify_keyspace_events; /* Events to propagate via Pub/Sub. This is an
                                    xor of NOTIFY_... flags. */
     /* Cluster */
@@ -1267,13 +1360,34 @@ struct redisServer {
                              execution. */
     int lua_kill;         /* Kill the script if true. */
     int lua_always_replicate_commands; /* Default replication type. */
+    int lua_jit;          /* Use the LuaJIT trace compiler if available. */
+    dict *lua_results;    /* Results of read only scripts, see scripting.c */
+    unsigned long lua_results_max; /* Max number of cached results. */
+    unsigned long long lua_results_mem; /* Memory used by cached results. */
     /* Lazy free */
     int lazyfree_lazy_eviction;
     int lazyfree_lazy_expire;
     int lazyfree_lazy_server_del;
+    int lazyfree_lazy_overwrite;
+    int lazyfree_lazy_member_del;
+    int lazyfree_threads;           /* Threads releasing the lazy freed objects. */
     /* Latency monitor */
     long long latency_monitor_threshold;
     dict *latency_events;
+    int latency_tracking_enabled; /* Per command latency histograms. */
+    /* Hot keys / big keys sampling, see keystats.c */
+    long long keystats_sample_ratio; /* Sample one lookup every N. 0 = off. */
+    long long keystats_countdown;    /* Lookups left before next sample. */
+    int key_memory_tracking;         /* Track the memory of every value. */
+    /* Event loop phases profiler, see latency.c */
+    int eventloop_profiling;        /* Charge the event loop time to phases. */
+    int el_phase;                   /* EL_PHASE_* currently running. */
+    long long el_phase_start;       /* Time the current phase started. */
+    struct elPhaseStats el_phases[EL_PHASE_NUM];
+    long long el_iterations;        /* Number of event loop iterations. */
+    long long el_iteration_start;   /* Current iteration start time. */
+    long long el_iteration_usec[EL_PHASE_NUM]; /* Phases time at the start
+                                                  of the iteration. */
     /* Assert & bug reporting */
     const char *assert_failed;
     const char *assert_file;
@@ -1290,11 +1404,6 @@ struct redisServer {
     pthread_mutex_t unixtime_mutex;
 };
 
-typedef struct pubsubPattern {
-    client *client;
-    robj *pattern;
-} pubsubPattern;
-
 typedef void redisCommandProc(client *c);
 typedef int *redisGetKeysProc(struct redisCommand *cmd, robj **argv, int argc, int *numkeys);
 struct redisCommand {
@@ -1311,6 +1420,12 @@ struct redisCommand {
     int lastkey;  /* The last argument that's a key */
     int keystep;  /* The step between first and last key */
     long long microseconds, calls;
+    latencyHistogram *latency_hist; /* Execution time histogram. */
+    latencyHistogram *latency_total_hist; /* Histogram of the time from the
+                                             read of the command to its
+                                             completion, so including the
+                                             time spent queued in the query
+                                             buffer and blocked. */
 };
 
 struct redisFunctionSym {
@@ -1369,6 +1484,15 @@ typedef struct {
 
 #include "stream.h"  /* Stream data type header file. */
 
+/* The value of the client->bpop.keys dictionary for every key the client is
+ * blocked for. Remembering the node of the db->blocking_keys list the client
+ * was added to allows to unblock it in constant time, without scanning the
+ * (possibly very long) list of clients blocked for the same key. */
+typedef struct bkinfo {
+    listNode *listnode;     /* List node in db->blocking_keys[key] list. */
+    streamID stream_id;     /* Stream ID if we blocked in a stream. */
+} bkinfo;
+
 #define OBJ_HASH_KEY 1
 #define OBJ_HASH_VALUE 2
 
@@ -1386,6 +1510,7 @@ extern dictType clusterNodesDictType;
 extern dictType clusterNodesBlackListDictType;
 extern dictType dbDictType;
 extern dictType shaScriptObjectDictType;
+extern dictType luaResultsDictType;
 extern double R_Zero, R_PosInf, R_NegInf, R_Nan;
 extern dictType hashDictType;
 extern dictType replScriptCacheDictType;
@@ -1461,6 +1586,8 @@ size_t sdsZmallocSize(sds s);
 size_t getStringObjectSdsUsedMemory(robj *o);
 void freeClientReplyValue(void *o);
 void *dupClientReplyValue(void *o);
+clientReplyBlock *createReplyBlock(size_t size);
+void addReplyBlock(client *c, clientReplyBlock *b);
 void getClientsMaxBuffers(unsigned long *longest_output_list,
                           unsigned long *biggest_input_buffer);
 char *getClientPeerId(client *client);
@@ -1480,6 +1607,7 @@ void disconnectSlaves(void);
 int listenToPort(int port, int *fds, int *count);
 void pauseClients(mstime_t duration);
 int clientsArePaused(void);
+client *lookupClientByID(uint64_t id);
 int processEventsWhileBlocked(void);
 int handleClientsWithPendingWrites(void);
 int clientHasPendingReplies(client *c);
@@ -1521,6 +1649,7 @@ void initClientMultiState(client *c);
 void freeClientMultiState(client *c);
 void queueMultiCommand(client *c);
 void touchWatchedKey(redisDb *db, robj *key);
+int isWatchedKeyTouched(client *c);
 void touchWatchedKeysOnFlush(int dbid);
 void discardTransaction(client *c);
 void flagTransaction(client *c);
@@ -1541,6 +1670,8 @@ robj *createObject(int type, void *ptr);
 robj *createStringObject(const char *ptr, size_t len);
 robj *createRawStringObject(const char *ptr, size_t len);
 robj *createEmbeddedStringObject(const char *ptr, size_t len);
+void *objectToInline(robj *o);
+robj *createObjectFromInline(void *v);
 robj *dupStringObject(const robj *o);
 int isSdsRepresentableAsLongLong(sds s, long long *llval);
 int isObjectRepresentableAsLongLong(robj *o, long long *llongval);
@@ -1556,7 +1687,7 @@ robj *createSetObject(void);
 robj *createIntsetObject(void);
 robj *createHashObject(void);
 robj *createZsetObject(void);
-robj *createZsetZiplistObject(void);
+robj *createZsetListpackObject(void);
 robj *createStreamObject(void);
 robj *createModuleObject(moduleType *mt, void *value);
 int getLongFromObjectOrReply(client *c, robj *o, long *target, const char *msg);
@@ -1674,7 +1805,9 @@ typedef struct {
 
 zskiplist *zslCreate(void);     // 创建一个跳跃表，申请level为64的空间
 void zslFree(zskiplist *zsl);   // 释放一个跳跃表，所有元素也都会被释放
+void zslFreeNode(zskiplistNode *node);  // 释放一个结点及其元素
 zskiplistNode *zslInsert(zskiplist *zsl, double score, sds ele);    // 插入一个新元素，跳跃表将获得ele所有权
+void zsetBulkLoad(zset *zs, zsetBulkEntry *entries, unsigned long count); // 排序后线性时间构建跳跃表，zset必须为空
 unsigned char *zzlInsert(unsigned char *zl, sds ele, double score);
 int zslDelete(zskiplist *zsl, double score, sds ele, zskiplistNode **node); // 从跳跃表删除一个元素，返回1表示成功删除元素，否则返回0, 如果node为空，则被删除的元素直接释放node结点，否则只是将元素从跳跃表中软删除后放入node参数
 zskiplistNode *zslFirstInRange(zskiplist *zsl, zrangespec *range);  // 根据分值查找范围内第一个元素
@@ -1686,14 +1819,14 @@ unsigned char *zzlFirstInRange(unsigned char *zl, zrangespec *range);
 unsigned char *zzlLastInRange(unsigned char *zl, zrangespec *range);
 unsigned long zsetLength(const robj *zobj);
 void zsetConvert(robj *zobj, int encoding);
-void zsetConvertToZiplistIfNeeded(robj *zobj, size_t maxelelen);
+void zsetConvertToListpackIfNeeded(robj *zobj, size_t maxelelen);
 int zsetScore(robj *zobj, sds member, double *score);
 unsigned long zslGetRank(zskiplist *zsl, double score, sds o);  // 根据分数和键查找元素的排名，返回0表示没找到元素，大于0为排名
 int zsetAdd(robj *zobj, double score, sds ele, int *flags, double *newscore);
 long zsetRank(robj *zobj, sds ele, int reverse);
 int zsetDel(robj *zobj, sds ele);
 void genericZpopCommand(client *c, robj **keyv, int keyc, int where, int emitkey, robj *countarg);
-sds ziplistGetObject(unsigned char *sptr);
+sds lpGetObject(unsigned char *sptr);
 int zslValueGteMin(double value, zrangespec *spec); // 判断value是否在获取范围内，根据zrangespec里的字段判断是否包含最小值
 int zslValueLteMax(double value, zrangespec *spec); // 判断value是否在获取范围内，根据zrangespec里的字段判断是否包含最大
 void zslFreeLexRange(zlexrangespec *spec);  // 释放zlexrangespec结构体和内部的sds
@@ -1712,6 +1845,8 @@ int getMaxmemoryState(size_t *total, size_t *logical, size_t *tofree, float *lev
 size_t freeMemoryGetNotCountedMemory();
 int freeMemoryIfNeeded(void);
 int freeMemoryIfNeededAndSafe(void);
+void evictionCron(void);
+size_t evictionLag(void);
 int processCommand(client *c);
 void setupSignalHandlers(void);
 struct redisCommand *lookupCommand(sds name);
@@ -1743,6 +1878,7 @@ void closeListeningSockets(int unlink_unix_socket);
 void updateCachedTime(void);
 void resetServerStats(void);
 void activeDefragCycle(void);
+int activeDefragThreadNeedsGIL(void);
 unsigned int getLRUClock(void);
 unsigned int LRU_CLOCK(void);
 const char *evictPolicyToString(void);
@@ -1782,10 +1918,10 @@ unsigned long hashTypeLength(const robj *o);
 hashTypeIterator *hashTypeInitIterator(robj *subject);
 void hashTypeReleaseIterator(hashTypeIterator *hi);
 int hashTypeNext(hashTypeIterator *hi);
-void hashTypeCurrentFromZiplist(hashTypeIterator *hi, int what,
-                                unsigned char **vstr,
-                                unsigned int *vlen,
-                                long long *vll);
+void hashTypeCurrentFromListpack(hashTypeIterator *hi, int what,
+                                 unsigned char **vstr,
+                                 unsigned int *vlen,
+                                 long long *vll);
 sds hashTypeCurrentFromHashTable(hashTypeIterator *hi, int what);
 void hashTypeCurrentObject(hashTypeIterator *hi, int what, unsigned char **vstr, unsigned int *vlen, long long *vll);
 sds hashTypeCurrentObjectNewSds(hashTypeIterator *hi, int what);
@@ -1796,9 +1932,19 @@ int hashTypeSet(robj *o, sds field, sds value, int flags);
 /* Pub / Sub */
 int pubsubUnsubscribeAllChannels(client *c, int notify);
 int pubsubUnsubscribeAllPatterns(client *c, int notify);
-void freePubsubPattern(void *p);
-int listMatchPubsubPattern(void *a, void *b);
+int pubsubUnsubscribeAllShardChannels(client *c, int notify);
+void pubsubUnsubscribeShardChannelsInSlot(unsigned int slot);
 int pubsubPublishMessage(robj *channel, robj *message);
+int pubsubPublishShardMessage(robj *channel, robj *message);
+
+/* Client side caching (tracking mode) */
+void enableTracking(client *c, uint64_t redirect_to);
+void disableTracking(client *c);
+void trackingRememberKeys(client *c, robj **argv, int argc, struct redisCommand *cmd);
+void trackingRememberKeysList(client *c, robj **keys, int numkeys);
+void trackingInvalidateKey(robj *keyobj);
+void trackingInvalidateKeysOnFlush(int dbid);
+unsigned long trackingGetUsedSlots(void);
 
 /* Keyspace events notification */
 void notifyKeyspaceEvent(int type, char *event, robj *key, int dbid);
@@ -1825,12 +1971,16 @@ robj *lookupKeyWrite(redisDb *db, robj *key);
 robj *lookupKeyReadOrReply(client *c, robj *key, robj *reply);
 robj *lookupKeyWriteOrReply(client *c, robj *key, robj *reply);
 robj *lookupKeyReadWithFlags(redisDb *db, robj *key, int flags);
-robj *objectCommandLookup(client *c, robj *key);
-robj *objectCommandLookupOrReply(client *c, robj *key, robj *reply);
+#define OBJ_COMPUTE_SIZE_DEF_SAMPLES 5 /* Default sample size. */
+size_t objectComputeSize(robj *o, size_t sample_size);
+size_t objectAllocSize(robj *o);
+robj *objectCommandLookup(client *c, robj *key, int *inlined);
+robj *objectCommandLookupOrReply(client *c, robj *key, robj *reply, int *inlined);
 void objectSetLRUOrLFU(robj *val, long long lfu_freq, long long lru_idle,
                        long long lru_clock);
 #define LOOKUP_NONE 0
 #define LOOKUP_NOTOUCH (1<<0)
+#define LOOKUP_WRITE (1<<1)
 void dbAdd(redisDb *db, robj *key, robj *val);
 void dbOverwrite(redisDb *db, robj *key, robj *val);
 void setKey(redisDb *db, robj *key, robj *val);
@@ -1839,6 +1989,10 @@ robj *dbRandomKey(redisDb *db);
 int dbSyncDelete(redisDb *db, robj *key);
 int dbDelete(redisDb *db, robj *key);
 robj *dbUnshareStringValue(redisDb *db, robj *key, robj *o);
+int dbInlineValue(redisDb *db, robj *key, robj *val);
+robj *dbGetValue(redisDb *db, dictEntry *de);
+void dbReleaseTempValues(void);
+void inlineValuesCron(void);
 
 #define EMPTYDB_NO_FLAGS 0      /* No flags. */
 #define EMPTYDB_ASYNC (1<<0)    /* Reclaim memory in another thread. */
@@ -1858,9 +2012,34 @@ void slotToKeyDel(robj *key);
 void slotToKeyFlush(void);
 int dbAsyncDelete(redisDb *db, robj *key);
 void emptyDbAsync(redisDb *db);
+void emptyDbMemoryAsync(redisDb *db);
 void slotToKeyFlushAsync(void);
+void keymemTouch(redisDb *db, sds key);
+void keymemSetValue(redisDb *db, sds key, robj *val);
+void keymemSignal(redisDb *db, robj *key);
+void keymemDelete(redisDb *db, robj *key);
+void keymemForgetDb(redisDb *db);
+void keymemFlush(void);
+void keymemSetTracking(int enable);
+void keymemCron(int sync);
+int keymemIsComplete(void);
+long long keymemGetSize(redisDb *db, sds key);
+long long keymemValueBegin(void);
+void keymemValueEnd(robj *val, long long mark);
+void keymemStreamEnd(stream *s, long long mark);
+int keymemValueIsOpen(void);
+void keymemValueAdjust(long long bytes);
 size_t lazyfreeGetPendingObjectsCount(void);
 void freeObjAsync(robj *o);
+void freeSdsAsync(sds s);
+void freeZslNodeAsync(zskiplistNode *node);
+void lazyfreeFlushBatch(void);
+char *getObjectTypeName(robj *o);
+
+/* Hot keys and big keys statistics */
+void keystatsSampleLookup(redisDb *db, sds key, robj *val);
+void keystatsCron(void);
+void keystatsReset(void);
 
 /* API to get key arguments from commands */
 int *getKeysFromCommand(struct redisCommand *cmd, robj **argv, int argc, int *numkeys);
@@ -1878,6 +2057,7 @@ unsigned short crc16(const char *buf, int len);
 unsigned int keyHashSlot(char *key, int keylen);
 void clusterCron(void);
 void clusterPropagatePublish(robj *channel, robj *message);
+void clusterPropagatePublishShard(robj *channel, robj *message);
 void migrateCloseTimedoutSockets(void);
 void clusterBeforeSleep(void);
 int clusterSendModuleMessageToTarget(const char *target, uint64_t module_id, uint8_t type, unsigned char *payload, uint32_t len);
@@ -1896,10 +2076,22 @@ int redis_check_aof_main(int argc, char **argv);
 
 /* Scripting */
 void scriptingInit(int setup);
+void scriptingSetJit(lua_State *lua, int on);
+void scriptResultCacheTouchKey(redisDb *db, robj *key);
+void scriptResultCacheFlush(void);
 int ldbRemoveChild(pid_t pid);
 void ldbKillForkedSessions(void);
 int ldbPendingChildren(void);
 sds luaCreateFunction(client *c, lua_State *lua, robj *body);
+void luaReplyProto(const char *s, size_t len);
+void luaReplyBulk(const char *s, size_t len);
+void luaReplyInteger(long long ll);
+void luaReplyNull(void);
+void luaReplyStatus(const char *s, size_t len);
+void luaReplyError(const char *s, size_t len);
+void luaReplyArray(long len);
+void *luaReplyDeferredArray(void);
+void luaReplySetDeferredArray(void *handle, long len);
 
 /* Blocked clients */
 void processUnblockedClients(void);
@@ -1912,6 +2104,9 @@ void disconnectAllBlockedClients(void);
 void handleClientsBlockedOnKeys(void);
 void signalKeyAsReady(redisDb *db, robj *key);
 void blockForKeys(client *c, int btype, robj **keys, int numkeys, mstime_t timeout, robj *target, streamID *ids);
+void addClientToTimeoutTable(client *c);
+void removeClientFromTimeoutTable(client *c);
+void handleBlockedClientsTimeout(void);
 
 /* expire.c -- Handling of expired keys */
 void activeExpireCycle(int type);
@@ -1924,8 +2119,10 @@ size_t getSlaveKeyWithExpireCount(void);
 void evictionPoolAlloc(void);
 #define LFU_INIT_VAL 5
 unsigned long LFUGetTimeInMinutes(void);
+unsigned long LFUTimeElapsed(unsigned long ldt);
 uint8_t LFULogIncr(uint8_t value);
 unsigned long LFUDecrAndReturn(robj *o);
+unsigned long long LFUEstimateAccesses(unsigned long counter);
 
 /* Keys hashing / comparison functions for dict.c hash tables. */
 uint64_t dictSdsHash(const void *key);
@@ -2078,6 +2275,9 @@ void unsubscribeCommand(client *c);
 void psubscribeCommand(client *c);
 void punsubscribeCommand(client *c);
 void publishCommand(client *c);
+void ssubscribeCommand(client *c);
+void sunsubscribeCommand(client *c);
+void spublishCommand(client *c);
 void pubsubCommand(client *c);
 void watchCommand(client *c);
 void unwatchCommand(client *c);
@@ -2116,6 +2316,7 @@ void pfcountCommand(client *c);
 void pfmergeCommand(client *c);
 void pfdebugCommand(client *c);
 void latencyCommand(client *c);
+void keystatsCommand(client *c);
 void moduleCommand(client *c);
 void securityWarningCommand(client *c);
 void xaddCommand(client *c);
@@ -2128,6 +2329,7 @@ void xsetidCommand(client *c);
 void xackCommand(client *c);
 void xpendingCommand(client *c);
 void xclaimCommand(client *c);
+void xautoclaimCommand(client *c);
 void xinfoCommand(client *c);
 void xdelCommand(client *c);
 void xtrimCommand(client *c);
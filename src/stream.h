@@ -18,6 +18,11 @@ typedef struct stream {
     uint64_t length;        /* Number of elements inside this stream. */
     streamID last_id;       /* Zero if there are yet no items. */
     rax *cgroups;           /* Consumer groups dictionary: name -> streamCG */
+    streamID tail_master_id;/* Master ID of the node 'tail_fields' refers to. */
+    sds tail_fields;        /* Master entry fields of the tail node, each one
+                               prefixed by its length, so that XADD can check
+                               if an entry has the same fields without walking
+                               the listpack. NULL if not cached yet. */
 } stream;
 
 /* We define an iterator to iterate stream items in an abstract way, without
@@ -61,6 +66,12 @@ typedef struct streamCG {
     rax *consumers;         /* A radix tree representing the consumers by name
                                and their associated representation in the form
                                of streamConsumer structures. */
+    rax *pel_by_time;       /* The same pending entries, indexed by delivery
+                               time: the key is the delivery time as a 64 bit
+                               big endian number followed by the encoded ID,
+                               no value is associated. This way the oldest
+                               idle entries can be reached without scanning
+                               the whole PEL (see XAUTOCLAIM). */
 } streamCG;
 
 /* A specific consumer in a consumer group.  */
@@ -107,6 +118,7 @@ streamCG *streamLookupCG(stream *s, sds groupname);
 streamConsumer *streamLookupConsumer(streamCG *cg, sds name, int create);
 streamCG *streamCreateCG(stream *s, char *name, size_t namelen, streamID *id);
 streamNACK *streamCreateNACK(streamConsumer *consumer);
+void streamIndexNACK(streamCG *cg, unsigned char *rawid, streamNACK *nack);
 void streamDecodeID(void *buf, streamID *id);
 int streamCompareID(streamID *a, streamID *b);
 
@@ -44,10 +44,12 @@
 void listTypePush(robj *subject, robj *value, int where) {
     if (subject->encoding == OBJ_ENCODING_QUICKLIST) {
         int pos = (where == LIST_HEAD) ? QUICKLIST_HEAD : QUICKLIST_TAIL;
+        long long mark = keymemValueBegin();
         value = getDecodedObject(value);
         size_t len = sdslen(value->ptr);
         quicklistPush(subject->ptr, value->ptr, len, pos);
         decrRefCount(value);    // 减少引用数，引用数为0时释放内存
+        keymemValueEnd(subject,mark);
     } else {
         serverPanic("Unknown list encoding");   // 不是list结果
     }
@@ -65,11 +67,14 @@ robj *listTypePop(robj *subject, int where) {
 
     int ql_where = where == LIST_HEAD ? QUICKLIST_HEAD : QUICKLIST_TAIL;
     if (subject->encoding == OBJ_ENCODING_QUICKLIST) {
-        if (quicklistPopCustom(subject->ptr, ql_where, (unsigned char **)&value,
-                               NULL, &vlong, listPopSaver)) {
-            if (!value)
-                value = createStringObjectFromLongLong(vlong);
-        }
+        long long mark = keymemValueBegin();
+        int popped = quicklistPopCustom(subject->ptr, ql_where,
+                        (unsigned char **)&value, NULL, &vlong, listPopSaver);
+        /* The popped object is not part of the list. */
+        if (value) keymemValueAdjust(-(long long)objectAllocSize(value));
+        keymemValueEnd(subject,mark);
+        if (popped && !value)
+            value = createStringObjectFromLongLong(vlong);
     } else {
         serverPanic("Unknown list encoding");
     }
@@ -107,9 +112,10 @@ listTypeIterator *listTypeInitIterator(robj *subject, long index,
     return li;
 }
 
-/* Clean up the iterator. */
+/* Clean up the iterator. The node the iterator is at is compressed again,
+ * so that the reads don't change the size of the list. */
 void listTypeReleaseIterator(listTypeIterator *li) {
-    zfree(li->iter);
+    if (li->iter) quicklistReleaseIterator(li->iter);
     zfree(li);
 }
 
@@ -298,7 +304,9 @@ void linsertCommand(client *c) {
     if ((subject = lookupKeyWriteOrReply(c,c->argv[1],shared.czero)) == NULL ||
         checkType(c,subject,OBJ_LIST)) return;  // key不存在
 
-    /* Seek pivot from head to tail */
+    /* Seek pivot from head to tail. The iterator decompresses the nodes it
+     * visits, so its whole lifetime is accounted to the list. */
+    long long mark = keymemValueBegin();
     iter = listTypeInitIterator(subject,0,LIST_TAIL);
     while (listTypeNext(iter,&entry)) {
         if (listTypeEqual(&entry,c->argv[3])) {
@@ -308,6 +316,7 @@ void linsertCommand(client *c) {
         }
     }
     listTypeReleaseIterator(iter);
+    keymemValueEnd(subject,mark);
 
     if (inserted) {
         signalModifiedKey(c->db,c->argv[1]);
@@ -342,7 +351,11 @@ void lindexCommand(client *c) {
 
     if (o->encoding == OBJ_ENCODING_QUICKLIST) {
         quicklistEntry entry;
-        if (quicklistIndex(o->ptr, index, &entry)) {
+        /* The node of the element is left uncompressed. */
+        long long mark = keymemValueBegin();
+        int found = quicklistIndex(o->ptr, index, &entry);
+        keymemValueEnd(o,mark);
+        if (found) {
             if (entry.value) {
                 value = createStringObject((char*)entry.value,entry.sz);
             } else {
@@ -369,8 +382,10 @@ void lsetCommand(client *c) {
 
     if (o->encoding == OBJ_ENCODING_QUICKLIST) {
         quicklist *ql = o->ptr;
+        long long mark = keymemValueBegin();
         int replaced = quicklistReplaceAtIndex(ql, index,
                                                value->ptr, sdslen(value->ptr));
+        keymemValueEnd(o,mark);
         if (!replaced) {
             addReply(c,shared.outofrangeerr);
         } else {
@@ -493,8 +508,10 @@ void ltrimCommand(client *c) {
 
     /* Remove list elements to perform the trim */
     if (o->encoding == OBJ_ENCODING_QUICKLIST) {
+        long long mark = keymemValueBegin();
         quicklistDelRange(o->ptr,0,ltrim);
         quicklistDelRange(o->ptr,-rtrim,rtrim);
+        keymemValueEnd(o,mark);
     } else {
         serverPanic("Unknown list encoding");
     }
@@ -522,6 +539,7 @@ void lremCommand(client *c) {
     if (subject == NULL || checkType(c,subject,OBJ_LIST)) return;
 
     listTypeIterator *li;
+    long long mark = keymemValueBegin();
     if (toremove < 0) {
         toremove = -toremove;
         li = listTypeInitIterator(subject,-1,LIST_HEAD);
@@ -539,6 +557,7 @@ void lremCommand(client *c) {
         }
     }
     listTypeReleaseIterator(li);
+    keymemValueEnd(subject,mark);
 
     if (removed) {
         signalModifiedKey(c->db,c->argv[1]);
@@ -577,8 +596,8 @@ void rpoplpushHandlePush(client *c, robj *dstkey, robj *dstobj, robj *value) {
                             server.list_compress_depth);
         dbAdd(c->db,dstkey,dstobj);
     }
-    signalModifiedKey(c->db,dstkey);
     listTypePush(dstobj,value,LIST_HEAD);
+    signalModifiedKey(c->db,dstkey);
     notifyKeyspaceEvent(NOTIFY_LIST,"lpush",dstkey,c->db->id);
     /* Always send the pushed value to the client. */
     addReplyBulk(c,value);
@@ -55,13 +55,16 @@ robj *setTypeCreate(sds value) {
  * 如果该值已经是集合的成员，则不执行任何操作并返回0，否则添加新元素并返回1。*/
 int setTypeAdd(robj *subject, sds value) {
     long long llval;
+    int added = 0;
+    long long mark = keymemValueBegin();
+
     if (subject->encoding == OBJ_ENCODING_HT) {
         dict *ht = subject->ptr;
         dictEntry *de = dictAddRaw(ht,value,NULL);
         if (de) {
             dictSetKey(ht,de,sdsdup(value));
             dictSetVal(ht,de,NULL);
-            return 1;
+            added = 1;
         }
     } else if (subject->encoding == OBJ_ENCODING_INTSET) {
         if (isSdsRepresentableAsLongLong(value,&llval) == C_OK) {
@@ -72,7 +75,7 @@ int setTypeAdd(robj *subject, sds value) {
                  * too many entries. */
                 if (intsetLen(subject->ptr) > server.set_max_intset_entries)
                     setTypeConvert(subject,OBJ_ENCODING_HT);
-                return 1;
+                added = 1;
             }
         } else {
             /* Failed to get integer from object, convert to regular set. */
@@ -81,22 +84,24 @@ int setTypeAdd(robj *subject, sds value) {
             /* The set *was* an intset and this value is not integer
              * encodable, so dictAdd should always work. */
             serverAssert(dictAdd(subject->ptr,sdsdup(value),NULL) == DICT_OK);
-            return 1;
+            added = 1;
         }
     } else {
         serverPanic("Unknown set encoding");
     }
-    return 0;
+    keymemValueEnd(subject,mark);
+    return added;
 }
 
 // set删除value
 int setTypeRemove(robj *setobj, sds value) {
     long long llval;
     if (setobj->encoding == OBJ_ENCODING_HT) {
-        if (dictDelete(setobj->ptr,value) == DICT_OK) {
-            if (htNeedsResize(setobj->ptr)) dictResize(setobj->ptr);
-            return 1;
-        }
+        long long mark = keymemValueBegin();
+        int deleted = dictDelete(setobj->ptr,value) == DICT_OK;
+        if (deleted && htNeedsResize(setobj->ptr)) dictResize(setobj->ptr);
+        keymemValueEnd(setobj,mark);
+        if (deleted) return 1;
     } else if (setobj->encoding == OBJ_ENCODING_INTSET) {
         if (isSdsRepresentableAsLongLong(value,&llval) == C_OK) {
             int success;
@@ -113,7 +118,11 @@ int setTypeRemove(robj *setobj, sds value) {
 int setTypeIsMember(robj *subject, sds value) {
     long long llval;
     if (subject->encoding == OBJ_ENCODING_HT) {
-        return dictFind((dict*)subject->ptr,value) != NULL;
+        /* The lookup may perform a rehashing step. */
+        long long mark = keymemValueBegin();
+        int found = dictFind((dict*)subject->ptr,value) != NULL;
+        keymemValueEnd(subject,mark);
+        return found;
     } else if (subject->encoding == OBJ_ENCODING_INTSET) {
         if (isSdsRepresentableAsLongLong(value,&llval) == C_OK) {
             return intsetFind((intset*)subject->ptr,llval);
@@ -227,7 +236,9 @@ sds setTypeNextObject(setTypeIterator *si) {
  * 请注意，sdsele和llele指针都应该被传递，并且不能为空，因为函数将尝试用容易被误用的值来防御地填充non - used字段。*/
 int setTypeRandomElement(robj *setobj, sds *sdsele, int64_t *llele) {
     if (setobj->encoding == OBJ_ENCODING_HT) {
+        long long mark = keymemValueBegin();
         dictEntry *de = dictGetRandomKey(setobj->ptr);
+        keymemValueEnd(setobj,mark);
         *sdsele = dictGetKey(de);
         *llele = -123456789; /* Not needed. Defensive. */
     } else if (setobj->encoding == OBJ_ENCODING_INTSET) {
@@ -259,6 +270,7 @@ void setTypeConvert(robj *setobj, int enc) {
 
     if (enc == OBJ_ENCODING_HT) {
         int64_t intele;
+        long long mark = keymemValueBegin();
         dict *d = dictCreate(&setDictType,NULL);
         sds element;
 
@@ -276,6 +288,7 @@ void setTypeConvert(robj *setobj, int enc) {
         setobj->encoding = OBJ_ENCODING_HT;
         zfree(setobj->ptr);
         setobj->ptr = d;
+        keymemValueEnd(setobj,mark);
     } else {
         serverPanic("Unsupported set conversion");
     }
@@ -32,6 +32,8 @@
 #include "stream.h"
 
 #define STREAM_BYTES_PER_LISTPACK 2048
+#define STREAM_LISTPACK_MAX_PREALLOC 4096 /* Max capacity the tail node
+                                             listpack grows to in advance. */
 
 /* Every stream item inside the listpack, has a flags field that is used to
  * mark the entry as deleted, or having the same field as the "master"
@@ -42,7 +44,9 @@
 
 void streamFreeCG(streamCG *cg);
 void streamFreeNACK(streamNACK *na);
-size_t streamReplyWithRangeFromConsumerPEL(client *c, stream *s, streamID *start, streamID *end, size_t count, streamConsumer *consumer);
+size_t streamReplyWithRangeFromConsumerPEL(client *c, stream *s, streamID *start, streamID *end, size_t count, streamCG *group, streamConsumer *consumer);
+void streamUnindexNACK(streamCG *cg, unsigned char *rawid, streamNACK *nack);
+void streamSetNACKDeliveryTime(streamCG *cg, unsigned char *rawid, streamNACK *nack, mstime_t delivery_time);
 
 /* -----------------------------------------------------------------------
  * Low level stream encoding: a radix tree of listpacks.
@@ -56,6 +60,9 @@ stream *streamNew(void) {
     s->last_id.ms = 0;
     s->last_id.seq = 0;
     s->cgroups = NULL; /* Created on demand to save memory when not used. */
+    s->tail_master_id.ms = 0;
+    s->tail_master_id.seq = 0;
+    s->tail_fields = NULL; /* Cached by streamAppendItem(). */
     return s;
 }
 
@@ -64,6 +71,7 @@ void freeStream(stream *s) {
     raxFreeWithCallback(s->rax,(void(*)(void*))lpFree);
     if (s->cgroups)
         raxFreeWithCallback(s->cgroups,(void(*)(void*))streamFreeCG);
+    sdsfree(s->tail_fields);
     zfree(s);
 }
 
@@ -160,6 +168,62 @@ int streamCompareID(streamID *a, streamID *b) {
     return 0;
 }
 
+/* Append a field to the master fields representation used by the
+ * 'tail_fields' stream cache: the field length followed by the field. */
+static sds streamCatMasterField(sds fields, const void *field, uint32_t len) {
+    fields = sdscatlen(fields,&len,sizeof(len));
+    return sdscatlen(fields,field,len);
+}
+
+/* Return the 'tail_fields' representation of the fields of the first
+ * 'numfields' field-value pairs in 'argv'. */
+static sds streamMasterFieldsFromArgv(robj **argv, int64_t numfields) {
+    sds fields = sdsnewlen(&numfields,sizeof(numfields));
+    for (int64_t i = 0; i < numfields; i++) {
+        sds field = argv[i*2]->ptr;
+        fields = streamCatMasterField(fields,field,sdslen(field));
+    }
+    return fields;
+}
+
+/* Return the 'tail_fields' representation of the master entry fields of the
+ * stream node 'lp'. */
+static sds streamMasterFieldsFromListpack(unsigned char *lp) {
+    unsigned char *lp_ele = lpFirst(lp);
+    lp_ele = lpNext(lp,lp_ele); /* Seek deleted. */
+    lp_ele = lpNext(lp,lp_ele); /* Seek master entry num fields. */
+    int64_t numfields = lpGetInteger(lp_ele);
+    sds fields = sdsnewlen(&numfields,sizeof(numfields));
+    while(numfields--) {
+        int64_t e_len;
+        unsigned char buf[LP_INTBUF_SIZE];
+        lp_ele = lpNext(lp,lp_ele);
+        unsigned char *e = lpGet(lp_ele,&e_len,buf);
+        fields = streamCatMasterField(fields,e,e_len);
+    }
+    return fields;
+}
+
+/* Return 1 if the fields of the 'numfields' field-value pairs in 'argv' are
+ * exactly the master fields 'fields', in the same order. Otherwise 0 is
+ * returned. */
+static int streamSameMasterFields(sds fields, robj **argv, int64_t numfields) {
+    unsigned char *p = (unsigned char*)fields;
+    int64_t master_fields_count;
+    memcpy(&master_fields_count,p,sizeof(master_fields_count));
+    if (master_fields_count != numfields) return 0;
+    p += sizeof(master_fields_count);
+    for (int64_t i = 0; i < numfields; i++) {
+        sds field = argv[i*2]->ptr;
+        uint32_t len;
+        memcpy(&len,p,sizeof(len));
+        p += sizeof(len);
+        if (sdslen(field) != len || memcmp(p,field,len) != 0) return 0;
+        p += len;
+    }
+    return 1;
+}
+
 /* Adds a new item into the stream 's' having the specified number of
  * field-value pairs as specified in 'numfields' and stored into 'argv'.
  * Returns the new entry ID populating the 'added_id' structure.
@@ -253,10 +317,18 @@ int streamAppendItem(stream *s, robj **argv, int64_t numfields, streamID *added_
 
     int flags = STREAM_ITEM_FLAG_NONE;
     if (lp == NULL || lp_bytes > server.stream_node_max_bytes) {
+        /* No more entries will be appended to the old tail node, if any:
+         * release the spare capacity it was grown to. */
+        if (lp_bytes) {
+            unsigned char *oldlp = ri.data;
+            unsigned char *newlp = lpShrinkToFit(oldlp);
+            if (newlp != oldlp)
+                raxInsert(s->rax,ri.key,ri.key_len,newlp,NULL);
+        }
         master_id = id;
         streamEncodeID(rax_key,&id);
         /* Create the listpack having the master entry ID and fields. */
-        lp = lpNew();
+        lp = lpNew(0);
         lp = lpAppendInteger(lp,1); /* One item, the one we are adding. */
         lp = lpAppendInteger(lp,0); /* Zero deleted so far. */
         lp = lpAppendInteger(lp,numfields);
@@ -269,6 +341,9 @@ int streamAppendItem(stream *s, robj **argv, int64_t numfields, streamID *added_
         /* The first entry we insert, has obviously the same fields of the
          * master entry. */
         flags |= STREAM_ITEM_FLAG_SAMEFIELDS;
+        sdsfree(s->tail_fields);
+        s->tail_fields = streamMasterFieldsFromArgv(argv,numfields);
+        s->tail_master_id = master_id;
     } else {
         serverAssert(ri.key_len == sizeof(rax_key));
         memcpy(rax_key,ri.key,sizeof(rax_key));
@@ -277,33 +352,42 @@ int streamAppendItem(stream *s, robj **argv, int64_t numfields, streamID *added_
         streamDecodeID(rax_key,&master_id);
         unsigned char *lp_ele = lpFirst(lp);
 
-        /* Update count and skip the deleted fields. */
+        /* Update count. */
         int64_t count = lpGetInteger(lp_ele);
         lp = lpReplaceInteger(lp,&lp_ele,count+1);
-        lp_ele = lpNext(lp,lp_ele); /* seek deleted. */
-        lp_ele = lpNext(lp,lp_ele); /* seek master entry num fields. */
 
         /* Check if the entry we are adding, have the same fields
-         * as the master entry. */
-        int64_t master_fields_count = lpGetInteger(lp_ele);
-        lp_ele = lpNext(lp,lp_ele);
-        if (numfields == master_fields_count) {
-            int64_t i;
-            for (i = 0; i < master_fields_count; i++) {
-                sds field = argv[i*2]->ptr;
-                int64_t e_len;
-                unsigned char buf[LP_INTBUF_SIZE];
-                unsigned char *e = lpGet(lp_ele,&e_len,buf);
-                /* Stop if there is a mismatch. */
-                if (sdslen(field) != (size_t)e_len ||
-                    memcmp(e,field,e_len) != 0) break;
-                lp_ele = lpNext(lp,lp_ele);
-            }
-            /* All fields are the same! We can compress the field names
-             * setting a single bit in the flags. */
-            if (i == master_fields_count) flags |= STREAM_ITEM_FLAG_SAMEFIELDS;
+         * as the master entry. The master fields of the tail node are
+         * cached in the stream, so most of the times we don't need to walk
+         * the master entry: the cache is only refreshed when the tail node
+         * changed, for instance after loading the stream. */
+        if (s->tail_fields == NULL ||
+            streamCompareID(&s->tail_master_id,&master_id) != 0)
+        {
+            sdsfree(s->tail_fields);
+            s->tail_fields = streamMasterFieldsFromListpack(lp);
+            s->tail_master_id = master_id;
         }
-    }
+        /* All fields are the same! We can compress the field names
+         * setting a single bit in the flags. */
+        if (streamSameMasterFields(s->tail_fields,argv,numfields))
+            flags |= STREAM_ITEM_FLAG_SAMEFIELDS;
+    }
+
+    /* The tail node is where all the appends happen: make room for the
+     * new entry growing the listpack geometrically (see lpReserve()), so
+     * that it is not reallocated at every XADD, without preallocating the
+     * whole node for streams that will only have a few entries. Every
+     * element takes at most 10 bytes other than its string: the encoding
+     * header and the backlen. */
+    size_t entry_bytes = (numfields*2+5)*10;
+    for (int64_t i = 0; i < numfields*2; i++)
+        entry_bytes += sdslen(argv[i]->ptr);
+    size_t max_capacity = STREAM_LISTPACK_MAX_PREALLOC;
+    if (server.stream_node_max_bytes &&
+        (size_t)server.stream_node_max_bytes < max_capacity)
+        max_capacity = server.stream_node_max_bytes;
+    lp = lpReserve(lp,entry_bytes,max_capacity);
 
     /* Populate the listpack with the new entry. We use the following
      * encoding:
@@ -910,7 +994,7 @@ size_t streamReplyWithRange(client *c, stream *s, streamID *start, streamID *end
      * as delivered. */
     if (group && (flags & STREAM_RWR_HISTORY)) {
         return streamReplyWithRangeFromConsumerPEL(c,s,start,end,count,
-                                                   consumer);
+                                                   group,consumer);
     }
 
     if (!(flags & STREAM_RWR_RAWENTRIES))
@@ -950,6 +1034,7 @@ size_t streamReplyWithRange(client *c, stream *s, streamID *start, streamID *end
         if (group && !(flags & STREAM_RWR_NOACK)) {
             unsigned char buf[sizeof(streamID)];
             streamEncodeID(buf,&id);
+            long long mark = keymemValueBegin();
 
             /* Try to add a new NACK. Most of the time this will work and
              * will not require extra lookups. We'll fix the problem later
@@ -970,13 +1055,16 @@ size_t streamReplyWithRange(client *c, stream *s, streamID *start, streamID *end
                 raxRemove(nack->consumer->pel,buf,sizeof(buf),NULL);
                 /* Update the consumer and NACK metadata. */
                 nack->consumer = consumer;
-                nack->delivery_time = mstime();
+                streamSetNACKDeliveryTime(group,buf,nack,mstime());
                 nack->delivery_count = 1;
                 /* Add the entry in the new consumer local PEL. */
                 raxInsert(consumer->pel,buf,sizeof(buf),nack,NULL);
             } else if (group_inserted == 1 && consumer_inserted == 0) {
                 serverPanic("NACK half-created. Should not be possible.");
+            } else {
+                streamIndexNACK(group,buf,nack);
             }
+            keymemStreamEnd(s,mark);
 
             /* Propagate as XCLAIM. */
             if (spi) {
@@ -1010,7 +1098,7 @@ size_t streamReplyWithRange(client *c, stream *s, streamID *start, streamID *end
  * seek into the radix tree of the messages in order to emit the full message
  * to the client. However clients only reach this code path when they are
  * fetching the history of already retrieved messages, which is rare. */
-size_t streamReplyWithRangeFromConsumerPEL(client *c, stream *s, streamID *start, streamID *end, size_t count, streamConsumer *consumer) {
+size_t streamReplyWithRangeFromConsumerPEL(client *c, stream *s, streamID *start, streamID *end, size_t count, streamCG *group, streamConsumer *consumer) {
     raxIterator ri;
     unsigned char startkey[sizeof(streamID)];
     unsigned char endkey[sizeof(streamID)];
@@ -1039,7 +1127,9 @@ size_t streamReplyWithRangeFromConsumerPEL(client *c, stream *s, streamID *start
             addReply(c,shared.nullmultibulk);
         } else {
             streamNACK *nack = ri.data;
-            nack->delivery_time = mstime();
+            long long mark = keymemValueBegin();
+            streamSetNACKDeliveryTime(group,ri.key,nack,mstime());
+            keymemStreamEnd(s,mark);
             nack->delivery_count++;
         }
         arraylen++;
@@ -1223,10 +1313,11 @@ void xaddCommand(client *c) {
     s = o->ptr;
 
     /* Append using the low level function and return the ID. */
-    if (streamAppendItem(s,c->argv+field_pos,(c->argc-field_pos)/2,
-        &id, id_given ? &id : NULL)
-        == C_ERR)
-    {
+    long long mark = keymemValueBegin();
+    int retval = streamAppendItem(s,c->argv+field_pos,(c->argc-field_pos)/2,
+                                  &id, id_given ? &id : NULL);
+    keymemValueEnd(o,mark);
+    if (retval == C_ERR) {
         addReplyError(c,"The ID specified in XADD is equal or smaller than the "
                         "target stream top item");
         return;
@@ -1239,7 +1330,10 @@ void xaddCommand(client *c) {
 
     if (maxlen >= 0) {
         /* Notify xtrim event if needed. */
-        if (streamTrimByLength(s,maxlen,approx_maxlen)) {
+        mark = keymemValueBegin();
+        int64_t trimmed = streamTrimByLength(s,maxlen,approx_maxlen);
+        keymemValueEnd(o,mark);
+        if (trimmed) {
             notifyKeyspaceEvent(NOTIFY_STREAM,"xtrim",c->argv[1],c->db->id);
         }
         if (approx_maxlen) streamRewriteApproxMaxlen(c,s,maxlen_arg_idx);
@@ -1517,8 +1611,12 @@ void xreadCommand(client *c) {
             addReplyMultiBulkLen(c,2);
             addReplyBulk(c,c->argv[streams_arg+i]);
             streamConsumer *consumer = NULL;
-            if (groups) consumer = streamLookupConsumer(groups[i],
-                                                        consumername->ptr,1);
+            if (groups) {
+                long long mark = keymemValueBegin();
+                consumer = streamLookupConsumer(groups[i],
+                                                consumername->ptr,1);
+                keymemStreamEnd(s,mark);
+            }
             streamPropInfo spi = {c->argv[i+streams_arg],groupname};
             int flags = 0;
             if (noack) flags |= STREAM_RWR_NOACK;
@@ -1602,6 +1700,42 @@ void streamFreeNACK(streamNACK *na) {
     zfree(na);
 }
 
+/* Build the key of the group delivery time index for the entry 'rawid':
+ * the delivery time as a big endian 64 bit number followed by the encoded
+ * stream ID, so that the index is sorted by delivery time and ties are
+ * resolved by ID. 'buf' must be at least STREAM_PEL_TIME_KEYLEN bytes. */
+#define STREAM_PEL_TIME_KEYLEN (sizeof(uint64_t)+sizeof(streamID))
+static void streamEncodeDeliveryKey(unsigned char *buf, mstime_t delivery_time, unsigned char *rawid) {
+    uint64_t t = htonu64((uint64_t)delivery_time);
+    memcpy(buf,&t,sizeof(t));
+    memcpy(buf+sizeof(t),rawid,sizeof(streamID));
+}
+
+/* Add the NACK for the entry 'rawid' to the delivery time index of the
+ * group. This must be called every time a NACK is added to the group PEL,
+ * once its delivery time is set. */
+void streamIndexNACK(streamCG *cg, unsigned char *rawid, streamNACK *nack) {
+    unsigned char key[STREAM_PEL_TIME_KEYLEN];
+    streamEncodeDeliveryKey(key,nack->delivery_time,rawid);
+    raxInsert(cg->pel_by_time,key,sizeof(key),NULL,NULL);
+}
+
+/* Remove the NACK for the entry 'rawid' from the delivery time index of
+ * the group. Called before the NACK is removed from the group PEL. */
+void streamUnindexNACK(streamCG *cg, unsigned char *rawid, streamNACK *nack) {
+    unsigned char key[STREAM_PEL_TIME_KEYLEN];
+    streamEncodeDeliveryKey(key,nack->delivery_time,rawid);
+    raxRemove(cg->pel_by_time,key,sizeof(key),NULL);
+}
+
+/* Update the delivery time of a NACK already in the group PEL, keeping the
+ * delivery time index in sync. */
+void streamSetNACKDeliveryTime(streamCG *cg, unsigned char *rawid, streamNACK *nack, mstime_t delivery_time) {
+    streamUnindexNACK(cg,rawid,nack);
+    nack->delivery_time = delivery_time;
+    streamIndexNACK(cg,rawid,nack);
+}
+
 /* Free a consumer and associated data structures. Note that this function
  * will not reassign the pending messages associated with this consumer
  * nor will delete them from the stream, so when this function is called
@@ -1625,6 +1759,7 @@ streamCG *streamCreateCG(stream *s, char *name, size_t namelen, streamID *id) {
 
     streamCG *cg = zmalloc(sizeof(*cg));
     cg->pel = raxNew();
+    cg->pel_by_time = raxNew();
     cg->consumers = raxNew();
     cg->last_id = *id;
     raxInsert(s->cgroups,(unsigned char*)name,namelen,cg,NULL);
@@ -1634,6 +1769,7 @@ streamCG *streamCreateCG(stream *s, char *name, size_t namelen, streamID *id) {
 /* Free a consumer group and all its associated data. */
 void streamFreeCG(streamCG *cg) {
     raxFreeWithCallback(cg->pel,(void(*)(void*))streamFreeNACK);
+    raxFree(cg->pel_by_time);
     raxFreeWithCallback(cg->consumers,(void(*)(void*))streamFreeConsumer);
     zfree(cg);
 }
@@ -1682,6 +1818,7 @@ uint64_t streamDelConsumer(streamCG *cg, sds name) {
     raxSeek(&ri,"^",NULL,0);
     while(raxNext(&ri)) {
         streamNACK *nack = ri.data;
+        streamUnindexNACK(cg,ri.key,nack);
         raxRemove(cg->pel,ri.key,ri.key_len,NULL);
         streamFreeNACK(nack);
     }
@@ -1784,7 +1921,9 @@ NULL
             s = o->ptr;
         }
 
+        long long mark = keymemValueBegin();
         streamCG *cg = streamCreateCG(s,grpname,sdslen(grpname),&id);
+        keymemStreamEnd(s,mark);
         if (cg) {
             addReply(c,shared.ok);
             server.dirty++;
@@ -1807,8 +1946,10 @@ NULL
         notifyKeyspaceEvent(NOTIFY_STREAM,"xgroup-setid",c->argv[2],c->db->id);
     } else if (!strcasecmp(opt,"DESTROY") && c->argc == 4) {
         if (cg) {
+            long long mark = keymemValueBegin();
             raxRemove(s->cgroups,(unsigned char*)grpname,sdslen(grpname),NULL);
             streamFreeCG(cg);
+            keymemStreamEnd(s,mark);
             addReply(c,shared.cone);
             server.dirty++;
             notifyKeyspaceEvent(NOTIFY_STREAM,"xgroup-destroy",
@@ -1819,7 +1960,9 @@ NULL
     } else if (!strcasecmp(opt,"DELCONSUMER") && c->argc == 5) {
         /* Delete the consumer and returns the number of pending messages
          * that were yet associated with such a consumer. */
+        long long mark = keymemValueBegin();
         long long pending = streamDelConsumer(cg,c->argv[4]->ptr);
+        keymemStreamEnd(s,mark);
         addReplyLongLong(c,pending);
         server.dirty++;
         notifyKeyspaceEvent(NOTIFY_STREAM,"xgroup-delconsumer",
@@ -1900,9 +2043,12 @@ void xackCommand(client *c) {
          * we are able to remove the entry from both PELs. */
         streamNACK *nack = raxFind(group->pel,buf,sizeof(buf));
         if (nack != raxNotFound) {
+            long long mark = keymemValueBegin();
+            streamUnindexNACK(group,buf,nack);
             raxRemove(group->pel,buf,sizeof(buf),NULL);
             raxRemove(nack->consumer->pel,buf,sizeof(buf),NULL);
             streamFreeNACK(nack);
+            keymemValueEnd(o,mark);
             acknowledged++;
             server.dirty++;
         }
@@ -2222,7 +2368,9 @@ void xclaimCommand(client *c) {
     }
 
     /* Do the actual claiming. */
+    long long mark = keymemValueBegin();
     streamConsumer *consumer = streamLookupConsumer(group,c->argv[3]->ptr,1);
+    keymemValueEnd(o,mark);
     void *arraylenptr = addDeferredMultiBulkLength(c);
     size_t arraylen = 0;
     for (int j = 5; j <= last_id_arg; j++) {
@@ -2253,8 +2401,11 @@ void xclaimCommand(client *c) {
             if (!found) continue;
 
             /* Create the NACK. */
+            mark = keymemValueBegin();
             nack = streamCreateNACK(NULL);
             raxInsert(group->pel,buf,sizeof(buf),nack,NULL);
+            streamIndexNACK(group,buf,nack);
+            keymemValueEnd(o,mark);
         }
 
         if (nack != raxNotFound) {
@@ -2271,11 +2422,12 @@ void xclaimCommand(client *c) {
             /* Remove the entry from the old consumer.
              * Note that nack->consumer is NULL if we created the
              * NACK above because of the FORCE option. */
+            mark = keymemValueBegin();
             if (nack->consumer)
                 raxRemove(nack->consumer->pel,buf,sizeof(buf),NULL);
             /* Update the consumer and idle time. */
             nack->consumer = consumer;
-            nack->delivery_time = deliverytime;
+            streamSetNACKDeliveryTime(group,buf,nack,deliverytime);
             /* Set the delivery attempts counter if given, otherwise 
              * autoincrement unless JUSTID option provided */
             if (retrycount >= 0) {
@@ -2285,6 +2437,7 @@ void xclaimCommand(client *c) {
             }
             /* Add the entry in the new consumer local PEL. */
             raxInsert(consumer->pel,buf,sizeof(buf),nack,NULL);
+            keymemValueEnd(o,mark);
             /* Send the reply for this entry. */
             if (justid) {
                 addReplyStreamID(c,&id);
@@ -2310,6 +2463,126 @@ void xclaimCommand(client *c) {
 }
 
 
+/* XAUTOCLAIM <key> <group> <consumer> <min-idle-time> [COUNT <count>]
+ *            [JUSTID]
+ *
+ * Claim, on behalf of <consumer>, up to <count> pending messages of the
+ * group (100 by default) that are idle for at least <min-idle-time>
+ * milliseconds, oldest first. Claimed messages are handled exactly like
+ * XCLAIM does: the delivery time is reset and, unless JUSTID is given,
+ * the delivery counter is incremented.
+ *
+ * The candidates are fetched from the group delivery time index, so the
+ * command only touches the entries it claims instead of scanning the
+ * whole PEL. The reply has the same format of XCLAIM. */
+void xautoclaimCommand(client *c) {
+    streamCG *group = NULL;
+    robj *o = lookupKeyRead(c->db,c->argv[1]);
+    long long minidle; /* Minimum idle time argument. */
+    long long count = 100;
+    int justid = 0;
+
+    if (o) {
+        if (checkType(c,o,OBJ_STREAM)) return; /* Type error. */
+        group = streamLookupCG(o->ptr,c->argv[2]->ptr);
+    }
+
+    /* No key or group? Send an error given that the group creation
+     * is mandatory. */
+    if (o == NULL || group == NULL) {
+        addReplyErrorFormat(c,"-NOGROUP No such key '%s' or "
+                              "consumer group '%s'", (char*)c->argv[1]->ptr,
+                              (char*)c->argv[2]->ptr);
+        return;
+    }
+
+    if (getLongLongFromObjectOrReply(c,c->argv[4],&minidle,
+        "Invalid min-idle-time argument for XAUTOCLAIM")
+        != C_OK) return;
+    if (minidle < 0) minidle = 0;
+
+    for (int j = 5; j < c->argc; j++) {
+        int moreargs = (c->argc-1) - j; /* Number of additional arguments. */
+        char *opt = c->argv[j]->ptr;
+        if (!strcasecmp(opt,"COUNT") && moreargs) {
+            j++;
+            if (getLongLongFromObjectOrReply(c,c->argv[j],&count,
+                "Invalid COUNT option argument for XAUTOCLAIM")
+                != C_OK) return;
+            if (count <= 0) {
+                addReplyError(c,"COUNT must be > 0");
+                return;
+            }
+        } else if (!strcasecmp(opt,"JUSTID")) {
+            justid = 1;
+        } else {
+            addReplyErrorFormat(c,"Unrecognized XAUTOCLAIM option '%s'",opt);
+            return;
+        }
+    }
+
+    /* Collect the IDs to claim first: claiming an entry moves it to the
+     * tail of the delivery time index, so we can't claim while iterating. */
+    mstime_t now = mstime();
+    uint64_t pending = raxSize(group->pel);
+    size_t maxclaim = (uint64_t)count < pending ? (size_t)count : pending;
+    unsigned char *ids = zmalloc(sizeof(streamID)*(maxclaim ? maxclaim : 1));
+    size_t numids = 0;
+    raxIterator ri;
+    raxStart(&ri,group->pel_by_time);
+    raxSeek(&ri,"^",NULL,0);
+    while(numids < maxclaim && raxNext(&ri)) {
+        uint64_t t;
+        memcpy(&t,ri.key,sizeof(t));
+        mstime_t delivery_time = (mstime_t)ntohu64(t);
+        if (now - delivery_time < minidle) break;
+        memcpy(ids+numids*sizeof(streamID),ri.key+sizeof(t),
+               sizeof(streamID));
+        numids++;
+    }
+    raxStop(&ri);
+
+    /* Do the actual claiming. */
+    long long mark = keymemValueBegin();
+    streamConsumer *consumer = streamLookupConsumer(group,c->argv[3]->ptr,1);
+    keymemValueEnd(o,mark);
+    addReplyMultiBulkLen(c,numids);
+    for (size_t j = 0; j < numids; j++) {
+        unsigned char *buf = ids+j*sizeof(streamID);
+        streamID id;
+        streamDecodeID(buf,&id);
+        streamNACK *nack = raxFind(group->pel,buf,sizeof(streamID));
+        serverAssert(nack != raxNotFound);
+
+        /* Move the entry to the new consumer and reset its idle time. */
+        mark = keymemValueBegin();
+        raxRemove(nack->consumer->pel,buf,sizeof(streamID),NULL);
+        nack->consumer = consumer;
+        streamSetNACKDeliveryTime(group,buf,nack,now);
+        if (!justid) nack->delivery_count++;
+        raxInsert(consumer->pel,buf,sizeof(streamID),nack,NULL);
+        keymemValueEnd(o,mark);
+
+        /* Send the reply for this entry. */
+        if (justid) {
+            addReplyStreamID(c,&id);
+        } else {
+            size_t emitted = streamReplyWithRange(c,o->ptr,&id,&id,1,0,
+                                NULL,NULL,STREAM_RWR_RAWENTRIES,NULL);
+            if (!emitted) addReply(c,shared.nullbulk);
+        }
+
+        /* Propagate this change as an XCLAIM. */
+        robj *idarg = createObjectFromStreamID(&id);
+        streamPropagateXCLAIM(c,c->argv[1],group,c->argv[2],idarg,nack);
+        decrRefCount(idarg);
+        server.dirty++;
+    }
+    zfree(ids);
+    preventCommandPropagation(c);
+}
+
+
 /* XDEL <key> [<ID1> <ID2> ... <IDN>]
  *
  * Removes the specified entries from the stream. Returns the number
@@ -2332,10 +2605,12 @@ void xdelCommand(client *c) {
 
     /* Actually apply the command. */
     int deleted = 0;
+    long long mark = keymemValueBegin();
     for (int j = 2; j < c->argc; j++) {
         streamParseStrictIDOrReply(c,c->argv[j],&id,0); /* Retval already checked. */
         deleted += streamDeleteItem(s,&id);
     }
+    keymemValueEnd(o,mark);
 
     /* Propagate the write if needed. */
     if (deleted) {
@@ -2408,7 +2683,9 @@ void xtrimCommand(client *c) {
     /* Perform the trimming. */
     int64_t deleted = 0;
     if (trim_strategy == TRIM_STRATEGY_MAXLEN) {
+        long long mark = keymemValueBegin();
         deleted = streamTrimByLength(s,maxlen,approx_maxlen);
+        keymemValueEnd(o,mark);
     } else {
         addReplyError(c,"XTRIM called without an option to trim the stream");
         return;
@@ -0,0 +1,198 @@
+/* Server assisted client side caching: keys tracking.
+ *
+ * A client that enabled tracking with CLIENT TRACKING ON is free to cache
+ * locally the values of the keys it reads: the server remembers the keys
+ * fetched by read only commands and, as soon as one of them is modified,
+ * expired or evicted, sends an invalidation message so that the client can
+ * drop the stale values from its cache.
+ *
+ * Remembering every key read by every client would use unbounded memory, so
+ * the keys are hashed with CRC64 into a fixed table of TRACKING_TABLE_SIZE
+ * buckets, and for every bucket we store just the radix tree of the IDs of
+ * the clients that may have in cache keys hashing to such bucket. The
+ * invalidation message reports the bucket and not the key name: it is up to
+ * the client to compute the same hash and drop all the cached keys mapped
+ * to the bucket. Collisions just mean a few extra invalidations. Once the
+ * message is sent the bucket is reset, the client will be tracked again as
+ * soon as it fetches a key in the same bucket.
+ *
+ * The RESP2 protocol has no way to push out of band data into a connection
+ * that is used for normal commands, so the invalidation messages are sent
+ * to another connection, specified with the REDIRECT option, that must be
+ * subscribed to the __redis__:invalidate channel. The message is a normal
+ * Pub/Sub message whose payload is the bucket as an integer, or a null bulk
+ * when the whole table was invalidated because of a flush.
+ *
+ * 客户端缓存：将读取过的 key 用 CRC64 映射到固定大小的桶表，每个桶记录
+ * 可能缓存了这些 key 的客户端 ID；key 被修改、过期或淘汰时，向重定向连接
+ * 发送包含桶编号的失效消息。
+ */
+
+#include "server.h"
+
+#define TRACKING_TABLE_SIZE (1<<20) /* Must be a power of two. */
+
+/* The tracking table is allocated the first time a client enables tracking,
+ * so that instances not using client side caching don't pay for it. Every
+ * slot is a radix tree of client IDs, or NULL if no client is tracking keys
+ * hashing to the slot. */
+rax **TrackingTable = NULL;
+unsigned long TrackingTableUsedSlots = 0;
+robj *TrackingChannelName;
+
+/* Remove the tracking state from the client 'c'. Note that there is not much
+ * to do for us here: the client ID is not removed from the tracking table
+ * slots, that would require scanning the whole table. When the slots will be
+ * invalidated the client will be found without the CLIENT_TRACKING flag (or
+ * no longer connected) and will be skipped. */
+void disableTracking(client *c) {
+    if (c->flags & CLIENT_TRACKING) {
+        server.tracking_clients--;
+        c->flags &= ~CLIENT_TRACKING;
+        c->client_tracking_redirection = 0;
+    }
+}
+
+/* Enable the tracking state for the client 'c', and as a side effect allocate
+ * the tracking table if needed. Invalidation messages are sent to the client
+ * having ID 'redirect_to'. */
+void enableTracking(client *c, uint64_t redirect_to) {
+    if (!(c->flags & CLIENT_TRACKING)) server.tracking_clients++;
+    c->flags |= CLIENT_TRACKING;
+    c->client_tracking_redirection = redirect_to;
+    if (TrackingTable == NULL) {
+        TrackingTable = zcalloc(sizeof(rax*) * TRACKING_TABLE_SIZE);
+        TrackingChannelName = createStringObject("__redis__:invalidate",20);
+    }
+}
+
+/* Return the tracking table slot of the specified key. */
+static uint64_t trackingKeySlot(robj *keyobj) {
+    char buf[LONG_STR_SIZE];
+    unsigned char *p;
+    size_t len;
+
+    if (sdsEncodedObject(keyobj)) {
+        p = keyobj->ptr;
+        len = sdslen(keyobj->ptr);
+    } else {
+        len = ll2string(buf,sizeof(buf),(long)keyobj->ptr);
+        p = (unsigned char*)buf;
+    }
+    return crc64(0,p,len) & (TRACKING_TABLE_SIZE-1);
+}
+
+/* Remember that the client 'c' may have in cache the key 'keyobj'. */
+static void trackingRememberKey(client *c, robj *keyobj) {
+    uint64_t slot = trackingKeySlot(keyobj);
+
+    if (TrackingTable[slot] == NULL) {
+        TrackingTable[slot] = raxNew();
+        TrackingTableUsedSlots++;
+    }
+    raxTryInsert(TrackingTable[slot],
+        (unsigned char*)&c->id,sizeof(c->id),NULL,NULL);
+}
+
+/* This function is called after the execution of a read only command for
+ * clients that have tracking enabled, in order to remember the keys the
+ * command fetched. When the command was called from a script, 'c' is the
+ * client that called the script, while 'argv', 'argc' and 'cmd' describe the
+ * command executed by the Lua client. */
+void trackingRememberKeys(client *c, robj **argv, int argc, struct redisCommand *cmd) {
+    int numkeys;
+    int *keys = getKeysFromCommand(cmd,argv,argc,&numkeys);
+    if (keys == NULL) return;
+
+    for (int j = 0; j < numkeys; j++) trackingRememberKey(c,argv[keys[j]]);
+    getKeysFreeResult(keys);
+}
+
+/* Like trackingRememberKeys() but for a list of keys, used when the reply
+ * of a script is served from the scripts results cache. */
+void trackingRememberKeysList(client *c, robj **keys, int numkeys) {
+    for (int j = 0; j < numkeys; j++) trackingRememberKey(c,keys[j]);
+}
+
+/* Send the invalidation message for the specified slot, or for all the
+ * slots if 'slot' is -1, to the redirection client of 'c'. The message is
+ * only sent if the target is still connected and subscribed to the
+ * invalidation channel, otherwise we would corrupt the protocol of a
+ * connection that is not in Pub/Sub mode. */
+static void sendTrackingMessage(client *c, long long slot) {
+    client *target = lookupClientByID(c->client_tracking_redirection);
+
+    if (target == NULL ||
+        dictFind(target->pubsub_channels,TrackingChannelName) == NULL)
+        return;
+
+    addReply(target,shared.mbulkhdr[3]);
+    addReply(target,shared.messagebulk);
+    addReplyBulk(target,TrackingChannelName);
+    if (slot == -1)
+        addReply(target,shared.nullbulk);
+    else
+        addReplyLongLong(target,slot);
+}
+
+/* This function is called from signalModifiedKey() and when a key is
+ * expired or evicted. All the clients that may have in cache keys hashing
+ * to the same slot of 'keyobj' are sent an invalidation message, and the
+ * slot is cleared. */
+void trackingInvalidateKey(robj *keyobj) {
+    if (TrackingTable == NULL || TrackingTableUsedSlots == 0) return;
+
+    uint64_t slot = trackingKeySlot(keyobj);
+    rax *ids = TrackingTable[slot];
+    if (ids == NULL) return;
+
+    raxIterator ri;
+    raxStart(&ri,ids);
+    raxSeek(&ri,"^",NULL,0);
+    while(raxNext(&ri)) {
+        uint64_t id;
+        memcpy(&id,ri.key,sizeof(id));
+        client *c = lookupClientByID(id);
+        if (c == NULL || !(c->flags & CLIENT_TRACKING)) continue;
+        sendTrackingMessage(c,slot);
+    }
+    raxStop(&ri);
+
+    raxFree(ids);
+    TrackingTable[slot] = NULL;
+    TrackingTableUsedSlots--;
+}
+
+/* This function is called when one or all the Redis databases are flushed
+ * ('dbid' is -1 in the latter case). Since the table does not keep track of
+ * the DB the keys belong to, a flush invalidates every slot: all the
+ * clients with tracking enabled receive an invalidation message with a null
+ * payload, meaning that the whole cache must be dropped. */
+void trackingInvalidateKeysOnFlush(int dbid) {
+    UNUSED(dbid);
+    if (server.tracking_clients) {
+        listNode *ln;
+        listIter li;
+        listRewind(server.clients,&li);
+        while ((ln = listNext(&li)) != NULL) {
+            client *c = listNodeValue(ln);
+            if (c->flags & CLIENT_TRACKING) sendTrackingMessage(c,-1);
+        }
+    }
+
+    if (TrackingTable && TrackingTableUsedSlots) {
+        for (int j = 0; j < TRACKING_TABLE_SIZE; j++) {
+            if (TrackingTable[j] != NULL) {
+                raxFree(TrackingTable[j]);
+                TrackingTable[j] = NULL;
+            }
+        }
+        TrackingTableUsedSlots = 0;
+    }
+}
+
+/* Return the number of slots of the tracking table that are tracking at
+ * least one client, for INFO. */
+unsigned long trackingGetUsedSlots(void) {
+    return TrackingTableUsedSlots;
+}
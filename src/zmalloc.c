@@ -76,18 +76,104 @@ void zlibc_free(void *ptr) {
 #define update_zmalloc_stat_alloc(__n) do { \
     size_t _n = (__n); \
     if (_n&(sizeof(long)-1)) _n += sizeof(long)-(_n&(sizeof(long)-1)); \
-    atomicIncr(used_memory,__n); \
+    zmalloc_stat_add(__n); \
+    thread_used_memory += (__n); \
 } while(0)
 
 #define update_zmalloc_stat_free(__n) do { \
     size_t _n = (__n); \
     if (_n&(sizeof(long)-1)) _n += sizeof(long)-(_n&(sizeof(long)-1)); \
-    atomicDecr(used_memory,__n); \
+    zmalloc_stat_add(-(__n)); \
+    thread_used_memory -= (__n); \
 } while(0)
 
+/* The used memory is not a single counter updated atomically by all the
+ * threads: with the lazyfree threads releasing millions of objects, the
+ * main thread would contend the same cache line at every allocation.
+ * Instead every thread gets its own counter, in its own cache line, the
+ * first time it allocates, and zmalloc_used_memory() sums them. A counter
+ * may wrap below zero when a thread frees memory allocated by another one,
+ * but the sum is always right. When a thread exits its counter is added to
+ * the 'used_memory' counter and the slot is given to the next thread that
+ * allocates. The threads exceeding ZMALLOC_MAX_THREADS alive at the same
+ * time share the 'used_memory' counter, updated atomically.
+ *
+ * 每个线程使用独立的（按缓存行对齐的）计数器，读取时再汇总，避免原子操作争用。 */
+#define ZMALLOC_MAX_THREADS 32
+#define ZMALLOC_CACHE_LINE 64
+
+static struct {
+    size_t used;
+    int taken;      /* Owned by a running thread. */
+    char padding[ZMALLOC_CACHE_LINE-sizeof(size_t)-sizeof(int)];
+} __attribute__((aligned(ZMALLOC_CACHE_LINE))) used_memory_thread[ZMALLOC_MAX_THREADS];
+static int used_memory_threads = 0;     /* Counters ever used, to sum. */
+pthread_mutex_t used_memory_threads_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t used_memory_slots_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t used_memory_thread_key;
+static pthread_once_t used_memory_thread_once = PTHREAD_ONCE_INIT;
+static __thread int thread_counter = -1;
+
 static size_t used_memory = 0;  // 统计已使用内存大小
 pthread_mutex_t used_memory_mutex = PTHREAD_MUTEX_INITIALIZER;
 
+/* Bytes allocated minus bytes freed by the calling thread. Memory allocated
+ * by a thread and freed by another makes the counters of both drift, so
+ * only the difference between two readings in the same thread is
+ * meaningful. */
+static __thread long long thread_used_memory = 0;
+
+/* Called when a thread owning a counter exits: move the counter to the
+ * shared one and release the slot. */
+static void zmalloc_thread_release_counter(void *arg) {
+    int j = (int)(long)arg - 1;
+    volatile size_t *used = &used_memory_thread[j].used;
+
+    pthread_mutex_lock(&used_memory_slots_mutex);
+    atomicIncr(used_memory,*used);
+    *used = 0;
+    used_memory_thread[j].taken = 0;
+    pthread_mutex_unlock(&used_memory_slots_mutex);
+    /* The memory freed by the other destructors goes to the shared one. */
+    thread_counter = ZMALLOC_MAX_THREADS;
+}
+
+static void zmalloc_thread_key_init(void) {
+    pthread_key_create(&used_memory_thread_key,
+                       zmalloc_thread_release_counter);
+}
+
+/* Give a free counter to the calling thread, or the shared one if all the
+ * ZMALLOC_MAX_THREADS counters are owned by other threads. */
+static void zmalloc_thread_take_counter(void) {
+    int j;
+
+    pthread_once(&used_memory_thread_once,zmalloc_thread_key_init);
+    pthread_mutex_lock(&used_memory_slots_mutex);
+    for (j = 0; j < ZMALLOC_MAX_THREADS; j++)
+        if (!used_memory_thread[j].taken) break;
+    if (j < ZMALLOC_MAX_THREADS) {
+        used_memory_thread[j].taken = 1;
+        if (j >= used_memory_threads) atomicSet(used_memory_threads,j+1);
+    }
+    pthread_mutex_unlock(&used_memory_slots_mutex);
+    thread_counter = j;
+    if (j < ZMALLOC_MAX_THREADS)
+        pthread_setspecific(used_memory_thread_key,(void*)(long)(j+1));
+}
+
+static void zmalloc_stat_add(size_t n) {
+    if (thread_counter == -1) zmalloc_thread_take_counter();
+    if (thread_counter == ZMALLOC_MAX_THREADS) {
+        atomicIncr(used_memory,n);
+    } else {
+        /* Only this thread writes the counter, the readers in other threads
+         * just need to see a value not older than a few allocations. */
+        volatile size_t *used = &used_memory_thread[thread_counter].used;
+        *used += n;
+    }
+}
+
 // 内存不足，abort
 static void zmalloc_default_oom(size_t size) {
     fprintf(stderr, "zmalloc: Out of memory trying to allocate %zu bytes\n",
@@ -218,10 +304,48 @@ char *zstrdup(const char *s) {
 
 size_t zmalloc_used_memory(void) {
     size_t um;
+    int threads;
+
     atomicGet(used_memory,um);
+    atomicGet(used_memory_threads,threads);
+    for (int j = 0; j < threads; j++) {
+        volatile size_t *used = &used_memory_thread[j].used;
+        um += *used;
+    }
     return um;
 }
 
+long long zmalloc_thread_used_memory(void) {
+    return thread_used_memory;
+}
+
+/* Return the jemalloc arena used by the calling thread, or -1 if not using
+ * jemalloc. */
+int zmalloc_get_thread_arena(void) {
+#if defined(USE_JEMALLOC)
+    unsigned arena;
+    size_t sz = sizeof(arena);
+
+    if (je_mallctl("thread.arena", &arena, &sz, NULL, 0) == 0)
+        return arena;
+#endif
+    return -1;
+}
+
+/* Make the calling thread allocate from the specified jemalloc arena, as
+ * returned by zmalloc_get_thread_arena() in another thread. With other
+ * allocators this is a no-op. */
+void zmalloc_set_thread_arena(int arena) {
+#if defined(USE_JEMALLOC)
+    unsigned ind = arena;
+
+    if (arena == -1) return;
+    je_mallctl("thread.arena", NULL, NULL, &ind, sizeof(ind));
+#else
+    (void)arena;
+#endif
+}
+
 void zmalloc_set_oom_handler(void (*oom_handler)(size_t)) {
     zmalloc_oom_handler = oom_handler;
 }
@@ -448,9 +572,25 @@ size_t zmalloc_get_memory_size(void) {
 }
 
 #ifdef REDIS_TEST
+#include <assert.h>
 #define UNUSED(x) ((void)(x))
+
+/* Allocate a block the main thread will free, and check the counter of
+ * the calling thread. */
+static void *zmalloc_test_thread(void *arg) {
+    long long before = zmalloc_thread_used_memory();
+    void *ptr = zmalloc(1000);
+
+    UNUSED(arg);
+    assert(zmalloc_thread_used_memory()-before == (long long)zmalloc_size(ptr));
+    return ptr;
+}
+
 int zmalloc_test(int argc, char **argv) {
-    void *ptr;
+    void *ptr, *blocks[ZMALLOC_MAX_THREADS*3];
+    pthread_t threads[ZMALLOC_MAX_THREADS*2];
+    size_t initial;
+    int j, used;
 
     UNUSED(argc);
     UNUSED(argv);
@@ -461,6 +601,30 @@ int zmalloc_test(int argc, char **argv) {
     printf("Reallocated to 456 bytes; used: %zu\n", zmalloc_used_memory());
     zfree(ptr);
     printf("Freed pointer; used: %zu\n", zmalloc_used_memory());
+
+    /* The threads started one after the other reuse the same counter. */
+    initial = zmalloc_used_memory();
+    for (j = 0; j < ZMALLOC_MAX_THREADS*3; j++) {
+        pthread_create(&threads[0],NULL,zmalloc_test_thread,NULL);
+        pthread_join(threads[0],&blocks[j]);
+    }
+    atomicGet(used_memory_threads,used);
+    printf("%d threads started; counters used: %d\n",
+        ZMALLOC_MAX_THREADS*3, used);
+    assert(used <= 2);
+    assert(zmalloc_used_memory() > initial);
+    for (j = 0; j < ZMALLOC_MAX_THREADS*3; j++) zfree(blocks[j]);
+    assert(zmalloc_used_memory() == initial);
+
+    /* More threads than counters at the same time share the last one. */
+    for (j = 0; j < ZMALLOC_MAX_THREADS*2; j++)
+        pthread_create(&threads[j],NULL,zmalloc_test_thread,NULL);
+    for (j = 0; j < ZMALLOC_MAX_THREADS*2; j++)
+        pthread_join(threads[j],&blocks[j]);
+    for (j = 0; j < ZMALLOC_MAX_THREADS*2; j++) zfree(blocks[j]);
+    printf("%d concurrent threads; used: %zu\n",
+        ZMALLOC_MAX_THREADS*2, zmalloc_used_memory());
+    assert(zmalloc_used_memory() == initial);
     return 0;
 }
 #endif
@@ -93,6 +93,9 @@ void *zrealloc(void *ptr, size_t size); // 重新分配内存，赋值原来内
 void zfree(void *ptr);      // 释放
 char *zstrdup(const char *s);   // 复制内存的内容到一个新地址，以\0为结束标识
 size_t zmalloc_used_memory(void);   // 全局已分配内存大小
+long long zmalloc_thread_used_memory(void);  // 当前线程分配减去释放的内存大小
+int zmalloc_get_thread_arena(void);     // 当前线程使用的jemalloc arena
+void zmalloc_set_thread_arena(int arena);   // 当前线程使用指定的jemalloc arena
 void zmalloc_set_oom_handler(void (*oom_handler)(size_t));  // 设置内存不足时的回调函数，默认会abort
 size_t zmalloc_get_rss(void);   // 获取进程实际占用内存（包括共享库占用的内存）
 int zmalloc_get_allocator_info(size_t *allocated, size_t *active, size_t *resident);    // 使用jemalloc才有意义
@@ -0,0 +1,111 @@
+# Test SPUBLISH propagation inside the shard serving the channel slot.
+
+source "../tests/includes/init-tests.tcl"
+
+test "Create a 5 nodes cluster" {
+    create_cluster 5 5
+}
+
+test "Cluster is up" {
+    assert_cluster_state ok
+}
+
+# Return the number of shard Pub/Sub messages received by the instance
+# from the cluster bus.
+proc publishshard_received {id} {
+    set n [CI $id cluster_stats_messages_publishshard_received]
+    if {$n eq {}} {set n 0}
+    return $n
+}
+
+# Return a new client connected to the instance.
+proc instance_client {id {deferred 0}} {
+    redis 127.0.0.1 [get_instance_attrib redis $id port] $deferred
+}
+
+set channel "shardchannel"
+set slot [R 0 cluster keyslot $channel]
+
+test "SPUBLISH is redirected to the master serving the slot" {
+    set owner -1
+    foreach_redis_id id {
+        if {[RI $id role] ne {master}} continue
+        if {[catch {R $id spublish $channel hello} err]} {
+            assert_match "MOVED $slot *" $err
+        } else {
+            set owner $id
+        }
+    }
+    assert {$owner != -1}
+}
+
+# The shard is the master owning the slot and its slaves.
+set owner_id [dict get [get_myself $owner] id]
+set shard $owner
+set others {}
+foreach_redis_id id {
+    if {$id == $owner} continue
+    if {[dict get [get_myself $id] slaveof] eq $owner_id} {
+        lappend shard $id
+    } else {
+        lappend others $id
+    }
+}
+
+test "SPUBLISH reaches the subscribers of the whole shard only" {
+    assert {[llength $shard] > 1}
+    foreach id $others {
+        set received($id) [publishshard_received $id]
+    }
+
+    # Subscribe to the channel in every node of the shard, replicas
+    # included, that serve shard channels without READONLY.
+    foreach id $shard {
+        R $id deferred 1
+        R $id ssubscribe $channel
+        assert_equal [list ssubscribe $channel 1] [R $id read]
+    }
+
+    # Publish from every node of the shard.
+    foreach publisher $shard {
+        set data [randomValue]
+        set rd [instance_client $publisher]
+        assert_equal 1 [$rd spublish $channel $data]
+        $rd close
+        foreach id $shard {
+            assert_equal [list smessage $channel $data] [R $id read]
+        }
+    }
+
+    foreach id $shard {
+        R $id sunsubscribe $channel
+        R $id read
+        R $id deferred 0
+    }
+
+    # Nothing was sent to the nodes of the other shards.
+    foreach id $others {
+        assert_equal $received($id) [publishshard_received $id]
+    }
+}
+
+test "Shard channels are unsubscribed when the slot moves away" {
+    set target -1
+    foreach id $others {
+        if {[RI $id role] eq {master}} {set target $id; break}
+    }
+    set target_id [dict get [get_myself $target] id]
+
+    set rd [instance_client $owner 1]
+    $rd ssubscribe $channel
+    assert_equal [list ssubscribe $channel 1] [$rd read]
+
+    R $target cluster setslot $slot importing $owner_id
+    R $owner cluster setslot $slot migrating $target_id
+    R $target cluster setslot $slot node $target_id
+    R $owner cluster setslot $slot node $target_id
+
+    assert_equal [list sunsubscribe $channel 0] [$rd read]
+    assert_equal [list $channel 0] [R $owner pubsub shardnumsub $channel]
+    $rd close
+}
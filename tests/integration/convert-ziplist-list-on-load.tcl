@@ -0,0 +1,46 @@
+# Copy RDB with quicklists of ziplists to server path
+set server_path [tmpdir "server.convert-ziplist-list-on-load"]
+
+proc biglist_items {} {
+    set items {}
+    for {set j 0} {$j < 100} {incr j} {
+        lappend items item:$j $j
+    }
+    return $items
+}
+
+exec cp -f tests/assets/list-quicklist.rdb $server_path
+start_server [list overrides [list "dir" $server_path "dbfilename" "list-quicklist.rdb"]] {
+  test "RDB load ziplist quicklist: converts the nodes to listpacks" {
+    r select 0
+
+    assert_encoding quicklist list
+    assert_equal {a b 1 2 3 -100 hello} [r lrange list 0 -1]
+    assert_equal [biglist_items] [r lrange biglist 0 -1]
+  }
+
+  test "RDB load ziplist quicklist: converted lists can be modified and saved" {
+    r linsert list before 3 x
+    r lset biglist 50 changed
+    r rpoplpush biglist biglist
+    r ltrim biglist 0 150
+    set list [r lrange list 0 -1]
+    set biglist [r lrange biglist 0 -1]
+    r debug reload
+    assert_match "*ql_listpack_max*" [r debug object biglist]
+    assert_equal $list [r lrange list 0 -1]
+    assert_equal $biglist [r lrange biglist 0 -1]
+  }
+}
+
+exec cp -f tests/assets/list-quicklist.rdb $server_path
+start_server [list overrides [list "dir" $server_path "dbfilename" "list-quicklist.rdb" "list-compress-depth" 1]] {
+  test "RDB load ziplist quicklist: compressed lists" {
+    r select 0
+
+    assert_equal [biglist_items] [r lrange biglist 0 -1]
+    assert_equal item:50 [r lindex biglist 100]
+    r debug reload
+    assert_equal [biglist_items] [r lrange biglist 0 -1]
+  }
+}
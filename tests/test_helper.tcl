@@ -43,6 +43,7 @@ set ::all_tests {
     integration/aof
     integration/rdb
     integration/convert-zipmap-hash-on-load
+    integration/convert-ziplist-list-on-load
     integration/logging
     integration/psync2
     integration/psync2-reg
@@ -52,6 +53,8 @@ set ::all_tests {
     unit/maxmemory
     unit/introspection
     unit/introspection-2
+    unit/keystats
+    unit/tracking
     unit/limits
     unit/obuf-limits
     unit/bitops
@@ -0,0 +1,92 @@
+start_server {tags {"keystats"}} {
+    test {KEYSTATS sampling is disabled by default} {
+        r set foo bar
+        r get foo
+        list [r config get keystats-sample-ratio] [r keystats hot]
+    } {{keystats-sample-ratio 0} {}}
+
+    r config set keystats-sample-ratio 1
+
+    test {KEYSTATS HOT reports the most accessed keys} {
+        r flushall
+        r keystats reset
+        for {set j 0} {$j < 20} {incr j} {r set key:$j $j}
+        r set hot1 a
+        r set hot2 b
+        for {set j 0} {$j < 200} {incr j} {
+            r get hot1
+            r get hot2
+            r get hot1
+            r get key:[expr {$j % 20}]
+        }
+        set reply [r keystats hot count 2]
+        assert_equal 2 [llength $reply]
+        assert_equal {hot1 hot2} [list [dict get [lindex $reply 0] key] \
+                                       [dict get [lindex $reply 1] key]]
+        assert {[dict get [lindex $reply 0] ops_per_sec] >
+                [dict get [lindex $reply 1] ops_per_sec]}
+    }
+
+    test {KEYSTATS BIG reports the biggest keys} {
+        r flushall
+        r keystats reset
+        r set small foo
+        r rpush biglist {*}[lrepeat 1000 [string repeat x 50]]
+        r hset bighash {*}[lrepeat 100 field value]
+        r get small
+        r llen biglist
+        r hlen bighash
+        set reply [r keystats big]
+        assert_equal 3 [llength $reply]
+        set first [lindex $reply 0]
+        assert_equal biglist [dict get $first key]
+        assert_equal list [dict get $first type]
+        assert {[dict get $first bytes] >= 50000}
+        assert_equal small [dict get [lindex $reply 2] key]
+    }
+
+    test {KEYSTATS BIG forgets deleted keys} {
+        r del biglist
+        set reply [r keystats big]
+        assert_equal 2 [llength $reply]
+        assert_equal bighash [dict get [lindex $reply 0] key]
+    }
+
+    test {KEYSTATS BIG with many deleted and resized keys} {
+        r flushall
+        r keystats reset
+        for {set j 0} {$j < 30} {incr j} {
+            r rpush list:$j {*}[lrepeat [expr {$j+1}] [string repeat x 100]]
+            r llen list:$j
+        }
+        # Delete every other key, and make the smallest survivors the
+        # biggest ones, so that refreshing the heap reorders it.
+        for {set j 0} {$j < 30} {incr j 2} {r del list:$j}
+        for {set j 1} {$j < 10} {incr j 2} {
+            r rpush list:$j {*}[lrepeat 100 [string repeat x 100]]
+        }
+        set reply [r keystats big count 100]
+        assert_equal 15 [llength $reply]
+        foreach e $reply {
+            assert_equal 1 [r exists [dict get $e key]]
+            assert_equal list [dict get $e type]
+        }
+        assert_equal list:9 [dict get [lindex $reply 0] key]
+    }
+
+    test {KEYSTATS does not sample when disabled} {
+        r keystats reset
+        r config set keystats-sample-ratio 0
+        r get small
+        r hlen bighash
+        set reply [r keystats hot]
+        r config set keystats-sample-ratio 1
+        set reply
+    } {}
+
+    test {KEYSTATS wrong arguments} {
+        catch {r keystats hot count 0} e1
+        catch {r keystats foo} e2
+        list $e1 $e2
+    } {{ERR COUNT must be > 0} {ERR Unknown subcommand*}}
+}
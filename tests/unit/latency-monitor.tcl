@@ -27,6 +27,8 @@ start_server {tags {"latency-monitor"}} {
     test {LATENCY LATEST output is ok} {
         foreach event [r latency latest] {
             lassign $event eventname time latency max
+            # Slow commands are also reported as slow event loop iterations.
+            if {[string match eventloop* $eventname]} continue
             assert {$eventname eq "command"}
             assert {$max >= 450 & $max <= 650}
             assert {$time == $last_time}
@@ -48,6 +50,48 @@ start_server {tags {"latency-monitor"}} {
         assert {[r latency latest] eq {}}
     }
 
+    test {Slow event loop iterations are logged by phase} {
+        r config set latency-monitor-threshold 200
+        r latency reset
+        r debug sleep 0.3
+        set events [r latency latest]
+        assert_match {*eventloop-exec*} $events
+        set found 0
+        foreach event $events {
+            if {[lindex $event 0] eq {eventloop}} {
+                assert {[lindex $event 2] >= 300}
+                set found 1
+            }
+        }
+        assert {$found}
+    }
+
+    test {INFO eventloop reports the time spent by phase} {
+        r config resetstat
+        r ping
+        set info [r info eventloop]
+        assert_match {*eventloop_iterations:*} $info
+        foreach phase {other poll read parse exec write cron expire aof beforesleep} {
+            assert_match "*eventloop_phase_${phase}:calls=*,usec=*" $info
+        }
+        regexp {eventloop_phase_exec:calls=([0-9]+)} $info _ calls
+        assert {$calls >= 2}
+    }
+
+    test {INFO eventloop counters stop when eventloop-profiling is disabled} {
+        r config set eventloop-profiling no
+        r config resetstat
+        r ping
+        r ping
+        set info [r info eventloop]
+        assert_match {*eventloop_iterations:0*} $info
+        assert_match {*eventloop_phase_exec:calls=0,*} $info
+        r config set eventloop-profiling yes
+        r ping
+        regexp {eventloop_phase_exec:calls=([0-9]+)} [r info eventloop] _ calls
+        assert {$calls >= 1}
+    }
+
     test {LATENCY of expire events are correctly collected} {
         r config set latency-monitor-threshold 20
         r eval {
@@ -61,4 +105,51 @@ start_server {tags {"latency-monitor"}} {
         after 500
         assert_match {*expire-cycle*} [r latency latest]
     }
+
+    proc latencystat {cmd} {
+        if {[regexp "\r\n$cmd:(.*?)\r\n" [r info latencystats] _ value]} {
+            set _ $value
+        }
+    }
+
+    test {LATENCY HISTOGRAM and latencystats track command latency} {
+        r config resetstat
+        r set foo bar
+        for {set j 0} {$j < 10} {incr j} {r get foo}
+        r debug sleep 0.1
+        set hist [r latency histogram get nosuchcommand]
+        assert_equal {get} [lindex $hist 0]
+        assert_equal 10 [dict get [lindex $hist 1] calls]
+        # The last bucket of the cumulative histogram holds every call.
+        assert_equal 10 [lindex [dict get [lindex $hist 1] histogram_usec] end]
+        assert_match {p50=*,p99=*,p99.9=*,max=*} \
+            [latencystat latency_percentiles_usec_get]
+        regexp {max=([0-9]+)} [latencystat latency_percentiles_usec_debug] _ max
+        assert {$max >= 100000}
+    }
+
+    test {Total latency includes the time spent blocked} {
+        r config resetstat
+        set rd [redis_deferring_client]
+        $rd blpop blocked-list 0
+        after 200
+        r rpush blocked-list a
+        assert_equal {blocked-list a} [$rd read]
+        $rd close
+        regexp {max=([0-9]+)} [latencystat latency_percentiles_usec_blpop] _ max
+        assert {$max < 100000}
+        regexp {p50=([0-9]+)} \
+            [latencystat latency_total_percentiles_usec_blpop] _ p50
+        assert {$p50 >= 150000}
+    }
+
+    test {CONFIG RESETSTAT resets the histograms, latency-tracking disables them} {
+        r config resetstat
+        set empty {get {calls 0 histogram_usec {} total_histogram_usec {}}}
+        assert_equal $empty [r latency histogram get]
+        r config set latency-tracking no
+        r get foo
+        assert_equal $empty [r latency histogram get]
+        r config set latency-tracking yes
+    }
 }
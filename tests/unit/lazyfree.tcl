@@ -37,3 +37,59 @@ start_server {tags {"lazyfree"}} {
         }
     }
 }
+
+start_server {tags {"lazyfree"} overrides {lazyfree-threads 4}} {
+    test "UNLINK of many keys is reclaimed by the lazyfree threads" {
+        set orig_mem [s used_memory]
+        set args {}
+        for {set i 0} {$i < 1000} {incr i} {
+            lappend args $i
+        }
+        for {set j 0} {$j < 200} {incr j} {
+            r sadd myset:$j {*}$args
+        }
+        set peak_mem [s used_memory]
+        for {set j 0} {$j < 200} {incr j} {
+            assert {[r unlink myset:$j] == 1}
+        }
+        wait_for_condition 50 100 {
+            [s lazyfree_pending_objects] == 0 &&
+            [s used_memory] < $orig_mem+($peak_mem-$orig_mem)/4
+        } else {
+            fail "Memory is not reclaimed by the lazyfree threads"
+        }
+        assert_equal [lindex [r config get lazyfree-threads] 1] 4
+    }
+
+    test "Overwritten values and deleted members can be freed lazily" {
+        r config set lazyfree-lazy-overwrite yes
+        r config set lazyfree-lazy-member-del yes
+        r config set key-memory-tracking yes
+        for {set i 0} {$i < 1000} {incr i} {
+            r rpush mylist $i
+            r hset myhash field:$i [string repeat x 100]
+            r zadd myzset $i member:$i
+        }
+        r set mylist foo
+        for {set i 0} {$i < 500} {incr i} {
+            r hdel myhash field:$i
+            r zrem myzset member:$i
+        }
+        r zremrangebyscore myzset 500 599
+        r zremrangebyrank myzset 0 99
+        assert_equal [r get mylist] foo
+        assert_equal [r hlen myhash] 500
+        assert_equal [r hget myhash field:999] [string repeat x 100]
+        assert_equal [r zcard myzset] 300
+        assert_equal [r zrange myzset 0 0] member:700
+        r debug keymem-check
+        wait_for_condition 50 100 {
+            [s lazyfree_pending_objects] == 0
+        } else {
+            fail "The lazy freed members are not reclaimed"
+        }
+        r config set key-memory-tracking no
+        r config set lazyfree-lazy-overwrite no
+        r config set lazyfree-lazy-member-del no
+    } {OK}
+}
@@ -24,7 +24,8 @@ start_server {tags {"maxmemory"}} {
     }
 
     foreach policy {
-        allkeys-random allkeys-lru allkeys-lfu volatile-lru volatile-lfu volatile-random volatile-ttl
+        allkeys-random allkeys-lru allkeys-lfu allkeys-lfu-size volatile-lru
+        volatile-lfu volatile-lfu-size volatile-random volatile-ttl
     } {
         test "maxmemory - is the memory limit honoured? (policy $policy)" {
             # make sure to start with a blank instance
@@ -98,7 +99,7 @@ start_server {tags {"maxmemory"}} {
     }
 
     foreach policy {
-        volatile-lru volatile-lfu volatile-random volatile-ttl
+        volatile-lru volatile-lfu volatile-lfu-size volatile-random volatile-ttl
     } {
         test "maxmemory - policy $policy should only remove volatile keys." {
             # make sure to start with a blank instance
@@ -141,6 +142,102 @@ start_server {tags {"maxmemory"}} {
             }
         }
     }
+
+    foreach tracking {no yes} {
+        test "maxmemory - allkeys-lfu-size evicts big keys first (tracking $tracking)" {
+            r flushall
+            r config set maxmemory 0
+            r config set maxmemory-policy allkeys-lfu-size
+            r config set maxmemory-samples 10
+            r config set key-memory-tracking $tracking
+            set used [s used_memory]
+            for {set j 0} {$j < 20} {incr j} {
+                r set big:$j [string repeat x 10000]
+            }
+            for {set j 0} {$j < 1000} {incr j} {
+                r set small:$j [string repeat x 50]
+            }
+            # The small keys use about 150k, so to stay under the limit
+            # most of the big keys must be evicted.
+            r config set maxmemory [expr {$used+220*1024}]
+            for {set j 1000} {$j < 1200} {incr j} {
+                r set small:$j [string repeat x 50]
+            }
+            set big [llength [r keys big:*]]
+            set small [llength [r keys small:*]]
+            r config set maxmemory 0
+            r config set maxmemory-samples 5
+            r config set key-memory-tracking no
+            # With the plain LFU policy, since all the keys have the same
+            # access frequency, about 500 small keys and 10 big keys are
+            # evicted.
+            assert {$big < 10}
+            assert {$small > 900}
+        }
+    }
+
+    test "maxmemory - background eviction reaches the low watermark" {
+        r flushall
+        r config resetstat
+        set used [s used_memory]
+        set limit [expr {$used+2*1024*1024}]
+        r config set maxmemory $limit
+        r config set maxmemory-policy allkeys-random
+        r config set maxmemory-background-eviction yes
+        r config set maxmemory-low-watermark 80
+        for {set j 0} {$j < 5000} {incr j} {
+            r set key:$j [string repeat x 1000]
+        }
+        # Once the writes stop, the cron should keep evicting until the
+        # memory is under 80% of maxmemory. Note that our own client
+        # buffers are counted as well, so we don't wait for a zero lag.
+        wait_for_condition 100 50 {
+            [s used_memory] < $limit*0.9
+        } else {
+            fail "Background eviction didn't reach the low watermark"
+        }
+        assert {[s eviction_lag_bytes] < $limit*0.1}
+        assert {[s evicted_keys_background] > 0}
+        assert {[s evicted_keys] >= [s evicted_keys_background]}
+        assert {[r dbsize] < 5000}
+        r config set maxmemory 0
+        r config set maxmemory-background-eviction no
+        r config set maxmemory-low-watermark 95
+    }
+
+    test "maxmemory - background eviction refuses writes over the hard margin" {
+        r flushall
+        r config set maxmemory-policy allkeys-random
+        r config set maxmemory-background-eviction yes
+        r debug populate 200000 key 100
+        set limit [expr {[s used_memory]/2}]
+        # Send the commands together, so that the cron can't run in the
+        # middle: a single command can't evict so many keys in 500
+        # microseconds.
+        set rd [redis_deferring_client]
+        $rd write "config set maxmemory $limit\r\nset foo bar\r\n"
+        $rd write "config set maxmemory-hard-margin 100\r\nset foo bar\r\n"
+        $rd flush
+        assert_equal OK [$rd read]
+        catch {$rd read} e
+        assert_match {OOM*} $e
+        assert_equal OK [$rd read]
+        assert_equal OK [$rd read]
+        $rd close
+        r config set maxmemory 0
+        r config set maxmemory-background-eviction no
+        r config set maxmemory-hard-margin 5
+        r flushall
+    }
+
+    test "maxmemory - maxmemory-low-watermark must be a percentage" {
+        catch {r config set maxmemory-low-watermark 0} e1
+        catch {r config set maxmemory-low-watermark 101} e2
+        assert_match {*ERR*} $e1
+        assert_match {*ERR*} $e2
+        assert_equal [lindex [r config get maxmemory-low-watermark] 1] 95
+    }
+
 }
 
 proc test_slave_buffers {test_name cmd_count payload_len limit_memory pipeline} {
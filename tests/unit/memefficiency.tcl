@@ -36,178 +36,371 @@ start_server {tags {"memefficiency"}} {
     }
 }
 
-start_server {tags {"defrag"}} {
-    if {[string match {*jemalloc*} [s mem_allocator]]} {
-        test "Active defrag" {
-            r config set activedefrag no
-            r config set active-defrag-threshold-lower 5
-            r config set active-defrag-cycle-min 65
-            r config set active-defrag-cycle-max 75
-            r config set active-defrag-ignore-bytes 2mb
-            r config set maxmemory 100mb
-            r config set maxmemory-policy allkeys-lru
-            r debug populate 700000 asdf 150
-            r debug populate 170000 asdf 300
-            r ping ;# trigger eviction following the previous population
-            after 120 ;# serverCron only updates the info once in 100ms
-            set frag [s allocator_frag_ratio]
-            if {$::verbose} {
-                puts "frag $frag"
-            }
-            assert {$frag >= 1.4}
-            catch {r config set activedefrag yes} e
-            if {![string match {DISABLED*} $e]} {
-                # Wait for the active defrag to start working (decision once a
-                # second).
-                wait_for_condition 50 100 {
-                    [s active_defrag_running] ne 0
-                } else {
-                    fail "defrag not started."
-                }
+start_server {tags {"memefficiency"} overrides {key-memory-tracking yes}} {
+    test "Key memory tracking matches the actual size of the values" {
+        r flushall
+        for {set j 0} {$j < 500} {incr j} {
+            r sadd set $j
+            r rpush list $j
+            r hset hash field:$j $j
+            r zadd zset $j member:$j
+            r append string x$j
+            r xadd stream * field $j
+            r set key:$j [string repeat x $j]
+            r expire key:$j 100
+        }
+        for {set j 0} {$j < 200} {incr j} {
+            r srem set $j
+            r spop set
+            r lpop list
+            r hdel hash field:$j
+            r zrem zset member:$j
+            r del key:$j
+            r smove set set2 [expr {$j+300}]
+            r rpoplpush list list2
+        }
+        r rename zset zset2
+        r xgroup create stream mygroup 0
+        r xreadgroup group mygroup consumer count 100 streams stream >
+        r eval {redis.call('sadd','s1','a'); redis.call('lpush','l1','b')} 0
+        r debug keymem-check
+    } {}
 
-                # Wait for the active defrag to stop working.
-                wait_for_condition 150 100 {
-                    [s active_defrag_running] eq 0
-                } else {
-                    after 120 ;# serverCron only updates the info once in 100ms
-                    puts [r info memory]
-                    puts [r memory malloc-stats]
-                    fail "defrag didn't stop."
-                }
+    test "Key memory tracking follows in place updates of the values" {
+        r flushall
+        r config set list-compress-depth 1
+        for {set j 0} {$j < 2000} {incr j} {
+            r rpush list [string repeat $j 10]
+            r hset hash field:$j [string repeat x $j]
+            r zadd zset $j member:$j
+            r sadd set member:$j
+            r xadd stream * field $j
+        }
+        r lindex list 1000
+        r lset list 1500 new
+        r linsert list before new other
+        r lrem list 0 other
+        r ltrim list 10 -10
+        r hset hash field:1 y
+        r zadd zset 5000 member:1
+        r zremrangebyscore zset 0 100
+        r srem set member:1
+        r xgroup create stream mygroup 0
+        r xreadgroup group mygroup alice count 100 streams stream >
+        set ids [lindex [lindex [r xpending stream mygroup - + 10] 0] 0]
+        r xclaim stream mygroup bob 0 $ids
+        r xautoclaim stream mygroup carol 0 count 10
+        r xack stream mygroup $ids
+        r xgroup delconsumer stream mygroup alice
+        r xdel stream $ids
+        r xtrim stream maxlen 1000
+        r xgroup destroy stream mygroup
+        r config set list-compress-depth 0
+        r debug keymem-check
+    } {}
+
+    proc keyspace_used_memory {} {
+        if {[regexp {db9:.*used_memory=([0-9]+)} [r info keyspace] - mem]} {
+            return $mem
+        }
+        return 0
+    }
+
+    test "Key memory tracking: MEMORY USAGE and INFO keyspace" {
+        r flushall
+        r rpush mylist {*}[lrange [split [string repeat "abc," 1000] ,] 0 999]
+        set mylist_mem [keyspace_used_memory]
+        assert {$mylist_mem > 3000}
+        assert {[r memory usage mylist] > $mylist_mem}
+        r lpush otherlist a
+        set total [keyspace_used_memory]
+        assert {$total > $mylist_mem}
+        r del mylist
+        assert_equal [expr {$total-$mylist_mem}] [keyspace_used_memory]
+    }
+
+    test "Key memory tracking can be enabled at runtime" {
+        r config set key-memory-tracking no
+        r flushall
+        r sadd myset a b c
+        r hset myhash a b
+        assert {![string match "*used_memory*" [r info keyspace]]}
+        r config set key-memory-tracking yes
+        r sadd myset d e f
+        wait_for_condition 50 100 {
+            [string match "*used_memory*" [r info keyspace]]
+        } else {
+            fail "The keys were not measured"
+        }
+        r debug keymem-check
+    } {}
+}
+
+start_server {tags {"memefficiency"}} {
+    proc fill_small_values {} {
+        r flushall
+        set base_mem [s used_memory]
+        for {set j 0} {$j < 10000} {incr j} {
+            r set counter:$j [expr {$j+100000}]
+            r set flag:$j on
+        }
+        expr {[s used_memory]-$base_mem}
+    }
+
+    test "Small values are stored inline" {
+        r config set inline-small-values no
+        set objects_mem [fill_small_values]
+        r config set inline-small-values yes
+        set inline_mem [fill_small_values]
+        # At least the 16 bytes of the object are saved for every value.
+        assert {$inline_mem < $objects_mem-20000*16}
+    }
 
-                # Test the the fragmentation is lower.
+    test "Reading inline values does not convert them into objects" {
+        set inline_mem [fill_small_values]
+        set before [s used_memory]
+        for {set j 0} {$j < 10000} {incr j} {
+            r get counter:$j
+            r strlen flag:$j
+        }
+        assert {[s used_memory] < $before+20000*8}
+    }
+
+    test "Inline values are transparent to the commands" {
+        r flushall
+        r config set key-memory-tracking yes
+        set values [list 0 -1 12345 -2305843009213693952 -2305843009213693953 \
+                    9223372036854775807 {} a "a\x00b" "\xff\xfe" 1234567 \
+                    12345678 007 " 1" abcdefg abcdefgh]
+        set j 0
+        foreach v $values {
+            r set key:$j $v
+            incr j
+        }
+        set digest [r debug digest]
+        r debug reload
+        assert_equal $digest [r debug digest]
+        set j 0
+        foreach v $values {
+            assert_equal $v [r get key:$j]
+            assert_equal [string length $v] [r strlen key:$j]
+            assert_equal string [r type key:$j]
+            incr j
+        }
+        r set counter 100000
+        assert_equal 100001 [r incr counter]
+        r set str abc
+        assert_equal 6 [r append str def]
+        assert_equal abcdef [r get str]
+        r set num 1234
+        assert_equal int [r object encoding num]
+        r rename num num2
+        assert_equal 1234 [r get num2]
+        r debug keymem-check
+    } {}
+
+    test "Introspection does not change how inline values are stored" {
+        r set small abc
+        set usage [r memory usage small]
+        assert_equal embstr [r object encoding small]
+        assert_equal 1 [r object refcount small]
+        assert_equal 0 [r object idletime small]
+        assert_match {*encoding:embstr*} [r debug object small]
+        assert_equal $usage [r memory usage small]
+    }
+    r config set key-memory-tracking no
+}
+
+foreach defrag_thread {no yes} {
+    start_server [list tags {"defrag"} overrides [list active-defrag-thread $defrag_thread]] {
+        if {[string match {*jemalloc*} [s mem_allocator]]} {
+            test "Active defrag (thread: $defrag_thread)" {
+                r config set activedefrag no
+                r config set active-defrag-threshold-lower 5
+                r config set active-defrag-cycle-min 65
+                r config set active-defrag-cycle-max 75
+                r config set active-defrag-ignore-bytes 2mb
+                r config set maxmemory 100mb
+                r config set maxmemory-policy allkeys-lru
+                r debug populate 700000 asdf 150
+                r debug populate 170000 asdf 300
+                r ping ;# trigger eviction following the previous population
                 after 120 ;# serverCron only updates the info once in 100ms
                 set frag [s allocator_frag_ratio]
                 if {$::verbose} {
                     puts "frag $frag"
                 }
-                assert {$frag < 1.1}
-            } else {
-                set _ ""
-            }
-        } {}
-
-        test "Active defrag big keys" {
-            r flushdb
-            r config resetstat
-            r config set save "" ;# prevent bgsave from interfereing with save below
-            r config set activedefrag no
-            r config set active-defrag-max-scan-fields 1000
-            r config set active-defrag-threshold-lower 5
-            r config set active-defrag-cycle-min 65
-            r config set active-defrag-cycle-max 75
-            r config set active-defrag-ignore-bytes 2mb
-            r config set maxmemory 0
-            r config set list-max-ziplist-size 5 ;# list of 10k items will have 2000 quicklist nodes
-            r config set stream-node-max-entries 5
-            r hmset hash h1 v1 h2 v2 h3 v3
-            r lpush list a b c d
-            r zadd zset 0 a 1 b 2 c 3 d
-            r sadd set a b c d
-            r xadd stream * item 1 value a
-            r xadd stream * item 2 value b
-            r xgroup create stream mygroup 0
-            r xreadgroup GROUP mygroup Alice COUNT 1 STREAMS stream >
-
-            # create big keys with 10k items
-            set rd [redis_deferring_client]
-            for {set j 0} {$j < 10000} {incr j} {
-                $rd hset bighash $j [concat "asdfasdfasdf" $j]
-                $rd lpush biglist [concat "asdfasdfasdf" $j]
-                $rd zadd bigzset $j [concat "asdfasdfasdf" $j]
-                $rd sadd bigset [concat "asdfasdfasdf" $j]
-                $rd xadd bigstream * item 1 value a
-            }
-            for {set j 0} {$j < 50000} {incr j} {
-                $rd read ; # Discard replies
-            }
-
-            set expected_frag 1.7
-            if {$::accurate} {
-                # scale the hash to 1m fields in order to have a measurable the latency
-                for {set j 10000} {$j < 1000000} {incr j} {
+                assert {$frag >= 1.4}
+                catch {r config set activedefrag yes} e
+                if {![string match {DISABLED*} $e]} {
+                    # Wait for the active defrag to start working (decision once a
+                    # second).
+                    wait_for_condition 50 100 {
+                        [s active_defrag_running] ne 0
+                    } else {
+                        fail "defrag not started."
+                    }
+
+                    # Once the defrag thread did some work, turn it off: the
+                    # thread is parked and serverCron() completes the work.
+                    if {$defrag_thread} {
+                        wait_for_condition 50 100 {
+                            [s active_defrag_hits] > 0
+                        } else {
+                            fail "defrag thread not working."
+                        }
+                        r config set active-defrag-thread no
+                    }
+
+                    # Wait for the active defrag to stop working.
+                    wait_for_condition 150 100 {
+                        [s active_defrag_running] eq 0
+                    } else {
+                        after 120 ;# serverCron only updates the info once in 100ms
+                        puts [r info memory]
+                        puts [r memory malloc-stats]
+                        fail "defrag didn't stop."
+                    }
+
+                    # Test the the fragmentation is lower.
+                    after 120 ;# serverCron only updates the info once in 100ms
+                    set frag [s allocator_frag_ratio]
+                    if {$::verbose} {
+                        puts "frag $frag"
+                    }
+                    assert {$frag < 1.1}
+                } else {
+                    set _ ""
+                }
+            } {}
+
+            test "Active defrag big keys (thread: $defrag_thread)" {
+                r flushdb
+                r config resetstat
+                r config set save "" ;# prevent bgsave from interfereing with save below
+                r config set activedefrag no
+                r config set active-defrag-thread $defrag_thread
+                r config set active-defrag-max-scan-fields 1000
+                r config set active-defrag-threshold-lower 5
+                r config set active-defrag-cycle-min 65
+                r config set active-defrag-cycle-max 75
+                r config set active-defrag-ignore-bytes 2mb
+                r config set maxmemory 0
+                r config set list-max-ziplist-size 5 ;# list of 10k items will have 2000 quicklist nodes
+                r config set stream-node-max-entries 5
+                r hmset hash h1 v1 h2 v2 h3 v3
+                r lpush list a b c d
+                r zadd zset 0 a 1 b 2 c 3 d
+                r sadd set a b c d
+                r xadd stream * item 1 value a
+                r xadd stream * item 2 value b
+                r xgroup create stream mygroup 0
+                r xreadgroup GROUP mygroup Alice COUNT 1 STREAMS stream >
+
+                # create big keys with 10k items
+                set rd [redis_deferring_client]
+                for {set j 0} {$j < 10000} {incr j} {
                     $rd hset bighash $j [concat "asdfasdfasdf" $j]
+                    $rd lpush biglist [concat "asdfasdfasdf" $j]
+                    $rd zadd bigzset $j [concat "asdfasdfasdf" $j]
+                    $rd sadd bigset [concat "asdfasdfasdf" $j]
+                    $rd xadd bigstream * item 1 value a
                 }
-                for {set j 10000} {$j < 1000000} {incr j} {
+                for {set j 0} {$j < 50000} {incr j} {
                     $rd read ; # Discard replies
                 }
-                # creating that big hash, increased used_memory, so the relative frag goes down
-                set expected_frag 1.3
-            }
-
-            # add a mass of string keys
-            for {set j 0} {$j < 500000} {incr j} {
-                $rd setrange $j 150 a
-            }
-            for {set j 0} {$j < 500000} {incr j} {
-                $rd read ; # Discard replies
-            }
-            assert {[r dbsize] == 500010}
-
-            # create some fragmentation
-            for {set j 0} {$j < 500000} {incr j 2} {
-                $rd del $j
-            }
-            for {set j 0} {$j < 500000} {incr j 2} {
-                $rd read ; # Discard replies
-            }
-            assert {[r dbsize] == 250010}
-
-            # start defrag
-            after 120 ;# serverCron only updates the info once in 100ms
-            set frag [s allocator_frag_ratio]
-            if {$::verbose} {
-                puts "frag $frag"
-            }
-            assert {$frag >= $expected_frag}
-            r config set latency-monitor-threshold 5
-            r latency reset
-
-            set digest [r debug digest]
-            catch {r config set activedefrag yes} e
-            if {![string match {DISABLED*} $e]} {
-                # wait for the active defrag to start working (decision once a second)
-                wait_for_condition 50 100 {
-                    [s active_defrag_running] ne 0
-                } else {
-                    fail "defrag not started."
+
+                set expected_frag 1.7
+                if {$::accurate} {
+                    # scale the hash to 1m fields in order to have a measurable the latency
+                    for {set j 10000} {$j < 1000000} {incr j} {
+                        $rd hset bighash $j [concat "asdfasdfasdf" $j]
+                    }
+                    for {set j 10000} {$j < 1000000} {incr j} {
+                        $rd read ; # Discard replies
+                    }
+                    # creating that big hash, increased used_memory, so the relative frag goes down
+                    set expected_frag 1.3
                 }
 
-                # wait for the active defrag to stop working
-                wait_for_condition 500 100 {
-                    [s active_defrag_running] eq 0
-                } else {
-                    after 120 ;# serverCron only updates the info once in 100ms
-                    puts [r info memory]
-                    puts [r memory malloc-stats]
-                    fail "defrag didn't stop."
+                # add a mass of string keys
+                for {set j 0} {$j < 500000} {incr j} {
+                    $rd setrange $j 150 a
+                }
+                for {set j 0} {$j < 500000} {incr j} {
+                    $rd read ; # Discard replies
                 }
+                assert {[r dbsize] == 500010}
 
-                # test the the fragmentation is lower
+                # create some fragmentation
+                for {set j 0} {$j < 500000} {incr j 2} {
+                    $rd del $j
+                }
+                for {set j 0} {$j < 500000} {incr j 2} {
+                    $rd read ; # Discard replies
+                }
+                assert {[r dbsize] == 250010}
+
+                # start defrag
                 after 120 ;# serverCron only updates the info once in 100ms
                 set frag [s allocator_frag_ratio]
-                set max_latency 0
-                foreach event [r latency latest] {
-                    lassign $event eventname time latency max
-                    if {$eventname == "active-defrag-cycle"} {
-                        set max_latency $max
-                    }
-                }
                 if {$::verbose} {
                     puts "frag $frag"
-                    puts "max latency $max_latency"
-                    puts [r latency latest]
-                    puts [r latency history active-defrag-cycle]
                 }
-                assert {$frag < 1.1}
-                # due to high fragmentation, 10hz, and active-defrag-cycle-max set to 75,
-                # we expect max latency to be not much higher than 75ms
-                assert {$max_latency <= 120}
-            }
-            # verify the data isn't corrupted or changed
-            set newdigest [r debug digest]
-            assert {$digest eq $newdigest}
-            r save ;# saving an rdb iterates over all the data / pointers
-        } {OK}
+                assert {$frag >= $expected_frag}
+                r config set latency-monitor-threshold 5
+                r latency reset
+
+                set digest [r debug digest]
+                catch {r config set activedefrag yes} e
+                if {![string match {DISABLED*} $e]} {
+                    # wait for the active defrag to start working (decision once a second)
+                    wait_for_condition 50 100 {
+                        [s active_defrag_running] ne 0
+                    } else {
+                        fail "defrag not started."
+                    }
+
+                    # wait for the active defrag to stop working
+                    wait_for_condition 500 100 {
+                        [s active_defrag_running] eq 0
+                    } else {
+                        after 120 ;# serverCron only updates the info once in 100ms
+                        puts [r info memory]
+                        puts [r memory malloc-stats]
+                        fail "defrag didn't stop."
+                    }
+
+                    # test the the fragmentation is lower
+                    after 120 ;# serverCron only updates the info once in 100ms
+                    set frag [s allocator_frag_ratio]
+                    set max_latency 0
+                    foreach event [r latency latest] {
+                        lassign $event eventname time latency max
+                        if {$eventname == "active-defrag-cycle"} {
+                            set max_latency $max
+                        }
+                    }
+                    if {$::verbose} {
+                        puts "frag $frag"
+                        puts "max latency $max_latency"
+                        puts [r latency latest]
+                        puts [r latency history active-defrag-cycle]
+                    }
+                    assert {$frag < 1.1}
+                    # due to high fragmentation, 10hz, and active-defrag-cycle-max set to 75,
+                    # we expect max latency to be not much higher than 75ms
+                    assert {$max_latency <= 120}
+                    # The defrag thread works in steps of 500 microseconds.
+                    if {$defrag_thread} {
+                        assert {$max_latency < 5}
+                    }
+                }
+                # verify the data isn't corrupted or changed
+                set newdigest [r debug digest]
+                assert {$digest eq $newdigest}
+                r save ;# saving an rdb iterates over all the data / pointers
+            } {OK}
+        }
     }
 }
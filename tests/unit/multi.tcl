@@ -211,6 +211,45 @@ start_server {tags {"multi"}} {
         set res
     } {PONG}
 
+    test {WATCH of the same key by many clients} {
+        r del x
+        r set x 1
+        set clients {}
+        for {set j 0} {$j < 10} {incr j} {
+            set rd [redis [srv 0 host] [srv 0 port]]
+            $rd select 9
+            $rd watch x
+            lappend clients $rd
+        }
+        # A client watching the key since before the modification fails,
+        # a client starting to watch it after succeeds.
+        [lindex $clients 0] incr x
+        set late [redis [srv 0 host] [srv 0 port]]
+        $late select 9
+        $late watch x
+        lappend clients $late
+        set res {}
+        foreach rd $clients {
+            $rd multi
+            $rd get x
+            lappend res [$rd exec]
+            $rd close
+        }
+        set res
+    } {{} {} {} {} {} {} {} {} {} {} 2}
+
+    test {CLIENT LIST shows clients whose WATCHed keys were touched} {
+        set rd [redis [srv 0 host] [srv 0 port]]
+        $rd select 9
+        $rd client setname watcher
+        $rd watch x
+        set flags1 [regexp {name=watcher .*flags=\w*d} [r client list]]
+        r set x 10
+        set flags2 [regexp {name=watcher .*flags=\w*d} [r client list]]
+        $rd close
+        list $flags1 $flags2
+    } {0 1}
+
     test {WATCH will consider touched keys target of EXPIRE} {
         r del x
         r set x foo
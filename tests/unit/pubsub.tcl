@@ -47,6 +47,16 @@ start_server {tags {"pubsub"}} {
         __consume_subscribe_messages $client punsubscribe $channels
     }
 
+    proc ssubscribe {client channels} {
+        $client ssubscribe {*}$channels
+        __consume_subscribe_messages $client ssubscribe $channels
+    }
+
+    proc sunsubscribe {client {channels {}}} {
+        $client sunsubscribe {*}$channels
+        __consume_subscribe_messages $client sunsubscribe $channels
+    }
+
     test "Pub/Sub PING" {
         set rd1 [redis_deferring_client]
         subscribe $rd1 somechannel
@@ -196,6 +206,75 @@ start_server {tags {"pubsub"}} {
         $rd1 close
     }
 
+    test "PUBLISH of big messages to many SUBSCRIBE and PSUBSCRIBE clients" {
+        set clients {}
+        for {set j 0} {$j < 5} {incr j} {
+            set rd [redis_deferring_client]
+            if {$j % 2} {
+                psubscribe $rd {big*}
+            } else {
+                subscribe $rd {bigchan}
+            }
+            lappend clients $rd
+        }
+        set msg1 [string repeat "abc\r\n" 1000]
+        set msg2 [string repeat x 100000]
+        assert_equal 5 [r publish bigchan $msg1]
+        assert_equal 5 [r publish bigchan small]
+        assert_equal 5 [r publish bigchan $msg2]
+        set j 0
+        foreach rd $clients {
+            foreach msg [list $msg1 small $msg2] {
+                if {$j % 2} {
+                    assert_equal [list pmessage big* bigchan $msg] [$rd read]
+                } else {
+                    assert_equal [list message bigchan $msg] [$rd read]
+                }
+            }
+            $rd close
+            incr j
+        }
+    }
+
+    test "PUBLISH/PSUBSCRIBE with patterns sharing a prefix" {
+        set rd1 [redis_deferring_client]
+        set rd2 [redis_deferring_client]
+        psubscribe $rd1 {* f* fo? foo* foo\\* f\[o\]o.* bar*}
+        psubscribe $rd2 {foo* *}
+        assert_equal 9 [r pubsub numpat]
+
+        foreach {chan matching1 matching2} {
+            foo.x {* f* foo* f\[o\]o.*} {foo* *}
+            fox {* f* fo?} {*}
+            foo* {* f* foo* foo\\*} {foo* *}
+            bar {* bar*} {*}
+            x {*} {*}
+        } {
+            set receivers [expr {[llength $matching1]+[llength $matching2]}]
+            assert_equal $receivers [r publish $chan hello]
+            foreach rd [list $rd1 $rd2] matching [list $matching1 $matching2] {
+                set got {}
+                foreach pat $matching {
+                    lappend got [lindex [$rd read] 1]
+                }
+                assert_equal [lsort $matching] [lsort $got]
+            }
+        }
+
+        punsubscribe $rd1
+        assert_equal 2 [r pubsub numpat]
+        assert_equal 2 [r publish foo.x hello]
+        $rd2 read
+        $rd2 read
+        punsubscribe $rd2
+        assert_equal 0 [r pubsub numpat]
+        assert_equal 0 [r publish foo.x hello]
+
+        # clean up clients
+        $rd1 close
+        $rd2 close
+    }
+
     test "NUMSUB returns numbers, not strings (#1561)" {
         r pubsub numsub abc def
     } {abc 0 def 0}
@@ -213,6 +292,47 @@ start_server {tags {"pubsub"}} {
         $rd1 close
     }
 
+    test "SPUBLISH/SSUBSCRIBE basics" {
+        set rd1 [redis_deferring_client]
+        set rd2 [redis_deferring_client]
+
+        assert_equal {1 2} [ssubscribe $rd1 {chan1 chan2}]
+        assert_equal {1 2} [list [subscribe $rd2 {chan1}] [psubscribe $rd2 {chan*}]]
+        assert_equal {chan1 chan2} [lsort [r pubsub shardchannels]]
+        assert_equal {chan2} [r pubsub shardchannels *2]
+        assert_equal {chan1 1 chan3 0} [r pubsub shardnumsub chan1 chan3]
+        assert_equal {chan1 1} [r pubsub numsub chan1]
+
+        # Shard channels and channels are different namespaces, and
+        # patterns never match shard channels.
+        assert_equal 1 [r spublish chan1 hello]
+        assert_equal 2 [r publish chan1 world]
+        assert_equal {smessage chan1 hello} [$rd1 read]
+        assert_equal {message chan1 world} [$rd2 read]
+        assert_equal {pmessage chan* chan1 world} [$rd2 read]
+
+        # The classic subscriptions keep the client in Pub/Sub mode.
+        assert_equal {1} [sunsubscribe $rd1 {chan1}]
+        assert_equal 0 [r spublish chan1 hello]
+        ssubscribe $rd2 {chan2}
+        assert_equal {chan2 2} [r pubsub shardnumsub chan2]
+        $rd2 sunsubscribe
+        assert_equal {sunsubscribe chan2 0} [$rd2 read]
+        $rd2 ping
+        assert_equal {pong {}} [$rd2 read]
+
+        # Unsubscribing from everything exits the Pub/Sub mode.
+        $rd1 sunsubscribe
+        assert_equal {sunsubscribe chan2 0} [$rd1 read]
+        $rd1 ping
+        assert_equal {PONG} [$rd1 read]
+        assert_equal {} [r pubsub shardchannels]
+
+        # clean up clients
+        $rd1 close
+        $rd2 close
+    }
+
     test "PUNSUBSCRIBE and UNSUBSCRIBE should always reply" {
         # Make sure we are not subscribed to any channel at all.
         r punsubscribe
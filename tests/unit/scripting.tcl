@@ -111,6 +111,28 @@ start_server {tags {"scripting"}} {
         } 1 mykey
     } {boolean 1}
 
+    test {EVAL - Redis nested and deferred length replies -> Lua type conversion} {
+        r del myzset mystream
+        r zadd myzset 1 a 2 b 3 c
+        r xadd mystream 1-0 f1 v1 f2 v2
+        r xadd mystream 2-0 f3 v3
+        r eval {
+            local z = redis.call('zrange',KEYS[1],0,-1,'withscores')
+            local s = redis.call('xrange',KEYS[2],'-','+')
+            local e = redis.call('xrange',KEYS[2],'3','+')
+            local n = redis.call('zscore',KEYS[1],'nosuchmember')
+            return {z,s,e,type(e),type(n),redis.call('zincrby',KEYS[1],1.5,'a')}
+        } 2 myzset mystream
+    } {{a 1 b 2 c 3} {{1-0 {f1 v1 f2 v2}} {2-0 {f3 v3}}} {} table boolean 2.5}
+
+    test {EVAL - Redis big bulk reply -> Lua type conversion} {
+        r set mykey [string repeat x 100000]
+        r eval {
+            local foo = redis.call('get',KEYS[1])
+            return {string.len(foo),redis.call('strlen',KEYS[1])}
+        } 1 mykey
+    } {100000 100000}
+
     test {EVAL - Is the Lua client using the currently selected DB?} {
         r set mykey "this is DB 9"
         r select 10
@@ -342,6 +364,33 @@ start_server {tags {"scripting"}} {
         set e
     } {*ERR*attempted to create global*}
 
+    test {Scripts can't load precompiled bytecode} {
+        r eval {
+            local f = function() return 1 end
+            local ok = loadstring(string.dump(f))
+            return ok == nil
+        } 0
+    } {1}
+
+    test {CONFIG SET lua-jit} {
+        r config set lua-jit no
+        if {[catch {r config set lua-jit yes} e]} {
+            # Redis was not compiled with LuaJIT.
+            assert_match {*DISABLED*} $e
+            assert_equal {lua-jit no} [r config get lua-jit]
+        } else {
+            set script {
+                local sum = 0
+                for i=1,tonumber(ARGV[1]) do sum = sum + i % 7 end
+                return sum
+            }
+            assert_equal 300000 [r eval $script 0 100000]
+            assert_equal 1 [r eval {return rawget(_G,"jit") == nil} 0]
+            r config set lua-jit no
+            assert_equal 300000 [r eval $script 0 100000]
+        }
+    }
+
     test {Test an example script DECR_IF_GT} {
         set decr_if_gt {
             local current
@@ -483,6 +532,137 @@ start_server {tags {"scripting"}} {
         } e
         set e
     } {*wrong number*}
+
+    test {Results of read only scripts are cached until keys are modified} {
+        r config set lua-result-cache-max-entries 100
+        r config resetstat
+        r del foo{t} bar{t}
+        r set foo{t} 1
+        set script {return redis.call('get',KEYS[1])}
+        assert_equal 1 [r eval $script 1 foo{t}]
+        assert_equal 1 [r evalsha [r script load $script] 1 foo{t}]
+        assert_equal 1 [s lua_results_hits]
+
+        # Every kind of modification invalidates the result.
+        r set foo{t} 2
+        assert_equal 2 [r eval $script 1 foo{t}]
+        r rename foo{t} bar{t}
+        assert_equal {} [r eval $script 1 foo{t}]
+        r set foo{t} 3
+        assert_equal 3 [r eval $script 1 foo{t}]
+        r move foo{t} 10
+        assert_equal {} [r eval $script 1 foo{t}]
+        r set foo{t} 4
+        assert_equal 4 [r eval $script 1 foo{t}]
+        r flushall
+        assert_equal {} [r eval $script 1 foo{t}]
+        r set foo{t} 5
+        assert_equal 5 [r eval $script 1 foo{t}]
+        assert_equal 5 [r eval $script 1 foo{t}]
+        assert_equal 2 [s lua_results_hits]
+
+        # Different arguments, or DB, are different entries.
+        assert_equal {} [r eval $script 1 bar{t}]
+        r select 10
+        assert_equal {} [r eval $script 1 foo{t}]
+        r select 9
+        assert_equal 2 [s lua_results_hits]
+        r config set lua-result-cache-max-entries 0
+    }
+
+    test {Cached results update the access time and stats of the keys} {
+        r config set lua-result-cache-max-entries 100
+        r set foo{t} 1
+        set script {return redis.call('get',KEYS[1])}
+        r eval $script 1 foo{t}
+        r config resetstat
+        r debug sleep 2
+        assert {[r object idletime foo{t}] >= 2}
+        assert_equal 1 [r eval $script 1 foo{t}]
+        assert_equal 1 [s lua_results_hits]
+        assert_equal 1 [s keyspace_hits]
+        assert {[r object idletime foo{t}] < 2}
+        r config set lua-result-cache-max-entries 0
+    }
+
+    test {Results of scripts writing or reading undeclared keys are not cached} {
+        r config set lua-result-cache-max-entries 100
+        r config resetstat
+        r set foo{t} 1
+        r set bar{t} 2
+        set script {return redis.call('incr',KEYS[1])}
+        assert_equal 2 [r eval $script 1 foo{t}]
+        assert_equal 3 [r eval $script 1 foo{t}]
+        set script {return redis.call('get','bar{t}')}
+        r eval $script 1 foo{t}
+        r eval $script 1 foo{t}
+        set script {return {redis.call('get',KEYS[1]),redis.call('time')}}
+        r eval $script 1 foo{t}
+        r eval $script 1 foo{t}
+        assert_equal 0 [s lua_results_hits]
+        assert_equal 0 [s lua_results_misses]
+
+        # Volatile keys are not cached.
+        r expire foo{t} 100
+        set script {return redis.call('get',KEYS[1])}
+        r eval $script 1 foo{t}
+        r eval $script 1 foo{t}
+        assert_equal 0 [s lua_results_hits]
+        r config set lua-result-cache-max-entries 0
+    }
+
+    test {Serving blocked clients invalidates the cached results} {
+        r config set lua-result-cache-max-entries 100
+        r del l{t} s{t}
+        set llen {return redis.call('llen',KEYS[1])}
+        set rd [redis_deferring_client]
+        $rd blpop l{t} 0
+        wait_for_condition 50 100 {
+            [s blocked_clients] == 1
+        } else {
+            fail "Client not blocked"
+        }
+        r multi
+        r rpush l{t} x
+        r eval $llen 1 l{t}
+        assert_equal {1 1} [r exec]
+        assert_equal {l{t} x} [$rd read]
+        assert_equal 0 [r eval $llen 1 l{t}]
+
+        # The same for the PEL of the consumer groups.
+        set xpending {return redis.call('xpending',KEYS[1],'g')[1]}
+        r xgroup create s{t} g $ mkstream
+        $rd xreadgroup group g c block 0 streams s{t} >
+        wait_for_condition 50 100 {
+            [s blocked_clients] == 1
+        } else {
+            fail "Client not blocked"
+        }
+        r multi
+        r xadd s{t} * a 1
+        r eval $xpending 1 s{t}
+        r exec
+        $rd read
+        assert_equal 1 [r eval $xpending 1 s{t}]
+        $rd close
+        r config set lua-result-cache-max-entries 0
+    }
+
+    test {The results cache evicts entries when full} {
+        r config set lua-result-cache-max-entries 10
+        r config resetstat
+        set script {return redis.call('exists',KEYS[1])}
+        for {set j 0} {$j < 100} {incr j} {
+            assert_equal 0 [r eval $script 1 key:$j]
+        }
+        for {set j 0} {$j < 100} {incr j} {
+            r set key:$j x
+            assert_equal 1 [r eval $script 1 key:$j]
+        }
+        assert_equal 0 [s lua_results_hits]
+        assert {[s used_memory_scripts] > 0}
+        r config set lua-result-cache-max-entries 0
+    }
 }
 
 # Start a new server since the last test in this stanza will kill the
@@ -0,0 +1,76 @@
+start_server {tags {"tracking"}} {
+    # A deferring client subscribed to the invalidation channel, and
+    # another client used to modify the keys.
+    set rd [redis_deferring_client]
+    $rd client id
+    set redir [$rd read]
+    $rd subscribe __redis__:invalidate
+    $rd read ; # Consume the SUBSCRIBE reply.
+    set w [redis [srv 0 host] [srv 0 port]]
+    $w select 9
+
+    test {CLIENT TRACKING requires a valid REDIRECT} {
+        catch {r client tracking on} e1
+        catch {r client tracking on redirect 123456789} e2
+        list [string match "*REDIRECT*" $e1] [string match "*not exist*" $e2]
+    } {1 1}
+
+    test {Clients are able to enable tracking} {
+        r client tracking on redirect $redir
+        list [string match "*flags=t*" [r client list]] \
+             [s tracking_clients]
+    } {1 1}
+
+    test {The connection gets invalidation messages about all the keys} {
+        r mset a 1 b 2 c 3
+        r mget a b c
+        $w set a 10
+        $w set c 30
+        set slots {}
+        lappend slots [$rd read]
+        lappend slots [$rd read]
+        lsort $slots
+    } [lsort [list \
+        {message __redis__:invalidate 490260} \
+        {message __redis__:invalidate 813542}]]
+
+    test {Invalidation is sent only once until the key is fetched again} {
+        $w set a 11
+        $w set a 12
+        r get a
+        $w set a 13
+        $rd read
+    } {message __redis__:invalidate 490260}
+
+    test {Keys fetched by scripts are tracked for the caller} {
+        r eval {return redis.call('get',KEYS[1])} 1 b
+        $w incr b
+        $rd read
+    } {message __redis__:invalidate 647327}
+
+    test {Expired keys are invalidated} {
+        r set e 1 px 50
+        r get e
+        after 100
+        $w exists e ; # Trigger the lazy expire.
+        lindex [$rd read] 1
+    } {__redis__:invalidate}
+
+    test {FLUSHALL invalidates the whole cache} {
+        r get a
+        $w flushall
+        $rd read
+    } {message __redis__:invalidate {}}
+
+    test {Clients are able to disable tracking} {
+        r client tracking off
+        r set x 1
+        r get x
+        $w set x 2
+        $w publish __redis__:invalidate done
+        list [$rd read] [s tracking_clients]
+    } {{message __redis__:invalidate done} 0}
+
+    $rd close
+    $w close
+}
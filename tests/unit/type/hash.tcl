@@ -14,8 +14,8 @@ start_server {tags {"hash"}} {
         list [r hlen smallhash]
     } {8}
 
-    test {Is the small hash encoded with a ziplist?} {
-        assert_encoding ziplist smallhash
+    test {Is the small hash encoded with a listpack?} {
+        assert_encoding listpack smallhash
     }
 
     test {HSET/HLEN - Big hash creation} {
@@ -252,7 +252,7 @@ start_server {tags {"hash"}} {
         lappend rv [r hexists bighash nokey]
     } {1 0 1 0}
 
-    test {Is a ziplist encoded Hash promoted on big payload?} {
+    test {Is a listpack encoded Hash promoted on big payload?} {
         r hset smallhash foo [string repeat a 1024]
         r debug object smallhash
     } {*hashtable*}
@@ -438,12 +438,59 @@ start_server {tags {"hash"}} {
         }
     }
 
-    test {Hash ziplist regression test for large keys} {
+    test {Hash listpack regression test for large keys} {
         r hset hash kkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkk a
         r hset hash kkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkk b
         r hget hash kkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkk
     } {b}
 
+    test {Hash listpack encoding survives DEBUG RELOAD and DUMP / RESTORE} {
+        r del hash hash2
+        r hmset hash a 1 b -20 c 5000000000 d foo e {} f 0123
+        assert_encoding listpack hash
+        set expected [r hgetall hash]
+        r debug reload
+        assert_encoding listpack hash
+        assert_equal $expected [r hgetall hash]
+        r restore hash2 0 [r dump hash]
+        assert_encoding listpack hash2
+        assert_equal $expected [r hgetall hash2]
+        list [r hget hash c] [r hget hash f] [r hexists hash e]
+    } {5000000000 0123 1}
+
+    test {Hash listpack field lookups with every element encoding} {
+        set original_value [lindex [r config get hash-max-ziplist-value] 1]
+        r config set hash-max-ziplist-value 5000
+        r del hash
+        # 7 bit unsigned, 13 bit and wider integers, 6 bit, 12 bit and 32 bit
+        # strings, and strings that look like integers but are not stored
+        # as such. Every value is the name of a field not in the hash, so
+        # that matching a value instead of a field would be detected.
+        set fields [list 0 1 127 128 -1 4095 -4096 4096 -4097 32767 \
+                    -2147483648 9223372036854775807 -9223372036854775808 \
+                    {} a 007 -0 +1 { 1} 1a 12345678901234567890 \
+                    [string repeat x 63] [string repeat x 64] \
+                    [string repeat y 4095] [string repeat y 4096]]
+        set j 0
+        foreach f $fields {
+            r hset hash $f missing:$j
+            incr j
+        }
+        assert_encoding listpack hash
+        set j 0
+        foreach f $fields {
+            assert_equal missing:$j [r hget hash $f]
+            incr j
+        }
+        foreach f [list 2 126 129 -2 4094 -4095 4097 -4098 32766 \
+                   9223372036854775806 00 -00 b { 2} 2a \
+                   [string repeat x 62] [string repeat x 65] \
+                   [string repeat y 4094] missing:0 missing:1] {
+            assert_equal 0 [r hexists hash $f]
+        }
+        r config set hash-max-ziplist-value $original_value
+    }
+
     foreach size {10 512} {
         test "Hash fuzzing #1 - $size fields" {
             for {set times 0} {$times < 10} {incr times} {
@@ -505,7 +552,7 @@ start_server {tags {"hash"}} {
         }
     }
 
-    test {Stress test the hash ziplist -> hashtable encoding conversion} {
+    test {Stress test the hash listpack -> hashtable encoding conversion} {
         r config set hash-max-ziplist-entries 32
         for {set j 0} {$j < 100} {incr j} {
             r del myhash
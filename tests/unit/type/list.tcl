@@ -222,6 +222,64 @@ start_server {
         assert_equal foo [lindex [r lrange blist 0 -1] 0]
     }
 
+    test "Clients blocked on multiple keys are served in any order" {
+        r del shared own0 own1 own2 own3
+        set clients {}
+        for {set j 0} {$j < 4} {incr j} {
+            set rd [redis_deferring_client]
+            $rd brpop own$j shared 0
+            lappend clients $rd
+        }
+        # Serve them from the last blocked, so that they are not at the
+        # head of the list of clients blocked for the shared key.
+        for {set j 3} {$j >= 0} {incr j -1} {
+            r lpush own$j $j
+            assert_equal [list own$j $j] [[lindex $clients $j] read]
+        }
+        r lpush shared x
+        assert_equal {x} [r lrange shared 0 -1]
+        foreach rd $clients {$rd close}
+    }
+
+    test "Blocked clients with different timeouts time out in order" {
+        r del blist
+        set rd1 [redis_deferring_client]
+        set rd2 [redis_deferring_client]
+        set rd3 [redis_deferring_client]
+        $rd1 blpop blist 2
+        $rd2 blpop blist 1
+        $rd3 blpop blist 0
+        assert_equal {} [$rd2 read]
+        r lpush blist a
+        assert_equal {blist a} [$rd1 read]
+        $rd1 blpop blist 1
+        assert_equal {} [$rd1 read]
+        r lpush blist b
+        assert_equal {blist b} [$rd3 read]
+        $rd1 close
+        $rd2 close
+        $rd3 close
+    }
+
+    test "Blocked clients time out precisely regardless of hz" {
+        r config set hz 1
+        r del blist
+        set rd [redis_deferring_client]
+        set start [clock milliseconds]
+        $rd blpop blist 1
+        wait_for_condition 50 10 {
+            [s clients_in_timeout_table] == 1
+        } else {
+            fail "Client not in the timeout table"
+        }
+        assert_equal {} [$rd read]
+        set elapsed [expr {[clock milliseconds]-$start}]
+        r config set hz 10
+        $rd close
+        assert_equal 0 [s clients_in_timeout_table]
+        assert {$elapsed >= 1000 && $elapsed < 1400}
+    }
+
     test "BRPOPLPUSH with zero timeout should block indefinitely" {
         set rd [redis_deferring_client]
         r del blist target
@@ -238,6 +238,67 @@ start_server {
         assert {[lindex $reply 0 3] == 2}
     }
 
+    test {XAUTOCLAIM claims the oldest idle entries first} {
+        r del mystream
+        set id1 [r XADD mystream * a 1]
+        set id2 [r XADD mystream * b 2]
+        set id3 [r XADD mystream * c 3]
+        r XGROUP CREATE mystream mygroup 0
+
+        # Redeliver item 1 later, so that the delivery order differs from
+        # the ID order.
+        r XREADGROUP GROUP mygroup client1 STREAMS mystream >
+        r debug sleep 0.1
+        r XCLAIM mystream mygroup client1 0 $id1
+        r debug sleep 0.2
+
+        # Nothing is idle enough.
+        assert_equal {} [r XAUTOCLAIM mystream mygroup client2 10000]
+
+        set reply [r XAUTOCLAIM mystream mygroup client2 10 COUNT 2]
+        assert_equal 2 [llength $reply]
+        assert_equal [list $id2 {b 2}] [lindex $reply 0]
+        assert_equal [list $id3 {c 3}] [lindex $reply 1]
+        set reply [r XAUTOCLAIM mystream mygroup client3 0 JUSTID]
+        assert_equal [list $id1 $id2 $id3] $reply
+
+        # Claimed entries are moved to the new consumer and are no longer
+        # idle, while JUSTID does not increment the delivery count.
+        set pending [r XPENDING mystream mygroup - + 10]
+        assert_equal 3 [llength $pending]
+        foreach entry $pending {
+            assert_equal client3 [lindex $entry 1]
+            assert {[lindex $entry 2] < 100}
+            assert_equal 2 [lindex $entry 3]
+        }
+        assert_equal {} [r XAUTOCLAIM mystream mygroup client2 100]
+    }
+
+    test {XAUTOCLAIM index survives XACK, DELCONSUMER and reloads} {
+        r del mystream
+        for {set j 0} {$j < 100} {incr j} {
+            lappend ids [r XADD mystream * item $j]
+        }
+        r XGROUP CREATE mystream mygroup 0
+        r XREADGROUP GROUP mygroup c1 count 50 STREAMS mystream >
+        r XREADGROUP GROUP mygroup c2 count 50 STREAMS mystream >
+        r XACK mystream mygroup {*}[lrange $ids 0 9]
+        r XGROUP DELCONSUMER mystream mygroup c2
+        r debug reload
+        set reply [r XAUTOCLAIM mystream mygroup c3 0 COUNT 1000 JUSTID]
+        assert_equal [lrange $ids 10 49] $reply
+        assert_equal 40 [lindex [r XPENDING mystream mygroup] 0]
+    }
+
+    test {XAUTOCLAIM errors} {
+        r del mystream
+        assert_error "*NOGROUP*" {r XAUTOCLAIM mystream mygroup c1 0}
+        r XADD mystream * a 1
+        r XGROUP CREATE mystream mygroup 0
+        assert_error "*COUNT*" {r XAUTOCLAIM mystream mygroup c1 0 COUNT 0}
+        assert_error "*Unrecognized*" {r XAUTOCLAIM mystream mygroup c1 0 FOO}
+    }
+
     start_server {} {
         set master [srv -1 client]
         set master_host [srv -1 host]
@@ -144,6 +144,41 @@ start_server {
         assert {[r xrange mystream - +] == [lreverse [r xrevrange mystream + -]]}
     }
 
+    test {XADD keeps the master fields right across nodes and reloads} {
+        r DEL mystream-fields
+        r config set stream-node-max-entries 10
+        for {set j 0} {$j < 100} {incr j} {
+            if {$j == 50} {r debug reload}
+            if {$j % 7 == 0} {
+                r XADD mystream-fields * b $j a $j
+            } else {
+                r XADD mystream-fields * a $j b $j
+            }
+        }
+        r config set stream-node-max-entries 100
+        set fields_items [r XRANGE mystream-fields - +]
+        for {set j 0} {$j < 100} {incr j} {
+            if {$j % 7 == 0} {
+                set fields_expected [list b $j a $j]
+            } else {
+                set fields_expected [list a $j b $j]
+            }
+            assert_equal $fields_expected [lindex $fields_items $j 1]
+        }
+    }
+
+    test {Small streams don't use the memory of a whole node} {
+        set base [s used_memory]
+        for {set j 0} {$j < 1000} {incr j} {
+            r XADD small-stream:$j * a 1
+        }
+        set used [expr {([s used_memory]-$base)/1000}]
+        for {set j 0} {$j < 1000} {incr j} {
+            r DEL small-stream:$j
+        }
+        assert {$used < 1500}
+    }
+
     test {XREAD with non empty stream} {
         set res [r XREAD COUNT 1 STREAMS mystream 0-0]
         assert {[lrange [lindex $res 0 1 0 1] 0 1] eq {item 0}}
@@ -7,7 +7,7 @@ start_server {tags {"zset"}} {
     }
 
     proc basics {encoding} {
-        if {$encoding == "ziplist"} {
+        if {$encoding == "listpack"} {
             r config set zset-max-ziplist-entries 128
             r config set zset-max-ziplist-value 64
         } elseif {$encoding == "skiplist"} {
@@ -735,7 +735,7 @@ start_server {tags {"zset"}} {
         }
     }
 
-    basics ziplist
+    basics listpack
     basics skiplist
 
     test {ZINTERSTORE regression with two sets, intset+hashtable} {
@@ -751,7 +751,7 @@ start_server {tags {"zset"}} {
         r zrange out 0 -1 withscores
     } {neginf 0}
 
-    test {ZINTERSTORE #516 regression, mixed sets and ziplist zsets} {
+    test {ZINTERSTORE #516 regression, mixed sets and listpack zsets} {
         r sadd one 100 101 102 103
         r sadd two 100 200 201 202
         r zadd three 1 500 1 501 1 502 1 503 1 100
@@ -781,12 +781,136 @@ start_server {tags {"zset"}} {
         }
     }
 
+    proc assert_zset_ranks_consistent {key} {
+        set len [r zcard $key]
+        set rank 0
+        foreach ele [r zrange $key 0 -1] {
+            assert_equal $rank [r zrank $key $ele]
+            assert_equal [expr {$len-$rank-1}] [r zrevrank $key $ele]
+            incr rank
+        }
+        assert_equal $len $rank
+    }
+
+    foreach opts {{} {nx} {ch} {nx ch}} {
+        test "ZADD with many pairs on a new key is bulk loaded correctly - opts: {$opts}" {
+            r del bulk seq
+            set cmd [list r zadd bulk {*}$opts]
+            set expected 0
+            for {set j 0} {$j < 1000} {incr j} {
+                set score [randomInt 100]
+                set ele ele-[randomInt 700]
+                lappend cmd $score $ele
+                incr expected [r zadd seq {*}$opts $score $ele]
+            }
+            assert_equal $expected [{*}$cmd]
+            assert_encoding skiplist bulk
+            assert_equal [r zrange seq 0 -1 withscores] \
+                         [r zrange bulk 0 -1 withscores]
+            assert_zset_ranks_consistent bulk
+        }
+    }
+
+    test {ZSCORE listpack lookups with every element encoding} {
+        set original_max [lindex [r config get zset-max-ziplist-entries] 1]
+        set original_value [lindex [r config get zset-max-ziplist-value] 1]
+        r config set zset-max-ziplist-entries 128
+        r config set zset-max-ziplist-value 5000
+        r del zset
+        # Every score is also a member name not in the set, so that matching
+        # a score instead of a member would be detected.
+        set members [list 0 1 127 128 -1 4095 -4096 4096 -4097 \
+                     9223372036854775807 -9223372036854775808 \
+                     {} a 007 -0 +1 { 1} 1a [string repeat x 63] \
+                     [string repeat x 64] [string repeat y 4096]]
+        set j 0
+        foreach m $members {
+            r zadd zset [expr {1000+$j}] $m
+            incr j
+        }
+        assert_encoding listpack zset
+        set j 0
+        foreach m $members {
+            assert_equal [expr {1000+$j}] [r zscore zset $m]
+            incr j
+        }
+        foreach m [list 2 126 -2 4094 -4098 00 b { 2} 1000 1001 \
+                   [string repeat x 62] [string repeat y 4095]] {
+            assert_equal {} [r zscore zset $m]
+        }
+        r config set zset-max-ziplist-entries $original_max
+        r config set zset-max-ziplist-value $original_value
+    }
+
+    test {ZADD with many repeated pairs on a new key may stay a listpack} {
+        set original_max [lindex [r config get zset-max-ziplist-entries] 1]
+        set original_value [lindex [r config get zset-max-ziplist-value] 1]
+        r config set zset-max-ziplist-entries 128
+        r config set zset-max-ziplist-value 64
+        r del bulk
+        set cmd [list r zadd bulk]
+        for {set j 0} {$j < 1000} {incr j} {
+            lappend cmd $j ele-[expr {$j % 10}]
+        }
+        assert_equal 10 [{*}$cmd]
+        assert_encoding listpack bulk
+        r config set zset-max-ziplist-entries $original_max
+        r config set zset-max-ziplist-value $original_value
+        r zrange bulk 0 -1 withscores
+    } {ele-0 990 ele-1 991 ele-2 992 ele-3 993 ele-4 994 ele-5 995 ele-6 996 ele-7 997 ele-8 998 ele-9 999}
+
+    test {Listpack encoded zsets are saved and loaded as listpacks} {
+        set original_max [lindex [r config get zset-max-ziplist-entries] 1]
+        set original_value [lindex [r config get zset-max-ziplist-value] 1]
+        r config set zset-max-ziplist-entries 128
+        r config set zset-max-ziplist-value 64
+        r del lpzset
+        for {set j 0} {$j < 100} {incr j} {
+            set ele [string repeat x [expr {$j % 50}]]$j
+            r zadd lpzset [expr {$j % 7}] $ele
+        }
+        set before [r zrange lpzset 0 -1 withscores]
+        assert_encoding listpack lpzset
+        r debug reload
+        assert_encoding listpack lpzset
+        assert_equal $before [r zrange lpzset 0 -1 withscores]
+
+        # Delete ranges in the middle, and at the tail.
+        set expected [concat [lrange $before 0 19] [lrange $before 40 end]]
+        r zremrangebyrank lpzset 10 19
+        assert_equal $expected [r zrange lpzset 0 -1 withscores]
+        r zremrangebyscore lpzset 6 6
+        r zremrangebyrank lpzset -5 -1
+        assert_zset_ranks_consistent lpzset
+        assert_equal {} [r zrangebyscore lpzset 6 6]
+        assert_equal 0 [r zremrangebyrank lpzset 1000 2000]
+        r config set zset-max-ziplist-entries $original_max
+        r config set zset-max-ziplist-value $original_value
+    }
+
+    test {ZUNIONSTORE and ZINTERSTORE results have consistent ranks} {
+        r del one two dest
+        set cmd1 [list r zadd one]
+        set cmd2 [list r zadd two]
+        for {set j 0} {$j < 1000} {incr j} {
+            lappend cmd1 [randomInt 100] [randomInt 1000]
+            lappend cmd2 [randomInt 100] [randomInt 1000]
+        }
+        {*}$cmd1
+        {*}$cmd2
+        r zunionstore dest 2 one two
+        assert_encoding skiplist dest
+        assert_zset_ranks_consistent dest
+        r zinterstore dest 2 one two aggregate max
+        assert_zset_ranks_consistent dest
+    }
+
     test "ZSET commands don't accept the empty strings as valid score" {
         assert_error "*not*float*" {r zadd myzset "" abc}
     }
 
     proc stressers {encoding} {
-        if {$encoding == "ziplist"} {
+        if {$encoding == "listpack"} {
             # Little extra to allow proper fuzzing in the sorting stresser
             r config set zset-max-ziplist-entries 256
             r config set zset-max-ziplist-value 64
@@ -1198,7 +1322,7 @@ start_server {tags {"zset"}} {
     }
 
     tags {"slow"} {
-        stressers ziplist
+        stressers listpack
         stressers skiplist
     }
 
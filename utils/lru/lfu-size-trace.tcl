@@ -0,0 +1,98 @@
+#!/usr/bin/env tclsh8.5
+# Replay a synthetic cache trace against a Redis server, once for every
+# maxmemory policy, reporting the hit rate of each one.
+#
+# Usage: lfu-size-trace.tcl [host] [port] [requests] [keys] [seed]
+#
+# The keys are requested following a zipf distribution (s = 1), and every
+# key has a value of a fixed, log-normal distributed size (median 512
+# bytes, capped at 64k), so that a few keys are both big and popular. Every
+# request is a GET, followed by a SET of the value on a miss, like a cache
+# in front of a database would do. maxmemory is set to 20% of the data set
+# size plus the memory used by the empty server.
+#
+# The server is flushed and its configuration changed: don't run it against
+# a server with real data.
+#
+# Released under the BSD license like Redis itself
+
+source [file join [file dirname [info script]] ../../tests/support/redis.tcl]
+
+set host [expr {[llength $argv] > 0 ? [lindex $argv 0] : "127.0.0.1"}]
+set port [expr {[llength $argv] > 1 ? [lindex $argv 1] : 6379}]
+set requests [expr {[llength $argv] > 2 ? [lindex $argv 2] : 300000}]
+set numkeys [expr {[llength $argv] > 3 ? [lindex $argv 3] : 20000}]
+set seed [expr {[llength $argv] > 4 ? [lindex $argv 4] : 1234}]
+set policies {allkeys-lru allkeys-lfu allkeys-lfu-size}
+
+# Gaussian random number, Box-Muller.
+proc gauss {} {
+    set u [expr {1.0-rand()}]
+    set v [expr {rand()}]
+    expr {sqrt(-2.0*log($u))*cos(2*3.14159265358979*$v)}
+}
+
+# Generate the value sizes and the cumulative zipf distribution.
+expr {srand($seed)}
+set total 0
+set sum 0.0
+for {set j 0} {$j < $numkeys} {incr j} {
+    set size [expr {int(512*exp(1.2*[gauss]))}]
+    if {$size < 1} {set size 1}
+    if {$size > 65536} {set size 65536}
+    lappend sizes $size
+    incr total $size
+    set sum [expr {$sum+1.0/($j+1)}]
+    lappend cdf $sum
+}
+
+# Return a key following the zipf distribution, for 'r' in [0,1).
+proc zipf_key {r} {
+    set target [expr {$r*$::sum}]
+    set lo 0
+    set hi [expr {$::numkeys-1}]
+    while {$lo < $hi} {
+        set mid [expr {($lo+$hi)/2}]
+        if {[lindex $::cdf $mid] < $target} {
+            set lo [expr {$mid+1}]
+        } else {
+            set hi $mid
+        }
+    }
+    return $lo
+}
+
+# Return the value of an INFO field.
+proc s_field {r field} {
+    regexp "\r\n$field:(\[0-9\]+)" [$r info] -> value
+    return $value
+}
+proc s_used_memory {r} {s_field $r used_memory}
+proc s_evicted_keys {r} {s_field $r evicted_keys}
+
+# The same trace is used for all the policies.
+for {set j 0} {$j < $requests} {incr j} {
+    lappend trace [zipf_key [expr {rand()}]]
+}
+
+set r [redis $host $port]
+puts "$requests requests, $numkeys keys, $total bytes of values"
+foreach policy $policies {
+    $r config set maxmemory 0
+    $r flushall
+    $r config set maxmemory-policy $policy
+    $r config set maxmemory [expr {[s_used_memory $r]+$total/5}]
+    $r config resetstat
+    set hits 0
+    foreach k $trace {
+        if {[$r get key:$k] ne {}} {
+            incr hits
+        } else {
+            $r set key:$k [string repeat x [lindex $sizes $k]]
+        }
+    }
+    puts [format "%-18s %.3f hit rate, %d keys evicted" $policy \
+        [expr {double($hits)/$requests}] [s_evicted_keys $r]]
+}
+$r config set maxmemory 0
+$r flushall
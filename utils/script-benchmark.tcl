@@ -0,0 +1,128 @@
+#!/usr/bin/env tclsh8.5
+# Benchmark of CPU bound Lua scripts.
+#
+# Usage: script-benchmark.tcl [host] [port] [calls]
+#
+# Every script is loaded with SCRIPT LOAD and called 'calls' times with
+# EVALSHA, reporting the server side microseconds per call as found in
+# INFO commandstats, so that the network round trip is not accounted.
+#
+# Run it against servers compiled with and without USE_LUAJIT=yes in order
+# to compare the scripting engines. When the server supports the lua-jit
+# option every script is also executed with the LuaJIT trace compiler
+# enabled.
+#
+# Released under the BSD license like Redis itself
+
+source [file join [file dirname [info script]] ../tests/support/redis.tcl]
+
+set host [expr {[llength $argv] > 0 ? [lindex $argv 0] : "127.0.0.1"}]
+set port [expr {[llength $argv] > 1 ? [lindex $argv 1] : 6379}]
+set calls [expr {[llength $argv] > 2 ? [lindex $argv 2] : 100}]
+
+# Name, keys, arguments and body of every script.
+set ::scripts {
+    loop {} {100000} {
+        local sum = 0
+        for i=1,tonumber(ARGV[1]) do
+            sum = (sum + i * i) % 1000003
+        end
+        return sum
+    }
+    primes {} {20000} {
+        local count, n = 0, tonumber(ARGV[1])
+        for i=2,n do
+            local prime = true
+            for j=2,math.floor(math.sqrt(i)) do
+                if i % j == 0 then prime = false; break end
+            end
+            if prime then count = count + 1 end
+        end
+        return count
+    }
+    zscore {__sb:zset} {1000} {
+        local items = redis.call('zrange',KEYS[1],0,tonumber(ARGV[1])-1,'withscores')
+        local best, bestscore = false, -1
+        for i=1,#items,2 do
+            local s = tonumber(items[i+1])
+            local score = math.log(s+1)*0.7 + (s % 13)/13*0.3
+            if score > bestscore then best, bestscore = items[i], score end
+        end
+        return best
+    }
+    strings {} {2000} {
+        local parts = {}
+        for i=1,tonumber(ARGV[1]) do
+            local s = string.format("item:%d:%s",i,string.rep("x",i%16))
+            parts[#parts+1] = string.upper(string.sub(s,1,12))
+        end
+        local joined = table.concat(parts,",")
+        local _, count = string.gsub(joined,"ITEM","")
+        return count
+    }
+    cjson {} {200} {
+        local t = {}
+        for i=1,tonumber(ARGV[1]) do
+            t[i] = {id=i, name="user"..i, score=i*1.5, tags={"a","b","c"}}
+        end
+        local decoded = cjson.decode(cjson.encode(t))
+        return #decoded
+    }
+    cmsgpack {} {200} {
+        local t = {}
+        for i=1,tonumber(ARGV[1]) do
+            t[i] = {id=i, name="user"..i, score=i*1.5, tags={"a","b","c"}}
+        end
+        local decoded = cmsgpack.unpack(cmsgpack.pack(t))
+        return #decoded
+    }
+}
+
+proc usec_per_call {r} {
+    set info [$r info commandstats]
+    if {[regexp {cmdstat_evalsha:calls=\d+,usec=\d+,usec_per_call=([0-9.]+)} \
+            $info -> usec]} {
+        return $usec
+    }
+    return 0
+}
+
+proc bench {r calls} {
+    set res {}
+    foreach {name keys args body} $::scripts {
+        set sha [$r script load $body]
+        $r config resetstat
+        for {set j 0} {$j < $calls} {incr j} {
+            $r evalsha $sha [llength $keys] {*}$keys {*}$args
+        }
+        lappend res $name [usec_per_call $r]
+    }
+    return $res
+}
+
+set r [redis $host $port]
+$r del __sb:zset
+for {set j 0} {$j < 1000} {incr j} {
+    $r zadd __sb:zset [expr {rand()*1000}] member:$j
+}
+
+set jit [expr {![catch {$r config set lua-jit no}]}]
+set runs [list interpreter [bench $r $calls]]
+if {$jit && ![catch {$r config set lua-jit yes}]} {
+    lappend runs jit [bench $r $calls]
+    $r config set lua-jit no
+}
+$r del __sb:zset
+
+set header [format "%-10s" script]
+foreach engine [dict keys $runs] {
+    append header [format " %15s" $engine]
+}
+puts $header
+foreach {name keys args body} $::scripts {
+    set line [format "%-10s" $name]
+    foreach {engine res} $runs {
+        append line [format " %15s" "[dict get $res $name] usec"]
+    }
+    puts $line
+}